@@ -0,0 +1,205 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // mremap
+#endif
+
+#include "arena.h"
+#include "common.h"
+
+#define ALIGNMENT 16
+#define align_up(x, a) (((x) + (a)-1) & ~(size_t)((a)-1))
+#define CHUNK_HEADER align_up(sizeof(arena_chunk_t), ALIGNMENT)
+
+static size_t page_size(void) {
+  static size_t size = 0;
+  if (size == 0) {
+    long ps = sysconf(_SC_PAGESIZE);
+    size = ps > 0 ? (size_t)ps : 4096;
+  }
+  return size;
+}
+
+static size_t page_align(size_t bytes) {
+  size_t ps = page_size();
+  return (bytes + ps - 1) / ps * ps;
+}
+
+static void* pages_map(size_t bytes) {
+  void* ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+// type: arena_t
+struct arena_chunk {
+  arena_chunk_t* next;
+  size_t size, used;
+};
+
+void arena_init(arena_t* arena, size_t chunk_size, size_t high_water) {
+  arena->head = NULL;
+  arena->chunk_size = page_align(chunk_size);
+  arena->high_water = page_align(max(high_water, CHUNK_HEADER));
+}
+
+void arena_destroy(arena_t* arena) {
+  for (arena_chunk_t *it = arena->head, *next; it != NULL; it = next) {
+    next = it->next;
+    munmap(it, it->size);
+  }
+  arena->head = NULL;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+  size = align_up(size, ALIGNMENT);
+
+  arena_chunk_t* chunk = arena->head;
+  if (rcl_unlikely(chunk == NULL || chunk->used + size > chunk->size)) {
+    // geometric growth: after a reset the largest chunk fits everything
+    size_t bytes = arena->chunk_size;
+    if (chunk != NULL)
+      bytes = chunk->size * 2;
+    bytes = page_align(max(bytes, size + CHUNK_HEADER));
+
+    chunk = pages_map(bytes);
+    if (chunk == NULL) {
+      rcl_perror("mmap arena chunk");
+      return NULL;
+    }
+
+    chunk->next = arena->head;
+    chunk->size = bytes;
+    chunk->used = CHUNK_HEADER;
+    arena->head = chunk;
+  }
+
+  void* ptr = rcl_pointer_to(chunk, chunk->used);
+  chunk->used += size;
+  return ptr;
+}
+
+void arena_reset(arena_t* arena) {
+  arena_chunk_t* head = arena->head;
+  if (head == NULL)
+    return;
+
+  for (arena_chunk_t *it = head->next, *next; it != NULL; it = next) {
+    next = it->next;
+    munmap(it, it->size);
+  }
+
+  // keep the chunk mapped, but don't hold the resident pages of a peak
+  size_t used = page_align(head->used);
+  if (used > arena->high_water)
+    (void)madvise(rcl_pointer_to(head, arena->high_water),
+                  used - arena->high_water, MADV_DONTNEED);
+
+  head->next = NULL;
+  head->used = CHUNK_HEADER;
+}
+
+// type: buffer_t
+bool buffer_reserve(buffer_t* b, size_t capacity) {
+  if (capacity <= b->capacity)
+    return true;
+
+  size_t bytes = page_align(max(capacity, b->capacity + b->capacity / 2));
+
+  void* data = NULL;
+  if (b->data == NULL) {
+    data = pages_map(bytes);
+  } else {
+#ifdef MREMAP_MAYMOVE
+    data = mremap(b->data, b->capacity, bytes, MREMAP_MAYMOVE);
+    if (data == MAP_FAILED)
+      data = NULL;
+#else
+    data = pages_map(bytes);
+    if (data != NULL) {
+      rcl_memcpy(data, b->data, b->size);
+      munmap(b->data, b->capacity);
+    }
+#endif
+  }
+
+  if (rcl_unlikely(data == NULL)) {
+    rcl_perror("map buffer pages");
+    return false;
+  }
+
+  b->data = data;
+  b->capacity = bytes;
+
+  return true;
+}
+
+void buffer_trim(buffer_t* b) {
+  if (b->data != NULL)
+    munmap(b->data, b->capacity);
+
+  b->data = NULL;
+  b->size = 0;
+  b->capacity = 0;
+}
+
+// type: buffer_pool_t
+bool buffer_pool_init(buffer_pool_t* pool, size_t count, size_t high_water) {
+  pool->count = count;
+  pool->high_water = high_water;
+  pool->idle_bytes = 0;
+
+  pool->items = calloc(count, sizeof(buffer_t));
+  if (rcl_unlikely(pool->items == NULL))
+    return false;
+
+  if (!queue_init(&(pool->idle), count))
+    return false;
+
+  for (size_t i = 0; i < count; ++i)
+    if (!queue_push(&(pool->idle), &(pool->items[i])))
+      return false;
+
+  return true;
+}
+
+void buffer_pool_destroy(buffer_pool_t* pool) {
+  if (pool->items != NULL) {
+    for (size_t i = 0; i < pool->count; ++i)
+      buffer_trim(&(pool->items[i]));
+    free(pool->items);
+  }
+
+  queue_destroy(&(pool->idle));
+}
+
+buffer_t* buffer_pool_acquire(buffer_pool_t* pool) {
+  buffer_t* buffer = NULL;
+  if (!queue_pop(&(pool->idle), (void**)&buffer))
+    return NULL;
+
+  pool->idle_bytes -= buffer->capacity;
+  buffer->size = 0;
+
+  return buffer;
+}
+
+void buffer_pool_release(buffer_pool_t* pool, buffer_t* buffer) {
+  buffer->size = 0;
+
+  // keep hot buffers mapped, but don't hold the peaks forever: the check and
+  // the add are one step, so concurrent releases don't overshoot the mark
+  size_t idle = atomic_load_explicit(&(pool->idle_bytes), memory_order_relaxed);
+  do {
+    if (idle + buffer->capacity > pool->high_water) {
+      buffer_trim(buffer);
+      break;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &(pool->idle_bytes), &idle, idle + buffer->capacity,
+      memory_order_relaxed, memory_order_relaxed));
+
+  // the queue holds every item of the pool, only a double release fails
+  if (rcl_unlikely(!queue_push(&(pool->idle), buffer))) {
+    rcl_error("buffer is released twice\n");
+    pool->idle_bytes -= buffer->capacity;
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef _RCL_ARENA_H
+#define _RCL_ARENA_H
+
+#include "common.h"
+#include "queue.h"
+
+// Page-granular memory for the ingest path.
+//
+// arena_t: bump allocator for short-lived objects (JSON trees), everything is
+// released at once by arena_reset, which keeps only the largest chunk and
+// gives back its pages above the high-water mark.
+//
+// buffer_t: growable byte buffer backed by anonymous mappings (mremap where
+// available), buffer_pool_t shares a fixed set of them between stages and
+// trims idle memory above the high-water mark.
+
+typedef struct arena_chunk arena_chunk_t;
+
+typedef struct {
+  arena_chunk_t* head;
+  size_t chunk_size, high_water;
+} arena_t;
+
+void arena_init(arena_t* arena, size_t chunk_size, size_t high_water);
+void arena_destroy(arena_t* arena);
+
+void* arena_alloc(arena_t* arena, size_t size);
+void arena_reset(arena_t* arena);
+
+typedef struct {
+  char* data;
+  size_t size, capacity;
+} buffer_t;
+
+bool buffer_reserve(buffer_t* buffer, size_t capacity);
+void buffer_trim(buffer_t* buffer);
+
+typedef struct {
+  buffer_t* items;
+  size_t count, high_water;
+
+  atomic_size_t idle_bytes;
+  queue_t idle;  // buffer_t*
+} buffer_pool_t;
+
+bool buffer_pool_init(buffer_pool_t* pool, size_t count, size_t high_water);
+void buffer_pool_destroy(buffer_pool_t* pool);
+
+buffer_t* buffer_pool_acquire(buffer_pool_t* pool);
+void buffer_pool_release(buffer_pool_t* pool, buffer_t* buffer);
+
+#endif  // _RCL_ARENA_H
@@ -0,0 +1,294 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // nftw
+#endif
+
+#include <ftw.h>
+#include <getopt.h>
+
+#include "../liboracle.h"
+#include "chain.h"
+#include "report.h"
+
+// Blocks of one insert, about a commit of the upstream
+enum { INSERT_BATCH_BLOCKS = 100 };
+
+enum { SHAPE_MAX_ADDRESSES = 100, SHAPE_MAX_EVENTS = 1 };
+
+typedef struct {
+  const char* name;
+  uint64_t window;  // blocks, clamped to the chain
+  size_t addresses, events;
+} bench_shape_t;
+
+static const bench_shape_t SHAPES[] = {
+    {"single_block", 1, 1, 0},         {"wide_range", 100000, 1, 0},
+    {"many_addresses", 1000, 100, 0},  {"event", 10000, 0, 1},
+    {"unfiltered", 10000, 0, 0},
+};
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-d datadir] [-b blocks] [-l logs] [-q queries] "
+          "[-s seed] [-m ram]\n"
+          "  fills a db with a synthetic chain and measures inserts and "
+          "queries,\n"
+          "  results are JSON lines on stdout\n"
+          "  -d  db dir, a filled one is continued (a new temporary dir)\n"
+          "  -b  blocks of the chain (100000)\n"
+          "  -l  mean logs per block (250)\n"
+          "  -q  queries per shape (1000)\n"
+          "  -s  seed of the chain and the queries (1)\n"
+          "  -m  ram limit of the db in bytes (0)\n",
+          name);
+}
+
+static void bench_hex(char* out, const uint8_t* data, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+
+  *out++ = '0';
+  *out++ = 'x';
+  for (size_t i = 0; i < size; ++i) {
+    *out++ = digits[data[i] >> 4];
+    *out++ = digits[data[i] & 0xf];
+  }
+  *out = '\0';
+}
+
+static rcl_result bench_insert(rcl_t* db,
+                               bench_chain_t* chain,
+                               uint64_t from,
+                               uint64_t to) {
+  uint64_t batches =
+      (to - from + INSERT_BATCH_BLOCKS - 1) / INSERT_BATCH_BLOCKS;
+
+  bench_latency_t latency;
+  if (bench_latency_init(&latency, batches) != 0)
+    return RCLE_OUT_OF_MEMORY;
+
+  size_t capacity = INSERT_BATCH_BLOCKS * 1024;
+  rcl_log_t* logs = malloc(capacity * sizeof(rcl_log_t));
+  if (logs == NULL) {
+    bench_latency_destroy(&latency);
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  rcl_result rc = RCLE_OK;
+  uint64_t total = 0, elapsed = 0;
+
+  for (uint64_t block = from; block < to && rc == RCLE_OK;) {
+    uint64_t last = min(block + INSERT_BATCH_BLOCKS, to) - 1;
+
+    size_t size = 0;
+    for (uint64_t number = block; number <= last; ++number) {
+      if (capacity - size < BENCH_MAX_BLOCK_LOGS) {
+        rcl_log_t* grown = realloc(logs, 2 * capacity * sizeof(rcl_log_t));
+        if (grown == NULL) {
+          rc = RCLE_OUT_OF_MEMORY;
+          break;
+        }
+        logs = grown;
+        capacity *= 2;
+      }
+
+      size += bench_chain_block(chain, number, logs + size);
+    }
+    if (rc != RCLE_OK)
+      break;
+
+    uint64_t started = rcl_clock_ns();
+    rc = rcl_insert_range(db, block, last, size, logs);
+    uint64_t took = rcl_clock_ns() - started;
+
+    bench_latency_add(&latency, took);
+    elapsed += took;
+    total += size;
+    block = last + 1;
+
+    if ((block - from) % (1000 * INSERT_BATCH_BLOCKS) == 0)
+      fprintf(stderr, "inserted %" PRIu64 " of %" PRIu64 " blocks\n",
+              block - from, to - from);
+  }
+
+  if (rc == RCLE_OK) {
+    double seconds = (double)elapsed / 1e9;
+    bench_report("insert", "range", &latency,
+                 "\"blocks\": %" PRIu64 ", \"logs\": %" PRIu64
+                 ", \"seconds\": %.3f, \"logs_per_sec\": %.0f",
+                 to - from, total, seconds,
+                 seconds > 0 ? (double)total / seconds : 0);
+  }
+
+  free(logs);
+  bench_latency_destroy(&latency);
+
+  return rc;
+}
+
+static rcl_result bench_query(rcl_t* db,
+                              bench_chain_t* chain,
+                              const bench_shape_t* shape,
+                              uint64_t blocks,
+                              size_t queries,
+                              uint64_t seed) {
+  static char addresses[SHAPE_MAX_ADDRESSES][2 + 2 * ADDRESS_LENGTH + 1];
+  static char events[SHAPE_MAX_EVENTS][2 + 2 * HASH_LENGTH + 1];
+
+  size_t tlen[TOPICS_LENGTH] = {shape->events};
+  rcl_query_t* query = NULL;
+  rcl_result rc = rcl_query_alloc(&query, shape->addresses, tlen);
+  if (rc != RCLE_OK)
+    return rc;
+
+  bench_latency_t latency;
+  if (bench_latency_init(&latency, queries) != 0) {
+    rcl_query_free(query);
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  query->limit = 0;
+
+  bench_rng_t rng = {seed};
+  uint64_t window = min(shape->window, blocks), matched = 0;
+
+  for (size_t i = 0; i < queries && rc == RCLE_OK; ++i) {
+    query->from = bench_rng_next(&rng) % (blocks - window + 1);
+    query->to = query->from + window - 1;
+
+    for (size_t k = 0; k < shape->addresses; ++k) {
+      rcl_address_t address;
+      bench_chain_address(chain, bench_chain_pick_address(chain, &rng),
+                          address);
+      bench_hex(addresses[k], address, sizeof(rcl_address_t));
+      query->address[k].encoded = addresses[k];
+    }
+
+    for (size_t k = 0; k < shape->events; ++k) {
+      rcl_hash_t topic;
+      bench_chain_event(chain, bench_chain_pick_event(chain, &rng), topic);
+      bench_hex(events[k], topic, sizeof(rcl_hash_t));
+      query->topics[0][k].encoded = events[k];
+    }
+
+    uint64_t result = 0, started = rcl_clock_ns();
+    rc = rcl_query(db, query, &result);
+    bench_latency_add(&latency, rcl_clock_ns() - started);
+
+    matched += result;
+  }
+
+  if (rc == RCLE_OK)
+    bench_report("query", shape->name, &latency,
+                 "\"window\": %" PRIu64 ", \"addresses\": %zu, "
+                 "\"events\": %zu, \"matched\": %" PRIu64,
+                 window, shape->addresses, shape->events, matched);
+
+  bench_latency_destroy(&latency);
+  rcl_query_free(query);
+
+  return rc;
+}
+
+static int bench_unlink(const char* path,
+                        const struct stat* sb,
+                        int flag,
+                        struct FTW* ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+  bench_chain_config_t config;
+  bench_chain_defaults(&config);
+
+  char tmpl[] = "/tmp/logsoracle-bench.XXXXXX";
+  char* dir = NULL;
+  uint64_t blocks = 100000, ram_limit = 0;
+  size_t queries = 1000;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "d:b:l:q:s:m:h")) != -1) {
+    switch (opt) {
+      case 'd':
+        dir = optarg;
+        break;
+      case 'b':
+        blocks = strtoull(optarg, NULL, 10);
+        break;
+      case 'l':
+        config.logs_per_block = strtod(optarg, NULL);
+        break;
+      case 'q':
+        queries = strtoull(optarg, NULL, 10);
+        break;
+      case 's':
+        config.seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'm':
+        ram_limit = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc || blocks == 0 || config.logs_per_block <= 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // a given dir is kept to be continued by the next run
+  bool temporary = dir == NULL;
+  if (temporary && (dir = mkdtemp(tmpl)) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "db: %s\n", dir);
+
+  rcl_t* db = NULL;
+  rcl_result rc = RCLE_OUT_OF_MEMORY;
+
+  bench_chain_t* chain = bench_chain_new(&config);
+  if (chain == NULL) {
+    fprintf(stderr, "couldn't create the chain\n");
+    goto exit;
+  }
+
+  if ((rc = rcl_open(dir, ram_limit, &db)) != RCLE_OK) {
+    fprintf(stderr, "couldn't open db: %s\n", rcl_strerror(rc));
+    goto exit;
+  }
+
+  // the chain is deterministic, so a filled db is continued
+  uint64_t written = 0, logs = 0;
+  (void)rcl_blocks_count(db, &written);
+  if (written < blocks)
+    rc = bench_insert(db, chain, written, blocks);
+
+  (void)rcl_logs_count(db, &logs);
+  printf("{\"bench\": \"dataset\", \"blocks\": %" PRIu64
+         ", \"logs\": %" PRIu64 ", \"seed\": %" PRIu64
+         ", \"logs_per_block\": %.1f}\n",
+         blocks, logs, config.seed, config.logs_per_block);
+
+  size_t shapes = sizeof(SHAPES) / sizeof(SHAPES[0]);
+  for (size_t i = 0; i < shapes && rc == RCLE_OK; ++i)
+    rc = bench_query(db, chain, &(SHAPES[i]), blocks, queries,
+                     config.seed ^ (i + 1));
+
+  if (rc != RCLE_OK)
+    fprintf(stderr, "bench failed: %s\n", rcl_strerror(rc));
+
+exit:
+  if (db != NULL)
+    rcl_free(db);
+  if (chain != NULL)
+    bench_chain_free(chain);
+
+  if (temporary)
+    nftw(dir, bench_unlink, 16, FTW_DEPTH | FTW_PHYS);
+
+  return rc == RCLE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,208 @@
+#include <math.h>
+
+#include "chain.h"
+
+uint64_t bench_rng_next(bench_rng_t* rng) {
+  uint64_t z = (rng->state += 0x9e3779b97f4a7c15ull);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+  return z ^ (z >> 31);
+}
+
+double bench_rng_double(bench_rng_t* rng) {
+  return (double)(bench_rng_next(rng) >> 11) * 0x1.0p-53;
+}
+
+// Salts of the key spaces
+enum {
+  SALT_BLOCK = 1,
+  SALT_ADDRESS = 2,
+  SALT_EVENT = 3,
+  SALT_ACCOUNT = 4,
+};
+
+// Share of logs by their number of topics, 0 is an anonymous event
+static const double TOPICS_SHARE[TOPICS_LENGTH + 1] = {0.01, 0.12, 0.18, 0.60,
+                                                       0.09};
+
+// Indexed topics holding an address, the rest are amounts, ids and so on
+static const double ACCOUNT_TOPICS = 0.7;
+
+static const double LOGS_SIGMA = 1.0;
+
+// type: bench_zipf_t, cumulative probabilities of the ranks
+typedef struct {
+  uint64_t n;
+  double* cdf;
+} bench_zipf_t;
+
+struct bench_chain {
+  bench_chain_config_t config;
+  double logs_mu;
+
+  bench_zipf_t addresses, events, accounts;
+};
+
+void bench_chain_defaults(bench_chain_config_t* config) {
+  *config = (bench_chain_config_t){
+      .seed = 1,
+      .addresses = 100000,
+      .events = 20000,
+      .accounts = 1000000,
+      .skew = 1.1,
+      .logs_per_block = 250,
+      .empty_blocks = 0.01,
+  };
+}
+
+static int bench_zipf_init(bench_zipf_t* zipf, uint64_t n, double skew) {
+  zipf->n = n;
+  zipf->cdf = malloc(n * sizeof(double));
+  if (zipf->cdf == NULL)
+    return -1;
+
+  double sum = 0;
+  for (uint64_t i = 0; i < n; ++i)
+    zipf->cdf[i] = (sum += pow((double)(i + 1), -skew));
+  for (uint64_t i = 0; i < n; ++i)
+    zipf->cdf[i] /= sum;
+
+  return 0;
+}
+
+static uint64_t bench_zipf_pick(bench_zipf_t* zipf, bench_rng_t* rng) {
+  double u = bench_rng_double(rng);
+
+  uint64_t l = 0, r = zipf->n - 1;
+  while (l < r) {
+    uint64_t m = l + (r - l) / 2;
+    if (zipf->cdf[m] > u)
+      r = m;
+    else
+      l = m + 1;
+  }
+
+  return l;
+}
+
+bench_chain_t* bench_chain_new(const bench_chain_config_t* config) {
+  bench_chain_t* chain = calloc(1, sizeof(bench_chain_t));
+  if (chain == NULL)
+    return NULL;
+
+  chain->config = *config;
+  chain->logs_mu = log(config->logs_per_block) - LOGS_SIGMA * LOGS_SIGMA / 2;
+
+  if (bench_zipf_init(&(chain->addresses), config->addresses, config->skew) ||
+      bench_zipf_init(&(chain->events), config->events, config->skew) ||
+      bench_zipf_init(&(chain->accounts), config->accounts, config->skew)) {
+    bench_chain_free(chain);
+    return NULL;
+  }
+
+  return chain;
+}
+
+void bench_chain_free(bench_chain_t* chain) {
+  free(chain->addresses.cdf);
+  free(chain->events.cdf);
+  free(chain->accounts.cdf);
+  free(chain);
+}
+
+static void bench_chain_key(bench_chain_t* chain,
+                            uint64_t salt,
+                            uint64_t rank,
+                            uint8_t* key,
+                            size_t size) {
+  bench_rng_t rng = {chain->config.seed ^ (salt << 56) ^ rank};
+
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t word = bench_rng_next(&rng);
+    memcpy(key + i, &word, min(size - i, sizeof(uint64_t)));
+  }
+}
+
+void bench_chain_address(bench_chain_t* chain,
+                         uint64_t rank,
+                         rcl_address_t address) {
+  bench_chain_key(chain, SALT_ADDRESS, rank, address, sizeof(rcl_address_t));
+}
+
+void bench_chain_event(bench_chain_t* chain, uint64_t rank, rcl_hash_t topic) {
+  bench_chain_key(chain, SALT_EVENT, rank, topic, sizeof(rcl_hash_t));
+}
+
+uint64_t bench_chain_pick_address(bench_chain_t* chain, bench_rng_t* rng) {
+  return bench_zipf_pick(&(chain->addresses), rng);
+}
+
+uint64_t bench_chain_pick_event(bench_chain_t* chain, bench_rng_t* rng) {
+  return bench_zipf_pick(&(chain->events), rng);
+}
+
+static size_t bench_chain_logs_count(bench_chain_t* chain, bench_rng_t* rng) {
+  if (bench_rng_double(rng) < chain->config.empty_blocks)
+    return 0;
+
+  // Box-Muller, 1 - u keeps the logarithm finite
+  double u1 = 1 - bench_rng_double(rng), u2 = bench_rng_double(rng);
+  double z = sqrt(-2 * log(u1)) * cos(6.283185307179586 * u2);
+
+  double count = round(exp(chain->logs_mu + LOGS_SIGMA * z));
+  if (count < 1)
+    return 1;
+  if (count > BENCH_MAX_BLOCK_LOGS)
+    return BENCH_MAX_BLOCK_LOGS;
+  return (size_t)count;
+}
+
+static size_t bench_chain_topics_count(bench_rng_t* rng) {
+  double u = bench_rng_double(rng);
+
+  size_t count = 0;
+  for (; count < TOPICS_LENGTH && u >= TOPICS_SHARE[count]; ++count)
+    u -= TOPICS_SHARE[count];
+
+  return count;
+}
+
+size_t bench_chain_block(bench_chain_t* chain,
+                         uint64_t number,
+                         rcl_log_t* logs) {
+  uint64_t salt = (uint64_t)SALT_BLOCK << 56;
+  bench_rng_t rng = {chain->config.seed ^ salt ^ number};
+  (void)bench_rng_next(&rng);
+
+  size_t count = bench_chain_logs_count(chain, &rng);
+  memset(logs, 0, count * sizeof(rcl_log_t));
+
+  for (size_t i = 0; i < count; ++i) {
+    rcl_log_t* it = &(logs[i]);
+    it->block_number = number;
+
+    bench_chain_address(chain, bench_zipf_pick(&(chain->addresses), &rng),
+                        it->address);
+
+    size_t topics = bench_chain_topics_count(&rng);
+    if (topics > 0)
+      bench_chain_event(chain, bench_zipf_pick(&(chain->events), &rng),
+                        it->topics[0]);
+
+    for (size_t k = 1; k < topics; ++k) {
+      if (bench_rng_double(&rng) < ACCOUNT_TOPICS) {
+        uint64_t account = bench_zipf_pick(&(chain->accounts), &rng);
+        bench_chain_key(chain, SALT_ACCOUNT, account,
+                        it->topics[k] + HASH_LENGTH - ADDRESS_LENGTH,
+                        ADDRESS_LENGTH);
+      } else {
+        for (size_t j = 0; j < HASH_LENGTH; j += sizeof(uint64_t)) {
+          uint64_t word = bench_rng_next(&rng);
+          memcpy(it->topics[k] + j, &word, sizeof(uint64_t));
+        }
+      }
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,51 @@
+#ifndef _RCL_BENCH_CHAIN_H
+#define _RCL_BENCH_CHAIN_H
+
+#include "../upstream.h"
+
+// splitmix64, small and good enough for data generation
+typedef struct {
+  uint64_t state;
+} bench_rng_t;
+
+uint64_t bench_rng_next(bench_rng_t* rng);
+double bench_rng_double(bench_rng_t* rng);  // [0, 1)
+
+// Mainnet-like chain, a block depends only on the seed and its number, so any
+// range is reproducible in any order
+typedef struct {
+  uint64_t seed;
+  uint64_t addresses;     // distinct contracts
+  uint64_t events;        // distinct topic0s
+  uint64_t accounts;      // distinct indexed addresses in topics 1-3
+  double skew;            // zipf exponent of contracts, events and accounts
+  double logs_per_block;  // mean of a log-normal distribution
+  double empty_blocks;    // ratio of blocks without logs
+} bench_chain_config_t;
+
+enum { BENCH_MAX_BLOCK_LOGS = 8192 };
+
+void bench_chain_defaults(bench_chain_config_t* config);
+
+struct bench_chain;
+typedef struct bench_chain bench_chain_t;
+
+bench_chain_t* bench_chain_new(const bench_chain_config_t* config);
+void bench_chain_free(bench_chain_t* chain);
+
+// Writes the logs of a block, at most BENCH_MAX_BLOCK_LOGS, returns their count
+size_t bench_chain_block(bench_chain_t* chain,
+                         uint64_t number,
+                         rcl_log_t* logs);
+
+// Keys by popularity rank, 0 is the most popular one
+void bench_chain_address(bench_chain_t* chain,
+                         uint64_t rank,
+                         rcl_address_t address);
+void bench_chain_event(bench_chain_t* chain, uint64_t rank, rcl_hash_t topic);
+
+// Ranks with the chain's popularity, queries ask for popular keys more often
+uint64_t bench_chain_pick_address(bench_chain_t* chain, bench_rng_t* rng);
+uint64_t bench_chain_pick_event(bench_chain_t* chain, bench_rng_t* rng);
+
+#endif  // _RCL_BENCH_CHAIN_H
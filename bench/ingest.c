@@ -0,0 +1,335 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // nftw
+#endif
+
+#include <ftw.h>
+#include <getopt.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#include "../liboracle.h"
+#include "node.h"
+
+enum {
+  POLL_MS = 100,  // of the head and the progress
+  PROGRESS_MS = 5000,
+  HEAD_TIMEOUT_MS = 5000,
+};
+
+static const char HEAD_REQUEST[] =
+    "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"eth_blockNumber\","
+    "\"params\":[]}";
+
+typedef struct {
+  char data[256];
+  size_t size;
+} bench_reply_t;
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-u url] [-d datadir] [-m ram] [-M mode] [-c blocks] "
+          "[-w seconds] [node options]\n"
+          "  ingests a chain with rcl_set_upstream until it catches up with "
+          "the head,\n"
+          "  results are JSON lines on stdout\n"
+          "  -u  node url (a mock node in a child process with the node "
+          "options)\n"
+          "  -d  db dir, a filled one is continued (a new temporary dir)\n"
+          "  -m  ram limit of the db in bytes (0)\n"
+          "  -M  logs, batch or receipts, see rcl_set_upstream_mode (logs)\n"
+          "  -c  blocks of an eth_getLogs call in the batch mode (16)\n"
+          "  -w  seconds before giving up (600)\n",
+          name);
+  bench_node_usage(stderr);
+}
+
+// Forks a mock node, so its memory isn't in the peak RSS of the ingest
+static pid_t bench_spawn(const bench_node_config_t* config,
+                         char* url,
+                         size_t size) {
+  uint16_t port = 0;
+  int fd = bench_node_listen(0, &port);
+  if (fd < 0) {
+    perror("listen");
+    return -1;
+  }
+
+  pid_t pid = fork();
+  if (pid == 0) {
+#ifdef __linux__
+    (void)prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+    bench_node_t* node = bench_node_new(config);
+    if (node == NULL) {
+      fprintf(stderr, "couldn't create the node\n");
+      _exit(EXIT_FAILURE);
+    }
+
+    (void)bench_node_serve(node, fd);
+    _exit(EXIT_FAILURE);
+  }
+
+  if (pid < 0)
+    perror("fork");
+
+  close(fd);
+  snprintf(url, size, "http://127.0.0.1:%u", port);
+
+  return pid;
+}
+
+static size_t bench_reply_write(char* data,
+                                size_t size,
+                                size_t nmemb,
+                                void* userp) {
+  bench_reply_t* reply = userp;
+  size_t count = min(size * nmemb, sizeof(reply->data) - 1 - reply->size);
+
+  memcpy(reply->data + reply->size, data, count);
+  reply->size += count;
+
+  return size * nmemb;
+}
+
+// eth_blockNumber of the node, the way the daemon polls it
+static bool bench_head(CURL* curl, uint64_t* head) {
+  bench_reply_t reply = {.size = 0};
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &reply);
+  if (curl_easy_perform(curl) != CURLE_OK)
+    return false;
+
+  reply.data[reply.size] = '\0';
+
+  cJSON* root = cJSON_Parse(reply.data);
+  const cJSON* result = cJSON_GetObjectItemCaseSensitive(root, "result");
+
+  bool ok = cJSON_IsString(result) &&
+            strncmp(result->valuestring, "0x", 2) == 0;
+  if (ok)
+    *head = strtoull(result->valuestring + 2, NULL, 16);
+
+  cJSON_Delete(root);
+  return ok;
+}
+
+static CURL* bench_head_init(const char* url, struct curl_slist** headers) {
+  CURL* curl = curl_easy_init();
+  if (curl == NULL)
+    return NULL;
+
+  *headers = curl_slist_append(NULL, "Content-Type: application/json");
+
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, *headers);
+  curl_easy_setopt(curl, CURLOPT_POSTFIELDS, HEAD_REQUEST);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bench_reply_write);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)HEAD_TIMEOUT_MS);
+
+  return curl;
+}
+
+static void bench_sleep_ms(uint64_t ms) {
+  struct timespec ts = {.tv_sec = (time_t)(ms / 1000),
+                        .tv_nsec = (long)(ms % 1000) * 1000000};
+  nanosleep(&ts, NULL);
+}
+
+static int bench_unlink(const char* path,
+                        const struct stat* sb,
+                        int flag,
+                        struct FTW* ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+  bench_node_config_t node;
+  bench_node_defaults(&node);
+
+  const char *url = NULL, *mode_name = "logs";
+  char tmpl[] = "/tmp/logsoracle-ingest.XXXXXX";
+  char* dir = NULL;
+  uint64_t ram_limit = 0, call_blocks = 16, wait_s = 600;
+  rcl_upstream_mode mode = RCL_UPSTREAM_LOGS;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "u:d:m:M:c:w:h" BENCH_NODE_OPTIONS)) !=
+         -1) {
+    switch (opt) {
+      case 'u':
+        url = optarg;
+        continue;
+      case 'd':
+        dir = optarg;
+        continue;
+      case 'm':
+        ram_limit = strtoull(optarg, NULL, 10);
+        continue;
+      case 'M':
+        mode_name = optarg;
+        if (strcmp(optarg, "logs") == 0)
+          mode = RCL_UPSTREAM_LOGS;
+        else if (strcmp(optarg, "batch") == 0)
+          mode = RCL_UPSTREAM_BATCH;
+        else if (strcmp(optarg, "receipts") == 0)
+          mode = RCL_UPSTREAM_RECEIPTS;
+        else
+          break;
+        continue;
+      case 'c':
+        call_blocks = strtoull(optarg, NULL, 10);
+        continue;
+      case 'w':
+        wait_s = strtoull(optarg, NULL, 10);
+        continue;
+      case 'h':
+        usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        if (bench_node_option(&node, opt, optarg))
+          continue;
+        break;
+    }
+
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (optind != argc || call_blocks == 0) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char address[64];
+  pid_t child = -1;
+  if (url == NULL) {
+    if ((child = bench_spawn(&node, address, sizeof(address))) < 0)
+      return EXIT_FAILURE;
+    url = address;
+  }
+
+  bool temporary = dir == NULL;
+  if (temporary && (dir = mkdtemp(tmpl)) == NULL) {
+    perror("mkdtemp");
+    return EXIT_FAILURE;
+  }
+  fprintf(stderr, "db: %s, node: %s\n", dir, url);
+
+  struct curl_slist* headers = NULL;
+  CURL* curl = bench_head_init(url, &headers);
+
+  rcl_t* db = NULL;
+  rcl_result rc = curl == NULL ? RCLE_LIBCURL : rcl_open(dir, ram_limit, &db);
+  if (rc == RCLE_OK)
+    rc = rcl_set_upstream_mode(db, mode, call_blocks);
+
+  uint64_t head = 0, started = rcl_clock_ns();
+  bool headed = false, caught_up = false;
+  rcl_stats_t before = {0}, stats = {0};
+
+  if (rc == RCLE_OK) {
+    (void)rcl_stats(db, &before);
+    stats = before;
+
+    while (!(headed = bench_head(curl, &head)) &&
+           rcl_clock_ns() - started < wait_s * 1000000000) {
+      if (child > 0 && waitpid(child, NULL, WNOHANG) == child) {
+        child = -1;
+        break;
+      }
+      bench_sleep_ms(POLL_MS);
+    }
+
+    if (headed) {
+      (void)rcl_update_height(db, head);
+
+      started = rcl_clock_ns();
+      rc = rcl_set_upstream(db, url);
+    }
+  }
+
+  uint64_t progress = started;
+  while (rc == RCLE_OK && headed) {
+    bench_sleep_ms(POLL_MS);
+
+    uint64_t polled;
+    if (bench_head(curl, &polled) && polled != head) {
+      head = polled;
+      (void)rcl_update_height(db, head);
+    }
+
+    (void)rcl_stats(db, &stats);
+    if ((caught_up = stats.next > head))
+      break;
+
+    if (child > 0 && waitpid(child, NULL, WNOHANG) == child) {
+      fprintf(stderr, "the node exited\n");
+      child = -1;
+      break;
+    }
+
+    uint64_t now = rcl_clock_ns();
+    if (now - started >= wait_s * 1000000000) {
+      fprintf(stderr, "no catch up in %" PRIu64 "s\n", wait_s);
+      break;
+    }
+
+    if (now - progress >= PROGRESS_MS * 1000000ull) {
+      progress = now;
+      fprintf(stderr, "ingested %" PRIu64 " of %" PRIu64 " blocks\n",
+              stats.next, head + 1);
+    }
+  }
+
+  if (rc == RCLE_OK && headed) {
+    double seconds = (double)(rcl_clock_ns() - started) / 1e9;
+    uint64_t blocks = stats.next - before.next;
+    uint64_t logs = stats.logs_count - before.logs_count;
+    uint64_t requests = stats.upstream_requests - before.upstream_requests;
+    uint64_t latency_us =
+        stats.upstream_latency.sum_us - before.upstream_latency.sum_us;
+
+    struct rusage usage = {0};
+    (void)getrusage(RUSAGE_SELF, &usage);
+
+    printf("{\"bench\": \"ingest\", \"case\": \"%s\", \"caught_up\": %s"
+           ", \"head\": %" PRIu64 ", \"blocks\": %" PRIu64
+           ", \"logs\": %" PRIu64 ", \"seconds\": %.3f"
+           ", \"blocks_per_sec\": %.0f, \"logs_per_sec\": %.0f"
+           ", \"peak_rss_mb\": %.1f, \"requests\": %" PRIu64
+           ", \"request_mean_ms\": %.1f, \"errors\": %" PRIu64 "}\n",
+           mode_name, caught_up ? "true" : "false", head, blocks, logs,
+           seconds, seconds > 0 ? (double)blocks / seconds : 0,
+           seconds > 0 ? (double)logs / seconds : 0,
+           (double)usage.ru_maxrss / 1024, requests,
+           requests > 0 ? (double)latency_us / 1e3 / (double)requests : 0,
+           stats.upstream_errors - before.upstream_errors);
+  } else if (rc != RCLE_OK) {
+    fprintf(stderr, "bench failed: %s\n", rcl_strerror(rc));
+  } else {
+    fprintf(stderr, "no head from %s\n", url);
+  }
+
+  if (db != NULL)
+    rcl_free(db);
+  if (curl != NULL)
+    curl_easy_cleanup(curl);
+  curl_slist_free_all(headers);
+
+  if (child > 0) {
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+  }
+
+  if (temporary)
+    nftw(dir, bench_unlink, 16, FTW_DEPTH | FTW_PHYS);
+
+  return caught_up ? EXIT_SUCCESS : EXIT_FAILURE;
+}
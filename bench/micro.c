@@ -0,0 +1,712 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // nftw
+#endif
+
+#include <ftw.h>
+#include <getopt.h>
+
+#include "../liboracle.h"
+#include "chain.h"
+#include "report.h"
+
+// Ingest and query kernels on a corpus of eth_getLogs response bodies, they
+// are captured from a node by 'healthcheck -capture' or synthesized from the
+// bench chain. Filters are the healthcheck fixtures.
+
+enum { HEX_MAX = 2 + 2 * HASH_LENGTH + 1 };
+
+typedef struct {
+  char* data;
+  size_t size;
+  size_t first, count;  // logs of the body in the corpus
+} bench_body_t;
+
+typedef struct {
+  char hex[HEX_MAX];
+  int bytes;
+} bench_hex_t;
+
+typedef struct {
+  rcl_query_keys_t query;
+  rcl_address_t* addresses;
+  rcl_hash_t* topics[TOPICS_LENGTH];
+} bench_fixture_t;
+
+typedef struct {
+  vector_t bodies;    // bench_body_t
+  vector_t logs;      // rcl_log_t of all bodies in order
+  vector_t hex;       // bench_hex_t, keys of the logs
+  vector_t fixtures;  // bench_fixture_t
+  vector_t blooms;    // bloom_t of the corpus blocks
+
+  rcl_t* db;  // the corpus with blocks renumbered from 0
+  uint64_t min_ns;
+} bench_ctx_t;
+
+static volatile uint64_t bench_sink;
+
+typedef struct {
+  uint64_t ns, cycles;
+} bench_clock_t;
+
+static void bench_start(bench_clock_t* clock) {
+  clock->cycles = bench_cycles();
+  clock->ns = rcl_clock_ns();
+}
+
+static void bench_stop(bench_clock_t* clock, bench_kernel_t* kernel) {
+  kernel->ns += rcl_clock_ns() - clock->ns;
+  kernel->cycles += bench_cycles() - clock->cycles;
+}
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-f fixtures] [-t ms] [-n bodies] [-l logs] [body...]\n"
+          "  runs ingest and query kernels on eth_getLogs response bodies,\n"
+          "  results are JSON lines on stdout\n"
+          "  -f  filters, one '[filter]' per line "
+          "(internal/healthcheck/fixtures.jsonl)\n"
+          "  -t  minimal time of a kernel (200)\n"
+          "  -n  synthesized bodies without captured ones (64)\n"
+          "  -l  mean logs per block of synthesized bodies (250)\n",
+          name);
+}
+
+static char* bench_read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL)
+    return NULL;
+
+  char* data = NULL;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    long length = ftell(file);
+    if (length >= 0 && fseek(file, 0, SEEK_SET) == 0 &&
+        (data = malloc((size_t)length + 1)) != NULL) {
+      *size = fread(data, 1, (size_t)length, file);
+      data[*size] = '\0';
+    }
+  }
+
+  fclose(file);
+  return data;
+}
+
+static void bench_hex(FILE* out, const uint8_t* data, size_t size) {
+  fputs("\"0x", out);
+  for (size_t i = 0; i < size; ++i)
+    fprintf(out, "%02x", data[i]);
+  fputc('"', out);
+}
+
+// A body of [from, to] in the shape of a node's answer, with all the fields
+// the parser skips
+static char* bench_synthesize(bench_chain_t* chain,
+                              uint64_t from,
+                              uint64_t to,
+                              rcl_log_t* logs,
+                              size_t* size) {
+  char* data = NULL;
+  FILE* out = open_memstream(&data, size);
+  if (out == NULL)
+    return NULL;
+
+  fputs("{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":[", out);
+
+  bool first = true;
+  for (uint64_t number = from; number <= to; ++number) {
+    size_t count = bench_chain_block(chain, number, logs);
+
+    for (size_t i = 0; i < count; ++i) {
+      fputs(first ? "{\"address\":" : ",{\"address\":", out);
+      first = false;
+
+      bench_hex(out, logs[i].address, sizeof(rcl_address_t));
+      fputs(",\"topics\":[", out);
+      for (size_t k = 0; k < TOPICS_LENGTH; ++k) {
+        static const rcl_hash_t zero = {0};
+        if (memcmp(logs[i].topics[k], zero, sizeof(rcl_hash_t)) == 0)
+          break;
+        if (k > 0)
+          fputc(',', out);
+        bench_hex(out, logs[i].topics[k], sizeof(rcl_hash_t));
+      }
+
+      fputs("],\"data\":", out);
+      bench_hex(out, logs[i].topics[0], sizeof(rcl_hash_t) / 2);
+      fprintf(out, ",\"blockNumber\":\"0x%" PRIx64 "\"", number);
+      fputs(",\"transactionHash\":", out);
+      bench_hex(out, logs[i].topics[1], sizeof(rcl_hash_t));
+      fprintf(out, ",\"transactionIndex\":\"0x%zx\"", i / 4);
+      fputs(",\"blockHash\":", out);
+      bench_hex(out, logs[(i + 1) % count].address, sizeof(rcl_hash_t) / 2);
+      fprintf(out, ",\"logIndex\":\"0x%zx\",\"removed\":false}", i);
+    }
+  }
+
+  fputs("]}", out);
+  fclose(out);
+
+  return data;
+}
+
+static int bench_hex_key(vector_t* hex, const uint8_t* key, int bytes) {
+  bench_hex_t* it = vector_add(hex);
+  if (it == NULL)
+    return -1;
+
+  static const char digits[] = "0123456789abcdef";
+
+  it->bytes = bytes;
+  it->hex[0] = '0';
+  it->hex[1] = 'x';
+  for (int i = 0; i < bytes; ++i) {
+    it->hex[2 + 2 * i] = digits[key[i] >> 4];
+    it->hex[3 + 2 * i] = digits[key[i] & 0xf];
+  }
+  it->hex[2 + 2 * bytes] = '\0';
+
+  return 0;
+}
+
+// Parses every body once, it keeps their logs and their keys in hex
+static int bench_corpus_index(bench_ctx_t* ctx) {
+  for (size_t i = 0; i < ctx->bodies.size; ++i) {
+    bench_body_t* body = vector_at(&(ctx->bodies), i);
+    body->first = ctx->logs.size;
+
+    rcl_result rc = rcl_response_parse(body->data, body->size,
+                                       RCL_UPSTREAM_LOGS, 1, 1, NULL,
+                                       &(ctx->logs));
+    if (rc != RCLE_OK) {
+      fprintf(stderr, "couldn't parse body %zu: %s\n", i, rcl_strerror(rc));
+      return -1;
+    }
+
+    body->count = ctx->logs.size - body->first;
+  }
+
+  for (size_t i = 0; i < ctx->logs.size; ++i) {
+    rcl_log_t* log = vector_at(&(ctx->logs), i);
+    if (bench_hex_key(&(ctx->hex), log->address, ADDRESS_LENGTH) != 0)
+      return -1;
+    for (size_t k = 0; k < TOPICS_LENGTH; ++k)
+      if (bench_hex_key(&(ctx->hex), log->topics[k], HASH_LENGTH) != 0)
+        return -1;
+  }
+
+  return 0;
+}
+
+static int bench_decode(const cJSON* item, uint8_t* key, size_t size) {
+  if (!cJSON_IsString(item) || strlen(item->valuestring) != 2 + 2 * size)
+    return -1;
+
+  hex2bin(key, item->valuestring, (int)size);
+  return 0;
+}
+
+// Keys of one set: a string, an array of them, or null for any
+static int bench_fixture_keys(const cJSON* item,
+                              size_t size,
+                              void** keys,
+                              size_t* count) {
+  *keys = NULL;
+  *count = 0;
+
+  if (item == NULL || cJSON_IsNull(item))
+    return 0;
+
+  size_t n = cJSON_IsArray(item) ? (size_t)cJSON_GetArraySize(item) : 1;
+  if (n == 0)
+    return 0;
+
+  uint8_t* data = malloc(n * size);
+  if (data == NULL)
+    return -1;
+
+  *keys = data;
+  *count = n;
+
+  if (!cJSON_IsArray(item))
+    return bench_decode(item, data, size);
+
+  const cJSON* it = NULL;
+  cJSON_ArrayForEach(it, item) {
+    if (bench_decode(it, data, size) != 0)
+      return -1;
+    data += size;
+  }
+
+  return 0;
+}
+
+static void bench_fixture_free(bench_fixture_t* fixture) {
+  free(fixture->addresses);
+  for (size_t i = 0; i < TOPICS_LENGTH; ++i)
+    free(fixture->topics[i]);
+}
+
+static int bench_fixture_parse(const char* line, bench_fixture_t* fixture) {
+  memset(fixture, 0, sizeof(bench_fixture_t));
+
+  // '[filter]' or a recorded '{"params": [filter], "expected": count}'
+  cJSON* root = cJSON_Parse(line);
+  const cJSON* params = cJSON_IsObject(root)
+                            ? cJSON_GetObjectItemCaseSensitive(root, "params")
+                            : root;
+  const cJSON* filter = cJSON_IsArray(params) ? cJSON_GetArrayItem(params, 0)
+                                              : NULL;
+
+  int rc = cJSON_IsObject(filter) ? 0 : -1;
+  if (rc == 0) {
+    const cJSON* address = cJSON_GetObjectItemCaseSensitive(filter, "address");
+    rc = bench_fixture_keys(address, ADDRESS_LENGTH,
+                            (void**)&(fixture->addresses),
+                            &(fixture->query.alen));
+  }
+
+  const cJSON* topics = cJSON_GetObjectItemCaseSensitive(filter, "topics");
+  if (rc == 0 && cJSON_GetArraySize(topics) > TOPICS_LENGTH)
+    rc = -1;
+
+  for (int i = 0; rc == 0 && i < cJSON_GetArraySize(topics); ++i)
+    rc = bench_fixture_keys(cJSON_GetArrayItem(topics, i), HASH_LENGTH,
+                            (void**)&(fixture->topics[i]),
+                            &(fixture->query.tlen[i]));
+
+  cJSON_Delete(root);
+
+  fixture->query.address = (const rcl_address_t*)fixture->addresses;
+  for (size_t i = 0; i < TOPICS_LENGTH; ++i)
+    fixture->query.topics[i] = (const rcl_hash_t*)fixture->topics[i];
+
+  if (rc != 0)
+    bench_fixture_free(fixture);
+  return rc;
+}
+
+static int bench_fixtures_load(bench_ctx_t* ctx, const char* path) {
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+    return -1;
+
+  char* line = NULL;
+  size_t capacity = 0;
+  while (getline(&line, &capacity, file) > 0) {
+    bench_fixture_t fixture;
+    if (bench_fixture_parse(line, &fixture) != 0)
+      continue;
+
+    bench_fixture_t* it = vector_add(&(ctx->fixtures));
+    if (it == NULL) {
+      bench_fixture_free(&fixture);
+      break;
+    }
+    *it = fixture;
+  }
+
+  free(line);
+  fclose(file);
+
+  return 0;
+}
+
+static int bench_log_compare(const void* a, const void* b) {
+  int rc = logscomp(a, b);
+  return rc != 0 ? rc : memcmp(a, b, sizeof(rcl_log_t));
+}
+
+// Distinct logs of the corpus in a db, blocks are renumbered from 0, and a
+// bloom of every block for bloom_check
+static int bench_db_fill(bench_ctx_t* ctx, char* dir) {
+  size_t size = ctx->logs.size;
+  if (size == 0)
+    return -1;
+
+  rcl_log_t* logs = malloc(size * sizeof(rcl_log_t));
+  if (logs == NULL)
+    return -1;
+
+  memcpy(logs, ctx->logs.buffer, size * sizeof(rcl_log_t));
+  qsort(logs, size, sizeof(rcl_log_t), bench_log_compare);
+
+  size_t distinct = 0;
+  for (size_t i = 0; i < size; ++i)
+    if (distinct == 0 || bench_log_compare(&logs[i], &logs[distinct - 1]))
+      logs[distinct++] = logs[i];
+
+  uint64_t block = 0, original = logs[0].block_number;
+  bloom_t* bloom = NULL;
+
+  for (size_t i = 0; i < distinct; ++i) {
+    if (bloom == NULL || logs[i].block_number != original) {
+      block += bloom != NULL;
+      original = logs[i].block_number;
+
+      if ((bloom = vector_add(&(ctx->blooms))) == NULL) {
+        free(logs);
+        return -1;
+      }
+      bloom_init(*bloom);
+    }
+
+    logs[i].block_number = block;
+
+    bloom_add(bloom, logs[i].address);
+    for (size_t k = 0; k < TOPICS_LENGTH; ++k)
+      bloom_add(bloom, logs[i].topics[k]);
+  }
+
+  rcl_result rc = rcl_open(dir, 0, &(ctx->db));
+  if (rc == RCLE_OK)
+    rc = rcl_insert_range(ctx->db, 0, block, distinct, logs);
+
+  free(logs);
+
+  if (rc != RCLE_OK) {
+    fprintf(stderr, "couldn't fill db: %s\n", rcl_strerror(rc));
+    return -1;
+  }
+
+  return 0;
+}
+
+// Kernels, a pass is one round over the corpus
+
+static void pass_req_parse(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  arena_t arena;
+  arena_init(&arena, 1024 * 1024, 32 * 1024 * 1024);
+
+  vector_t logs;
+  if (!vector_init(&logs, 1024, sizeof(rcl_log_t))) {
+    arena_destroy(&arena);
+    return;
+  }
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t i = 0; i < ctx->bodies.size; ++i) {
+    bench_body_t* body = vector_at(&(ctx->bodies), i);
+    (void)rcl_response_parse(body->data, body->size, RCL_UPSTREAM_LOGS, 1, 1,
+                             &arena, &logs);
+
+    kernel->bytes += body->size;
+    kernel->logs += logs.size;
+
+    vector_reset(&logs);
+    arena_reset(&arena);
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += ctx->bodies.size;
+
+  vector_destroy(&logs);
+  arena_destroy(&arena);
+}
+
+static void pass_hex2bin(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  rcl_hash_t key;
+  uint64_t sink = 0;
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t i = 0; i < ctx->hex.size; ++i) {
+    bench_hex_t* it = vector_at(&(ctx->hex), i);
+    hex2bin(key, it->hex, it->bytes);
+    sink += key[0];
+    kernel->bytes += 2 + 2 * (uint64_t)it->bytes;
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += ctx->hex.size;
+  kernel->logs += ctx->logs.size;
+  bench_sink += sink;
+}
+
+static void pass_murmur64A(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  uint64_t sink = 0;
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t i = 0; i < ctx->logs.size; ++i) {
+    rcl_log_t* log = vector_at(&(ctx->logs), i);
+    sink ^= murmur64A(log->address, sizeof(rcl_address_t), HASH_SEED);
+    for (size_t k = 0; k < TOPICS_LENGTH; ++k)
+      sink ^= murmur64A(log->topics[k], sizeof(rcl_hash_t), HASH_SEED);
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += ctx->logs.size * (1 + TOPICS_LENGTH);
+  kernel->bytes += ctx->logs.size * sizeof(rcl_log_t);
+  kernel->logs += ctx->logs.size;
+  bench_sink += sink;
+}
+
+static void pass_bloom_add(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  bloom_t bloom;
+  bloom_init(bloom);
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  uint64_t block = UINT64_MAX;
+  for (size_t i = 0; i < ctx->logs.size; ++i) {
+    rcl_log_t* log = vector_at(&(ctx->logs), i);
+    if (log->block_number != block) {
+      block = log->block_number;
+      bloom_init(bloom);
+    }
+
+    bloom_add(&bloom, log->address);
+    for (size_t k = 0; k < TOPICS_LENGTH; ++k)
+      bloom_add(&bloom, log->topics[k]);
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += ctx->logs.size * (1 + TOPICS_LENGTH);
+  kernel->bytes += ctx->logs.size * (ADDRESS_LENGTH + HASH_LENGTH * 4);
+  kernel->logs += ctx->logs.size;
+  bench_sink += bloom[0];
+}
+
+// The same sets as rcl_block_check: any key of every set
+static bool bench_bloom_match(bloom_t* bloom,
+                              const rcl_query_keys_t* q,
+                              uint64_t* checks) {
+  for (size_t i = 0; i < 1 + TOPICS_LENGTH; ++i) {
+    size_t len = i == 0 ? q->alen : q->tlen[i - 1];
+    size_t size = i == 0 ? ADDRESS_LENGTH : HASH_LENGTH;
+    const uint8_t* keys = i == 0 ? (const uint8_t*)q->address
+                                 : (const uint8_t*)q->topics[i - 1];
+
+    bool match = len == 0;
+    for (size_t k = 0; !match && k < len; ++k, ++(*checks))
+      match = bloom_check(bloom, (uint8_t*)(keys + k * size));
+    if (!match)
+      return false;
+  }
+
+  return true;
+}
+
+// Every fixture against every block, like the scan before the data pages
+static void pass_bloom_check(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  uint64_t passed = 0, checks = 0;
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t f = 0; f < ctx->fixtures.size; ++f) {
+    bench_fixture_t* fixture = vector_at(&(ctx->fixtures), f);
+
+    for (size_t b = 0; b < ctx->blooms.size; ++b)
+      passed += bench_bloom_match(vector_at(&(ctx->blooms), b),
+                                  &(fixture->query), &checks);
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += checks;
+  kernel->logs += ctx->fixtures.size * ctx->logs.size;
+  bench_sink += passed;
+}
+
+static void pass_vector_sort(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  vector_t logs = ctx->logs;
+  logs.buffer = malloc(logs.size * logs.item_size);
+  if (logs.buffer == NULL)
+    return;
+  memcpy(logs.buffer, ctx->logs.buffer, logs.size * logs.item_size);
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t i = 0; i < ctx->bodies.size; ++i) {
+    bench_body_t* body = vector_at(&(ctx->bodies), i);
+
+    vector_t part = logs;
+    part.buffer = vector_at(&logs, body->first);
+    part.size = body->count;
+    vector_sort(&part, logscomp);
+  }
+
+  bench_stop(&clock, kernel);
+  kernel->ops += ctx->bodies.size;
+  kernel->bytes += logs.size * logs.item_size;
+  kernel->logs += logs.size;
+
+  free(logs.buffer);
+}
+
+// rcl_query_check_data is internal, it's measured through whole queries
+// per log that passed the blooms
+static void pass_check_data(bench_ctx_t* ctx, bench_kernel_t* kernel) {
+  rcl_stats_t before, after;
+  (void)rcl_stats(ctx->db, &before);
+
+  bench_clock_t clock;
+  bench_start(&clock);
+
+  for (size_t f = 0; f < ctx->fixtures.size; ++f) {
+    bench_fixture_t* fixture = vector_at(&(ctx->fixtures), f);
+    fixture->query.from = 0;
+    fixture->query.to = UINT64_MAX;
+
+    uint64_t result = 0;
+    (void)rcl_query_keys(ctx->db, &(fixture->query), &result);
+    bench_sink += result;
+  }
+
+  bench_stop(&clock, kernel);
+  (void)rcl_stats(ctx->db, &after);
+
+  kernel->ops += ctx->fixtures.size;
+  kernel->logs += after.logs_examined - before.logs_examined;
+}
+
+typedef void (*bench_pass_t)(bench_ctx_t* ctx, bench_kernel_t* kernel);
+
+static void bench_run(bench_ctx_t* ctx, const char* name, bench_pass_t pass) {
+  bench_kernel_t warmup = {0}, kernel = {0};
+  pass(ctx, &warmup);
+
+  do {
+    pass(ctx, &kernel);
+  } while (kernel.ns < ctx->min_ns && kernel.ops > 0);
+
+  bench_report_kernel(name, &kernel);
+}
+
+static int bench_unlink(const char* path,
+                        const struct stat* sb,
+                        int flag,
+                        struct FTW* ftw) {
+  (void)sb;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+int main(int argc, char* argv[]) {
+  bench_chain_config_t config;
+  bench_chain_defaults(&config);
+
+  const char* fixtures = "internal/healthcheck/fixtures.jsonl";
+  size_t synthesized = 64;
+  uint64_t min_ms = 200;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "f:t:n:l:h")) != -1) {
+    switch (opt) {
+      case 'f':
+        fixtures = optarg;
+        break;
+      case 't':
+        min_ms = strtoull(optarg, NULL, 10);
+        break;
+      case 'n':
+        synthesized = strtoull(optarg, NULL, 10);
+        break;
+      case 'l':
+        config.logs_per_block = strtod(optarg, NULL);
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  bench_ctx_t ctx = {.min_ns = min_ms * 1000000};
+  if (!vector_init(&(ctx.bodies), 64, sizeof(bench_body_t)) ||
+      !vector_init(&(ctx.logs), 1024, sizeof(rcl_log_t)) ||
+      !vector_init(&(ctx.hex), 1024, sizeof(bench_hex_t)) ||
+      !vector_init(&(ctx.fixtures), 1024, sizeof(bench_fixture_t)) ||
+      !vector_init(&(ctx.blooms), 1024, sizeof(bloom_t))) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+
+  // captured bodies, or a synthesized corpus of 4 blocks per body
+  for (int i = optind; i < argc; ++i) {
+    bench_body_t* body = vector_add(&(ctx.bodies));
+    if (body != NULL)
+      body->data = bench_read_file(argv[i], &(body->size));
+
+    if (body == NULL || body->data == NULL) {
+      fprintf(stderr, "couldn't read %s\n", argv[i]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (ctx.bodies.size == 0) {
+    bench_chain_t* chain = bench_chain_new(&config);
+    rcl_log_t* logs = malloc(BENCH_MAX_BLOCK_LOGS * sizeof(rcl_log_t));
+
+    for (size_t i = 0; chain && logs && i < synthesized; ++i) {
+      bench_body_t* body = vector_add(&(ctx.bodies));
+      if (body == NULL)
+        break;
+      body->data = bench_synthesize(chain, 4 * i, 4 * i + 3, logs,
+                                    &(body->size));
+      if (body->data == NULL)
+        ctx.bodies.size--;
+    }
+
+    free(logs);
+    if (chain != NULL)
+      bench_chain_free(chain);
+  }
+
+  if (ctx.bodies.size == 0 || bench_corpus_index(&ctx) != 0) {
+    fprintf(stderr, "empty corpus\n");
+    return EXIT_FAILURE;
+  }
+
+  if (bench_fixtures_load(&ctx, fixtures) != 0)
+    fprintf(stderr, "no fixtures at %s, filter kernels are skipped\n",
+            fixtures);
+
+  char dir[] = "/tmp/logsoracle-micro.XXXXXX";
+  if (mkdtemp(dir) == NULL || bench_db_fill(&ctx, dir) != 0) {
+    fprintf(stderr, "couldn't create the corpus db\n");
+    return EXIT_FAILURE;
+  }
+
+  uint64_t bytes = 0;
+  for (size_t i = 0; i < ctx.bodies.size; ++i)
+    bytes += ((bench_body_t*)vector_at(&(ctx.bodies), i))->size;
+
+  printf("{\"bench\": \"corpus\", \"bodies\": %" PRIu64 ", \"bytes\": %" PRIu64
+         ", \"logs\": %" PRIu64 ", \"blocks\": %" PRIu64
+         ", \"fixtures\": %" PRIu64 "}\n",
+         ctx.bodies.size, bytes, ctx.logs.size, ctx.blooms.size,
+         ctx.fixtures.size);
+
+  bench_run(&ctx, "req_parse", pass_req_parse);
+  bench_run(&ctx, "hex2bin", pass_hex2bin);
+  bench_run(&ctx, "murmur64A", pass_murmur64A);
+  bench_run(&ctx, "bloom_add", pass_bloom_add);
+  bench_run(&ctx, "vector_sort_logscomp", pass_vector_sort);
+  if (ctx.fixtures.size > 0) {
+    bench_run(&ctx, "bloom_check", pass_bloom_check);
+    bench_run(&ctx, "rcl_query_check_data", pass_check_data);
+  }
+
+  rcl_free(ctx.db);
+  nftw(dir, bench_unlink, 16, FTW_DEPTH | FTW_PHYS);
+
+  for (size_t i = 0; i < ctx.bodies.size; ++i)
+    free(((bench_body_t*)vector_at(&(ctx.bodies), i))->data);
+  for (size_t i = 0; i < ctx.fixtures.size; ++i)
+    bench_fixture_free(vector_at(&(ctx.fixtures), i));
+
+  vector_destroy(&(ctx.bodies));
+  vector_destroy(&(ctx.logs));
+  vector_destroy(&(ctx.hex));
+  vector_destroy(&(ctx.fixtures));
+  vector_destroy(&(ctx.blooms));
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,64 @@
+#include <getopt.h>
+
+#include "node.h"
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-p port] [node options]\n"
+          "  serves eth_blockNumber, eth_getLogs and eth_getBlockReceipts of "
+          "a generated\n"
+          "  chain or a dump on 127.0.0.1, for offline upstream tests\n"
+          "  -p  port, 0 picks a free one (8545)\n",
+          name);
+  bench_node_usage(stderr);
+}
+
+int main(int argc, char* argv[]) {
+  bench_node_config_t config;
+  bench_node_defaults(&config);
+
+  uint16_t port = 8545;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:h" BENCH_NODE_OPTIONS)) != -1) {
+    if (opt == 'p') {
+      port = (uint16_t)strtoul(optarg, NULL, 10);
+      continue;
+    }
+
+    if (opt != 'h' && bench_node_option(&config, opt, optarg))
+      continue;
+
+    usage(argv[0]);
+    return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (optind != argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  bench_node_t* node = bench_node_new(&config);
+  if (node == NULL) {
+    fprintf(stderr, "couldn't create the node\n");
+    return EXIT_FAILURE;
+  }
+
+  uint16_t bound = 0;
+  int fd = bench_node_listen(port, &bound);
+  if (fd < 0) {
+    perror("listen");
+    bench_node_free(node);
+    return EXIT_FAILURE;
+  }
+
+  fprintf(stderr, "listening on http://127.0.0.1:%u, head %" PRIu64 "\n",
+          bound, bench_node_head(node));
+
+  (void)bench_node_serve(node, fd);
+
+  close(fd);
+  bench_node_free(node);
+
+  return EXIT_FAILURE;
+}
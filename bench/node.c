@@ -0,0 +1,849 @@
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#include "node.h"
+
+enum {
+  NODE_READ_CHUNK = 64 * 1024,
+  NODE_WRITE_CHUNK = 64 * 1024,  // the unit of the rate limit
+  NODE_HEADERS_MAX = 64 * 1024,
+  NODE_BODY_MAX = 64 * 1024 * 1024,
+
+  NODE_LOG_JSON_MAX = 1024,  // bytes of a log without its data field
+  NODE_TX_LOGS = 4,          // logs of a transaction
+};
+
+// -32005 with this message is what providers answer on too large ranges
+enum {
+  RPC_PARSE_ERROR = -32700,
+  RPC_INVALID_REQUEST = -32600,
+  RPC_METHOD_NOT_FOUND = -32601,
+  RPC_INVALID_PARAMS = -32602,
+  RPC_INTERNAL_ERROR = -32603,
+  RPC_LIMIT_EXCEEDED = -32005,
+};
+
+// Salts of the hashes the chain doesn't have
+static const uint64_t SALT_BLOCK_HASH = 1ull << 60;
+static const uint64_t SALT_TX_HASH = 2ull << 60;
+static const uint64_t SALT_DATA = 3ull << 60;
+
+struct bench_node {
+  bench_node_config_t config;
+  uint64_t started;  // rcl_clock_ns
+  uint64_t last;     // the last block there is
+
+  bench_chain_t* chain;  // or the dump
+  vector_t logs;         // rcl_log_t
+
+  atomic_uint_fast64_t paced;  // rcl_clock_ns of the next write
+  atomic_uint_fast64_t connections;
+};
+
+typedef struct {
+  char* data;
+  size_t size, capacity;
+} node_buf_t;
+
+typedef struct {
+  bench_node_t* node;
+  int fd;
+  bench_rng_t rng;  // of the faults
+
+  node_buf_t in, body;
+  size_t consumed;  // bytes of the last request in 'in'
+
+  rcl_log_t* logs;  // generated ones
+  size_t logs_capacity;
+  uint8_t* data;  // the data field of a log
+} node_conn_t;
+
+void bench_node_defaults(bench_node_config_t* config) {
+  *config = (bench_node_config_t){
+      .blocks = 100000,
+      .dump_format = RCL_DUMP_JSONL,
+      .data_size = 64,
+  };
+  bench_chain_defaults(&(config->chain));
+}
+
+bool bench_node_option(bench_node_config_t* config, int opt, const char* arg) {
+  switch (opt) {
+    case 'b':
+      config->blocks = strtoull(arg, NULL, 10);
+      break;
+    case 't':
+      config->block_time_ms = strtoull(arg, NULL, 10);
+      break;
+    case 'l':
+      config->chain.logs_per_block = strtod(arg, NULL);
+      break;
+    case 's':
+      config->chain.seed = strtoull(arg, NULL, 10);
+      break;
+    case 'r':
+    case 'R':
+      config->dump = arg;
+      config->dump_format = opt == 'r' ? RCL_DUMP_JSONL : RCL_DUMP_BINARY;
+      break;
+    case 'L':
+      config->latency_ms = strtoull(arg, NULL, 10);
+      break;
+    case 'T':
+      config->rate = strtoull(arg, NULL, 10);
+      break;
+    case 'e':
+      config->errors = strtod(arg, NULL);
+      break;
+    case 'x':
+      config->max_results = strtoull(arg, NULL, 10);
+      break;
+    case 'D':
+      config->data_size = (size_t)strtoull(arg, NULL, 10);
+      break;
+    default:
+      return false;
+  }
+
+  return true;
+}
+
+void bench_node_usage(FILE* out) {
+  fputs(
+      "  node:\n"
+      "  -b  blocks at start, the head of a dump is its last block at most "
+      "(100000)\n"
+      "  -t  block time in ms, the head grows, 0 is a fixed head (0)\n"
+      "  -l  mean logs per block of the generated chain (250)\n"
+      "  -s  seed of the generated chain and the faults (1)\n"
+      "  -r  a JSONL dump instead of the generated chain, see rcl_import\n"
+      "  -R  a binary dump instead of the generated chain\n"
+      "  -L  latency of a response in ms (0)\n"
+      "  -T  bytes per second of all responses, 0 is unlimited (0)\n"
+      "  -e  share of requests failed with 503 or an RPC error (0)\n"
+      "  -x  eth_getLogs calls over it fail as too many results, 0 is "
+      "unlimited (0)\n"
+      "  -D  bytes of the data field of a log (64)\n",
+      out);
+}
+
+static rcl_result bench_node_load(bench_node_t* node) {
+  dump_reader_t reader;
+  rcl_result rc = dump_open(&reader, node->config.dump,
+                            node->config.dump_format);
+  if (rc != RCLE_OK)
+    return rc;
+
+  size_t size;
+  do {
+    size = node->logs.size;
+    rc = dump_read(&reader, &(node->logs), 1 << 16);
+  } while (rc == RCLE_OK && node->logs.size != size);
+
+  dump_close(&reader);
+  if (rc != RCLE_OK)
+    return rc;
+
+  if (node->logs.size == 0) {
+    fprintf(stderr, "no logs in %s\n", node->config.dump);
+    return RCLE_INVALID_DUMP;
+  }
+
+  vector_sort(&(node->logs), logscomp);
+  node->last = ((rcl_log_t*)vector_last(&(node->logs)))->block_number;
+
+  return RCLE_OK;
+}
+
+bench_node_t* bench_node_new(const bench_node_config_t* config) {
+  if (config->blocks == 0)
+    return NULL;
+
+  bench_node_t* node = calloc(1, sizeof(bench_node_t));
+  if (node == NULL)
+    return NULL;
+
+  node->config = *config;
+  node->last = UINT64_MAX;
+
+  if (!vector_init(&(node->logs), 0, sizeof(rcl_log_t))) {
+    free(node);
+    return NULL;
+  }
+
+  bool loaded;
+  if (config->dump != NULL) {
+    loaded = bench_node_load(node) == RCLE_OK;
+  } else {
+    node->chain = bench_chain_new(&(config->chain));
+    loaded = node->chain != NULL;
+  }
+
+  if (!loaded) {
+    bench_node_free(node);
+    return NULL;
+  }
+
+  node->started = rcl_clock_ns();
+  return node;
+}
+
+void bench_node_free(bench_node_t* node) {
+  if (node->chain != NULL)
+    bench_chain_free(node->chain);
+  vector_destroy(&(node->logs));
+  free(node);
+}
+
+uint64_t bench_node_head(bench_node_t* node) {
+  uint64_t head = node->config.blocks - 1;
+  if (node->config.block_time_ms > 0)
+    head += (rcl_clock_ns() - node->started) /
+            (node->config.block_time_ms * 1000000);
+
+  return min(head, node->last);
+}
+
+static void node_sleep_ns(uint64_t ns) {
+  struct timespec ts = {.tv_sec = (time_t)(ns / 1000000000),
+                        .tv_nsec = (long)(ns % 1000000000)};
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+// Deterministic bytes of the hashes and the data the chain doesn't keep
+static void node_hash(uint64_t seed, uint8_t* out, size_t size) {
+  bench_rng_t rng = {seed};
+  for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+    uint64_t word = bench_rng_next(&rng);
+    memcpy(out + i, &word, min(size - i, sizeof(uint64_t)));
+  }
+}
+
+static bool buf_reserve(node_buf_t* buf, size_t size) {
+  if (buf->capacity - buf->size >= size)
+    return true;
+
+  size_t capacity = max(buf->capacity * 2, buf->size + size);
+  capacity = max(capacity, (size_t)NODE_READ_CHUNK);
+  char* data = realloc(buf->data, capacity);
+  if (data == NULL)
+    return false;
+
+  buf->data = data;
+  buf->capacity = capacity;
+  return true;
+}
+
+// The writes below don't check the space, it's reserved by the caller
+
+static void buf_puts(node_buf_t* buf, const char* str) {
+  size_t size = strlen(str);
+  memcpy(buf->data + buf->size, str, size);
+  buf->size += size;
+}
+
+static void buf_hex(node_buf_t* buf, const uint8_t* data, size_t size) {
+  static const char digits[] = "0123456789abcdef";
+
+  char* out = buf->data + buf->size;
+  *out++ = '"';
+  *out++ = '0';
+  *out++ = 'x';
+  for (size_t i = 0; i < size; ++i) {
+    *out++ = digits[data[i] >> 4];
+    *out++ = digits[data[i] & 0xf];
+  }
+  *out++ = '"';
+
+  buf->size = (size_t)(out - buf->data);
+}
+
+// A quantity is hex without leading zeros
+static void buf_quantity(node_buf_t* buf, uint64_t value) {
+  static const char digits[] = "0123456789abcdef";
+
+  char reversed[16];
+  size_t count = 0;
+  do {
+    reversed[count++] = digits[value & 0xf];
+    value >>= 4;
+  } while (value != 0);
+
+  char* out = buf->data + buf->size;
+  *out++ = '"';
+  *out++ = '0';
+  *out++ = 'x';
+  while (count > 0)
+    *out++ = reversed[--count];
+  *out++ = '"';
+
+  buf->size = (size_t)(out - buf->data);
+}
+
+static bool buf_printf(node_buf_t* buf, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static bool buf_printf(node_buf_t* buf, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int size = vsnprintf(NULL, 0, format, args);
+  va_end(args);
+
+  if (size < 0 || !buf_reserve(buf, (size_t)size + 1))
+    return false;
+
+  va_start(args, format);
+  vsnprintf(buf->data + buf->size, (size_t)size + 1, format, args);
+  va_end(args);
+
+  buf->size += (size_t)size;
+  return true;
+}
+
+// Writes '{"jsonrpc":"2.0","id":id,' of a response
+static bool node_begin(node_conn_t* conn, const cJSON* id) {
+  if (cJSON_IsNumber(id))
+    return buf_printf(&(conn->body), "{\"jsonrpc\":\"2.0\",\"id\":%.0f,",
+                      id->valuedouble);
+
+  if (cJSON_IsString(id))
+    return buf_printf(&(conn->body), "{\"jsonrpc\":\"2.0\",\"id\":\"%s\",",
+                      id->valuestring);
+
+  return buf_printf(&(conn->body), "{\"jsonrpc\":\"2.0\",\"id\":null,");
+}
+
+static bool node_error(node_conn_t* conn,
+                       const cJSON* id,
+                       int code,
+                       const char* message) {
+  return node_begin(conn, id) &&
+         buf_printf(&(conn->body),
+                    "\"error\":{\"code\":%d,\"message\":\"%s\"}}", code,
+                    message);
+}
+
+// A block tag or number, tags except "earliest" are the head
+static bool node_block(const cJSON* item, uint64_t head, uint64_t* number) {
+  if (item == NULL) {
+    *number = head;
+    return true;
+  }
+
+  if (!cJSON_IsString(item))
+    return false;
+
+  const char* str = item->valuestring;
+  if (strcmp(str, "earliest") == 0) {
+    *number = 0;
+    return true;
+  }
+
+  if (strncmp(str, "0x", 2) != 0) {
+    *number = head;
+    return strcmp(str, "latest") == 0 || strcmp(str, "safe") == 0 ||
+           strcmp(str, "finalized") == 0 || strcmp(str, "pending") == 0;
+  }
+
+  char* end = NULL;
+  errno = 0;
+  *number = strtoull(str + 2, &end, 16);
+  return errno == 0 && end != str + 2 && *end == '\0';
+}
+
+// Logs of [from, to], a generated range stops past 'limit' logs
+static bool node_logs(node_conn_t* conn,
+                      uint64_t from,
+                      uint64_t to,
+                      uint64_t limit,
+                      const rcl_log_t** logs,
+                      size_t* count) {
+  bench_node_t* node = conn->node;
+
+  if (node->chain == NULL) {
+    vector_t* all = &(node->logs);
+
+    size_t l = 0, r = all->size;
+    while (l < r) {
+      size_t m = l + (r - l) / 2;
+      if (((rcl_log_t*)vector_at(all, m))->block_number < from)
+        l = m + 1;
+      else
+        r = m;
+    }
+
+    size_t end = l;
+    while (end < all->size &&
+           ((rcl_log_t*)vector_at(all, end))->block_number <= to)
+      ++end;
+
+    *logs = vector_at(all, l);
+    *count = end - l;
+    return true;
+  }
+
+  size_t size = 0;
+  for (uint64_t number = from; number <= to; ++number) {
+    if (limit > 0 && size > limit)
+      break;
+
+    if (conn->logs_capacity - size < BENCH_MAX_BLOCK_LOGS) {
+      size_t capacity = max(2 * conn->logs_capacity,
+                            (size_t)(2 * BENCH_MAX_BLOCK_LOGS));
+      rcl_log_t* grown = realloc(conn->logs, capacity * sizeof(rcl_log_t));
+      if (grown == NULL)
+        return false;
+
+      conn->logs = grown;
+      conn->logs_capacity = capacity;
+    }
+
+    size += bench_chain_block(node->chain, number, conn->logs + size);
+  }
+
+  *logs = conn->logs;
+  *count = size;
+  return true;
+}
+
+static void node_log_json(node_conn_t* conn,
+                          const rcl_log_t* log,
+                          const uint8_t* block_hash,
+                          size_t index) {
+  static const rcl_hash_t zero = {0};
+
+  node_buf_t* out = &(conn->body);
+  size_t data_size = conn->node->config.data_size;
+  uint64_t number = log->block_number;
+
+  rcl_hash_t tx_hash;
+  node_hash(SALT_TX_HASH ^ (number << 16) ^ (index / NODE_TX_LOGS), tx_hash,
+            sizeof(rcl_hash_t));
+  node_hash(SALT_DATA ^ (number << 16) ^ index, conn->data, data_size);
+
+  buf_puts(out, "{\"address\":");
+  buf_hex(out, log->address, sizeof(rcl_address_t));
+  buf_puts(out, ",\"topics\":[");
+  for (size_t k = 0; k < TOPICS_LENGTH; ++k) {
+    if (memcmp(log->topics[k], zero, sizeof(rcl_hash_t)) == 0)
+      break;
+    if (k > 0)
+      buf_puts(out, ",");
+    buf_hex(out, log->topics[k], sizeof(rcl_hash_t));
+  }
+  buf_puts(out, "],\"data\":");
+  buf_hex(out, conn->data, data_size);
+  buf_puts(out, ",\"blockNumber\":");
+  buf_quantity(out, number);
+  buf_puts(out, ",\"transactionHash\":");
+  buf_hex(out, tx_hash, sizeof(rcl_hash_t));
+  buf_puts(out, ",\"transactionIndex\":");
+  buf_quantity(out, index / NODE_TX_LOGS);
+  buf_puts(out, ",\"blockHash\":");
+  buf_hex(out, block_hash, sizeof(rcl_hash_t));
+  buf_puts(out, ",\"logIndex\":");
+  buf_quantity(out, index);
+  buf_puts(out, ",\"removed\":false}");
+}
+
+// Comma separated logs, 'index' is the one of the first log in its block
+static bool node_logs_json(node_conn_t* conn,
+                           const rcl_log_t* logs,
+                           size_t count,
+                           size_t index) {
+  size_t size = NODE_LOG_JSON_MAX + 2 * conn->node->config.data_size;
+  rcl_hash_t block_hash;
+
+  for (size_t i = 0; i < count; ++i, ++index) {
+    if (i == 0 || logs[i].block_number != logs[i - 1].block_number) {
+      node_hash(SALT_BLOCK_HASH ^ logs[i].block_number, block_hash,
+                sizeof(rcl_hash_t));
+      if (i > 0)
+        index = 0;
+    }
+
+    if (!buf_reserve(&(conn->body), size))
+      return false;
+    if (i > 0)
+      buf_puts(&(conn->body), ",");
+    node_log_json(conn, &(logs[i]), block_hash, index);
+  }
+
+  return true;
+}
+
+// Filters other than the range are ignored, the ingest asks for all logs
+static bool node_get_logs(node_conn_t* conn,
+                          const cJSON* id,
+                          const cJSON* filter) {
+  uint64_t head = bench_node_head(conn->node), from, to;
+  uint64_t limit = conn->node->config.max_results;
+
+  if (!cJSON_IsObject(filter) ||
+      cJSON_GetObjectItemCaseSensitive(filter, "blockHash") != NULL ||
+      !node_block(cJSON_GetObjectItemCaseSensitive(filter, "fromBlock"), head,
+                  &from) ||
+      !node_block(cJSON_GetObjectItemCaseSensitive(filter, "toBlock"), head,
+                  &to) ||
+      from > to)
+    return node_error(conn, id, RPC_INVALID_PARAMS, "invalid block range");
+
+  const rcl_log_t* logs = NULL;
+  size_t count = 0;
+  if (from <= head &&
+      !node_logs(conn, from, min(to, head), limit, &logs, &count))
+    return false;
+
+  if (limit > 0 && count > limit) {
+    char message[64];
+    snprintf(message, sizeof(message),
+             "query returned more than %" PRIu64 " results", limit);
+    return node_error(conn, id, RPC_LIMIT_EXCEEDED, message);
+  }
+
+  if (!node_begin(conn, id) || !buf_printf(&(conn->body), "\"result\":[") ||
+      !node_logs_json(conn, logs, count, 0))
+    return false;
+
+  return buf_printf(&(conn->body), "]}");
+}
+
+// Receipts of the block's logs in transactions of NODE_TX_LOGS logs
+static bool node_get_receipts(node_conn_t* conn,
+                              const cJSON* id,
+                              const cJSON* block) {
+  uint64_t head = bench_node_head(conn->node), number;
+
+  if (!node_block(block, head, &number))
+    return node_error(conn, id, RPC_INVALID_PARAMS, "invalid block");
+
+  if (number > head)
+    return node_begin(conn, id) &&
+           buf_printf(&(conn->body), "\"result\":null}");
+
+  const rcl_log_t* logs = NULL;
+  size_t count = 0;
+  if (!node_logs(conn, number, number, 0, &logs, &count) ||
+      !node_begin(conn, id) || !buf_printf(&(conn->body), "\"result\":["))
+    return false;
+
+  rcl_hash_t block_hash, tx_hash;
+  node_hash(SALT_BLOCK_HASH ^ number, block_hash, sizeof(rcl_hash_t));
+
+  for (size_t i = 0; i < count; i += NODE_TX_LOGS) {
+    node_buf_t* out = &(conn->body);
+    if (!buf_reserve(out, NODE_LOG_JSON_MAX))
+      return false;
+
+    node_hash(SALT_TX_HASH ^ (number << 16) ^ (i / NODE_TX_LOGS), tx_hash,
+              sizeof(rcl_hash_t));
+
+    buf_puts(out, i > 0 ? ",{\"transactionHash\":" : "{\"transactionHash\":");
+    buf_hex(out, tx_hash, sizeof(rcl_hash_t));
+    buf_puts(out, ",\"transactionIndex\":");
+    buf_quantity(out, i / NODE_TX_LOGS);
+    buf_puts(out, ",\"blockHash\":");
+    buf_hex(out, block_hash, sizeof(rcl_hash_t));
+    buf_puts(out, ",\"blockNumber\":");
+    buf_quantity(out, number);
+    buf_puts(out, ",\"status\":\"0x1\",\"logs\":[");
+
+    if (!node_logs_json(conn, logs + i, min(count - i, (size_t)NODE_TX_LOGS),
+                        i) ||
+        !buf_printf(out, "]}"))
+      return false;
+  }
+
+  return buf_printf(&(conn->body), "]}");
+}
+
+static bool node_call(node_conn_t* conn, const cJSON* call) {
+  const cJSON* id = cJSON_GetObjectItemCaseSensitive(call, "id");
+  const cJSON* method = cJSON_GetObjectItemCaseSensitive(call, "method");
+  const cJSON* params = cJSON_GetObjectItemCaseSensitive(call, "params");
+
+  if (!cJSON_IsString(method))
+    return node_error(conn, id, RPC_INVALID_REQUEST, "invalid request");
+
+  if (strcmp(method->valuestring, "eth_blockNumber") == 0)
+    return node_begin(conn, id) &&
+           buf_printf(&(conn->body), "\"result\":\"0x%" PRIx64 "\"}",
+                      bench_node_head(conn->node));
+
+  if (strcmp(method->valuestring, "eth_getLogs") == 0)
+    return node_get_logs(conn, id, cJSON_GetArrayItem(params, 0));
+
+  if (strcmp(method->valuestring, "eth_getBlockReceipts") == 0)
+    return node_get_receipts(conn, id, cJSON_GetArrayItem(params, 0));
+
+  return node_error(conn, id, RPC_METHOD_NOT_FOUND, "method not found");
+}
+
+// Fills the body of a request, returns the HTTP status
+static int node_handle(node_conn_t* conn, const char* request, size_t size) {
+  bench_node_config_t* config = &(conn->node->config);
+  conn->body.size = 0;
+
+  if (config->latency_ms > 0)
+    node_sleep_ns(config->latency_ms * 1000000);
+
+  // the faults are split between both kinds
+  double fault = bench_rng_double(&(conn->rng));
+  if (fault < config->errors / 2)
+    return 503;
+  if (fault < config->errors)
+    return node_error(conn, NULL, RPC_INTERNAL_ERROR, "injected fault") ? 200
+                                                                         : 500;
+
+  cJSON* root = cJSON_ParseWithLength(request, size);
+  if (root == NULL)
+    return node_error(conn, NULL, RPC_PARSE_ERROR, "parse error") ? 200 : 500;
+
+  bool ok = true;
+  if (cJSON_IsArray(root)) {
+    ok = buf_printf(&(conn->body), "[");
+
+    const cJSON* call = NULL;
+    cJSON_ArrayForEach(call, root) {
+      if (call != root->child)
+        ok = ok && buf_printf(&(conn->body), ",");
+      ok = ok && node_call(conn, call);
+    }
+
+    ok = ok && buf_printf(&(conn->body), "]");
+  } else {
+    ok = node_call(conn, root);
+  }
+
+  cJSON_Delete(root);
+  return ok ? 200 : 500;
+}
+
+// Spreads the writes of all connections to the rate
+static void node_pace(bench_node_t* node, size_t bytes) {
+  if (node->config.rate == 0)
+    return;
+
+  uint64_t cost = (uint64_t)((double)bytes * 1e9 / (double)node->config.rate);
+  uint64_t now = rcl_clock_ns(), at = node->paced, start;
+  do {
+    start = max(at, now);
+  } while (!atomic_compare_exchange_weak(&(node->paced), &at, start + cost));
+
+  if (start > now)
+    node_sleep_ns(start - now);
+}
+
+static bool node_write(node_conn_t* conn, const char* data, size_t size) {
+  for (size_t sent = 0; sent < size;) {
+    size_t chunk = min(size - sent, (size_t)NODE_WRITE_CHUNK);
+    node_pace(conn->node, chunk);
+
+    ssize_t n = send(conn->fd, data + sent, chunk, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+
+    sent += (size_t)n;
+  }
+
+  return true;
+}
+
+static bool node_respond(node_conn_t* conn, int status, bool closing) {
+  const char* reason = status == 200   ? "OK"
+                       : status == 503 ? "Service Unavailable"
+                                       : "Internal Server Error";
+  if (status != 200)
+    conn->body.size = 0;
+
+  char head[192];
+  int size = snprintf(head, sizeof(head),
+                      "HTTP/1.1 %d %s\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Content-Length: %zu\r\n%s\r\n",
+                      status, reason, conn->body.size,
+                      closing ? "Connection: close\r\n" : "");
+
+  return node_write(conn, head, (size_t)size) &&
+         node_write(conn, conn->body.data, conn->body.size);
+}
+
+static bool node_recv(node_conn_t* conn) {
+  if (!buf_reserve(&(conn->in), NODE_READ_CHUNK))
+    return false;
+
+  ssize_t n;
+  do {
+    n = recv(conn->fd, conn->in.data + conn->in.size, NODE_READ_CHUNK, 0);
+  } while (n < 0 && errno == EINTR);
+
+  if (n <= 0)
+    return false;
+
+  conn->in.size += (size_t)n;
+  return true;
+}
+
+// 'line' starts with the header 'name:', its value is in 'value'
+static bool node_header(const char* line,
+                        const char* name,
+                        const char** value) {
+  size_t size = strlen(name);
+  if (strncasecmp(line, name, size) != 0)
+    return false;
+
+  for (line += size; *line == ' ' || *line == '\t'; ++line)
+    ;
+
+  *value = line;
+  return true;
+}
+
+// Reads the next request of the connection, the previous one is dropped.
+// Returns false at the end of the connection.
+static bool node_read(node_conn_t* conn,
+                      size_t* offset,
+                      size_t* length,
+                      bool* closing) {
+  node_buf_t* in = &(conn->in);
+  if (conn->consumed > 0) {
+    memmove(in->data, in->data + conn->consumed, in->size - conn->consumed);
+    in->size -= conn->consumed;
+    conn->consumed = 0;
+  }
+
+  size_t end = 0, scanned = 0;  // 'end' is after the headers
+  while (end == 0) {
+    for (; scanned + 4 <= in->size && end == 0; ++scanned)
+      if (memcmp(in->data + scanned, "\r\n\r\n", 4) == 0)
+        end = scanned + 4;
+
+    if (end == 0 && (in->size > NODE_HEADERS_MAX || !node_recv(conn)))
+      return false;
+  }
+
+  *length = 0;
+  *closing = false;
+
+  bool expect = false;
+  const char *line = in->data, *last = in->data + end, *value;
+  while ((line = memchr(line, '\n', (size_t)(last - line))) != NULL &&
+         ++line < last) {
+    if (node_header(line, "content-length:", &value))
+      *length = strtoull(value, NULL, 10);
+    else if (node_header(line, "expect:", &value))
+      expect = strncasecmp(value, "100-continue", 12) == 0;
+    else if (node_header(line, "connection:", &value))
+      *closing = strncasecmp(value, "close", 5) == 0;
+  }
+
+  if (*length > NODE_BODY_MAX)
+    return false;
+
+  // curl waits for it before sending larger bodies
+  static const char proceed[] = "HTTP/1.1 100 Continue\r\n\r\n";
+  if (expect && in->size < end + *length &&
+      send(conn->fd, proceed, sizeof(proceed) - 1, MSG_NOSIGNAL) < 0)
+    return false;
+
+  while (in->size < end + *length)
+    if (!node_recv(conn))
+      return false;
+
+  *offset = end;
+  conn->consumed = end + *length;
+  return true;
+}
+
+static void node_conn_free(node_conn_t* conn) {
+  close(conn->fd);
+  free(conn->in.data);
+  free(conn->body.data);
+  free(conn->logs);
+  free(conn->data);
+  free(conn);
+}
+
+static void* node_conn_thrd(void* data) {
+  node_conn_t* conn = data;
+
+  size_t offset, length;
+  bool closing;
+  while (node_read(conn, &offset, &length, &closing)) {
+    int status = node_handle(conn, conn->in.data + offset, length);
+    if (!node_respond(conn, status, closing) || closing)
+      break;
+  }
+
+  node_conn_free(conn);
+  return NULL;
+}
+
+int bench_node_listen(uint16_t port, uint16_t* bound) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+
+  int one = 1;
+  (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr = {
+      .sin_family = AF_INET,
+      .sin_port = htons(port),
+      .sin_addr = {.s_addr = htonl(INADDR_LOOPBACK)},
+  };
+  socklen_t size = sizeof(addr);
+
+  if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0 ||
+      getsockname(fd, (struct sockaddr*)&addr, &size) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  *bound = ntohs(addr.sin_port);
+  return fd;
+}
+
+int bench_node_serve(bench_node_t* node, int fd) {
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  for (;;) {
+    int client = accept(fd, NULL, NULL);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      perror("accept");
+      break;
+    }
+
+    int one = 1;
+    (void)setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    node_conn_t* conn = calloc(1, sizeof(node_conn_t));
+    if (conn == NULL) {
+      close(client);
+      continue;
+    }
+
+    conn->node = node;
+    conn->fd = client;
+    conn->rng.state = node->config.chain.seed ^ ++(node->connections);
+    conn->data = malloc(max(node->config.data_size, (size_t)1));
+
+    pthread_t thrd;
+    if (conn->data == NULL ||
+        pthread_create(&thrd, &attr, node_conn_thrd, conn) != 0)
+      node_conn_free(conn);
+  }
+
+  pthread_attr_destroy(&attr);
+  return -1;
+}
@@ -0,0 +1,49 @@
+#ifndef _RCL_BENCH_NODE_H
+#define _RCL_BENCH_NODE_H
+
+#include "../dump.h"
+#include "chain.h"
+
+// Local JSON-RPC node with eth_blockNumber, eth_getLogs and
+// eth_getBlockReceipts of a generated chain or a recorded dump, and the
+// faults of a real one
+typedef struct {
+  bench_chain_config_t chain;
+  uint64_t blocks;         // the head at start is 'blocks - 1'
+  uint64_t block_time_ms;  // the head grows a block per interval, 0 is fixed
+
+  const char* dump;  // recorded logs instead of the chain, sorted by block
+  rcl_dump_format dump_format;
+
+  uint64_t latency_ms;    // before every response
+  uint64_t rate;          // bytes per second of all responses, 0 is unlimited
+  double errors;          // share of requests failed with 503 or an RPC error
+  uint64_t max_results;   // larger eth_getLogs calls fail, 0 is unlimited
+  size_t data_size;       // bytes of the data field of a log
+} bench_node_config_t;
+
+void bench_node_defaults(bench_node_config_t* config);
+
+// getopt options of the config shared by the tools, see bench_node_usage
+#define BENCH_NODE_OPTIONS "b:t:l:s:r:R:L:T:e:x:D:"
+
+// Applies an option of BENCH_NODE_OPTIONS, false for the other ones
+bool bench_node_option(bench_node_config_t* config, int opt, const char* arg);
+void bench_node_usage(FILE* out);
+
+struct bench_node;
+typedef struct bench_node bench_node_t;
+
+// Loads the dump, the head of a dump is its last block at most
+bench_node_t* bench_node_new(const bench_node_config_t* config);
+void bench_node_free(bench_node_t* node);
+
+uint64_t bench_node_head(bench_node_t* node);
+
+// A listening socket on 127.0.0.1, port 0 picks a free one
+int bench_node_listen(uint16_t port, uint16_t* bound);
+
+// Serves connections of 'fd' on own threads, returns only on an accept error
+int bench_node_serve(bench_node_t* node, int fd);
+
+#endif  // _RCL_BENCH_NODE_H
@@ -0,0 +1,130 @@
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "report.h"
+
+int bench_latency_init(bench_latency_t* latency, size_t capacity) {
+  *latency = (bench_latency_t){.capacity = capacity};
+  latency->ns = malloc(max(capacity, (size_t)1) * sizeof(uint64_t));
+  return latency->ns == NULL ? -1 : 0;
+}
+
+void bench_latency_destroy(bench_latency_t* latency) {
+  free(latency->ns);
+  latency->ns = NULL;
+}
+
+void bench_latency_add(bench_latency_t* latency, uint64_t ns) {
+  if (latency->count < latency->capacity)
+    latency->ns[latency->count++] = ns;
+}
+
+static int bench_compare(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static double bench_percentile(bench_latency_t* latency, double p) {
+  if (latency->count == 0)
+    return 0;
+
+  size_t i = (size_t)(p * (double)(latency->count - 1));
+  return (double)latency->ns[i] / 1e3;
+}
+
+void bench_report(const char* bench,
+                  const char* name,
+                  bench_latency_t* latency,
+                  const char* extra,
+                  ...) {
+  qsort(latency->ns, latency->count, sizeof(uint64_t), bench_compare);
+
+  uint64_t total = 0;
+  for (size_t i = 0; i < latency->count; ++i)
+    total += latency->ns[i];
+
+  double mean = latency->count == 0
+                    ? 0
+                    : (double)total / 1e3 / (double)latency->count;
+  printf(
+      "{\"bench\": \"%s\", \"case\": \"%s\", \"count\": %zu, "
+      "\"mean_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, "
+      "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f",
+      bench, name, latency->count, mean, bench_percentile(latency, 0.5),
+      bench_percentile(latency, 0.9), bench_percentile(latency, 0.99),
+      bench_percentile(latency, 0.999), bench_percentile(latency, 1));
+
+  if (extra != NULL && extra[0] != '\0') {
+    va_list args;
+    va_start(args, extra);
+    printf(", ");
+    vprintf(extra, args);
+    va_end(args);
+  }
+
+  printf("}\n");
+  fflush(stdout);
+}
+
+static pthread_once_t cycles_once = PTHREAD_ONCE_INIT;
+static int cycles_fd = -1;
+
+static void bench_cycles_init(void) {
+  struct perf_event_attr attr = {
+      .type = PERF_TYPE_HARDWARE,
+      .size = sizeof(struct perf_event_attr),
+      .config = PERF_COUNT_HW_CPU_CYCLES,
+      .exclude_kernel = 1,
+      .exclude_hv = 1,
+  };
+
+  // the calling thread on any CPU, it fails in most containers
+  cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+uint64_t bench_cycles(void) {
+  pthread_once(&cycles_once, bench_cycles_init);
+
+  uint64_t count = 0;
+  if (cycles_fd >= 0 && read(cycles_fd, &count, sizeof(count)) == sizeof(count))
+    return count;
+
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+const char* bench_cycles_source(void) {
+  pthread_once(&cycles_once, bench_cycles_init);
+
+  if (cycles_fd >= 0)
+    return "perf";
+#if defined(__x86_64__) || defined(__i386__)
+  return "tsc";
+#else
+  return "none";
+#endif
+}
+
+static double bench_ratio(uint64_t x, uint64_t y) {
+  return y == 0 ? 0 : (double)x / (double)y;
+}
+
+void bench_report_kernel(const char* name, const bench_kernel_t* kernel) {
+  printf(
+      "{\"bench\": \"micro\", \"case\": \"%s\", \"ops\": %" PRIu64
+      ", \"ns_per_op\": %.1f, \"bytes_per_op\": %.1f, \"logs_per_op\": %.1f"
+      ", \"ns_per_log\": %.2f, \"cycles_per_log\": %.1f, \"cycles\": \"%s\"}\n",
+      name, kernel->ops, bench_ratio(kernel->ns, kernel->ops),
+      bench_ratio(kernel->bytes, kernel->ops),
+      bench_ratio(kernel->logs, kernel->ops),
+      bench_ratio(kernel->ns, kernel->logs),
+      bench_ratio(kernel->cycles, kernel->logs), bench_cycles_source());
+  fflush(stdout);
+}
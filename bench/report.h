@@ -0,0 +1,40 @@
+#ifndef _RCL_BENCH_REPORT_H
+#define _RCL_BENCH_REPORT_H
+
+#include "../common.h"
+
+// Latencies of one case, reported as a JSON line on stdout
+typedef struct {
+  uint64_t* ns;
+  size_t count, capacity;
+} bench_latency_t;
+
+int bench_latency_init(bench_latency_t* latency, size_t capacity);
+void bench_latency_destroy(bench_latency_t* latency);
+
+// Drops samples over the capacity
+void bench_latency_add(bench_latency_t* latency, uint64_t ns);
+
+// Prints {"bench": bench, "case": name, "count": ..., percentiles in us, and
+// the 'extra' fields given as a JSON fragment}, it sorts the samples
+void bench_report(const char* bench,
+                  const char* name,
+                  bench_latency_t* latency,
+                  const char* extra,
+                  ...) __attribute__((format(printf, 4, 5)));
+
+// Totals of a kernel run 'ops' times over 'bytes' of input and 'logs' logs
+typedef struct {
+  uint64_t ops, bytes, logs;
+  uint64_t ns, cycles;
+} bench_kernel_t;
+
+// Cycles of this thread from perf events, or TSC ticks where they aren't
+// available, see bench_cycles_source
+uint64_t bench_cycles(void);
+const char* bench_cycles_source(void);
+
+// Prints {"bench": "micro", "case": name, per op and per log numbers}
+void bench_report_kernel(const char* name, const bench_kernel_t* kernel);
+
+#endif  // _RCL_BENCH_REPORT_H
@@ -115,6 +115,16 @@ int hex2bin(uint8_t* b, const char* str, int bytes);
 
 uint64_t murmur64A(const void* key, const uint64_t len, const uint32_t seed);
 
+// seed of the keys' hashes in the blooms and the summaries, it's a part of
+// the db format
+enum { HASH_SEED = 1907531730u };
+
+rcl_inline uint64_t rcl_clock_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
 #define max(a, b)           \
   ({                        \
     __typeof__(a) _a = (a); \
@@ -0,0 +1,158 @@
+package main
+
+import (
+	"context"
+	"errors"
+	"sort"
+	"strconv"
+	"strings"
+	"sync"
+	"time"
+
+	liboracle "github.com/drpcorg/logs-oracle"
+)
+
+// Coalescer shares one db.Query between identical queries in flight, and
+// keeps results for a short TTL while the finalized height is the same
+type Coalescer struct {
+	db      *liboracle.Conn
+	ttl     time.Duration
+	timeout time.Duration // of one execution, 0 is none
+
+	mu       sync.Mutex
+	height   uint64 // finalized height of the done queries
+	inflight map[string]*coalescedQuery
+	done     map[string]*coalescedQuery
+}
+
+type coalescedQuery struct {
+	wg      sync.WaitGroup
+	result  uint64
+	err     error
+	expires time.Time
+}
+
+// done queries are swept when there are more of them
+const coalescerSweepSize = 4096
+
+// waiters get it when the shared execution panicked
+var errCoalescedAborted = errors.New("query was aborted")
+
+func NewCoalescer(db *liboracle.Conn, ttl, timeout time.Duration) *Coalescer {
+	return &Coalescer{
+		db:       db,
+		ttl:      ttl,
+		timeout:  timeout,
+		inflight: make(map[string]*coalescedQuery),
+		done:     make(map[string]*coalescedQuery),
+	}
+}
+
+func (c *Coalescer) Query(query *liboracle.Query, finalized uint64) (uint64, error) {
+	key := queryKey(query)
+	now := time.Now()
+
+	c.mu.Lock()
+
+	if finalized != c.height {
+		c.height = finalized
+		clear(c.done)
+	}
+
+	if it, ok := c.done[key]; ok && now.Before(it.expires) {
+		c.mu.Unlock()
+		return it.result, it.err
+	}
+
+	if it, ok := c.inflight[key]; ok {
+		c.mu.Unlock()
+		it.wg.Wait()
+		return it.result, it.err
+	}
+
+	it := &coalescedQuery{}
+	it.wg.Add(1)
+	c.inflight[key] = it
+
+	c.mu.Unlock()
+
+	// waiters are released even if the query panics
+	defer func() {
+		c.mu.Lock()
+		delete(c.inflight, key)
+		if it.err == nil && c.ttl > 0 && finalized == c.height {
+			if len(c.done) >= coalescerSweepSize {
+				c.sweep(now)
+			}
+			c.done[key] = it
+		}
+		c.mu.Unlock()
+
+		it.wg.Done()
+	}()
+
+	// shared by all waiters, so it isn't bound to any of their requests
+	ctx := context.Background()
+	if c.timeout > 0 {
+		var cancel context.CancelFunc
+		ctx, cancel = context.WithTimeout(ctx, c.timeout)
+		defer cancel()
+	}
+
+	it.err = errCoalescedAborted
+	it.result, it.err = c.db.QueryContext(ctx, query)
+	it.expires = time.Now().Add(c.ttl)
+
+	return it.result, it.err
+}
+
+func (c *Coalescer) sweep(now time.Time) {
+	for key, it := range c.done {
+		if !now.Before(it.expires) {
+			delete(c.done, key)
+		}
+	}
+}
+
+// queryKey is the same for queries with the same blocks and sets of keys
+func queryKey(query *liboracle.Query) string {
+	var key strings.Builder
+
+	key.WriteString(strconv.FormatUint(query.FromBlock, 16))
+	key.WriteByte('-')
+	key.WriteString(strconv.FormatUint(query.ToBlock, 16))
+	if query.Limit != nil {
+		key.WriteByte('/')
+		key.WriteString(strconv.FormatUint(*query.Limit, 16))
+	}
+
+	// trailing wildcards don't change the query
+	topics := query.Topics
+	for len(topics) > 0 && len(topics[len(topics)-1]) == 0 {
+		topics = topics[:len(topics)-1]
+	}
+
+	writeKeySet(&key, query.Addresses)
+	for _, alternatives := range topics {
+		writeKeySet(&key, alternatives)
+	}
+
+	return key.String()
+}
+
+func writeKeySet(key *strings.Builder, set []string) {
+	normalized := make([]string, len(set))
+	for i, it := range set {
+		normalized[i] = strings.ToLower(strings.TrimPrefix(strings.TrimPrefix(it, "0x"), "0X"))
+	}
+	sort.Strings(normalized)
+
+	key.WriteByte('|')
+	for i, it := range normalized {
+		if i > 0 && it == normalized[i-1] {
+			continue // duplicates match the same logs
+		}
+		key.WriteString(it)
+		key.WriteByte(',')
+	}
+}
@@ -1,19 +1,27 @@
 package main
 
 import (
+	"bytes"
 	"context"
+	"encoding/json"
+	"errors"
 	"flag"
 	"fmt"
+	"io"
+	"math"
 	"math/big"
+	"net"
 	"net/http"
 	"os"
 	"os/signal"
+	"runtime"
 	"sync"
 	"time"
 
 	"github.com/labstack/echo-contrib/echoprometheus"
 	"github.com/labstack/echo/v4"
 	"github.com/labstack/echo/v4/middleware"
+	"github.com/prometheus/client_golang/prometheus"
 	"github.com/rs/zerolog"
 	"github.com/rs/zerolog/log"
 	"github.com/kelseyhightower/envconfig"
@@ -26,17 +34,178 @@ type Config struct {
 	BindPort    int    `default:"8000"`
 	MetricsPort int    `default:"8001"`
 
-	DataDir  string `required:"true"`
-	RamLimit uint64  `default:"0"` // bytes
+	DataDir  string // required without Chains
+	RamLimit uint64 `default:"0"` // bytes, shared by all chains of Chains
 
-	NodeRPC  string `required:"true"`
-	NodeWS   string `required:"true"`
+	NodeRPC        string
+	NodeWS         string
+	NodeMode       string `default:"logs"` // logs, batch or receipts
+	NodeCallBlocks uint64 `default:"0"`
+
+	Chains      string // JSON file of ChainConfig, hosts them in one engine
+	Connections int    `default:"0"` // requests in flight of all chains
+
+	StandingFilters string // JSON file of filters, see addStandingFilters
+
+	ShardFrom    uint64        `default:"0"` // the db keeps [ShardFrom, ShardTo)
+	ShardTo      uint64        `default:"0"` // 0 is unbounded
+	Shards       string        // JSON file of Shard, coordinates them
+	ShardTimeout time.Duration `default:"5s"` // 0 is none
+
+	ReplicaPort int    `default:"0"` // serves followers when set
+	LeaderAddr  string // host:port, follows the leader instead of the node
+
+	QueryWorkers int   `default:"0"` // queries of batches in flight, 0 is NumCPU
+	BatchLimit   int   `default:"1000"`
+	BodyLimit    int64 `default:"1048576"` // bytes of a request
+
+	CoalesceTTL  time.Duration `default:"250ms"` // 0 only joins queries in flight
+	QueryTimeout time.Duration `default:"5s"`    // 0 is none
+
+	QuerySLO           time.Duration `default:"0"` // latency target of the ingest pacing, 0 is off
+	QuerySLOPercentile uint          `default:"99"`
+}
+
+// ChainConfig is a chain hosted with others, served at /rpc/:id
+type ChainConfig struct {
+	ID             string `json:"id"` // chain id, decimal or 0x
+	DataDir        string `json:"dataDir"`
+	NodeRPC        string `json:"nodeRpc"`
+	NodeWS         string `json:"nodeWs"`
+	NodeMode       string `json:"nodeMode"`
+	NodeCallBlocks uint64 `json:"nodeCallBlocks"`
+
+	StandingFilters string `json:"standingFilters"`
+}
+
+var (
+	queryWorkers chan struct{} // bounds queries of all batches
+	batchLimit   int
+	bodyLimit    int64
+)
+
+func upstreamMode(mode string) (liboracle.UpstreamMode, error) {
+	switch mode {
+	case "", "logs":
+		return liboracle.UpstreamLogs, nil
+	case "batch":
+		return liboracle.UpstreamBatch, nil
+	case "receipts":
+		return liboracle.UpstreamReceipts, nil
+	}
+	return 0, fmt.Errorf("unknown node mode: %s", mode)
 }
 
 func NewConfig() (*Config, error) {
 	var config Config
-	err := envconfig.Process("oracle", &config)
-	return &config, err
+	if err := envconfig.Process("oracle", &config); err != nil {
+		return &config, err
+	}
+
+	if config.ShardTo != 0 && config.ShardFrom >= config.ShardTo {
+		return &config, errors.New("required ShardFrom < ShardTo")
+	}
+
+	if config.Shards != "" {
+		if config.Chains != "" || config.ReplicaPort != 0 || config.LeaderAddr != "" {
+			return &config, errors.New("a coordinator of shards has no db")
+		}
+		if config.NodeWS == "" {
+			return &config, errors.New("required NodeWS")
+		}
+		return &config, nil
+	}
+
+	if config.Chains != "" {
+		if config.ReplicaPort != 0 || config.LeaderAddr != "" {
+			return &config, errors.New("replication isn't supported with chains")
+		}
+		if config.ShardFrom != 0 || config.ShardTo != 0 {
+			return &config, errors.New("shards aren't supported with chains")
+		}
+		return &config, nil
+	}
+
+	if config.DataDir == "" || config.NodeRPC == "" || config.NodeWS == "" {
+		return &config, errors.New("required DataDir, NodeRPC and NodeWS")
+	}
+	return &config, nil
+}
+
+// ChainConfigs are the chains of the file or the one of the env
+func (c *Config) ChainConfigs() ([]ChainConfig, error) {
+	if c.Chains == "" {
+		return []ChainConfig{{
+			DataDir:        c.DataDir,
+			NodeRPC:        c.NodeRPC,
+			NodeWS:         c.NodeWS,
+			NodeMode:       c.NodeMode,
+			NodeCallBlocks: c.NodeCallBlocks,
+
+			StandingFilters: c.StandingFilters,
+		}}, nil
+	}
+
+	data, err := os.ReadFile(c.Chains)
+	if err != nil {
+		return nil, err
+	}
+
+	var chains []ChainConfig
+	if err := json.Unmarshal(data, &chains); err != nil {
+		return nil, fmt.Errorf("parse %s: %w", c.Chains, err)
+	}
+
+	seen := make(map[string]bool, len(chains))
+	for i := range chains {
+		id, err := chainID(chains[i].ID)
+		if err != nil {
+			return nil, err
+		}
+		if seen[id] {
+			return nil, fmt.Errorf("duplicate chain %s", id)
+		}
+		if chains[i].DataDir == "" || chains[i].NodeRPC == "" || chains[i].NodeWS == "" {
+			return nil, fmt.Errorf("chain %s: required dataDir, nodeRpc and nodeWs", id)
+		}
+
+		chains[i].ID = id
+		seen[id] = true
+	}
+
+	return chains, nil
+}
+
+// chainID normalizes a decimal or 0x chain id to decimal
+func chainID(str string) (string, error) {
+	value, ok := new(big.Int).SetString(str, 0)
+	if !ok || value.Sign() < 0 {
+		return "", fmt.Errorf("invalid chain id '%s'", str)
+	}
+	return value.String(), nil
+}
+
+// Oracle counts logs of a query by the db or by the shards
+type Oracle interface {
+	Query(query *liboracle.Query, finalized uint64) (uint64, error)
+}
+
+// Chain is a db with its node, one per chain of the process. A coordinator
+// of shards has no db.
+type Chain struct {
+	ID     string
+	DB     *liboracle.Conn
+	Node   *Node
+	Oracle Oracle
+}
+
+func (ch *Chain) Close() {
+	if ch.Node != nil {
+		ch.Node.Close()
+	}
+	if ch.DB != nil {
+		ch.DB.Close()
+	}
 }
 
 func (c *Config) IsDev() bool {
@@ -74,45 +243,41 @@ func main() {
 	log.Logger = logger
 	zerolog.DefaultContextLogger = &logger
 
-	db, err := liboracle.NewDB(config.DataDir, config.RamLimit)
+	if config.QueryWorkers <= 0 {
+		config.QueryWorkers = runtime.NumCPU()
+	}
+	queryWorkers = make(chan struct{}, config.QueryWorkers)
+	batchLimit = config.BatchLimit
+	bodyLimit = config.BodyLimit
+
+	chains, engine, err := openChains(ctx, config)
 	if err != nil {
 		log.Panic().Err(err).Msg("couldn't load db")
 	}
-	defer db.Close()
+	if engine != nil {
+		defer engine.Close() // after the dbs
+	}
+	for _, chain := range chains {
+		defer chain.Close()
+	}
 
-	node, err := NewNode(ctx, config.NodeWS)
-	if err != nil {
-		log.Panic().Err(err).Msg("couldn't connect to node")
+	if config.ReplicaPort != 0 {
+		replicas, err := net.Listen("tcp", fmt.Sprintf(":%d", config.ReplicaPort))
+		if err != nil {
+			log.Panic().Err(err).Msg("couldn't listen for followers")
+		}
+		defer replicas.Close()
+
+		go serveFollowers(replicas, chains[0].DB)
 	}
-	defer node.Close()
 
 	// run
 	wg := sync.WaitGroup{}
 
-	go func() {
+	for _, chain := range chains {
 		wg.Add(1)
-		defer wg.Done()
-
-		db.SetUpstream(config.NodeRPC)
-
-		headch := make(chan *big.Int)
-		go node.SubscribeNewHead(ctx, &wg, headch)
-
-		for {
-			select {
-			case data := <-headch:
-				if err := db.UpdateHeight(data.Uint64()); err != nil {
-					log.Error().Err(err).Msg("couldn't update height in db")
-					return
-				} else {
-					log.Debug().Uint64("head", data.Uint64()).Msg("updated head in db")
-				}
-
-			case <-ctx.Done():
-				return
-			}
-		}
-	}()
+		go followHead(ctx, &wg, chain, config.LeaderAddr != "")
+	}
 
 	app := echo.New()
 	go func() {
@@ -127,9 +292,26 @@ func main() {
 		app.Use(middleware.Decompress())
 		app.Use(echoprometheus.NewMiddleware("oracle"))
 
-		app.POST("/rpc", func(c echo.Context) error {
-			return handleHttp(c, node, db)
-		})
+		if config.Chains == "" {
+			chain := chains[0]
+			app.POST("/rpc", func(c echo.Context) error {
+				return handleHttp(c, chain.Node, chain.Oracle)
+			})
+		} else {
+			byID := make(map[string]*Chain, len(chains))
+			for _, chain := range chains {
+				byID[chain.ID] = chain
+			}
+
+			app.POST("/rpc/:chain", func(c echo.Context) error {
+				id, err := chainID(c.Param("chain"))
+				chain := byID[id]
+				if err != nil || chain == nil {
+					return c.JSON(http.StatusNotFound, CreateResponseError("unknown chain"))
+				}
+				return handleHttp(c, chain.Node, chain.Oracle)
+			})
+		}
 
 		if err := app.Start(fmt.Sprintf(":%d", config.BindPort)); err != nil {
 			if err != http.ErrServerClosed {
@@ -147,6 +329,21 @@ func main() {
 		metrics.HidePort = true
 		metrics.HideBanner = true
 
+		if coordinator, ok := chains[0].Oracle.(*Coordinator); ok {
+			prometheus.MustRegister(NewShardsCollector(coordinator))
+		}
+
+		for _, chain := range chains {
+			if chain.DB == nil {
+				continue
+			}
+
+			registerer := prometheus.DefaultRegisterer
+			if config.Chains != "" {
+				registerer = prometheus.WrapRegistererWith(prometheus.Labels{"chain": chain.ID}, registerer)
+			}
+			registerer.MustRegister(NewOracleCollector(chain.DB))
+		}
 		metrics.GET("/metrics", echoprometheus.NewHandler())
 
 		if err := metrics.Start(fmt.Sprintf(":%d", config.MetricsPort)); err != nil {
@@ -179,6 +376,224 @@ func main() {
 	wg.Wait() // wait background workers
 }
 
+// openChains opens the db of the env or, with Chains, the db of every chain
+// in an engine sharing RamLimit and the node connections
+func openChains(ctx context.Context, config *Config) ([]*Chain, *liboracle.Engine, error) {
+	if config.Shards != "" {
+		chain, err := openCoordinator(ctx, config)
+		if err != nil {
+			return nil, nil, err
+		}
+		return []*Chain{chain}, nil, nil
+	}
+
+	configs, err := config.ChainConfigs()
+	if err != nil {
+		return nil, nil, err
+	}
+
+	var engine *liboracle.Engine
+	if config.Chains != "" {
+		if engine, err = liboracle.NewEngine(config.RamLimit, config.Connections); err != nil {
+			return nil, nil, err
+		}
+	}
+
+	chains := make([]*Chain, 0, len(configs))
+	for _, cc := range configs {
+		chain, err := openChain(ctx, config, engine, cc)
+		if err != nil {
+			for _, chain := range chains {
+				chain.Close()
+			}
+			if engine != nil {
+				engine.Close()
+			}
+			return nil, nil, err
+		}
+		chains = append(chains, chain)
+	}
+
+	return chains, engine, nil
+}
+
+func openChain(ctx context.Context, config *Config, engine *liboracle.Engine, cc ChainConfig) (*Chain, error) {
+	chain := &Chain{ID: cc.ID}
+
+	var err error
+	switch {
+	case engine != nil:
+		chain.DB, err = engine.Open(cc.DataDir)
+	case config.LeaderAddr != "":
+		chain.DB, err = openFollower(cc.DataDir, config.RamLimit, config.LeaderAddr)
+	case config.ShardFrom != 0 || config.ShardTo != 0:
+		to := config.ShardTo
+		if to == 0 {
+			to = math.MaxUint64
+		}
+		chain.DB, err = liboracle.NewShard(cc.DataDir, config.RamLimit, config.ShardFrom, to)
+	default:
+		chain.DB, err = liboracle.NewDB(cc.DataDir, config.RamLimit)
+	}
+	if err != nil {
+		return nil, err
+	}
+
+	mode, err := upstreamMode(cc.NodeMode)
+	if err == nil {
+		err = chain.DB.SetUpstreamMode(mode, cc.NodeCallBlocks)
+	}
+	if err == nil {
+		chain.Node, err = NewNode(ctx, cc.NodeWS)
+	}
+	if err == nil && cc.StandingFilters != "" {
+		err = addStandingFilters(chain.DB, cc.StandingFilters)
+	}
+	if err == nil {
+		err = chain.DB.SetQuerySLO(config.QuerySLO, config.QuerySLOPercentile)
+	}
+	if err == nil && config.LeaderAddr == "" {
+		err = chain.DB.SetUpstream(cc.NodeRPC)
+	}
+	if err != nil {
+		chain.Close()
+		return nil, fmt.Errorf("chain '%s': %w", cc.ID, err)
+	}
+
+	chain.Oracle = NewCoalescer(chain.DB, config.CoalesceTTL, config.QueryTimeout)
+	return chain, nil
+}
+
+// addStandingFilters registers the eth_getLogs filters of the file (only
+// their address and topics) before the ingest, the db backfills their counts
+// and queries with the same keys use them
+func addStandingFilters(db *liboracle.Conn, path string) error {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return err
+	}
+
+	var filters []Filter
+	if err := json.Unmarshal(data, &filters); err != nil {
+		return fmt.Errorf("parse %s: %w", path, err)
+	}
+
+	for i := range filters {
+		var q liboracle.Query
+		if err := filters[i].parseKeys(&q); err != nil {
+			return fmt.Errorf("standing filter %d: %w", i, err)
+		}
+
+		id, err := db.AddStandingFilter(&q)
+		if err != nil {
+			return fmt.Errorf("standing filter %d: %w", i, err)
+		}
+
+		next, _ := db.StandingFilterNext(id)
+		log.Info().Uint64("id", id).Uint64("next", next).Msg("standing filter")
+	}
+
+	return nil
+}
+
+// openCoordinator answers queries by the shards, the node resolves block tags
+func openCoordinator(ctx context.Context, config *Config) (*Chain, error) {
+	shards, err := ReadShards(config.Shards)
+	if err != nil {
+		return nil, err
+	}
+
+	node, err := NewNode(ctx, config.NodeWS)
+	if err != nil {
+		return nil, err
+	}
+
+	return &Chain{Node: node, Oracle: NewCoordinator(shards, config.ShardTimeout)}, nil
+}
+
+// followHead moves the height of the db to the node's head, a follower's
+// height is driven by its leader and a coordinator only tracks the head
+func followHead(ctx context.Context, wg *sync.WaitGroup, chain *Chain, follower bool) {
+	defer wg.Done()
+
+	log := log.With().Str("chain", chain.ID).Logger()
+
+	headch := make(chan *big.Int)
+	go chain.Node.SubscribeNewHead(ctx, wg, headch)
+
+	var leader <-chan time.Time
+	if follower {
+		ticker := time.NewTicker(time.Second)
+		defer ticker.Stop()
+		leader = ticker.C
+	}
+
+	for {
+		select {
+		case <-leader:
+			// the stream can't be resumed, a supervisor restarts the follower
+			// on a clean data dir
+			if err := chain.DB.ReplicaCheck(); err != nil {
+				log.Fatal().Err(err).Msg("lost the leader")
+			}
+
+		case data := <-headch:
+			if follower || chain.DB == nil {
+				continue
+			}
+
+			if err := chain.DB.UpdateHeight(data.Uint64()); err != nil {
+				log.Error().Err(err).Msg("couldn't update height in db")
+				return
+			} else {
+				log.Debug().Uint64("head", data.Uint64()).Msg("updated head in db")
+			}
+
+		case <-ctx.Done():
+			return
+		}
+	}
+}
+
+func openFollower(dataDir string, ramLimit uint64, leaderAddr string) (*liboracle.Conn, error) {
+	leader, err := net.Dial("tcp", leaderAddr)
+	if err != nil {
+		return nil, err
+	}
+	defer leader.Close()
+
+	file, err := leader.(*net.TCPConn).File()
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	return liboracle.NewFollower(dataDir, ramLimit, file)
+}
+
+func serveFollowers(listener net.Listener, db *liboracle.Conn) {
+	for {
+		follower, err := listener.Accept()
+		if err != nil {
+			return // closed on shutdown
+		}
+
+		file, err := follower.(*net.TCPConn).File()
+		follower.Close()
+		if err != nil {
+			log.Error().Err(err).Msg("couldn't take follower's connection")
+			continue
+		}
+
+		if err := db.ReplicaAttach(file); err != nil {
+			log.Error().Err(err).Msg("couldn't attach follower")
+		} else {
+			log.Info().Str("addr", follower.RemoteAddr().String()).Msg("follower attached")
+		}
+		file.Close()
+	}
+}
+
 type Filter struct {
 	Limit     *uint64  `json:"limit"`
 	FromBlock *string `json:"fromBlock"`
@@ -235,6 +650,15 @@ func (raw *Filter) ToQuery(node *Node) (*liboracle.Query, error) {
 
 	q.Limit = raw.Limit
 
+	if err := raw.parseKeys(&q); err != nil {
+		return nil, err
+	}
+
+	return &q, nil
+}
+
+// parseKeys sets the addresses and topics of q
+func (raw *Filter) parseKeys(q *liboracle.Query) error {
 	// Address
 	if raw.Address != nil {
 		switch r := raw.Address.(type) {
@@ -243,7 +667,7 @@ func (raw *Filter) ToQuery(node *Node) (*liboracle.Query, error) {
 				if str, ok := addr.(string); ok {
 					q.Addresses = append(q.Addresses, str)
 				} else {
-					return nil, fmt.Errorf("non-string address at index %d", i)
+					return fmt.Errorf("non-string address at index %d", i)
 				}
 			}
 
@@ -251,14 +675,14 @@ func (raw *Filter) ToQuery(node *Node) (*liboracle.Query, error) {
 			q.Addresses = append(q.Addresses, r)
 
 		default:
-			return nil, fmt.Errorf("invalid addresses in query")
+			return fmt.Errorf("invalid addresses in query")
 		}
 	}
 
 	// Topics
 	if raw.Topics != nil {
 		if len(raw.Topics) > 4 {
-			return nil, fmt.Errorf("allowed only 4 topic filters")
+			return fmt.Errorf("allowed only 4 topic filters")
 		}
 
 		q.Topics = make([][]string, len(raw.Topics))
@@ -281,17 +705,17 @@ func (raw *Filter) ToQuery(node *Node) (*liboracle.Query, error) {
 					if topic, ok := rawTopic.(string); ok {
 						q.Topics[i] = append(q.Topics[i], topic)
 					} else {
-						return nil, fmt.Errorf("invalid topic(s)")
+						return fmt.Errorf("invalid topic(s)")
 					}
 				}
 
 			default:
-				return nil, fmt.Errorf("invalid topic(s)")
+				return fmt.Errorf("invalid topic(s)")
 			}
 		}
 	}
 
-	return &q, nil
+	return nil
 }
 
 type (
@@ -307,17 +731,77 @@ func CreateResponseError(message string) Response {
 	return Response{Error: &message}
 }
 
-func handleHttp(c echo.Context, node *Node, db *liboracle.Conn) error {
+type (
+	// Call is a JSON-RPC call with eth_getLogs's params, the method isn't
+	// checked so gateways may use their own names
+	Call struct {
+		ID     json.RawMessage `json:"id"`
+		Method *string         `json:"method"`
+		Params Request         `json:"params"`
+	}
+
+	CallResponse struct {
+		JSONRPC string          `json:"jsonrpc"`
+		ID      json.RawMessage `json:"id"`
+		Result  *uint64         `json:"result,omitempty"`
+		Error   *CallError      `json:"error,omitempty"`
+	}
+
+	CallError struct {
+		Code    int    `json:"code"`
+		Message string `json:"message"`
+	}
+)
+
+func CreateCallError(id json.RawMessage, code int, message string) CallResponse {
+	return CallResponse{JSONRPC: "2.0", ID: id, Error: &CallError{Code: code, Message: message}}
+}
+
+// handleHttp takes a JSON-RPC call, a batch of them or the bare params of
+// one call ([filter]) answered without the envelope
+func handleHttp(c echo.Context, node *Node, oracle Oracle) error {
 	ctx := c.Request().Context()
 	log := zerolog.Ctx(ctx)
 
+	body, err := io.ReadAll(http.MaxBytesReader(c.Response(), c.Request().Body, bodyLimit))
+	var tooLarge *http.MaxBytesError
+	if errors.As(err, &tooLarge) {
+		return c.JSON(http.StatusRequestEntityTooLarge, CreateResponseError("too large request"))
+	}
+	if err != nil {
+		log.Error().Err(err).Msg("Couldn't read request")
+		return c.JSON(http.StatusBadRequest, CreateResponseError("parse error"))
+	}
+
+	body = bytes.TrimSpace(body)
+	if len(body) > 0 && body[0] == '{' {
+		return handleCalls(c, node, oracle, []json.RawMessage{body}, true)
+	}
+
+	var items []json.RawMessage
+	if err := json.Unmarshal(body, &items); err != nil {
+		log.Error().Err(err).Msg("Couldn't parse request")
+		return c.JSON(http.StatusBadRequest, CreateResponseError("parse error"))
+	}
+
+	// one call makes a batch, its other items are invalid calls
+	for _, item := range items {
+		var call Call
+		if json.Unmarshal(item, &call) == nil && call.Method != nil {
+			return handleCalls(c, node, oracle, items, false)
+		}
+	}
+
 	var filters Request
-	if err := c.Bind(&filters); err != nil {
+	if err := json.Unmarshal(body, &filters); err != nil {
 		log.Error().Err(err).Msg("Couldn't parse request")
 		return c.JSON(http.StatusBadRequest, CreateResponseError("parse error"))
 	}
 
-	if len(filters) != 1 {
+	if len(filters) == 0 {
+		return c.JSON(http.StatusBadRequest, CreateResponseError("missing filter"))
+	}
+	if len(filters) > 1 {
 		return c.JSON(http.StatusBadRequest, CreateResponseError("too many arguments, want at most 1"))
 	}
 
@@ -327,7 +811,10 @@ func handleHttp(c echo.Context, node *Node, db *liboracle.Conn) error {
 		return c.JSON(http.StatusInternalServerError, CreateResponseError(err.Error()))
 	}
 
-	result, err := db.Query(query)
+	result, err := oracle.Query(query, node.FinalizedBlock().Uint64())
+	if msg, ok := unavailableMessage(err); ok {
+		return c.JSON(http.StatusServiceUnavailable, CreateResponseError(msg))
+	}
 	if err != nil {
 		log.Error().Err(err).Msg("Couldn't query in db")
 		return c.JSON(http.StatusInternalServerError, CreateResponseError("internal server error"))
@@ -335,3 +822,89 @@ func handleHttp(c echo.Context, node *Node, db *liboracle.Conn) error {
 
 	return c.JSON(http.StatusOK, Response{Result: &result})
 }
+
+// handleCalls runs the calls concurrently, responses keep the calls' order
+func handleCalls(c echo.Context, node *Node, oracle Oracle, calls []json.RawMessage, single bool) error {
+	if len(calls) == 0 {
+		return c.JSON(http.StatusBadRequest, CreateCallError(nil, -32600, "empty batch"))
+	}
+	if len(calls) > batchLimit {
+		return c.JSON(http.StatusBadRequest, CreateCallError(nil, -32600, "too large batch"))
+	}
+
+	responses := make([]CallResponse, len(calls))
+
+	var wg sync.WaitGroup
+	for i := range calls {
+		wg.Add(1)
+		queryWorkers <- struct{}{}
+
+		go func(i int) {
+			defer wg.Done()
+			defer func() { <-queryWorkers }()
+
+			responses[i] = handleCall(c.Request().Context(), node, oracle, calls[i])
+		}(i)
+	}
+	wg.Wait()
+
+	if single {
+		return c.JSON(http.StatusOK, responses[0])
+	}
+	return c.JSON(http.StatusOK, responses)
+}
+
+func handleCall(ctx context.Context, node *Node, oracle Oracle, raw json.RawMessage) CallResponse {
+	log := zerolog.Ctx(ctx)
+
+	var call Call
+	if err := json.Unmarshal(raw, &call); err != nil {
+		return CreateCallError(nil, -32600, "invalid request")
+	}
+	if call.Method == nil {
+		return CreateCallError(call.ID, -32600, "invalid request")
+	}
+
+	if len(call.Params) == 0 {
+		return CreateCallError(call.ID, -32602, "missing filter")
+	}
+	if len(call.Params) > 1 {
+		return CreateCallError(call.ID, -32602, "too many arguments, want at most 1")
+	}
+
+	query, err := call.Params[0].ToQuery(node)
+	if err != nil {
+		return CreateCallError(call.ID, -32602, err.Error())
+	}
+
+	result, err := oracle.Query(query, node.FinalizedBlock().Uint64())
+	if msg, ok := unavailableMessage(err); ok {
+		return CreateCallError(call.ID, -32000, msg)
+	}
+	if err != nil {
+		log.Error().Err(err).Msg("Couldn't query in db")
+		return CreateCallError(call.ID, -32603, "internal server error")
+	}
+
+	return CallResponse{JSONRPC: "2.0", ID: call.ID, Result: &result}
+}
+
+// unavailableMessage tells about a stopped query, a gap or a failed shard
+func unavailableMessage(err error) (string, bool) {
+	var shard *ShardError
+	if errors.As(err, &shard) {
+		return shard.Error(), true
+	}
+
+	var gap *liboracle.RangeGap
+	if errors.As(err, &gap) {
+		return fmt.Sprintf("blocks from 0x%x aren't synced yet", gap.Reached+1), true
+	}
+
+	var canceled *liboracle.QueryCanceled
+	if !errors.As(err, &canceled) {
+		return "", false
+	}
+
+	return fmt.Sprintf("query timeout, scanned up to block 0x%x", canceled.Reached), true
+}
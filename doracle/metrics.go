@@ -0,0 +1,148 @@
+package main
+
+import (
+	"github.com/prometheus/client_golang/prometheus"
+	"github.com/rs/zerolog/log"
+
+	liboracle "github.com/drpcorg/logs-oracle"
+)
+
+// OracleCollector exports liboracle's stats, they're read on every scrape
+type OracleCollector struct {
+	db *liboracle.Conn
+}
+
+var (
+	oracleBlocks = desc("db_blocks", "Blocks in the db", nil)
+	oracleLogs   = desc("db_logs", "Logs in the db", nil)
+	oracleRAM    = desc("db_ram_limit_bytes", "Blocks kept in RAM, the share of the engine with chains", nil)
+
+	oracleQueries       = desc("queries_total", "Executed queries", nil)
+	oracleQueryErrors   = desc("query_errors_total", "Failed or overflowed queries", nil)
+	oracleBlocksScanned = desc("query_blocks_scanned_total", "Blocks visited by queries", nil)
+	oracleBloomsChecked = desc("query_blooms_checked_total", "Block blooms checked by queries", nil)
+	oracleBloomsPassed  = desc("query_blooms_passed_total", "Block blooms passed by queries", nil)
+	oracleLogsExamined  = desc("query_logs_examined_total", "Logs compared by queries", nil)
+	oracleLogsMatched   = desc("query_logs_matched_total", "Logs matched by filtered queries", nil)
+	oracleStandingHits  = desc("query_standing_hits_total", "Queries counted by a standing filter", nil)
+	oracleSummarized    = desc("query_blocks_summarized_total", "Blocks counted by summaries of sealed pages", nil)
+	oracleQueryDuration = desc("query_duration_seconds", "Query latency", nil)
+
+	oracleInserts        = desc("inserts_total", "Committed ranges", nil)
+	oracleBlocksInserted = desc("inserted_blocks_total", "Committed blocks", nil)
+	oracleLogsInserted   = desc("inserted_logs_total", "Committed logs", nil)
+	oracleInsertDuration = desc("insert_duration_seconds", "Commit latency", nil)
+
+	oracleHeight           = desc("upstream_height", "Height of the node", nil)
+	oracleLag              = desc("upstream_lag_blocks", "Blocks not fetched yet", nil)
+	oracleUpstreamRequests = desc("upstream_requests_total", "Finished requests to the node", nil)
+	oracleUpstreamErrors   = desc("upstream_errors_total", "Failed requests to the node", nil)
+	oracleUpstreamDuration = desc("upstream_request_duration_seconds", "Node request latency", nil)
+	oracleIngestThrottle   = desc("ingest_throttle_level", "Pacing of the ingest by query latency, 0 is full speed", nil)
+
+	oraclePageFaults = desc("page_faults_total", "Page faults of the process", []string{"kind"})
+	oracleWarmup     = desc("warmup_bytes", "Pages read in after the start, done of total", []string{"state"})
+)
+
+func desc(name, help string, labels []string) *prometheus.Desc {
+	return prometheus.NewDesc("oracle_"+name, help, labels, nil)
+}
+
+func NewOracleCollector(db *liboracle.Conn) *OracleCollector {
+	return &OracleCollector{db: db}
+}
+
+func (c *OracleCollector) Describe(ch chan<- *prometheus.Desc) {
+	prometheus.DescribeByCollect(c, ch)
+}
+
+func (c *OracleCollector) Collect(ch chan<- prometheus.Metric) {
+	s, err := c.db.Stats()
+	if err != nil {
+		log.Error().Err(err).Msg("couldn't read db stats")
+		return
+	}
+
+	gauge := func(d *prometheus.Desc, v uint64, labels ...string) {
+		ch <- prometheus.MustNewConstMetric(d, prometheus.GaugeValue, float64(v), labels...)
+	}
+	counter := func(d *prometheus.Desc, v uint64, labels ...string) {
+		ch <- prometheus.MustNewConstMetric(d, prometheus.CounterValue, float64(v), labels...)
+	}
+
+	gauge(oracleBlocks, s.BlocksCount)
+	gauge(oracleLogs, s.LogsCount)
+	gauge(oracleRAM, s.RamLimit)
+
+	counter(oracleQueries, s.Queries)
+	counter(oracleQueryErrors, s.QueryErrors)
+	counter(oracleBlocksScanned, s.BlocksScanned)
+	counter(oracleBloomsChecked, s.BloomsChecked)
+	counter(oracleBloomsPassed, s.BloomsPassed)
+	counter(oracleLogsExamined, s.LogsExamined)
+	counter(oracleLogsMatched, s.LogsMatched)
+	counter(oracleStandingHits, s.StandingHits)
+	counter(oracleSummarized, s.Summarized)
+	ch <- histogram(oracleQueryDuration, &s.QueryLatency)
+
+	counter(oracleInserts, s.Inserts)
+	counter(oracleBlocksInserted, s.BlocksInserted)
+	counter(oracleLogsInserted, s.LogsInserted)
+	ch <- histogram(oracleInsertDuration, &s.InsertLatency)
+
+	lag := uint64(0)
+	if s.Height+1 > s.Next {
+		lag = s.Height + 1 - s.Next
+	}
+
+	gauge(oracleHeight, s.Height)
+	gauge(oracleLag, lag)
+	counter(oracleUpstreamRequests, s.UpstreamRequests)
+	counter(oracleUpstreamErrors, s.UpstreamErrors)
+	ch <- histogram(oracleUpstreamDuration, &s.UpstreamLatency)
+	gauge(oracleIngestThrottle, s.IngestThrottle)
+
+	counter(oraclePageFaults, s.MinorFaults, "minor")
+	counter(oraclePageFaults, s.MajorFaults, "major")
+
+	gauge(oracleWarmup, s.WarmupDone, "done")
+	gauge(oracleWarmup, s.WarmupTotal, "total")
+}
+
+// ShardsCollector exports the requests of a coordinator to its shards
+type ShardsCollector struct {
+	coordinator *Coordinator
+}
+
+var (
+	shardRequests = desc("shard_requests_total", "Queries sent to the shard", []string{"shard"})
+	shardErrors   = desc("shard_errors_total", "Failed or timed out queries of the shard", []string{"shard"})
+)
+
+func NewShardsCollector(coordinator *Coordinator) *ShardsCollector {
+	return &ShardsCollector{coordinator: coordinator}
+}
+
+func (c *ShardsCollector) Describe(ch chan<- *prometheus.Desc) {
+	prometheus.DescribeByCollect(c, ch)
+}
+
+func (c *ShardsCollector) Collect(ch chan<- prometheus.Metric) {
+	for _, shard := range c.coordinator.shards {
+		ch <- prometheus.MustNewConstMetric(shardRequests, prometheus.CounterValue, float64(shard.requests.Load()), shard.URL)
+		ch <- prometheus.MustNewConstMetric(shardErrors, prometheus.CounterValue, float64(shard.errors.Load()), shard.URL)
+	}
+}
+
+// histogram converts power of two microsecond buckets to cumulative seconds
+func histogram(d *prometheus.Desc, h *liboracle.Histogram) prometheus.Metric {
+	buckets := make(map[float64]uint64, liboracle.HistogramBuckets-1)
+
+	cumulative := uint64(0)
+	for i := 0; i < liboracle.HistogramBuckets-1; i++ {
+		cumulative += h.Buckets[i]
+		buckets[float64(uint64(1)<<i)/1e6] = cumulative
+	}
+
+	return prometheus.MustNewConstHistogram(d, h.Count, float64(h.SumUs)/1e6, buckets)
+}
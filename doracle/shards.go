@@ -0,0 +1,222 @@
+package main
+
+import (
+	"bytes"
+	"context"
+	"encoding/json"
+	"errors"
+	"fmt"
+	"net/http"
+	"os"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	liboracle "github.com/drpcorg/logs-oracle"
+)
+
+// Shard is an oracle with the [From, To) blocks of the chain, see
+// Config.ShardFrom and Config.ShardTo
+type Shard struct {
+	From uint64 `json:"from"`
+	To   uint64 `json:"to"`  // 0 is unbounded, only for the last shard
+	URL  string `json:"url"` // its POST /rpc
+
+	requests atomic.Uint64
+	errors   atomic.Uint64
+}
+
+// ShardError is a failed or timed out query of a shard
+type ShardError struct {
+	Shard *Shard
+	Err   error
+}
+
+func (e *ShardError) Error() string {
+	if e.Shard.To == 0 {
+		return fmt.Sprintf("shard [0x%x, head]: %v", e.Shard.From, e.Err)
+	}
+	return fmt.Sprintf("shard [0x%x, 0x%x): %v", e.Shard.From, e.Shard.To, e.Err)
+}
+
+func (e *ShardError) Unwrap() error {
+	return e.Err
+}
+
+// ReadShards loads the shards sorted by blocks, they cover the chain from
+// block 0 without gaps or overlaps
+func ReadShards(path string) ([]*Shard, error) {
+	data, err := os.ReadFile(path)
+	if err != nil {
+		return nil, err
+	}
+
+	var shards []*Shard
+	if err := json.Unmarshal(data, &shards); err != nil {
+		return nil, fmt.Errorf("parse %s: %w", path, err)
+	}
+	if len(shards) == 0 {
+		return nil, fmt.Errorf("no shards in %s", path)
+	}
+
+	for i, shard := range shards {
+		if shard.URL == "" {
+			return nil, fmt.Errorf("shard %d: required url", i)
+		}
+		if shard.To == 0 && i != len(shards)-1 {
+			return nil, fmt.Errorf("shard %d: only the last one is unbounded", i)
+		}
+		if shard.To != 0 && shard.From >= shard.To {
+			return nil, fmt.Errorf("shard %d: required from < to", i)
+		}
+		if i == 0 && shard.From != 0 {
+			return nil, fmt.Errorf("shard 0: required from 0")
+		}
+		if i > 0 && shard.From < shards[i-1].To {
+			return nil, fmt.Errorf("shard %d: overlaps the previous one", i)
+		}
+		if i > 0 && shard.From > shards[i-1].To {
+			return nil, fmt.Errorf("shard %d: gap after the previous one", i)
+		}
+	}
+
+	return shards, nil
+}
+
+// Coordinator counts logs of a query by the shards covering its range, the
+// shards are queried concurrently and the first failure stops the others
+type Coordinator struct {
+	shards  []*Shard
+	client  *http.Client
+	timeout time.Duration // of one query, 0 is none
+}
+
+func NewCoordinator(shards []*Shard, timeout time.Duration) *Coordinator {
+	return &Coordinator{shards: shards, client: &http.Client{}, timeout: timeout}
+}
+
+func (c *Coordinator) Query(query *liboracle.Query, finalized uint64) (uint64, error) {
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	if c.timeout > 0 {
+		var stop context.CancelFunc
+		ctx, stop = context.WithTimeout(ctx, c.timeout)
+		defer stop()
+	}
+
+	// a bounded last shard leaves the blocks after it unanswered
+	if last := c.shards[len(c.shards)-1]; last.To != 0 && query.ToBlock >= last.To {
+		return 0, fmt.Errorf("blocks from 0x%x aren't in any shard", last.To)
+	}
+
+	var (
+		wg      sync.WaitGroup
+		total   atomic.Uint64
+		failure atomic.Pointer[ShardError]
+	)
+
+	for _, shard := range c.shards {
+		from, to := max(query.FromBlock, shard.From), query.ToBlock
+		if shard.To != 0 {
+			to = min(to, shard.To-1)
+		}
+		if from > to {
+			continue
+		}
+
+		wg.Add(1)
+		go func(shard *Shard, from, to uint64) {
+			defer wg.Done()
+
+			count, err := c.queryShard(ctx, shard, query, from, to)
+			if err != nil {
+				if failure.CompareAndSwap(nil, &ShardError{Shard: shard, Err: err}) {
+					cancel()
+				}
+				return
+			}
+			total.Add(count)
+		}(shard, from, to)
+	}
+	wg.Wait()
+
+	if err := failure.Load(); err != nil {
+		return 0, err
+	}
+
+	result := total.Load()
+	if query.Limit != nil && result > *query.Limit {
+		return 0, fmt.Errorf("more than %d logs in the query", *query.Limit)
+	}
+
+	return result, nil
+}
+
+// shardFilter is the eth_getLogs filter of the part of a query in a shard
+type shardFilter struct {
+	FromBlock string     `json:"fromBlock"`
+	ToBlock   string     `json:"toBlock"`
+	Limit     *uint64    `json:"limit,omitempty"`
+	Address   []string   `json:"address,omitempty"`
+	Topics    [][]string `json:"topics,omitempty"` // a nil set is null
+}
+
+func (c *Coordinator) queryShard(ctx context.Context, shard *Shard, query *liboracle.Query, from, to uint64) (uint64, error) {
+	shard.requests.Add(1)
+
+	count, err := c.post(ctx, shard, shardFilter{
+		FromBlock: fmt.Sprintf("0x%x", from),
+		ToBlock:   fmt.Sprintf("0x%x", to),
+		Limit:     query.Limit,
+		Address:   query.Addresses,
+		Topics:    query.Topics,
+	})
+	if err != nil {
+		if errors.Is(err, context.DeadlineExceeded) {
+			err = errors.New("timeout")
+		}
+		if !errors.Is(err, context.Canceled) { // stopped by another shard
+			shard.errors.Add(1)
+		}
+	}
+
+	return count, err
+}
+
+func (c *Coordinator) post(ctx context.Context, shard *Shard, filter shardFilter) (uint64, error) {
+	body, err := json.Marshal(struct {
+		JSONRPC string        `json:"jsonrpc"`
+		ID      int           `json:"id"`
+		Method  string        `json:"method"`
+		Params  []shardFilter `json:"params"`
+	}{"2.0", 1, "eth_getLogs", []shardFilter{filter}})
+	if err != nil {
+		return 0, err
+	}
+
+	req, err := http.NewRequestWithContext(ctx, http.MethodPost, shard.URL, bytes.NewReader(body))
+	if err != nil {
+		return 0, err
+	}
+	req.Header.Set("Content-Type", "application/json")
+
+	resp, err := c.client.Do(req)
+	if err != nil {
+		return 0, err
+	}
+	defer resp.Body.Close()
+
+	var answer CallResponse
+	if err := json.NewDecoder(resp.Body).Decode(&answer); err != nil {
+		return 0, fmt.Errorf("parse response: %w", err)
+	}
+	if answer.Error != nil {
+		return 0, errors.New(answer.Error.Message)
+	}
+	if answer.Result == nil {
+		return 0, errors.New("empty response")
+	}
+
+	return *answer.Result, nil
+}
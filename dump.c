@@ -0,0 +1,125 @@
+#include "dump.h"
+
+#include <endian.h>
+
+enum { DUMP_READ_BUFFER = 4 * 1024 * 1024 };
+
+rcl_result dump_open(dump_reader_t* self,
+                     const char* path,
+                     rcl_dump_format format) {
+  *self = (dump_reader_t){.format = format};
+
+  self->file = strcmp(path, "-") == 0 ? stdin : fopen(path, "rb");
+  if (self->file == NULL) {
+    rcl_perror("open dump");
+    return RCLE_FILESYSTEM;
+  }
+
+  // the dump is read once from the start to the end
+  (void)setvbuf(self->file, NULL, _IOFBF, DUMP_READ_BUFFER);
+  (void)posix_fadvise(fileno(self->file), 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  return RCLE_OK;
+}
+
+void dump_close(dump_reader_t* self) {
+  if (self->root)
+    cJSON_Delete(self->root);
+  free(self->line);
+
+  if (self->file && self->file != stdin)
+    fclose(self->file);
+
+  *self = (dump_reader_t){0};
+}
+
+static rcl_result dump_read_binary(dump_reader_t* self,
+                                   vector_t* logs,
+                                   size_t limit) {
+  uint8_t record[DUMP_RECORD_SIZE];
+
+  for (size_t i = 0; i < limit; ++i) {
+    size_t bytes = fread(record, 1, DUMP_RECORD_SIZE, self->file);
+    if (bytes == 0)
+      break;
+    if (bytes != DUMP_RECORD_SIZE) {
+      rcl_error("truncated binary dump record, %zu bytes\n", bytes);
+      return RCLE_INVALID_DUMP;
+    }
+
+    rcl_log_t* log = (rcl_log_t*)vector_add(logs);
+    if (rcl_unlikely(log == NULL))
+      return RCLE_OUT_OF_MEMORY;
+
+    uint64_t block_number;
+    memcpy(&block_number, record, sizeof(uint64_t));
+    log->block_number = le64toh(block_number);
+    memcpy(log->address, record + sizeof(uint64_t), ADDRESS_LENGTH);
+    memcpy(log->topics, record + sizeof(uint64_t) + ADDRESS_LENGTH,
+           HASH_LENGTH * TOPICS_LENGTH);
+  }
+
+  if (ferror(self->file)) {
+    rcl_perror("read dump");
+    return RCLE_FILESYSTEM;
+  }
+
+  return RCLE_OK;
+}
+
+static rcl_result dump_read_jsonl(dump_reader_t* self,
+                                  vector_t* logs,
+                                  size_t limit) {
+  for (size_t i = 0; i < limit;) {
+    if (self->next == NULL) {
+      if (self->root) {
+        cJSON_Delete(self->root);
+        self->root = NULL;
+      }
+
+      ssize_t length =
+          getline(&(self->line), &(self->line_capacity), self->file);
+      if (length < 0)
+        break;
+      if (strspn(self->line, " \t\r\n") == (size_t)length)  // blank line
+        continue;
+
+      self->root = cJSON_ParseWithLength(self->line, (size_t)length);
+      if (self->root == NULL) {
+        rcl_error("couldn't parse dump line: %.*s\n", (int)length, self->line);
+        return RCLE_INVALID_DUMP;
+      }
+
+      self->next = cJSON_IsArray(self->root) ? self->root->child : self->root;
+      continue;
+    }
+
+    rcl_log_t* log = (rcl_log_t*)vector_add(logs);
+    if (rcl_unlikely(log == NULL))
+      return RCLE_OUT_OF_MEMORY;
+
+    if (rcl_log_parse(self->next, log) != RCLE_OK)
+      return RCLE_INVALID_DUMP;
+
+    self->next = self->next == self->root ? NULL : self->next->next;
+    ++i;
+  }
+
+  if (ferror(self->file)) {
+    rcl_perror("read dump");
+    return RCLE_FILESYSTEM;
+  }
+
+  return RCLE_OK;
+}
+
+rcl_result dump_read(dump_reader_t* self, vector_t* logs, size_t limit) {
+  switch (self->format) {
+    case RCL_DUMP_BINARY:
+      return dump_read_binary(self, logs, limit);
+    case RCL_DUMP_JSONL:
+      return dump_read_jsonl(self, logs, limit);
+  }
+
+  return RCLE_UNKNOWN;
+}
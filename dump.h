@@ -0,0 +1,40 @@
+#ifndef _RCL_DUMP_H
+#define _RCL_DUMP_H
+
+#include "common.h"
+#include "err.h"
+#include "upstream.h"
+#include "vector.h"
+
+// Local log exports, logs must be sorted by block
+typedef enum {
+  RCL_DUMP_JSONL,   // a line is an eth_getLogs result or a single log object
+  RCL_DUMP_BINARY,  // packed rcl_log_t records, the block number is LE
+} rcl_dump_format;
+
+enum {
+  DUMP_RECORD_SIZE =
+      sizeof(uint64_t) + ADDRESS_LENGTH + HASH_LENGTH * TOPICS_LENGTH
+};
+
+typedef struct {
+  rcl_dump_format format;
+  FILE* file;
+
+  // JSONL: the current line and the rest of its logs
+  char* line;
+  size_t line_capacity;
+  cJSON* root;
+  const cJSON* next;
+} dump_reader_t;
+
+// "-" is stdin
+rcl_result dump_open(dump_reader_t* self,
+                     const char* path,
+                     rcl_dump_format format);
+void dump_close(dump_reader_t* self);
+
+// Appends up to 'limit' logs, nothing is added at the end of the dump
+rcl_result dump_read(dump_reader_t* self, vector_t* logs, size_t limit);
+
+#endif  // _RCL_DUMP_H
@@ -22,5 +22,19 @@ const char* rcl_strerror(rcl_result value) {
       return "libcurl internal error";
     case RCLE_UNKNOWN:
       return "unknown";
+    case RCLE_INVALID_RANGE:
+      return "logs are out of the blocks range";
+    case RCLE_RANGE_OVERLAP:
+      return "blocks range is already written";
+    case RCLE_INVALID_DUMP:
+      return "malformed logs dump or snapshot";
+    case RCLE_QUERY_CANCELED:
+      return "query is canceled or out of time";
+    case RCLE_UNKNOWN_FILTER:
+      return "there is no standing filter with the id";
+    case RCLE_RANGE_GAP:
+      return "blocks range has gaps that aren't written yet";
+    case RCLE_TOO_MANY_FILTERS:
+      return "there are too many standing filters";
   }
 }
@@ -17,6 +17,15 @@ typedef enum {
   RCLE_FILESYSTEM,
   RCLE_LIBCURL,
   RCLE_UNKNOWN,
+
+  // appended, so the values of compiled consumers don't change
+  RCLE_INVALID_RANGE,
+  RCLE_RANGE_OVERLAP,
+  RCLE_INVALID_DUMP,
+  RCLE_QUERY_CANCELED,
+  RCLE_UNKNOWN_FILTER,
+  RCLE_RANGE_GAP,
+  RCLE_TOO_MANY_FILTERS,
 } rcl_result;
 
 rcl_export const char* rcl_strerror(rcl_result value);
@@ -35,6 +35,38 @@ int file_open(file_t* f, const char* filename, size_t size) {
   return 0;
 }
 
+int file_write_all(int fd, const void* data, size_t size) {
+  for (const char* it = data; size > 0;) {
+    ssize_t written = write(fd, it, size);
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written < 0)
+      return -1;
+
+    it += written;
+    size -= (size_t)written;
+  }
+
+  return 0;
+}
+
+int file_read_all(int fd, void* data, size_t size) {
+  for (char* it = data; size > 0;) {
+    ssize_t count = read(fd, it, size);
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      return -1;
+    if (count == 0)
+      return 1;
+
+    it += count;
+    size -= (size_t)count;
+  }
+
+  return 0;
+}
+
 int file_lock(file_t* f) {
   if (f->locked)
     return 0;
@@ -47,6 +79,7 @@ int file_unlock(file_t* f) {
   if (!f->locked)
     return 0;
 
+  f->locked = false;
   return munlock(f->buffer, f->bytes) == 0 ? 0 : -1;
 }
 
@@ -12,6 +12,11 @@ typedef struct {
 int file_open(file_t* f, const char* filename, size_t size);
 int file_close(file_t* f);
 
+// Loop over short transfers and EINTR: 0 on success, 1 at the end of the
+// stream (read only), -1 on errors
+int file_write_all(int fd, const void* data, size_t size);
+int file_read_all(int fd, void* data, size_t size);
+
 int file_lock(file_t* f);
 int file_unlock(file_t* f);
 
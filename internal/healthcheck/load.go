@@ -0,0 +1,305 @@
+package main
+
+import (
+	"encoding/json"
+	"flag"
+	"fmt"
+	"math"
+	"math/bits"
+	"math/rand"
+	"net/http"
+	"os"
+	"sync"
+	"sync/atomic"
+	"time"
+
+	"github.com/rs/zerolog/log"
+)
+
+var duration = flag.Duration("duration", 0, "load test of the oracle for this long instead of the check, the fixtures are repeated")
+var warmup = flag.Duration("warmup", 0, "load test: requests started in this first period aren't measured")
+var qps = flag.Float64("qps", 0, "load test: target requests per second, required by the open loop")
+var loop = flag.String("loop", "closed", "load test: 'closed' loop of the workers, paced to qps if it's set, or 'open' loop at qps")
+
+const (
+	progressInterval = 10 * time.Second
+	mismatchesLogged = 10
+)
+
+// Log-linear buckets of microseconds: exact under 64us, then 32 buckets per
+// power of two, so a percentile is within 3% as in HdrHistogram
+const (
+	histogramLinear  = 64
+	histogramBuckets = histogramLinear + 32*58
+)
+
+type histogram struct {
+	counts     [histogramBuckets]atomic.Uint64
+	count, sum atomic.Uint64
+	max        atomic.Uint64
+}
+
+func bucketOf(us uint64) int {
+	if us < histogramLinear {
+		return int(us)
+	}
+
+	shift := bits.Len64(us) - 6
+	return 32*shift + int(us>>shift)
+}
+
+// The lowest value of the bucket
+func bucketValue(i int) uint64 {
+	if i < histogramLinear {
+		return uint64(i)
+	}
+
+	shift := (i - 32) / 32
+	return uint64(i-32*shift) << shift
+}
+
+func (h *histogram) record(latency time.Duration) {
+	us := uint64(max(latency.Microseconds(), 0))
+
+	h.counts[bucketOf(us)].Add(1)
+	h.count.Add(1)
+	h.sum.Add(us)
+
+	for prev := h.max.Load(); us > prev; prev = h.max.Load() {
+		if h.max.CompareAndSwap(prev, us) {
+			break
+		}
+	}
+}
+
+// The highest value of the bucket with the q-th request, in milliseconds
+func (h *histogram) percentile(q float64) float64 {
+	total := h.count.Load()
+	if total == 0 {
+		return 0
+	}
+
+	rank := max(uint64(math.Ceil(q*float64(total))), 1)
+
+	var seen uint64
+	for i := range h.counts {
+		if seen += h.counts[i].Load(); seen >= rank {
+			highest := h.max.Load()
+			if i+1 < histogramBuckets {
+				highest = min(bucketValue(i+1)-1, highest)
+			}
+			return float64(highest) / 1e3
+		}
+	}
+
+	return float64(h.max.Load()) / 1e3
+}
+
+// Latencies are from the intended start of a request, not the actual one, so
+// a stalled oracle is charged for the whole queue it makes: the coordinated
+// omission of a closed loop is corrected like in wrk2
+type load struct {
+	suites []fixture
+	order  []int
+	next   atomic.Uint64
+
+	measured time.Time // the end of the warmup
+	latency  histogram
+
+	requests, errors, mismatches atomic.Uint64
+}
+
+type loadResult struct {
+	Bench      string  `json:"bench"`
+	Case       string  `json:"case"`
+	Workers    int     `json:"workers"`
+	TargetQPS  float64 `json:"target_qps"`
+	QPS        float64 `json:"qps"`
+	Seconds    float64 `json:"seconds"`
+	Requests   uint64  `json:"requests"`
+	Errors     uint64  `json:"errors"`
+	Mismatches uint64  `json:"mismatches"`
+	MeanMs     float64 `json:"mean_ms"`
+	P50Ms      float64 `json:"p50_ms"`
+	P90Ms      float64 `json:"p90_ms"`
+	P99Ms      float64 `json:"p99_ms"`
+	P999Ms     float64 `json:"p999_ms"`
+	MaxMs      float64 `json:"max_ms"`
+}
+
+func (l *load) fire(intended time.Time) {
+	suite := l.suites[l.order[(l.next.Add(1)-1)%uint64(len(l.order))]]
+	params := string(suite.Params)
+
+	count, err := oracleRequest(params)
+	if intended.Before(l.measured) {
+		return
+	}
+
+	l.latency.record(time.Since(intended))
+	l.requests.Add(1)
+
+	if err != nil {
+		if l.errors.Add(1) == 1 {
+			log.Error().Err(err).Str("params", params).Msg("first failed oracle request")
+		}
+		return
+	}
+
+	if suite.Expected != nil && !suite.stale && *suite.Expected != count {
+		if l.mismatches.Add(1) <= mismatchesLogged {
+			log.Error().Msgf("different results: real=%d, estimate=%d, params=%s", *suite.Expected, count, params)
+		}
+	}
+}
+
+// Starts requests on the schedule of the rate whatever the responses are
+func (l *load) open(rate float64, end time.Time) {
+	var wg sync.WaitGroup
+
+	interval := time.Duration(float64(time.Second) / rate)
+	start := time.Now()
+
+	for i := 0; ; i++ {
+		intended := start.Add(time.Duration(i) * interval)
+		if !intended.Before(end) {
+			break
+		}
+
+		time.Sleep(time.Until(intended))
+
+		wg.Add(1)
+		go func() {
+			defer wg.Done()
+			l.fire(intended)
+		}()
+	}
+
+	wg.Wait()
+}
+
+// Each worker waits for its response, a paced one keeps own schedule
+func (l *load) closed(workers int, rate float64, end time.Time) {
+	var wg sync.WaitGroup
+
+	var interval time.Duration
+	if rate > 0 {
+		interval = time.Duration(float64(workers) * float64(time.Second) / rate)
+	}
+
+	start := time.Now()
+	for w := 0; w < workers; w++ {
+		wg.Add(1)
+
+		go func(w int) {
+			defer wg.Done()
+
+			next := start.Add(interval * time.Duration(w) / time.Duration(workers))
+			for {
+				intended := next
+				if interval == 0 {
+					intended = time.Now()
+				}
+
+				if !intended.Before(end) {
+					return
+				}
+
+				time.Sleep(time.Until(intended))
+				l.fire(intended)
+
+				next = intended.Add(interval)
+			}
+		}(w)
+	}
+
+	wg.Wait()
+}
+
+func (l *load) progress(done <-chan struct{}) {
+	ticker := time.NewTicker(progressInterval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-done:
+			return
+		case <-ticker.C:
+			log.Info().
+				Uint64("requests", l.requests.Load()).
+				Uint64("errors", l.errors.Load()).
+				Uint64("mismatches", l.mismatches.Load()).
+				Float64("p99_ms", l.latency.percentile(0.99)).
+				Msg("load test")
+		}
+	}
+}
+
+func runLoad(suites []fixture) {
+	if *loop != "open" && *loop != "closed" {
+		log.Fatal().Msgf("unknown loop: %s", *loop)
+	}
+
+	if *loop == "open" && *qps <= 0 {
+		log.Fatal().Msg("the open loop requires qps")
+	}
+
+	if len(suites) == 0 {
+		log.Fatal().Msg("no fixtures")
+	}
+
+	// connections are reused by all the concurrent requests
+	if transport, ok := http.DefaultTransport.(*http.Transport); ok {
+		transport.MaxIdleConns = 0
+		transport.MaxIdleConnsPerHost = max(*workers, 1024)
+	}
+
+	l := &load{suites: suites, order: rand.Perm(len(suites))}
+	l.measured = time.Now().Add(*warmup)
+	end := l.measured.Add(*duration)
+
+	done := make(chan struct{})
+	go l.progress(done)
+
+	if *loop == "open" {
+		l.open(*qps, end)
+	} else {
+		l.closed(*workers, *qps, end)
+	}
+
+	close(done)
+
+	seconds := time.Since(l.measured).Seconds()
+	requests := l.requests.Load()
+
+	result := loadResult{
+		Bench:      "load",
+		Case:       *loop,
+		Workers:    *workers,
+		TargetQPS:  *qps,
+		QPS:        float64(requests) / seconds,
+		Seconds:    seconds,
+		Requests:   requests,
+		Errors:     l.errors.Load(),
+		Mismatches: l.mismatches.Load(),
+		P50Ms:      l.latency.percentile(0.5),
+		P90Ms:      l.latency.percentile(0.9),
+		P99Ms:      l.latency.percentile(0.99),
+		P999Ms:     l.latency.percentile(0.999),
+		MaxMs:      float64(l.latency.max.Load()) / 1e3,
+	}
+	if requests > 0 {
+		result.MeanMs = float64(l.latency.sum.Load()) / 1e3 / float64(requests)
+	}
+
+	line, err := json.Marshal(result)
+	if err != nil {
+		log.Fatal().Err(err).Msg("couldn't encode the result")
+	}
+	fmt.Println(string(line))
+
+	if result.Mismatches > 0 {
+		log.Error().Msgf("%d estimates differ from the fixtures", result.Mismatches)
+		os.Exit(1)
+	}
+}
@@ -1,6 +1,7 @@
 package main
 
 import (
+	"bufio"
 	"bytes"
 	"encoding/json"
 	"flag"
@@ -10,6 +11,7 @@ import (
 	"math/rand"
 	"net/http"
 	"os"
+	"path/filepath"
 	"strings"
 	"sync"
 	"time"
@@ -25,10 +27,50 @@ var limit = flag.Int("limit", math.MaxInt, "count of testsuites")
 var workers = flag.Int("workers", 8, "count of workers")
 var nodeRpc = flag.String("node-rpc", "", "node http rpc URL")
 var oracleRpc = flag.String("oracle-rpc", "", "logs-oracle http URL")
+var capture = flag.String("capture", "", "dir to save node responses as a corpus of bench/micro, the oracle isn't checked")
+var fixturesPath = flag.String("fixtures", "", "fixtures file instead of the embedded one, e.g. a recorded one")
+var record = flag.String("record", "", "file to write the fixtures with their counts from the node, to check the oracle without a node")
 
 //go:embed fixtures.jsonl
 var fixtures string
 
+// A line of the fixtures: '[filter]' or a recorded
+// '{"params":[filter],"expected":count}' with the node's count of logs
+type fixture struct {
+	Params   json.RawMessage `json:"params"`
+	Expected *int            `json:"expected,omitempty"`
+
+	// the count is recorded for a block tag like "latest" that has moved
+	// since, so it isn't checked
+	stale bool
+}
+
+func parseFixtures(data string) ([]fixture, error) {
+	var suites []fixture
+
+	for i, line := range strings.Split(strings.Trim(data, "\n"), "\n") {
+		var suite fixture
+
+		if strings.HasPrefix(line, "[") {
+			suite.Params = json.RawMessage(line)
+		} else if err := json.Unmarshal([]byte(line), &suite); err != nil {
+			return nil, fmt.Errorf("fixture %d: %w", i+1, err)
+		}
+
+		if suite.Expected != nil {
+			moving, err := movingBlocks(suite.Params)
+			if err != nil {
+				return nil, fmt.Errorf("fixture %d: %w", i+1, err)
+			}
+			suite.stale = moving
+		}
+
+		suites = append(suites, suite)
+	}
+
+	return suites, nil
+}
+
 func main() {
 	flag.Parse()
 	rand.Seed(time.Now().UnixNano())
@@ -37,21 +79,94 @@ func main() {
 		Level(zerolog.DebugLevel).
 		With().Caller().Logger()
 
-	if *nodeRpc == "" {
+	data := fixtures
+	if *fixturesPath != "" {
+		content, err := os.ReadFile(*fixturesPath)
+		if err != nil {
+			log.Fatal().Err(err).Msg("couldn't read fixtures")
+		}
+		data = string(content)
+	}
+
+	suites, err := parseFixtures(data)
+	if err != nil {
+		log.Fatal().Err(err).Msg("couldn't parse fixtures")
+	}
+
+	count := min(len(suites), *limit)
+
+	if *duration > 0 {
+		if *oracleRpc == "" {
+			log.Fatal().Msg("required oracle-rpc flag")
+		}
+
+		runLoad(suites[:count])
+		return
+	}
+
+	recorded := true
+	for _, suite := range suites[:count] {
+		recorded = recorded && suite.Expected != nil
+	}
+
+	if *nodeRpc == "" && (*capture != "" || *record != "" || !recorded) {
 		log.Fatal().Msg("required node-rpc flag")
 	}
 
-	if *oracleRpc == "" {
+	if *oracleRpc == "" && *capture == "" && *record == "" {
 		log.Fatal().Msg("required oracle-rpc flag")
 	}
 
-	requests := strings.Split(strings.Trim(fixtures, "\n"), "\n")
+	if *record != "" {
+		recordFixtures(suites[:count])
+		return
+	}
+
+	parallel(rand.Perm(len(suites))[:count], func(i int) {
+		params := string(suites[i].Params)
+
+		if *capture != "" {
+			if err := captureRequest(params, filepath.Join(*capture, fmt.Sprintf("%04d.json", i))); err != nil {
+				log.Panic().Err(err).Msg("failed node request")
+			}
+			return
+		}
+
+		var fromNode int
+		var err error
+		if suites[i].Expected != nil {
+			fromNode = *suites[i].Expected
+		} else if fromNode, err = nodeRequest(params); err != nil {
+			log.Panic().Err(err).Msg("failed node request")
+		}
+
+		fromOracle, err := oracleRequest(params)
+		if err != nil {
+			log.Panic().Err(err).Msg("failed oracle request")
+		}
+
+		if suites[i].stale {
+			log.Warn().Str("params", params).Msg("recorded count of a moving block isn't checked")
+			return
+		}
+
+		if fromNode != fromOracle {
+			log.Panic().Msgf("different results: real=%d, estimate=%d, params=%s", fromNode, fromOracle, params)
+		}
+
+		log.Info().
+			Str("params", params).
+			Int("count", fromOracle).
+			Msgf("suite estimate matched")
+	})
 
-	order := rand.Perm(len(requests))
-	count := min(len(requests), *limit)
+	log.Info().Msgf("%d suites successfully finished", count)
+}
 
+// Runs the job for each index on the workers
+func parallel(indexes []int, job func(i int)) {
 	var wg sync.WaitGroup
-	jobs := make(chan string, *workers)
+	jobs := make(chan int, *workers)
 
 	for w := 1; w <= *workers; w++ {
 		wg.Add(1)
@@ -59,38 +174,150 @@ func main() {
 		go func() {
 			defer wg.Done()
 
-			for params := range jobs {
-				fromNode, err := nodeRequest(params)
-				if err != nil {
-					log.Panic().Err(err).Msg("failed node request")
-				}
-
-				fromOracle, err := oracleRequest(params)
-				if err != nil {
-					log.Panic().Err(err).Msg("failed oracle request")
-				}
-
-				if fromNode != fromOracle {
-					log.Panic().Msgf("different results: real=%d, estimate=%d, params=%s", fromNode, fromOracle, params)
-				}
-
-				log.Info().
-					Str("params", params).
-					Int("count", fromOracle).
-					Msgf("suite estimate matched")
+			for i := range jobs {
+				job(i)
 			}
 		}()
 	}
 
-	for i := 0; i < count; i++ {
-		jobs <- requests[order[i]]
+	for _, i := range indexes {
+		jobs <- i
 	}
 
 	close(jobs)
 
 	wg.Wait()
+}
 
-	log.Info().Msgf("%d suites successfully finished", count)
+// Writes the suites with the node's counts in the order of the fixtures, block
+// tags are pinned to their current heights so the counts don't go stale
+func recordFixtures(suites []fixture) {
+	heights := make(map[string]string)
+	for i := range suites {
+		params, err := pinBlocks(suites[i].Params, heights)
+		if err != nil {
+			log.Fatal().Err(err).Str("params", string(suites[i].Params)).Msg("couldn't pin blocks")
+		}
+		suites[i].Params = params
+	}
+
+	counts := make([]int, len(suites))
+	indexes := make([]int, len(suites))
+	for i := range indexes {
+		indexes[i] = i
+	}
+
+	parallel(indexes, func(i int) {
+		count, err := nodeRequest(string(suites[i].Params))
+		if err != nil {
+			log.Panic().Err(err).Str("params", string(suites[i].Params)).Msg("failed node request")
+		}
+		counts[i] = count
+	})
+
+	file, err := os.Create(*record)
+	if err != nil {
+		log.Fatal().Err(err).Msg("couldn't create fixtures")
+	}
+
+	writer := bufio.NewWriter(file)
+	for i := range suites {
+		suites[i].Expected = &counts[i]
+
+		line, err := json.Marshal(suites[i])
+		if err != nil {
+			log.Fatal().Err(err).Msg("couldn't encode a fixture")
+		}
+
+		writer.Write(line)
+		writer.WriteByte('\n')
+	}
+
+	if err := writer.Flush(); err != nil {
+		log.Fatal().Err(err).Msg("couldn't write fixtures")
+	}
+	file.Close()
+
+	log.Info().Msgf("%d suites recorded to %s", len(suites), *record)
+}
+
+// blockTags lists the range of the filters that isn't a fixed height, a missing
+// block is "latest"
+func blockTags(filters []map[string]json.RawMessage, visit func(filter map[string]json.RawMessage, key, tag string)) {
+	for _, filter := range filters {
+		if _, ok := filter["blockHash"]; ok {
+			continue
+		}
+
+		for _, key := range []string{"fromBlock", "toBlock"} {
+			tag := "latest"
+			if raw, ok := filter[key]; ok && json.Unmarshal(raw, &tag) != nil {
+				continue
+			}
+			if tag != "earliest" && !strings.HasPrefix(tag, "0x") {
+				visit(filter, key, tag)
+			}
+		}
+	}
+}
+
+func movingBlocks(params json.RawMessage) (bool, error) {
+	var filters []map[string]json.RawMessage
+	if err := json.Unmarshal(params, &filters); err != nil {
+		return false, err
+	}
+
+	moving := false
+	blockTags(filters, func(map[string]json.RawMessage, string, string) {
+		moving = true
+	})
+	return moving, nil
+}
+
+// pinBlocks replaces the block tags of the params with the node's heights,
+// they're cached in heights to pin all fixtures at the same ones
+func pinBlocks(params json.RawMessage, heights map[string]string) (json.RawMessage, error) {
+	var filters []map[string]json.RawMessage
+	if err := json.Unmarshal(params, &filters); err != nil {
+		return nil, err
+	}
+
+	var err error
+	blockTags(filters, func(filter map[string]json.RawMessage, key, tag string) {
+		height, ok := heights[tag]
+		if !ok && err == nil {
+			if height, err = blockRequest(tag); err == nil {
+				heights[tag] = height
+			}
+		}
+		filter[key], _ = json.Marshal(height)
+	})
+	if err != nil {
+		return nil, err
+	}
+
+	return json.Marshal(filters)
+}
+
+func post(url string, method string, params string) ([]byte, error) {
+	payload := fmt.Sprintf("{\"method\":\"%s\",\"params\":%s,\"id\":1,\"jsonrpc\":\"2.0\"}", method, params)
+
+	conn, err := http.Post(url, "application/json", bytes.NewBuffer([]byte(payload)))
+	if err != nil {
+		return nil, err
+	}
+
+	body, err := io.ReadAll(conn.Body)
+	conn.Body.Close()
+	if err != nil {
+		return nil, err
+	}
+
+	if conn.StatusCode > 299 {
+		return nil, fmt.Errorf("Response failed: status=%d, body=%s", conn.StatusCode, body)
+	}
+
+	return body, nil
 }
 
 func request(url string, method string, params string) (any, error) {
@@ -107,20 +334,11 @@ func request(url string, method string, params string) (any, error) {
 		Error   *Error `json:"error"`
 	}
 
-	payload := fmt.Sprintf("{\"method\":\"%s\",\"params\":%s,\"id\":1,\"jsonrpc\":\"2.0\"}", method, params)
-
-	conn, err := http.Post(url, "application/json", bytes.NewBuffer([]byte(payload)))
+	body, err := post(url, method, params)
 	if err != nil {
 		return "", err
 	}
 
-	body, err := io.ReadAll(conn.Body)
-	conn.Body.Close()
-
-	if conn.StatusCode > 299 {
-		return "", fmt.Errorf("Response failed: status=%d, body=%s", conn.StatusCode, body)
-	}
-
 	var response Response
 	if err := json.Unmarshal(body, &response); err != nil {
 		return "", err
@@ -147,6 +365,34 @@ func nodeRequest(params string) (int, error) {
 	return len(logs), nil
 }
 
+func blockRequest(tag string) (string, error) {
+	response, err := request(*nodeRpc, "eth_getBlockByNumber", fmt.Sprintf("[\"%s\",false]", tag))
+	if err != nil {
+		return "", err
+	}
+
+	block, ok := response.(map[string]any)
+	if !ok {
+		return "", fmt.Errorf("block %s is not an object: %v", tag, response)
+	}
+
+	number, ok := block["number"].(string)
+	if !ok {
+		return "", fmt.Errorf("block %s has no number: %v", tag, response)
+	}
+
+	return number, nil
+}
+
+func captureRequest(params string, path string) error {
+	body, err := post(*nodeRpc, "eth_getLogs", params)
+	if err != nil {
+		return err
+	}
+
+	return os.WriteFile(path, body, 0644)
+}
+
 func oracleRequest(params string) (int, error) {
 	response, err := request(*oracleRpc, "drpc_getLogsEstimate", params)
 	if err != nil {
@@ -12,6 +12,11 @@ class Example {
             System.out.println("Blocks: " + db.GetBlocksCount());
             System.out.println("Query: "
                     + db.Query(null, 1L, 16L, Collections.emptyList(), Collections.emptyList()));
+
+            try (var query = db.AcquireQuery()) {
+                query.SetRange(1L, 16L).AddAddressHex("0xdac17f958d2ee523a2206206994597c13d831ec7");
+                System.out.println("Query async: " + db.QueryAsync(query).join());
+            }
         }
     }
 }
@@ -9,12 +9,16 @@ import java.lang.invoke.MethodHandle;
 import java.lang.invoke.VarHandle;
 import java.net.URL;
 import java.nio.file.*;
+import java.time.Duration;
 import java.util.List;
+import java.util.Objects;
+import java.util.concurrent.*;
 
 class Constants {
     static final int HASH_LENGTH = 32;
     static final int ADDRESS_LENGTH = 20;
     static final int TOPICS_LENGTH = 4;
+    static final int RCL_HISTOGRAM_BUCKETS = 24;
 
     static final int RCLE_OK = 0;
     static final int RCLE_QUERY_OVERFLOW = 1;
@@ -26,6 +30,13 @@ class Constants {
     static final int RCLE_FILESYSTEM = 7;
     static final int RCLE_LIBCURL = 8;
     static final int RCLE_UNKNOWN = 9;
+    static final int RCLE_INVALID_RANGE = 10;
+    static final int RCLE_RANGE_OVERLAP = 11;
+    static final int RCLE_INVALID_DUMP = 12;
+    static final int RCLE_QUERY_CANCELED = 13;
+    static final int RCLE_UNKNOWN_FILTER = 14;
+    static final int RCLE_RANGE_GAP = 15;
+    static final int RCLE_TOO_MANY_FILTERS = 16;
 
     static final OfBoolean C_BOOL_LAYOUT = JAVA_BOOLEAN;
     static final OfByte C_CHAR_LAYOUT = JAVA_BYTE;
@@ -38,69 +49,102 @@ class Constants {
     static final OfAddress C_POINTER_LAYOUT = ADDRESS.withBitAlignment(64).asUnbounded();
 }
 
-class rcl_query_address {
-    static final StructLayout LAYOUT =
-            MemoryLayout
-                    .structLayout(Constants.C_POINTER_LAYOUT.withName("encoded"),
-                            Constants.C_LONG_LONG_LAYOUT.withName("_hash"),
-                            MemoryLayout.sequenceLayout(20, Constants.C_CHAR_LAYOUT)
-                                    .withName("_data"),
-                            MemoryLayout.paddingLayout(32))
-                    .withName("rcl_query_address");
-
-    static final VarHandle encoded_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("encoded"));
-}
-
-class rcl_query_topics {
-    static final StructLayout LAYOUT =
-            MemoryLayout
-                    .structLayout(Constants.C_POINTER_LAYOUT.withName("encoded"),
-                            Constants.C_LONG_LONG_LAYOUT.withName("_hash"),
-                            MemoryLayout.sequenceLayout(32, Constants.C_CHAR_LAYOUT)
-                                    .withName("_data"))
-                    .withName("rcl_query_topics");
-
-    static final VarHandle encoded_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("encoded"));
-}
-
-class rcl_query_t {
+class rcl_query_keys_t {
     static final StructLayout LAYOUT = MemoryLayout.structLayout(
-            Constants.C_POINTER_LAYOUT.withName("address"),
-            MemoryLayout.sequenceLayout(Constants.TOPICS_LENGTH, Constants.C_POINTER_LAYOUT)
-                    .withName("topics"),
             Constants.C_LONG_LONG_LAYOUT.withName("from"),
             Constants.C_LONG_LONG_LAYOUT.withName("to"),
             Constants.C_LONG_LONG_LAYOUT.withName("limit"),
+            Constants.C_POINTER_LAYOUT.withName("address"),
+            MemoryLayout.sequenceLayout(Constants.TOPICS_LENGTH, Constants.C_POINTER_LAYOUT)
+                    .withName("topics"),
             Constants.C_LONG_LONG_LAYOUT.withName("alen"),
             MemoryLayout.sequenceLayout(Constants.TOPICS_LENGTH, Constants.C_LONG_LONG_LAYOUT)
                     .withName("tlen"),
-            Constants.C_BOOL_LAYOUT, Constants.C_BOOL_LAYOUT, // _has_addresses, _has_topics
-            MemoryLayout.paddingLayout(48));
+            Constants.C_LONG_LONG_LAYOUT.withName("timeout_ns"),
+            Constants.C_POINTER_LAYOUT.withName("cancel"),
+            Constants.C_LONG_LONG_LAYOUT.withName("reached"));
+
+    static final long from_OFFSET = offset("from");
+    static final long to_OFFSET = offset("to");
+    static final long limit_OFFSET = offset("limit");
+    static final long address_OFFSET = offset("address");
+    static final long topics_OFFSET = offset("topics");
+    static final long alen_OFFSET = offset("alen");
+    static final long tlen_OFFSET = offset("tlen");
+    static final long timeout_ns_OFFSET = offset("timeout_ns");
+    static final long cancel_OFFSET = offset("cancel");
+    static final long reached_OFFSET = offset("reached");
+
+    static long offset(String name) {
+        return LAYOUT.byteOffset(MemoryLayout.PathElement.groupElement(name));
+    }
+}
 
-    static final VarHandle from_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("from"));
-    static final VarHandle to_VH = LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("to"));
-    static final VarHandle limit_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("limit"));
+class rcl_histogram_t {
+    static final StructLayout LAYOUT = MemoryLayout.structLayout(
+            Constants.C_LONG_LONG_LAYOUT.withName("count"),
+            Constants.C_LONG_LONG_LAYOUT.withName("sum_us"),
+            MemoryLayout.sequenceLayout(Constants.RCL_HISTOGRAM_BUCKETS, Constants.C_LONG_LONG_LAYOUT)
+                    .withName("buckets"));
 
-    static final VarHandle alen_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("alen"));
+    static final long count_OFFSET = offset("count");
+    static final long sum_us_OFFSET = offset("sum_us");
+    static final long buckets_OFFSET = offset("buckets");
 
-    public static MemorySegment tlen_slice(MemorySegment seg) {
-        return seg.asSlice(72, 32);
+    static long offset(String name) {
+        return LAYOUT.byteOffset(MemoryLayout.PathElement.groupElement(name));
+    }
+}
+
+class rcl_stats_t {
+    static final StructLayout LAYOUT = MemoryLayout.structLayout(
+            Constants.C_LONG_LONG_LAYOUT.withName("blocks_count"),
+            Constants.C_LONG_LONG_LAYOUT.withName("logs_count"),
+            Constants.C_LONG_LONG_LAYOUT.withName("queries"),
+            Constants.C_LONG_LONG_LAYOUT.withName("query_errors"),
+            Constants.C_LONG_LONG_LAYOUT.withName("blocks_scanned"),
+            Constants.C_LONG_LONG_LAYOUT.withName("blooms_checked"),
+            Constants.C_LONG_LONG_LAYOUT.withName("blooms_passed"),
+            Constants.C_LONG_LONG_LAYOUT.withName("logs_examined"),
+            Constants.C_LONG_LONG_LAYOUT.withName("logs_matched"),
+            Constants.C_LONG_LONG_LAYOUT.withName("standing_hits"),
+            Constants.C_LONG_LONG_LAYOUT.withName("blocks_summarized"),
+            rcl_histogram_t.LAYOUT.withName("query_latency"),
+            Constants.C_LONG_LONG_LAYOUT.withName("inserts"),
+            Constants.C_LONG_LONG_LAYOUT.withName("blocks_inserted"),
+            Constants.C_LONG_LONG_LAYOUT.withName("logs_inserted"),
+            rcl_histogram_t.LAYOUT.withName("insert_latency"),
+            Constants.C_LONG_LONG_LAYOUT.withName("height"),
+            Constants.C_LONG_LONG_LAYOUT.withName("next"),
+            Constants.C_LONG_LONG_LAYOUT.withName("upstream_requests"),
+            Constants.C_LONG_LONG_LAYOUT.withName("upstream_errors"),
+            rcl_histogram_t.LAYOUT.withName("upstream_latency"),
+            Constants.C_LONG_LONG_LAYOUT.withName("ingest_throttle"),
+            Constants.C_LONG_LONG_LAYOUT.withName("minor_faults"),
+            Constants.C_LONG_LONG_LAYOUT.withName("major_faults"),
+            Constants.C_LONG_LONG_LAYOUT.withName("ram_limit"),
+            Constants.C_LONG_LONG_LAYOUT.withName("warmup_done"),
+            Constants.C_LONG_LONG_LAYOUT.withName("warmup_total"));
+
+    static long get(MemorySegment segment, String name) {
+        return segment.get(ValueLayout.JAVA_LONG, offset(name));
     }
 
-    static final VarHandle address_VH =
-            LAYOUT.varHandle(MemoryLayout.PathElement.groupElement("address"));
+    static MemorySegment histogram(MemorySegment segment, String name) {
+        return segment.asSlice(offset(name), rcl_histogram_t.LAYOUT.byteSize());
+    }
 
-    public static MemorySegment topics_slice(MemorySegment seg) {
-        return seg.asSlice(8, 32);
+    static long offset(String name) {
+        return LAYOUT.byteOffset(MemoryLayout.PathElement.groupElement(name));
     }
 }
 
 public class LogsOracle implements AutoCloseable {
+    // see rcl_upstream_mode
+    public static final int UPSTREAM_LOGS = 0;
+    public static final int UPSTREAM_BATCH = 1;
+    public static final int UPSTREAM_RECEIPTS = 2;
+
     private Arena connArena = Arena.openShared();
     private MemorySegment connPtr;
 
@@ -175,11 +219,38 @@ public class LogsOracle implements AutoCloseable {
                     Constants.C_INT_LAYOUT,
                     Constants.C_POINTER_LAYOUT,
                     Constants.C_POINTER_LAYOUT));
-    static final MethodHandle rcl_query_MH = downcallHandle("rcl_query",
+    static final MethodHandle rcl_set_upstream_mode_MH = downcallHandle("rcl_set_upstream_mode",
+            FunctionDescriptor.of(
+                    Constants.C_INT_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_INT_LAYOUT,
+                    Constants.C_LONG_LONG_LAYOUT));
+    static final MethodHandle rcl_query_keys_MH = downcallHandle("rcl_query_keys",
+            FunctionDescriptor.of(
+                    Constants.C_INT_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_POINTER_LAYOUT));
+    static final MethodHandle rcl_query_split_MH = downcallHandle("rcl_query_split",
             FunctionDescriptor.of(
                     Constants.C_INT_LAYOUT,
                     Constants.C_POINTER_LAYOUT,
                     Constants.C_POINTER_LAYOUT,
+                    Constants.C_LONG_LONG_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_POINTER_LAYOUT));
+    static final MethodHandle rcl_query_histogram_MH = downcallHandle("rcl_query_histogram",
+            FunctionDescriptor.of(
+                    Constants.C_INT_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_LONG_LONG_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
+                    Constants.C_POINTER_LAYOUT));
+    static final MethodHandle rcl_stats_MH = downcallHandle("rcl_stats",
+            FunctionDescriptor.of(
+                    Constants.C_INT_LAYOUT,
+                    Constants.C_POINTER_LAYOUT,
                     Constants.C_POINTER_LAYOUT));
     static final MethodHandle rcl_logs_count_MH = downcallHandle("rcl_logs_count",
             FunctionDescriptor.of(
@@ -196,6 +267,19 @@ public class LogsOracle implements AutoCloseable {
                     Constants.C_POINTER_LAYOUT,
                     Constants.C_INT_LAYOUT));
 
+    // Idle queries, see AcquireQuery
+    private final ConcurrentLinkedQueue<KeyQuery> queries = new ConcurrentLinkedQueue<>();
+    private volatile boolean closed = false;
+
+    // Downcalls of async queries run on platform threads, so virtual threads
+    // waiting for them don't pin their carriers
+    private final ExecutorService workers = Executors.newFixedThreadPool(
+            Runtime.getRuntime().availableProcessors(), task -> {
+                var thread = new Thread(task, "logsoracle-query");
+                thread.setDaemon(true);
+                return thread;
+            });
+
     public LogsOracle(String dir, long ram_limit) throws LogsOracleException {
         try (Arena arena = Arena.openConfined()) {
             var dbPtr = connArena.allocate(Constants.C_POINTER_LAYOUT);
@@ -241,74 +325,406 @@ public class LogsOracle implements AutoCloseable {
         }
     }
 
+    // mode is one of UPSTREAM_*, callBlocks is the range of one
+    // eth_getLogs call in a batch (0 is the default)
+    public void SetUpstreamMode(int mode, long callBlocks) throws LogsOracleException {
+        int rc;
+        try {
+            rc = (int) rcl_set_upstream_mode_MH.invokeExact(connPtr, mode, callBlocks);
+        } catch (Throwable ex) {
+            throw new AssertionError("should not reach here", ex);
+        }
+
+        if (rc != Constants.RCLE_OK)
+            throw exception(rc);
+    }
+
     public long Query(
             Long limit,
             long fromBlock, long toBlock,
             List<String> address,
             List<List<String>> topics) throws LogsOracleException {
+        try (var query = AcquireQuery()) {
+            query.SetRange(fromBlock, toBlock).SetLimit(limit == null ? 0L : limit.longValue());
+
+            for (int i = 0; i < address.size(); ++i)
+                query.AddAddressHex(address.get(i));
+
+            for (int i = 0; i < Math.min(topics.size(), Constants.TOPICS_LENGTH); ++i) {
+                var current = topics.get(i);
+                for (int j = 0; j < current.size(); ++j)
+                    query.AddTopicHex(i, current.get(j));
+            }
+
+            return Query(query);
+        }
+    }
+
+    // Takes a pooled query, close it to give it back
+    public KeyQuery AcquireQuery() {
+        var query = queries.poll();
+        return query != null ? query : new KeyQuery();
+    }
+
+    public long Query(KeyQuery query) throws LogsOracleException {
+        int rc = run(query);
+        if (rc != Constants.RCLE_OK)
+            throw exception(rc);
+
+        return query.result.get(ValueLayout.JAVA_LONG, 0);
+    }
+
+    // Splits the query's range into chunks of at most 'maxLogs' matching logs
+    // in one scan, returns {from0, to0, from1, to1, ...}
+    public long[] QuerySplit(KeyQuery query, long maxLogs) throws LogsOracleException {
+        try (Arena arena = Arena.openConfined()) {
+            for (long capacity = 16; ; ) {
+                var chunks = arena.allocate(capacity * 2 * Long.BYTES, 8);
+                var count = arena.allocate(ValueLayout.JAVA_LONG, capacity);
+
+                int rc;
+                try {
+                    rc = (int) rcl_query_split_MH.invokeExact(connPtr, query.prepare(), maxLogs, chunks, count);
+                } catch (Throwable ex) {
+                    throw new AssertionError("should not reach here", ex);
+                }
+
+                long found = count.get(ValueLayout.JAVA_LONG, 0);
+                if (rc == Constants.RCLE_QUERY_OVERFLOW) {
+                    capacity = found;
+                    continue;
+                }
+                if (rc != Constants.RCLE_OK) throw exception(rc);
+
+                return chunks.asSlice(0, found * 2 * Long.BYTES).toArray(ValueLayout.JAVA_LONG);
+            }
+        }
+    }
+
+    // Counts matching logs of the query's range per 'bucketBlocks' blocks
+    public long[] QueryHistogram(KeyQuery query, long bucketBlocks) throws LogsOracleException {
+        if (bucketBlocks <= 0 || query.fromBlock > query.toBlock)
+            throw exception(Constants.RCLE_INVALID_RANGE);
+
+        long capacity = (query.toBlock - query.fromBlock) / bucketBlocks + 1;
         try (Arena arena = Arena.openConfined()) {
-            var query = arena.allocate(rcl_query_t.LAYOUT);
-
-            rcl_query_t.from_VH.set(query, fromBlock);
-            rcl_query_t.to_VH.set(query, toBlock);
-            rcl_query_t.limit_VH.set(query, limit == null ? -1L : limit.longValue());
-
-                    // address
-                    long alen = address.size();
-                    rcl_query_t.alen_VH.set(query, alen);
-                    if (alen > 0) {
-                        var addressPtr = arena.allocateArray(rcl_query_address.LAYOUT, alen);
-                        for (int i = 0; i < alen; ++i) {
-                            var item = addressPtr.asSlice(i * rcl_query_address.LAYOUT.byteSize());
-                            rcl_query_address.encoded_VH.set(
-                                    item, arena.allocateUtf8String(address.get(i)));
-                        }
-                        rcl_query_t.address_VH.set(query, addressPtr);
-                    } else {
-                        rcl_query_t.address_VH.set(query, NULL);
-                    }
-
-                    // topics
-                    var tlenM = rcl_query_t.tlen_slice(query);
-                    var topicsM = rcl_query_t.topics_slice(query);
-
-                    for (int i = 0; i < Constants.TOPICS_LENGTH; ++i) {
-                        var size = topics.size();
-                        var topicM = topicsM.asSlice(i * Constants.C_POINTER_LAYOUT.byteSize());
-
-                        if (size <= i) {
-                            topicM.set(Constants.C_POINTER_LAYOUT, 0, NULL);
-                            tlenM.set(ValueLayout.JAVA_LONG, i * ValueLayout.JAVA_LONG.byteSize(),
-                                    0L);
-                        } else {
-                            var current = topics.get(i);
-                            var topicPtr =
-                                    arena.allocateArray(rcl_query_topics.LAYOUT, current.size());
-
-                            for (int j = 0; j < current.size(); ++j) {
-                                var item = topicPtr.asSlice(j * rcl_query_topics.LAYOUT.byteSize());
-                                rcl_query_topics.encoded_VH.set(
-                                        item, arena.allocateUtf8String(current.get(j)));
-                            }
-
-                            topicM.set(Constants.C_POINTER_LAYOUT, 0, topicPtr);
-                            tlenM.set(ValueLayout.JAVA_LONG, i * ValueLayout.JAVA_LONG.byteSize(),
-                                    topics.get(i).size());
-                        }
-                    }
-
-                    // call
-                    var result = arena.allocate(Constants.C_POINTER_LAYOUT);
-
-                    int rc;
-                    try {
-                        rc = (int) rcl_query_MH.invokeExact(connPtr, query, result);
-                    } catch (Throwable ex) {
-                        throw new AssertionError("should not reach here", ex);
-                    }
-                    if (rc != Constants.RCLE_OK) throw exception(rc);
-
-                    return result.get(ValueLayout.JAVA_LONG, 0);
+            var buckets = arena.allocate(capacity * Long.BYTES, 8);
+            var count = arena.allocate(ValueLayout.JAVA_LONG, capacity);
+
+            int rc;
+            try {
+                rc = (int) rcl_query_histogram_MH.invokeExact(connPtr, query.prepare(), bucketBlocks, buckets, count);
+            } catch (Throwable ex) {
+                throw new AssertionError("should not reach here", ex);
+            }
+            if (rc != Constants.RCLE_OK) throw exception(rc);
+
+            return buckets.toArray(ValueLayout.JAVA_LONG);
+        }
+    }
+
+    // Runs all queries, outcomes are taken by KeyQuery.Result
+    public void QueryBatch(List<KeyQuery> batch) {
+        for (int i = 0; i < batch.size(); ++i)
+            run(batch.get(i));
+    }
+
+    public CompletableFuture<Long> QueryAsync(KeyQuery query) {
+        return CompletableFuture.supplyAsync(() -> {
+            try {
+                return Query(query);
+            } catch (LogsOracleException ex) {
+                throw new CompletionException(ex);
+            }
+        }, workers);
+    }
+
+    public CompletableFuture<Void> QueryBatchAsync(List<KeyQuery> batch) {
+        return CompletableFuture.runAsync(() -> QueryBatch(batch), workers);
+    }
+
+    private int run(KeyQuery query) {
+        int rc;
+        try {
+            rc = (int) rcl_query_keys_MH.invokeExact(connPtr, query.prepare(), query.result);
+        } catch (Throwable ex) {
+            throw new AssertionError("should not reach here", ex);
+        }
+
+        query.code = rc;
+        return rc;
+    }
+
+    // KeyQuery is a reusable query with binary keys, see rcl_query_keys_t.
+    // Keys are kept in its native memory, so nothing is marshalled per call.
+    public final class KeyQuery implements AutoCloseable {
+        private static final int SETS = 1 + Constants.TOPICS_LENGTH; // addresses, then topics
+        private static final VarHandle CANCEL = ValueLayout.JAVA_INT.varHandle();
+
+        private final Arena arena = Arena.openShared();
+        private final MemorySegment query = arena.allocate(rcl_query_keys_t.LAYOUT);
+        private final MemorySegment result = arena.allocate(ValueLayout.JAVA_LONG);
+        private final MemorySegment cancel = arena.allocate(ValueLayout.JAVA_INT);
+
+        private final MemorySegment[] keys = new MemorySegment[SETS];
+        private final long[] lengths = new long[SETS];
+
+        private long fromBlock, toBlock, limit, timeoutNanos;
+        private int code = Constants.RCLE_OK;
+
+        private KeyQuery() {
+        }
+
+        public KeyQuery SetRange(long fromBlock, long toBlock) {
+            this.fromBlock = fromBlock;
+            this.toBlock = toBlock;
+            return this;
+        }
+
+        // 0 is no limit
+        public KeyQuery SetLimit(long limit) {
+            this.limit = limit;
+            return this;
+        }
+
+        // The scan is stopped with RCLE_QUERY_CANCELED after the timeout, 0 is none
+        public KeyQuery SetTimeout(Duration timeout) {
+            this.timeoutNanos = timeout.toNanos();
+            return this;
+        }
+
+        // Stops the running or the next run from any thread, until Reset
+        public void Cancel() {
+            CANCEL.setVolatile(cancel, 1);
+        }
+
+        // Last block scanned by a canceled run
+        public long Reached() {
+            return query.get(ValueLayout.JAVA_LONG, rcl_query_keys_t.reached_OFFSET);
+        }
+
+        public KeyQuery AddAddress(byte[] address) {
+            return add(0, address);
+        }
+
+        // Copies 'count' addresses of 20 bytes at once
+        public KeyQuery AddAddresses(MemorySegment addresses, long count) {
+            return add(0, addresses, count);
+        }
+
+        public KeyQuery AddAddressHex(String address) {
+            return addHex(0, address);
+        }
+
+        // Adds an alternative of the i-th topic, no alternatives match all
+        public KeyQuery AddTopic(int i, byte[] topic) {
+            return add(1 + Objects.checkIndex(i, Constants.TOPICS_LENGTH), topic);
+        }
+
+        public KeyQuery AddTopics(int i, MemorySegment topics, long count) {
+            return add(1 + Objects.checkIndex(i, Constants.TOPICS_LENGTH), topics, count);
+        }
+
+        public KeyQuery AddTopicHex(int i, String topic) {
+            return addHex(1 + Objects.checkIndex(i, Constants.TOPICS_LENGTH), topic);
+        }
+
+        public KeyQuery Reset() {
+            fromBlock = toBlock = limit = timeoutNanos = 0;
+            java.util.Arrays.fill(lengths, 0);
+            CANCEL.setVolatile(cancel, 0);
+            code = Constants.RCLE_OK;
+            return this;
+        }
+
+        // Outcome of the last run in a batch
+        public long Result() throws LogsOracleException {
+            if (code != Constants.RCLE_OK)
+                throw exception(code);
+
+            return result.get(ValueLayout.JAVA_LONG, 0);
+        }
+
+        @Override
+        public void close() {
+            if (closed) {
+                arena.close();
+            } else {
+                queries.offer(Reset());
+            }
+        }
+
+        private static long keySize(int set) {
+            return set == 0 ? Constants.ADDRESS_LENGTH : Constants.HASH_LENGTH;
+        }
+
+        private KeyQuery add(int set, byte[] key) {
+            if (key.length != keySize(set))
+                throw new IllegalArgumentException("invalid key length: " + key.length);
+
+            long offset = reserve(set, 1);
+            MemorySegment.copy(key, 0, keys[set], ValueLayout.JAVA_BYTE, offset, key.length);
+            return this;
+        }
+
+        private KeyQuery add(int set, MemorySegment src, long count) {
+            long offset = reserve(set, count);
+            MemorySegment.copy(src, 0, keys[set], offset, count * keySize(set));
+            return this;
+        }
+
+        private KeyQuery addHex(int set, String key) {
+            long size = keySize(set), offset = reserve(set, 1);
+
+            int start = key.startsWith("0x") || key.startsWith("0X") ? 2 : 0;
+            boolean valid = key.length() - start == 2 * size;
+
+            for (int i = 0; valid && i < size; ++i) {
+                int hi = Character.digit(key.charAt(start + 2 * i), 16);
+                int lo = Character.digit(key.charAt(start + 2 * i + 1), 16);
+
+                valid = hi >= 0 && lo >= 0;
+                keys[set].set(ValueLayout.JAVA_BYTE, offset + i, (byte) (hi << 4 | lo));
+            }
+
+            if (!valid) {
+                lengths[set]--;
+                throw new IllegalArgumentException("invalid hex key: " + key);
+            }
+
+            return this;
+        }
+
+        // Returns the offset of 'count' new keys, arrays grow twice
+        private long reserve(int set, long count) {
+            long size = keySize(set), used = lengths[set] * size, need = used + count * size;
+
+            var current = keys[set];
+            if (current == null || current.byteSize() < need) {
+                long capacity = Math.max(need, current == null ? 4 * size : 2 * current.byteSize());
+
+                var grown = arena.allocate(capacity, 8);
+                if (current != null)
+                    MemorySegment.copy(current, 0, grown, 0, used);
+                keys[set] = grown;
+            }
+
+            lengths[set] += count;
+            return used;
+        }
+
+        private MemorySegment prepare() {
+            query.set(ValueLayout.JAVA_LONG, rcl_query_keys_t.from_OFFSET, fromBlock);
+            query.set(ValueLayout.JAVA_LONG, rcl_query_keys_t.to_OFFSET, toBlock);
+            query.set(ValueLayout.JAVA_LONG, rcl_query_keys_t.limit_OFFSET, limit);
+            query.set(ValueLayout.JAVA_LONG, rcl_query_keys_t.timeout_ns_OFFSET, timeoutNanos);
+            query.set(Constants.C_POINTER_LAYOUT, rcl_query_keys_t.cancel_OFFSET, cancel);
+
+            for (int set = 0; set < SETS; ++set) {
+                long pointer = set == 0
+                        ? rcl_query_keys_t.address_OFFSET
+                        : rcl_query_keys_t.topics_OFFSET + (set - 1) * Constants.C_POINTER_LAYOUT.byteSize();
+                long length = set == 0
+                        ? rcl_query_keys_t.alen_OFFSET
+                        : rcl_query_keys_t.tlen_OFFSET + (set - 1) * ValueLayout.JAVA_LONG.byteSize();
+
+                query.set(Constants.C_POINTER_LAYOUT, pointer, keys[set] == null ? NULL : keys[set]);
+                query.set(ValueLayout.JAVA_LONG, length, lengths[set]);
+            }
+
+            return query;
+        }
+    }
+
+        public Stats GetStats() throws LogsOracleException {
+            try (Arena arena = Arena.openConfined()) {
+                var result = arena.allocate(rcl_stats_t.LAYOUT);
+
+                int rc;
+                try {
+                    rc = (int) rcl_stats_MH.invokeExact(connPtr, result);
+                } catch (Throwable ex) {
+                    throw new AssertionError("should not reach here", ex);
+                }
+                if (rc != Constants.RCLE_OK) throw exception(rc);
+
+                return new Stats(result);
+            }
+        }
+
+        // see rcl_histogram_t, the i-th bucket counts calls under 2^i us
+        public static final class Histogram {
+            static final int BUCKETS = Constants.RCL_HISTOGRAM_BUCKETS;
+
+            public final long count, sumUs;
+            public final long[] buckets;
+
+            Histogram(MemorySegment segment) {
+                count = segment.get(ValueLayout.JAVA_LONG, rcl_histogram_t.count_OFFSET);
+                sumUs = segment.get(ValueLayout.JAVA_LONG, rcl_histogram_t.sum_us_OFFSET);
+                buckets = segment.asSlice(rcl_histogram_t.buckets_OFFSET, BUCKETS * Long.BYTES)
+                        .toArray(ValueLayout.JAVA_LONG);
+            }
+        }
+
+        // see rcl_stats_t, counters since the db was opened
+        public static final class Stats {
+            public final long blocksCount, logsCount;
+
+            public final long queries, queryErrors;
+            public final long blocksScanned, bloomsChecked, bloomsPassed;
+            public final long logsExamined, logsMatched;
+            public final long standingHits; // queries counted by a standing filter
+            public final long blocksSummarized; // counted by summaries of sealed pages
+            public final Histogram queryLatency;
+
+            public final long inserts, blocksInserted, logsInserted;
+            public final Histogram insertLatency;
+
+            public final long height, next; // the lag is 'height - next'
+            public final long upstreamRequests, upstreamErrors;
+            public final Histogram upstreamLatency;
+            public final long ingestThrottle; // see rcl_set_query_slo, 0 is full speed
+
+            public final long minorFaults, majorFaults;
+
+            public final long ramLimit; // bytes of blocks kept in RAM
+            public final long warmupDone, warmupTotal; // it's done when equal
+
+            // fields are read by the names of rcl_stats_t.LAYOUT
+            Stats(MemorySegment segment) {
+                blocksCount = rcl_stats_t.get(segment, "blocks_count");
+                logsCount = rcl_stats_t.get(segment, "logs_count");
+
+                queries = rcl_stats_t.get(segment, "queries");
+                queryErrors = rcl_stats_t.get(segment, "query_errors");
+                blocksScanned = rcl_stats_t.get(segment, "blocks_scanned");
+                bloomsChecked = rcl_stats_t.get(segment, "blooms_checked");
+                bloomsPassed = rcl_stats_t.get(segment, "blooms_passed");
+                logsExamined = rcl_stats_t.get(segment, "logs_examined");
+                logsMatched = rcl_stats_t.get(segment, "logs_matched");
+                standingHits = rcl_stats_t.get(segment, "standing_hits");
+                blocksSummarized = rcl_stats_t.get(segment, "blocks_summarized");
+                queryLatency = new Histogram(rcl_stats_t.histogram(segment, "query_latency"));
+
+                inserts = rcl_stats_t.get(segment, "inserts");
+                blocksInserted = rcl_stats_t.get(segment, "blocks_inserted");
+                logsInserted = rcl_stats_t.get(segment, "logs_inserted");
+                insertLatency = new Histogram(rcl_stats_t.histogram(segment, "insert_latency"));
+
+                height = rcl_stats_t.get(segment, "height");
+                next = rcl_stats_t.get(segment, "next");
+                upstreamRequests = rcl_stats_t.get(segment, "upstream_requests");
+                upstreamErrors = rcl_stats_t.get(segment, "upstream_errors");
+                upstreamLatency = new Histogram(rcl_stats_t.histogram(segment, "upstream_latency"));
+                ingestThrottle = rcl_stats_t.get(segment, "ingest_throttle");
+
+                minorFaults = rcl_stats_t.get(segment, "minor_faults");
+                majorFaults = rcl_stats_t.get(segment, "major_faults");
+
+                ramLimit = rcl_stats_t.get(segment, "ram_limit");
+                warmupDone = rcl_stats_t.get(segment, "warmup_done");
+                warmupTotal = rcl_stats_t.get(segment, "warmup_total");
             }
         }
 
@@ -347,6 +763,18 @@ public class LogsOracle implements AutoCloseable {
 
         @Override
         public void close() throws IOException {
+            closed = true;
+
+            workers.shutdown();
+            try {
+                workers.awaitTermination(Long.MAX_VALUE, TimeUnit.NANOSECONDS);
+            } catch (InterruptedException ex) {
+                Thread.currentThread().interrupt();
+            }
+
+            for (var query = queries.poll(); query != null; query = queries.poll())
+                query.arena.close();
+
             try {
                 rcl_free_MH.invokeExact(connPtr);
             } catch (Throwable ex) {
@@ -375,5 +803,13 @@ public class LogsOracle implements AutoCloseable {
             public boolean isQueryOverflow() {
                 return code == Constants.RCLE_QUERY_OVERFLOW;
             }
+
+            public boolean isQueryCanceled() {
+                return code == Constants.RCLE_QUERY_CANCELED;
+            }
+
+            public boolean isRangeGap() {
+                return code == Constants.RCLE_RANGE_GAP;
+            }
         }
     }
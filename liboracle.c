@@ -1,14 +1,30 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // sync_file_range
+#endif
+
 #include "liboracle.h"
 
+#include <poll.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
 #include "common.h"
+#include "dump.h"
 #include "file.h"
+#include "snapshot.h"
 #include "upstream.h"
 #include "vector.h"
 
 enum { RCL_QUERY_SIZE_LIMIT = 4 * 1024 * 1024 };  // 4MB RAM
+enum { IMPORT_BATCH_SIZE = 1 << 20, IMPORT_THREADS_MAX = 8 };
 
 typedef char rcl_filepath_t[PATH_MAX + 1];
 
+static const char MANIFEST_FILENAME[] = "toc.txt";
+static const char WARM_FILENAME[] = "warm.txt";  // see rcl_warm_save
+static const char STANDING_FILENAME[] = "standing.txt";  // see rcl_standing_t
+
 static uint64_t LOGS_PAGE_CAPACITY = 1000000;   // 1m
 static uint64_t BLOCKS_FILE_CAPACITY = 100000;  // 100k
 
@@ -21,17 +37,38 @@ typedef struct {
   bloom_t logs_bloom;
 } rcl_block_t;
 
-static bool rcl_block_check(rcl_block_t* block, rcl_query_t* query) {
-  size_t k, match;
+#define BLOCKS_PAGE_SIZE (BLOCKS_FILE_CAPACITY * sizeof(rcl_block_t))
 
-  for (match = query->alen == 0, k = 0; !match && k < query->alen; ++k)
-    match = bloom_check(&(block->logs_bloom), query->address[k]._data);
-  if (!match)
-    return false;
+// type: rcl_filter_t, flat keys of a query, the first set is addresses and
+// then topics. Raw keys are checked in blooms, their hashes in data pages.
+#define FILTER_SETS (1 + TOPICS_LENGTH)
 
-  for (size_t i = 0; i < TOPICS_LENGTH; ++i) {
-    for (match = query->tlen[i] == 0, k = 0; !match && k < query->tlen[i]; ++k)
-      match = bloom_check(&(block->logs_bloom), query->topics[i][k]._data);
+typedef struct {
+  uint64_t from, to, limit;
+  uint64_t deadline;  // rcl_clock_ns, 0 is none
+  const int* cancel;
+  uint64_t reached;
+  bool any;  // there are keys
+  size_t len[FILTER_SETS];
+  const uint8_t* keys[FILTER_SETS];
+  uint64_t* hashes[FILTER_SETS];
+
+  // optional, called for every block with matching logs
+  void (*visit)(void* data, uint64_t number, uint64_t count);
+  void* visit_data;
+} rcl_filter_t;
+
+#define filter_key_size(set) \
+  ((set) == 0 ? sizeof(rcl_address_t) : sizeof(rcl_hash_t))
+
+static bool rcl_block_check(rcl_block_t* block, rcl_filter_t* filter) {
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    size_t size = filter_key_size(i);
+    bool match = filter->len[i] == 0;
+
+    for (size_t k = 0; !match && k < filter->len[i]; ++k)
+      match = bloom_check(&(block->logs_bloom),
+                          (uint8_t*)(filter->keys[i] + k * size));
     if (!match)
       return false;
   }
@@ -69,26 +106,171 @@ void rcl_page_destroy(rcl_page_t* page) {
   file_close(&(page->topics));
 }
 
-// type: rcl_t
-static uint32_t HASH_SEED = 1907531730ul;
+// type: rcl_standing_t, a filter registered by rcl_standing_filter_add with
+// the prefix counts of its logs: the n-th one is the count in [window_from, n]
+// blocks, it's written for the completed blocks up to 'next'. A query with the
+// same keys counts this part by two lookups.
+enum {
+  STANDING_FILTERS_MAX = 64,
+  STANDING_KEYS_MAX = 64,         // of all sets of a filter
+  STANDING_INLINE_BLOCKS = 1024,  // counted by the insert itself
+  STANDING_FILL_BLOCKS = 100000,  // counted by the filler at once
+  STANDING_FILL_INTERVAL_S = 1,
+};
 
+typedef struct {
+  uint64_t id;
+  rcl_filter_t filter;  // keys of a set are sorted by hashes
+  uint64_t hashes[STANDING_KEYS_MAX];
+  uint8_t keys[STANDING_KEYS_MAX * sizeof(rcl_hash_t)];
+
+  atomic_uint_fast64_t next;
+  atomic_bool removed;  // readers may still hold it, see rcl_standing_reclaim
+  slots_t pages;        // <file_t>, uint64_t counts paged as blocks
+} rcl_standing_t;
+
+// Gaps before the head are synced by upstreams of their own, a worker is
+// given a span of a gap and its height stops at the end of it
+enum {
+  BACKFILL_WORKERS = 4,
+  BACKFILL_SPAN_BLOCKS = (1 << 16),
+};
+
+// type: rcl_backfill_t, a worker of the [from, to] span, NULL is a free slot
+typedef struct {
+  rcl_upstream_t* upstream;
+  uint64_t from, to;
+} rcl_backfill_t;
+
+// type: rcl_t
 struct rcl {
   // Config
-  uint64_t ram_limit;
+  atomic_uint_fast64_t ram_limit;  // of rcl_open or the engine's share
   rcl_filepath_t dir;
+  uint64_t window_from, window_to;  // [from, to) blocks of the shard
 
-  rcl_upstream_t* upstream;
+  rcl_upstream_t* upstream;  // follows the head
+
+  // Backfill of the gaps before the head, see rcl_backfill_step. The lock
+  // guards the workers and the config of the upstreams given to new ones.
+  pthread_mutex_t backfill_lock;
+  rcl_backfill_t backfill[BACKFILL_WORKERS];
+  uint64_t backfill_next, backfill_end;  // owned by filler, not given yet
+  char* upstream_url;
+  uint64_t upstream_height, upstream_call_blocks;
+  rcl_upstream_mode upstream_mode;
+
+  rcl_engine_t* engine;  // NULL for a db of its own
+  uint64_t heat, heat_scanned;  // see rcl_engine_balance
 
   // DB state
+  pthread_mutex_t lock;  // writers and the ranges
   FILE* manifest;
   atomic_size_t blocks_count, logs_count;
+  vector_t ranges;  // <rcl_range_t>, completed blocks, sorted and merged
+  atomic_size_t completed;  // the window has no gaps before it
+  vector_t imports;         // <rcl_range_t>, reserved by rcl_import
 
   // Data pages
   vector_t blocks_pages;  // <file_t>
   vector_t data_pages;    // <rcl_page_t>
+
+  vector_t replicas;  // <rcl_replica_t*>, followers or the leader
+
+  // Standing filters, queries read the slots without the lock. A removed
+  // filter leaves its slot at once and is freed when no reader holds it.
+  _Atomic(rcl_standing_t*) standing[STANDING_FILTERS_MAX];
+  atomic_size_t standing_size;  // of used slots, some may be empty
+  uint64_t standing_id;         // the last given one
+  atomic_size_t standing_readers;
+  rcl_standing_t* standing_retired[STANDING_FILTERS_MAX];
+  size_t standing_retired_size;
+
+  slots_t summaries;  // <_Atomic(rcl_summary_t*)>, of blocks pages
+
+  // Counts what inserts leave behind, see rcl_filler
+  pthread_t filler;
+  pthread_cond_t filler_wake;
+  atomic_bool filler_stop;
+
+  // Ingest pacing by the query latency, see rcl_schedule
+  atomic_uint_fast64_t slo_latency_ns;  // 0 is off
+  atomic_uint slo_percentile;
+  atomic_uint throttle;   // the level of the upstream
+  uint64_t scheduled_at;  // owned by filler, as the buckets seen then
+  uint64_t scheduled[RCL_HISTOGRAM_BUCKETS];
+
+  // Warmup after rcl_open, see rcl_warmer
+  pthread_t warmer;
+  atomic_bool warm_stop;
+  bool warmed;  // the warmer is done, pages are locked by rcl_lock_blocks
+  atomic_uint_fast64_t warm_done, warm_total;  // bytes
+
+  // Stats, see rcl_stats
+  struct {
+    atomic_uint_fast64_t queries, query_errors;
+    atomic_uint_fast64_t blocks_scanned, blooms_checked, blooms_passed;
+    atomic_uint_fast64_t logs_examined, logs_matched;
+    atomic_uint_fast64_t standing_hits, blocks_summarized;
+    stats_histogram_t query_latency;
+
+    atomic_uint_fast64_t inserts, blocks_inserted, logs_inserted;
+    stats_histogram_t insert_latency;
+  } counters;
 };
 
-static int rcl_open_blocks_page(rcl_t* self) {
+// type: rcl_replica_frame_t, rows of one commit, see rcl_replica_attach
+typedef struct {
+  uint64_t from, to;                  // blocks rows
+  uint64_t position, count;           // data cells
+  uint64_t blocks_count, logs_count;  // the watermark after the commit
+} rcl_replica_frame_t;
+
+// a follower that falls this far behind is dropped, it bootstraps again
+enum { REPLICA_FRAMES_LIMIT = 1 << 16 };
+
+// type: rcl_replica_t, a stream to a follower or from the leader
+typedef struct {
+  rcl_t* db;
+  int fd;
+  bool leader;  // the stream comes from the leader
+  atomic_bool closed;
+  pthread_t thread;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  vector_t frames;  // <rcl_replica_frame_t>, not sent yet
+} rcl_replica_t;
+
+static void rcl_replica_free(rcl_replica_t* replica);
+
+// Pages of blocks before the window are holes, they are never locked
+static size_t rcl_window_first_page(rcl_t* self) {
+  return self->window_from / BLOCKS_FILE_CAPACITY;
+}
+
+// Keeps the first pages of blocks of the window in RAM up to 'ram_limit', the
+// caller holds the lock. It's the warmer's job until it's done.
+static void rcl_lock_blocks(rcl_t* self) {
+  if (!self->warmed)
+    return;
+
+  uint64_t locked_count = self->ram_limit / BLOCKS_PAGE_SIZE;
+  for (size_t i = 0; i < self->blocks_pages.size; ++i) {
+    file_t* lfile = vector_at(&(self->blocks_pages), i);
+
+    if (locked_count > 0 && i >= rcl_window_first_page(self)) {
+      locked_count--;
+      if (file_lock(lfile))
+        rcl_error("failed to lock the file with index\n");
+    } else {
+      if (file_unlock(lfile))
+        rcl_error("failed to unlock the file with index\n");
+    }
+  }
+}
+
+static int rcl_open_blocks_page(rcl_t* self, bool fresh) {
   rcl_filepath_t filename = {0};
 
   int rc = rcl_page_filename(filename, self->dir, self->blocks_pages.size, 'b');
@@ -96,30 +278,23 @@ static int rcl_open_blocks_page(rcl_t* self) {
     return -1;
   }
 
+  // a page beyond the manifest is a leftover, the new one must be zeroed
+  if (fresh && unlink(filename) != 0 && errno != ENOENT) {
+    rcl_perror("unlink blocks page");
+    return -1;
+  }
+
   file_t* file = (file_t*)vector_add(&(self->blocks_pages));
   if (rcl_unlikely(file == NULL)) {
     return -2;
   }
 
-  size_t filesize = BLOCKS_FILE_CAPACITY * sizeof(rcl_block_t);
-  rc = file_open(file, filename, filesize);
+  rc = file_open(file, filename, BLOCKS_PAGE_SIZE);
   if (rcl_unlikely(rc != 0)) {
     return -3;
   }
 
-  uint64_t locked_count = self->ram_limit / filesize;
-  for (size_t i = 0; i < self->blocks_pages.size; ++i) {
-    file_t* lfile = vector_at(&(self->blocks_pages), i);
-
-    if (locked_count > 0) {
-      locked_count--;
-      if (file_lock(lfile))
-        rcl_error("failed to lock the file with index\n");
-    } else {
-      if (file_unlock(lfile))
-        rcl_error("failed to unlock the file with index\n");
-    }
-  }
+  rcl_lock_blocks(self);
 
   return 0;
 }
@@ -168,50 +343,181 @@ static rcl_block_t* rcl_get_block(rcl_t* self, uint64_t number) {
   return &(file_as_blocks(file)[offset]);
 }
 
-static int rcl_add_block(rcl_t* self, uint64_t block_number) {
-  for (size_t i = self->blocks_count; i <= block_number; ++i) {
+// Opens blocks up to 'to' as empty ones, they are gaps until a range is done
+static int rcl_extend_blocks(rcl_t* self, uint64_t to) {
+  for (uint64_t i = self->blocks_count; i <= to;) {
     uint64_t page, offset;
     get_position(i, BLOCKS_FILE_CAPACITY, &page, &offset);
 
+    uint64_t count = min(BLOCKS_FILE_CAPACITY - offset, to - i + 1);
+
     if (self->blocks_pages.size <= page) {
-      int status = rcl_open_blocks_page(self);
+      int status = rcl_open_blocks_page(self, true);
       if (rcl_unlikely(status != 0))
         return status;
+    } else {
+      file_t* file = vector_at(&(self->blocks_pages), page);
+      memset(&(file_as_blocks(file)[offset]), 0, count * sizeof(rcl_block_t));
     }
 
+    i += count;
+  }
+
+  return 0;
+}
+
+// Drops logs of already opened blocks
+static void rcl_clear_blocks(rcl_t* self, uint64_t from, uint64_t to) {
+  for (uint64_t i = from; i <= to;) {
+    uint64_t page, offset;
+    get_position(i, BLOCKS_FILE_CAPACITY, &page, &offset);
+
+    uint64_t count = min(BLOCKS_FILE_CAPACITY - offset, to - i + 1);
+
     file_t* file = vector_at(&(self->blocks_pages), page);
+    memset(&(file_as_blocks(file)[offset]), 0, count * sizeof(rcl_block_t));
+
+    i += count;
+  }
+}
 
-    rcl_block_t* blocks = file_as_blocks(file);
-    blocks[offset].logs_count = 0;
-    blocks[offset].offset = 0;
-    bloom_init(blocks[offset].logs_bloom);
+// type: rcl_range_t, the vector is sorted and adjacent ranges are merged
+static bool rcl_ranges_overlap(vector_t* ranges, uint64_t from, uint64_t to) {
+  for (size_t i = 0; i < ranges->size; ++i) {
+    rcl_range_t* range = vector_at(ranges, i);
+    if (range->from > to)
+      break;
+    if (range->to >= from)
+      return true;
+  }
 
-    if (i != 0) {
-      rcl_block_t* last;
+  return false;
+}
 
-      if (offset == 0) {
-        file_t* prev_file = vector_at(&(self->blocks_pages), page - 1);
-        rcl_block_t* prev_blocks = file_as_blocks(prev_file);
+static int rcl_ranges_add(vector_t* ranges, uint64_t from, uint64_t to) {
+  rcl_range_t* items = (rcl_range_t*)ranges->buffer;
 
-        last = &(prev_blocks[BLOCKS_FILE_CAPACITY - 1]);
-      } else {
-        last = &(blocks[offset - 1]);
-      }
+  size_t i = 0;
+  while (i < ranges->size && items[i].to + 1 < from)
+    ++i;
+
+  size_t j = i;
+  for (; j < ranges->size && items[j].from <= to + 1; ++j) {
+    from = min(from, items[j].from);
+    to = max(to, items[j].to);
+  }
+
+  if (j == i) {
+    if (vector_add(ranges) == NULL)
+      return -1;
+
+    items = (rcl_range_t*)ranges->buffer;
+    memmove(&(items[i + 1]), &(items[i]),
+            (ranges->size - i - 1) * sizeof(rcl_range_t));
+  } else {
+    memmove(&(items[i + 1]), &(items[j]),
+            (ranges->size - j) * sizeof(rcl_range_t));
+    ranges->size -= j - i - 1;
+  }
+
+  items[i].from = from;
+  items[i].to = to;
 
-      blocks[offset].offset = last->offset + last->logs_count;
+  return 0;
+}
+
+// The first blocks of [from, to] out of the ranges, false if there are none
+static bool rcl_ranges_gap(vector_t* ranges,
+                           uint64_t from,
+                           uint64_t to,
+                           rcl_range_t* gap) {
+  for (size_t i = 0; i < ranges->size && from <= to; ++i) {
+    rcl_range_t* range = vector_at(ranges, i);
+    if (range->to < from)
+      continue;
+    if (range->from > from) {
+      *gap = (rcl_range_t){.from = from, .to = min(to, range->from - 1)};
+      return true;
     }
+    from = range->to + 1;
+  }
+
+  if (from > to)
+    return false;
+
+  *gap = (rcl_range_t){.from = from, .to = to};
+  return true;
+}
+
+// Updates 'completed', so queries before the first gap don't take the lock.
+// The caller holds the lock.
+static void rcl_ranges_sync(rcl_t* self) {
+  uint64_t completed = self->window_from;
+  if (self->ranges.size > 0) {
+    rcl_range_t* first = vector_at(&(self->ranges), 0);
+    if (first->from <= completed)
+      completed = first->to + 1;
   }
+  self->completed = completed;
+}
 
+static int rcl_ranges_commit(rcl_t* self, uint64_t from, uint64_t to) {
+  if (rcl_ranges_add(&(self->ranges), from, to) != 0)
+    return -1;
+
+  rcl_ranges_sync(self);
   return 0;
 }
 
+// The blocks are written or reserved by an import, the caller holds the lock
+static bool rcl_ranges_taken(rcl_t* self, uint64_t from, uint64_t to) {
+  if (rcl_ranges_overlap(&(self->ranges), from, to))
+    return true;
+
+  for (size_t i = 0; i < self->imports.size; ++i) {
+    rcl_range_t* range = vector_at(&(self->imports), i);
+    if (range->from <= to && from <= range->to)
+      return true;
+  }
+
+  return false;
+}
+
+// The first gap of [from, to] without the blocks of imports, the caller holds
+// the lock
+static bool rcl_ranges_free(rcl_t* self,
+                            uint64_t from,
+                            uint64_t to,
+                            rcl_range_t* gap) {
+  while (rcl_ranges_gap(&(self->ranges), from, to, gap)) {
+    bool reserved = false;
+    for (size_t i = 0; i < self->imports.size && !reserved; ++i) {
+      rcl_range_t* range = vector_at(&(self->imports), i);
+      if (range->to < gap->from || range->from > gap->to)
+        continue;
+
+      if (range->from <= gap->from) {
+        from = range->to + 1;
+        reserved = true;
+      } else {
+        gap->to = range->from - 1;
+      }
+    }
+
+    if (!reserved)
+      return true;
+  }
+
+  return false;
+}
+
 static rcl_result rcl_state_read(rcl_t* t) {
   int err = fseek(t->manifest, 0, SEEK_SET);
   if (err != 0)
     return RCLE_FILESYSTEM;
 
   size_t blocks, logs;
-  int count = fscanf(t->manifest, "%" PRIu64 " %" PRIu64 "", &blocks, &logs);
+  int count = fscanf(t->manifest, "%" SCNu64 " %" SCNu64 "", &blocks, &logs);
 
   t->blocks_count = blocks;
   t->logs_count = logs;
@@ -219,21 +525,52 @@ static rcl_result rcl_state_read(rcl_t* t) {
   if (count != 2)
     return RCLE_FILESYSTEM;
 
+  vector_reset(&(t->ranges));
+
+  rcl_range_t range;
+  while (fscanf(t->manifest, "%" SCNu64 " %" SCNu64 "", &(range.from),
+                &(range.to)) == 2) {
+    if (rcl_ranges_add(&(t->ranges), range.from, range.to) != 0)
+      return RCLE_OUT_OF_MEMORY;
+  }
+
+  // the manifest before out of order ranges, all blocks are contiguous
+  if (t->ranges.size == 0 && t->blocks_count > 0) {
+    if (rcl_ranges_add(&(t->ranges), 0, t->blocks_count - 1) != 0)
+      return RCLE_OUT_OF_MEMORY;
+  }
+  rcl_ranges_sync(t);
+
   rcl_debug("readed state: blocks = %zu, logs = %zu\n", t->blocks_count,
             t->logs_count);
 
   return RCLE_OK;
 }
 
+static bool rcl_state_print(FILE* out,
+                            uint64_t blocks,
+                            uint64_t logs,
+                            vector_t* ranges) {
+  if (fprintf(out, "%" PRIu64 " %" PRIu64 "\n", blocks, logs) <= 0)
+    return false;
+
+  for (size_t i = 0; i < ranges->size; ++i) {
+    rcl_range_t* range = vector_at(ranges, i);
+    if (fprintf(out, "%" PRIu64 " %" PRIu64 "\n", range->from, range->to) <= 0)
+      return false;
+  }
+
+  return true;
+}
+
 static rcl_result rcl_state_write(rcl_t* t) {
   if (fseek(t->manifest, 0, SEEK_SET) != 0) {
     rcl_perror("state fseek");
     return RCLE_FILESYSTEM;
   }
 
-  int bytes = fprintf(t->manifest, "%" PRIu64 " %" PRIu64 "", t->blocks_count,
-                      t->logs_count);
-  if (bytes <= 0)
+  if (!rcl_state_print(t->manifest, t->blocks_count, t->logs_count,
+                       &(t->ranges)))
     return RCLE_FILESYSTEM;
 
   if (fflush(t->manifest)) {
@@ -241,6 +578,12 @@ static rcl_result rcl_state_write(rcl_t* t) {
     return RCLE_FILESYSTEM;
   }
 
+  // merged ranges make the manifest shorter
+  if (ftruncate(fileno(t->manifest), ftell(t->manifest)) != 0) {
+    rcl_perror("state ftruncate");
+    return RCLE_FILESYSTEM;
+  }
+
   rcl_debug("writed state: blocks = %zu, logs = %zu\n", t->blocks_count,
             t->logs_count);
 
@@ -266,12 +609,12 @@ static rcl_result rcl_db_restore(rcl_t* self, const char* state_filename) {
     return RCLE_UNKNOWN;
 
   for (uint64_t i = 0; i < blocks_pages_count; ++i) {
-    if (rcl_open_blocks_page(self) != 0)
+    if (rcl_open_blocks_page(self, false) != 0)
       return RCLE_FILESYSTEM;
   }
 
   if (self->blocks_pages.size == 0)
-    if (rcl_open_blocks_page(self) != 0)
+    if (rcl_open_blocks_page(self, true) != 0)
       return RCLE_FILESYSTEM;
 
   // data pages
@@ -305,7 +648,7 @@ static rcl_result rcl_db_init(rcl_t* self, const char* state_filename) {
 
   if (!vector_init(&(self->blocks_pages), 1, sizeof(file_t)))
     return RCLE_UNKNOWN;
-  if (rcl_open_blocks_page(self) != 0)
+  if (rcl_open_blocks_page(self, true) != 0)
     return RCLE_FILESYSTEM;
 
   if (!vector_init(&(self->data_pages), 1, sizeof(rcl_page_t)))
@@ -322,179 +665,3030 @@ static rcl_result rcl_db_init(rcl_t* self, const char* state_filename) {
   return RCLE_OK;
 }
 
-static rcl_result rcl_upstream_callback(vector_t* logs, void* data) {
-  return rcl_insert((rcl_t*)data, logs->size, (rcl_log_t*)(logs->buffer));
+static rcl_result rcl_upstream_callback(uint64_t from,
+                                        uint64_t to,
+                                        vector_t* logs,
+                                        void* data);
+
+static bool rcl_window_contains(rcl_t* self, uint64_t from, uint64_t to) {
+  return from >= self->window_from && to < self->window_to;
 }
 
-rcl_result rcl_open(char* dir, uint64_t ram_limit, rcl_t** db_ptr) {
-  rcl_t* self = (rcl_t*)malloc(sizeof(rcl_t));
-  if (self == NULL) {
-    rcl_perror("malloc rcl_t");
-    return RCLE_OUT_OF_MEMORY;
-  }
+// Written blocks must lie inside the window, a shard isn't reopened narrower
+static bool rcl_window_check(rcl_t* self) {
+  if (self->ranges.size == 0)
+    return true;
 
-  *db_ptr = self;
+  rcl_range_t* first = vector_at(&(self->ranges), 0);
+  rcl_range_t* last = vector_at(&(self->ranges), self->ranges.size - 1);
 
-  self->ram_limit = ram_limit;
+  return rcl_window_contains(self, first->from, last->to);
+}
 
-  if (realpath(dir, self->dir) == NULL) {
-    rcl_perror("datadir's realpath");
-    return RCLE_INVALID_DATADIR;
-  }
+// type: rcl_warm_item_t, a page file of the warm set. rcl_open only maps the
+// files, the warmer reads them behind the queries: first the ones in the page
+// cache at the last rcl_free, then the blocks pages locked by 'ram_limit'.
+typedef struct {
+  char part;  // as in rcl_page_filename
+  uint64_t index;
+  uint64_t resident;  // pages of memory in the page cache
+} rcl_warm_item_t;
+
+enum { WARM_CHECK_BYTES = 1 << 20 };  // the stop is checked every 1MB
+
+// The caller holds the lock
+static file_t* rcl_warm_file(rcl_t* self, char part, uint64_t index) {
+  if (part == 'b')
+    return index < self->blocks_pages.size
+               ? vector_at(&(self->blocks_pages), index)
+               : NULL;
+
+  if (index >= self->data_pages.size)
+    return NULL;
+
+  rcl_page_t* page = vector_at(&(self->data_pages), index);
+  if (part == 'a')
+    return &(page->addresses);
+  if (part == 't')
+    return &(page->topics);
+  return NULL;
+}
 
-  rcl_filepath_t state_filename = {0};
-  int count = snprintf(state_filename, PATH_MAX, "%s/%s", self->dir, "toc.txt");
-  if (rcl_unlikely(count < 0 || count >= PATH_MAX)) {
-    return RCLE_UNKNOWN;
-  }
+// Faults a mapping in, it stays mapped until rcl_free joins the warmer
+static void rcl_warm_read(rcl_t* self, file_t file) {
+  size_t step = (size_t)sysconf(_SC_PAGESIZE);
+  (void)madvise(file.buffer, file.bytes, MADV_WILLNEED);
 
-  rcl_result result = RCLE_OK;
-  if (access(state_filename, F_OK) == 0) {
-    result = rcl_db_restore(self, state_filename);
-  } else {
-    result = rcl_db_init(self, state_filename);
+  const volatile uint8_t* data = file.buffer;
+  for (size_t i = 0; i < file.bytes; i += step) {
+    (void)data[i];
+
+    if (i % WARM_CHECK_BYTES == 0 && self->warm_stop)
+      return;
   }
 
-  if (result != RCLE_OK)
-    return result;
+  stats_add(self->warm_done, file.bytes);
+}
 
-  rcl_upstream_init(&(self->upstream),
-                    self->blocks_count == 0 ? 0 : self->blocks_count - 1,
-                    rcl_upstream_callback, self);
+static int rcl_warm_compare(const void* a, const void* b) {
+  uint64_t ra = ((const rcl_warm_item_t*)a)->resident,
+           rb = ((const rcl_warm_item_t*)b)->resident;
+  return ra < rb ? 1 : (ra > rb ? -1 : 0);
+}
 
-  return RCLE_OK;
+static bool rcl_warm_path(rcl_t* self, rcl_filepath_t path, const char* ext) {
+  int count =
+      snprintf(path, PATH_MAX, "%s/%s%s", self->dir, WARM_FILENAME, ext);
+  return count >= 0 && count < PATH_MAX;
 }
 
-void rcl_free(rcl_t* self) {
-  rcl_upstream_free(self->upstream);
+static void rcl_warm_load(rcl_t* self, vector_t* items) {
+  rcl_filepath_t path = {0};
+  if (!rcl_warm_path(self, path, ""))
+    return;
+
+  FILE* in = fopen(path, "r");
+  if (in == NULL)
+    return;  // the first start
+
+  rcl_warm_item_t item;
+  while (fscanf(in, " %c %" SCNu64 " %" SCNu64, &(item.part), &(item.index),
+                &(item.resident)) == 3) {
+    rcl_warm_item_t* it = vector_add(items);
+    if (it == NULL)
+      break;
+    *it = item;
+  }
 
-  (void)rcl_state_write(self);
+  fclose(in);
+}
 
-  if (fflush(self->manifest)) {
-    rcl_perror("state fflush");
-  }
+// Pages of memory of a mapping in the page cache
+static uint64_t rcl_warm_resident(file_t* file, uint8_t* vec, size_t step) {
+  if (mincore(file->buffer, file->bytes, vec) != 0)
+    return 0;
 
-  if (fclose(self->manifest)) {
-    rcl_perror("fclose manifest");
-  }
+  uint64_t count = 0;
+  for (size_t i = 0, n = (file->bytes + step - 1) / step; i < n; ++i)
+    count += vec[i] & 1;
+  return count;
+}
 
-  for (uint64_t i = 0; i < self->blocks_pages.size; ++i) {
-    file_t* it = (file_t*)(vector_remove_last(&(self->blocks_pages)));
-    file_close(it);
+static void rcl_warm_add(vector_t* items,
+                         file_t* file,
+                         char part,
+                         uint64_t index,
+                         uint8_t* vec,
+                         size_t step) {
+  uint64_t resident = rcl_warm_resident(file, vec, step);
+  if (resident == 0)
+    return;
+
+  rcl_warm_item_t* it = vector_add(items);
+  if (it != NULL)
+    *it = (rcl_warm_item_t){.part = part, .index = index, .resident = resident};
+}
+
+// Saves the page files in the page cache, the most resident first, they're
+// read first by the next warmer. The stages are stopped.
+static void rcl_warm_save(rcl_t* self) {
+  size_t step = (size_t)sysconf(_SC_PAGESIZE);
+  size_t largest = max(BLOCKS_PAGE_SIZE,
+                       LOGS_PAGE_CAPACITY * sizeof(rcl_cell_topics_t));
+
+  vector_t items;
+  uint8_t* vec = malloc(largest / step + 1);
+  if (vec == NULL || !vector_init(&items, 64, sizeof(rcl_warm_item_t))) {
+    free(vec);
+    return;
   }
 
+  for (uint64_t i = 0; i < self->blocks_pages.size; ++i)
+    rcl_warm_add(&items, vector_at(&(self->blocks_pages), i), 'b', i, vec,
+                 step);
+
   for (uint64_t i = 0; i < self->data_pages.size; ++i) {
-    rcl_page_t* it = (rcl_page_t*)(vector_remove_last(&(self->data_pages)));
-    rcl_page_destroy(it);
+    rcl_page_t* page = vector_at(&(self->data_pages), i);
+    rcl_warm_add(&items, &(page->addresses), 'a', i, vec, step);
+    rcl_warm_add(&items, &(page->topics), 't', i, vec, step);
   }
 
-  vector_destroy(&(self->blocks_pages));
-  vector_destroy(&(self->data_pages));
+  vector_sort(&items, rcl_warm_compare);
 
-  free(self);
-}
+  rcl_filepath_t path = {0}, staged = {0};
+  FILE* out = NULL;
+  if (rcl_warm_path(self, path, "") && rcl_warm_path(self, staged, ".tmp"))
+    out = fopen(staged, "w");
 
-rcl_result rcl_update_height(rcl_t* self, uint64_t height) {
-  return rcl_upstream_set_height(self->upstream, height);
-}
+  if (out != NULL) {
+    bool ok = true;
+    for (size_t i = 0; i < items.size && ok; ++i) {
+      rcl_warm_item_t* it = vector_at(&items, i);
+      ok = fprintf(out, "%c %" PRIu64 " %" PRIu64 "\n", it->part, it->index,
+                   it->resident) > 0;
+    }
 
-rcl_result rcl_set_upstream(rcl_t* self, const char* upstream) {
-  return rcl_upstream_set_url(self->upstream, upstream);
+    if (fclose(out) != 0 || !ok || rename(staged, path) != 0)
+      rcl_perror("save warm pages");
+  }
+
+  vector_destroy(&items);
+  free(vec);
 }
 
-rcl_result rcl_insert(rcl_t* self, size_t size, rcl_log_t* logs) {
-  rcl_result result = RCLE_OK, rc;
+static void* rcl_warmer(void* data) {
+  rcl_t* self = data;
 
-  if (size == 0)
-    return RCLE_OK;
+  vector_t items;
+  if (!vector_init(&items, 64, sizeof(rcl_warm_item_t)))
+    return NULL;
+  rcl_warm_load(self, &items);
 
-  for (rcl_log_t *log = logs, *end = logs + size; log != end;) {
-    uint64_t block_number = log->block_number;
+  // the total is known upfront for the progress
+  pthread_mutex_lock(&(self->lock));
 
-    if (rcl_unlikely(self->blocks_count > block_number + 1)) {
-      rcl_debug("add to old block, current: %zu, blocks count: %zu\n",
-                block_number, self->blocks_count);
-      result = RCLE_UNKNOWN;
-      goto error;
-    }
+  size_t first = rcl_window_first_page(self);
+  size_t pages = self->blocks_pages.size > first
+                     ? self->blocks_pages.size - first
+                     : 0;
+  pages = min(pages, (size_t)(self->ram_limit / BLOCKS_PAGE_SIZE));
 
-    if (block_number >= self->blocks_count) {
-      if (rcl_add_block(self, block_number) != 0) {
-        result = RCLE_UNKNOWN;
-        goto error;
-      }
-    }
+  bool* read = calloc(pages + 1, sizeof(bool));  // blocks pages to lock
+  if (read == NULL) {
+    pthread_mutex_unlock(&(self->lock));
+    vector_destroy(&items);
+    return NULL;
+  }
 
-    rcl_block_t* block = rcl_get_block(self, block_number);
-    assert(block != NULL);
+  uint64_t total = pages * BLOCKS_PAGE_SIZE;
+  for (size_t i = 0; i < items.size; ++i) {
+    rcl_warm_item_t* it = vector_at(&items, i);
+    file_t* file = rcl_warm_file(self, it->part, it->index);
+    if (file == NULL)
+      continue;
 
-    size_t count = 0;
-    for (; log != end && log->block_number == block_number; ++log) {
-      uint64_t page, offset;
-      get_position(self->logs_count + count, LOGS_PAGE_CAPACITY, &page,
-                   &offset);
+    if (it->part == 'b' && it->index >= first && it->index < first + pages)
+      read[it->index - first] = true;
+    else
+      total += file->bytes;
+  }
 
-      if (self->data_pages.size <= page) {
-        if (rcl_open_data_page(self) != 0) {
-          result = RCLE_UNKNOWN;
-          goto error;
-        }
-      }
+  pthread_mutex_unlock(&(self->lock));
 
-      rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
-      assert(logs_page != NULL);
+  self->warm_total = total;
 
-      bloom_add(&(block->logs_bloom), log->address);
-      file_as_addresses(logs_page->addresses)[offset] =
-          murmur64A(log->address, sizeof(rcl_address_t), HASH_SEED);
+  // files are copied under the lock, the vectors may grow meanwhile
+  for (size_t i = 0; i < items.size && !self->warm_stop; ++i) {
+    rcl_warm_item_t* it = vector_at(&items, i);
 
-      for (size_t j = 0; j < TOPICS_LENGTH; ++j) {
-        bloom_add(&(block->logs_bloom), log->topics[j]);
-        file_as_topics(logs_page->topics)[offset][j] =
-            murmur64A(log->topics[j], sizeof(rcl_hash_t), HASH_SEED);
-      }
+    pthread_mutex_lock(&(self->lock));
+    file_t* file = rcl_warm_file(self, it->part, it->index);
+    file_t copy = file != NULL ? *file : (file_t){0};
+    pthread_mutex_unlock(&(self->lock));
 
-      count++;
-    }
+    if (copy.buffer != NULL)
+      rcl_warm_read(self, copy);
+  }
 
-    block->logs_count += count;
+  vector_destroy(&items);
 
-    // mutex is not required as they are atomics
-    self->logs_count += count;
-    self->blocks_count = block_number + 1;
+  // pages are read before they're locked, so writers don't wait the disk
+  for (size_t i = first; i < first + pages && !self->warm_stop; ++i) {
+    pthread_mutex_lock(&(self->lock));
+    file_t copy = *(file_t*)vector_at(&(self->blocks_pages), i);
+    pthread_mutex_unlock(&(self->lock));
+
+    if (!read[i - first])
+      rcl_warm_read(self, copy);
+
+    pthread_mutex_lock(&(self->lock));
+    if (file_lock(vector_at(&(self->blocks_pages), i)))
+      rcl_error("failed to lock the file with index\n");
+    pthread_mutex_unlock(&(self->lock));
   }
 
-error:
-  if ((rc = rcl_state_write(self)) != RCLE_OK)
-    result = rc;
+  free(read);
 
-  return result;
+  // the limit may be changed meanwhile
+  pthread_mutex_lock(&(self->lock));
+  if (!self->warm_stop) {
+    self->warmed = true;
+    rcl_lock_blocks(self);
+  }
+  pthread_mutex_unlock(&(self->lock));
+
+  rcl_debug("warmed up \"%s\", %" PRIu64 " bytes\n", self->dir,
+            (uint64_t)self->warm_done);
+
+  return NULL;
 }
 
-// Let's select the query as a single block and clear it the same way.
-// It is necessary to avoid memory fragmentation and also to limit the size of
-// the query.
-rcl_result rcl_query_alloc(rcl_query_t** query,
-                           size_t alen,
-                           size_t tlen[TOPICS_LENGTH]) {
-  size_t bytes = sizeof(rcl_query_t) + sizeof(struct rcl_query_address) * alen;
-  for (size_t i = 0; i < TOPICS_LENGTH; ++i)
-    bytes += sizeof(struct rcl_query_topics[TOPICS_LENGTH]) * tlen[i];
+static void rcl_block_matches(rcl_t* self,
+                              rcl_block_t* block,
+                              rcl_filter_t* filter,
+                              uint64_t* count);
+static void rcl_filter_hash(rcl_filter_t* filter);
 
-  if (bytes > RCL_QUERY_SIZE_LIMIT)
-    return RCLE_TOO_LARGE_QUERY;
+// The count of the 'number' block, its page is opened by rcl_standing_extend
+static uint64_t* rcl_standing_at(rcl_standing_t* st, uint64_t number) {
+  uint64_t page, offset;
+  get_position(number, BLOCKS_FILE_CAPACITY, &page, &offset);
 
-  uint8_t* ptr = malloc(bytes);
-  if (ptr == NULL) {
-    rcl_perror("malloc rcl_query_t");
-    return RCLE_OUT_OF_MEMORY;
-  }
+  file_t* file = slots_at(&(st->pages), page);
+  return &(((uint64_t*)file->buffer)[offset]);
+}
 
-  *query = (void*)ptr;
-  ptr += sizeof(rcl_query_t);
+static int rcl_standing_filename(rcl_filepath_t filename,
+                                 const char* dirname,
+                                 uint64_t index,
+                                 uint64_t id) {
+  int count = snprintf(filename, PATH_MAX, "%s/%02" PRIx64 ".f%" PRIu64 ".rcl",
+                       dirname, index, id);
+  return count < 0 || count >= PATH_MAX ? -1 : 0;
+}
 
-  (*query)->address = (void*)ptr;
-  ptr += sizeof(struct rcl_query_address) * alen;
+// Opens pages of counts up to the 'to' block, the caller holds the lock. The
+// pages don't move, readers of the blocks under 'next' index them meanwhile.
+static int rcl_standing_extend(rcl_t* self, rcl_standing_t* st, uint64_t to) {
+  uint64_t size;
+  while ((size = slots_size(&(st->pages))) <= to / BLOCKS_FILE_CAPACITY) {
+    rcl_filepath_t filename = {0};
+    if (rcl_standing_filename(filename, self->dir, size, st->id))
+      return -1;
+
+    file_t* file = slots_add(&(st->pages));
+    if (file == NULL)
+      return -2;
+
+    if (file_open(file, filename, BLOCKS_FILE_CAPACITY * sizeof(uint64_t))) {
+      slots_remove_last(&(st->pages));
+      return -3;
+    }
+  }
+
+  return 0;
+}
+
+static uint64_t rcl_standing_block(rcl_t* self,
+                                   rcl_standing_t* st,
+                                   uint64_t number) {
+  rcl_block_t* block = rcl_get_block(self, number);
+  if (block->logs_count == 0)
+    return 0;
+  if (!st->filter.any)
+    return block->logs_count;
+
+  uint64_t count = 0;
+  if (rcl_block_check(block, &(st->filter)))
+    rcl_block_matches(self, block, &(st->filter), &count);
+  return count;
+}
+
+// Writes the counts of the [from, to] blocks and moves 'next' past them, the
+// caller holds the lock. NULL 'counts' are counted here.
+static void rcl_standing_write(rcl_t* self,
+                               rcl_standing_t* st,
+                               uint64_t from,
+                               uint64_t to,
+                               const uint64_t* counts) {
+  uint64_t total =
+      from > self->window_from ? *rcl_standing_at(st, from - 1) : 0;
+
+  for (uint64_t number = from; number <= to; ++number) {
+    total += counts != NULL ? counts[number - from]
+                            : rcl_standing_block(self, st, number);
+    *rcl_standing_at(st, number) = total;
+  }
+
+  st->next = to + 1;  // readers see the counts before it
+}
+
+// Keeps the filters up to date with the committed [from, to] blocks, the
+// caller holds the lock. A short range at 'next' is counted right away, the
+// head block may be continued, so it's counted again. The rest is left to
+// the filler.
+static void rcl_standing_commit(rcl_t* self, uint64_t from, uint64_t to) {
+  bool lagging = false;
+
+  for (size_t i = 0; i < self->standing_size; ++i) {
+    rcl_standing_t* st = self->standing[i];
+    if (st == NULL)
+      continue;
+
+    uint64_t next = st->next;
+    if (st->removed || next < from || next > to + 1) {
+      lagging = lagging || (!st->removed && next < from);
+      continue;
+    }
+
+    if (to - from < STANDING_INLINE_BLOCKS &&
+        rcl_standing_extend(self, st, to) == 0) {
+      rcl_standing_write(self, st, from, to, NULL);
+    } else {
+      st->next = from;
+      lagging = true;
+    }
+  }
+
+  if (lagging)
+    pthread_cond_signal(&(self->filler_wake));
+}
+
+// The last block of the completed range with 'from', at most
+// STANDING_FILL_BLOCKS of it. The caller holds the lock.
+static bool rcl_standing_span(rcl_t* self, uint64_t from, uint64_t* to) {
+  for (size_t i = 0; i < self->ranges.size; ++i) {
+    rcl_range_t* range = vector_at(&(self->ranges), i);
+    if (range->from <= from && from <= range->to) {
+      *to = min(range->to, from + STANDING_FILL_BLOCKS - 1);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Counts the next chunk of a filter without the lock, the caller holds it.
+// False if there's nothing to count or an insert has moved 'next' meanwhile.
+static bool rcl_standing_fill(rcl_t* self,
+                              rcl_standing_t* st,
+                              uint64_t* counts) {
+  uint64_t from = st->next, to;
+  if (!rcl_standing_span(self, from, &to) ||
+      rcl_standing_extend(self, st, to) != 0)
+    return false;
+
+  // it's a reader meanwhile, a removal doesn't free the filter
+  self->standing_readers++;
+  pthread_mutex_unlock(&(self->lock));
+  for (uint64_t number = from; number <= to; ++number)
+    counts[number - from] = rcl_standing_block(self, st, number);
+  pthread_mutex_lock(&(self->lock));
+  self->standing_readers--;
+
+  if (st->next != from || st->removed)
+    return false;
+
+  rcl_standing_write(self, st, from, to, counts);
+  return true;
+}
+
+static bool rcl_standing_path(rcl_t* self,
+                              rcl_filepath_t path,
+                              const char* ext) {
+  int count =
+      snprintf(path, PATH_MAX, "%s/%s%s", self->dir, STANDING_FILENAME, ext);
+  return count >= 0 && count < PATH_MAX;
+}
+
+// One line per filter: the id, 'next', lengths of the sets and the keys. The
+// caller holds the lock or the filler is stopped.
+static void rcl_standing_save(rcl_t* self) {
+  rcl_filepath_t path = {0}, staged = {0};
+  if (!rcl_standing_path(self, path, "") ||
+      !rcl_standing_path(self, staged, ".tmp"))
+    return;
+
+  FILE* out = fopen(staged, "w");
+  if (out == NULL) {
+    rcl_perror("save standing filters");
+    return;
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < self->standing_size && ok; ++i) {
+    rcl_standing_t* st = self->standing[i];
+    if (st == NULL || st->removed)
+      continue;
+
+    ok = fprintf(out, "%" PRIu64 " %" PRIu64, st->id, (uint64_t)st->next) > 0;
+    for (size_t s = 0; s < FILTER_SETS && ok; ++s)
+      ok = fprintf(out, " %zu", st->filter.len[s]) > 0;
+
+    for (size_t s = 0; s < FILTER_SETS && ok; ++s) {
+      size_t size = filter_key_size(s);
+      for (size_t k = 0; k < st->filter.len[s] && ok; ++k) {
+        const uint8_t* key = st->filter.keys[s] + k * size;
+        ok = fputs(" 0x", out) >= 0;
+        for (size_t b = 0; b < size && ok; ++b)
+          ok = fprintf(out, "%02x", key[b]) > 0;
+      }
+    }
+
+    ok = ok && fputc('\n', out) != EOF;
+  }
+
+  if (fclose(out) != 0 || !ok || rename(staged, path) != 0)
+    rcl_perror("save standing filters");
+}
+
+// Sorts the keys of every set by their hashes and drops repeated ones, so the
+// order of keys in a query doesn't matter
+static void rcl_standing_keys(rcl_filter_t* filter,
+                              size_t* len,
+                              uint64_t* hashes,
+                              uint8_t* keys) {
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    size_t size = filter_key_size(i);
+    len[i] = 0;
+
+    for (size_t k = 0; k < filter->len[i]; ++k) {
+      uint64_t hash = filter->hashes[i][k];
+
+      size_t j = 0;
+      while (j < len[i] && hashes[j] < hash)
+        ++j;
+      if (j < len[i] && hashes[j] == hash)
+        continue;
+
+      memmove(&(hashes[j + 1]), &(hashes[j]),
+              (len[i] - j) * sizeof(uint64_t));
+      hashes[j] = hash;
+
+      if (keys != NULL) {
+        memmove(keys + (j + 1) * size, keys + j * size, (len[i] - j) * size);
+        memcpy(keys + j * size, filter->keys[i] + k * size, size);
+      }
+
+      ++len[i];
+    }
+
+    hashes += len[i];
+    if (keys != NULL)
+      keys += len[i] * size;
+  }
+}
+
+// Takes the keys of 'filter', its hashes are set. The caller holds the lock.
+static rcl_standing_t* rcl_standing_new(rcl_t* self,
+                                        uint64_t id,
+                                        rcl_filter_t* filter) {
+  rcl_standing_t* st = calloc(1, sizeof(rcl_standing_t));
+  if (st == NULL) {
+    rcl_perror("malloc rcl_standing_t");
+    return NULL;
+  }
+
+  slots_init(&(st->pages), sizeof(file_t));
+
+  st->id = id;
+  st->next = self->window_from;
+  st->removed = false;
+
+  rcl_standing_keys(filter, st->filter.len, st->hashes, st->keys);
+
+  uint64_t* hashes = st->hashes;
+  uint8_t* keys = st->keys;
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    st->filter.hashes[i] = hashes;
+    st->filter.keys[i] = keys;
+    st->filter.any = st->filter.any || st->filter.len[i] > 0;
+
+    hashes += st->filter.len[i];
+    keys += st->filter.len[i] * filter_key_size(i);
+  }
+
+  return st;
+}
+
+static void rcl_standing_free(rcl_standing_t* st) {
+  for (size_t i = 0; i < slots_size(&(st->pages)); ++i)
+    file_close(slots_at(&(st->pages), i));
+  slots_destroy(&(st->pages));
+  free(st);
+}
+
+// Empties the slots of removed filters and frees them with their pages once
+// there are no readers, the caller holds the lock. Readers are counted before
+// they load a slot, so the ones that could take a retired filter are done
+// when the count is seen to be zero after the slot is emptied.
+static void rcl_standing_reclaim(rcl_t* self) {
+  for (size_t i = 0; i < self->standing_size; ++i) {
+    rcl_standing_t* st = self->standing[i];
+    if (st == NULL || !st->removed ||
+        self->standing_retired_size == STANDING_FILTERS_MAX)
+      continue;
+
+    self->standing[i] = NULL;
+    self->standing_retired[self->standing_retired_size++] = st;
+  }
+
+  if (self->standing_readers != 0)
+    return;
+
+  for (size_t i = 0; i < self->standing_retired_size; ++i)
+    rcl_standing_free(self->standing_retired[i]);
+  self->standing_retired_size = 0;
+}
+
+// Counts are valid up to the first not completed block after the last save
+static uint64_t rcl_standing_valid(rcl_t* self, uint64_t next) {
+  for (size_t i = 0; i < self->ranges.size; ++i) {
+    rcl_range_t* range = vector_at(&(self->ranges), i);
+    if (range->from <= self->window_from && next <= range->to + 1)
+      return max(next, self->window_from);
+  }
+
+  return self->window_from;
+}
+
+static rcl_result rcl_standing_load(rcl_t* self) {
+  rcl_filepath_t path = {0};
+  if (!rcl_standing_path(self, path, ""))
+    return RCLE_UNKNOWN;
+
+  FILE* in = fopen(path, "r");
+  if (in == NULL)
+    return RCLE_OK;  // there are no filters
+
+  rcl_result result = RCLE_OK;
+  uint64_t id, next;
+  rcl_filter_t filter = {0};
+
+  while (fscanf(in, "%" SCNu64 " %" SCNu64, &id, &next) == 2) {
+    uint64_t hashes[STANDING_KEYS_MAX];
+    uint8_t keys[STANDING_KEYS_MAX * sizeof(rcl_hash_t)], *key = keys;
+    size_t count = 0;
+
+    for (size_t i = 0; i < FILTER_SETS && result == RCLE_OK; ++i) {
+      if (fscanf(in, " %zu", &(filter.len[i])) != 1 ||
+          (count += filter.len[i]) > STANDING_KEYS_MAX)
+        result = RCLE_INVALID_DATADIR;
+    }
+
+    for (size_t i = 0, hashed = 0; i < FILTER_SETS && result == RCLE_OK; ++i) {
+      filter.keys[i] = key;
+      filter.hashes[i] = hashes + hashed;
+      hashed += filter.len[i];
+
+      for (size_t k = 0; k < filter.len[i] && result == RCLE_OK; ++k) {
+        char encoded[2 + 2 * sizeof(rcl_hash_t) + 1];
+        if (fscanf(in, " %66s", encoded) != 1 ||
+            strlen(encoded) != 2 + 2 * filter_key_size(i))
+          result = RCLE_INVALID_DATADIR;
+        else
+          hex2bin(key, encoded, (int)filter_key_size(i));
+        key += filter_key_size(i);
+      }
+    }
+
+    if (result != RCLE_OK || self->standing_size == STANDING_FILTERS_MAX)
+      break;
+
+    rcl_filter_hash(&filter);
+    rcl_standing_t* st = rcl_standing_new(self, id, &filter);
+    if (st == NULL) {
+      result = RCLE_OUT_OF_MEMORY;
+      break;
+    }
+
+    st->next = rcl_standing_valid(self, next);
+    if (st->next > self->window_from &&
+        rcl_standing_extend(self, st, st->next - 1) != 0) {
+      rcl_standing_free(st);
+      result = RCLE_FILESYSTEM;
+      break;
+    }
+
+    self->standing[self->standing_size] = st;
+    self->standing_size++;  // readers see the slot set
+    self->standing_id = max(self->standing_id, id);
+  }
+
+  if (result != RCLE_OK)
+    rcl_error("malformed \"%s\"\n", path);
+
+  fclose(in);
+  return result;
+}
+
+// type: rcl_summary_t, counts of the keys of a sealed blocks page: of its
+// addresses, topics at every position and the pairs of an address and a
+// topic. A page is sealed when its blocks
+// are completed and the head is past it, so the counts never change. A query
+// of such keys counts a page inside its range by lookups instead of a scan.
+typedef struct {
+  uint64_t key, count;
+} rcl_summary_entry_t;
+
+typedef struct {
+  uint64_t from, to;  // blocks, the part of the page inside the window
+  uint64_t logs;      // of all the blocks
+  uint64_t size;      // entries, sorted by keys
+} rcl_summary_header_t;
+
+typedef struct {
+  rcl_summary_header_t header;
+  const rcl_summary_entry_t* entries;
+  file_t file;
+} rcl_summary_t;
+
+// Keys of the kinds and of the topic positions mustn't meet, address hashes
+// are taken as they are
+static uint64_t rcl_summary_topic(uint64_t topic, size_t position) {
+  return topic ^ (0x9e3779b97f4a7c15ull * (position + 1));
+}
+
+static uint64_t rcl_summary_pair(uint64_t address,
+                                 uint64_t topic,
+                                 size_t position) {
+  return (address * 0xff51afd7ed558ccdull) ^
+         rcl_summary_topic(topic, position) ^ 0xc4ceb9fe1a85ec53ull;
+}
+
+// type: rcl_summary_table_t, open addressing by the low bits of keys (they're
+// hashes), a free slot has no count
+typedef struct {
+  rcl_summary_entry_t* slots;
+  size_t capacity, size;
+} rcl_summary_table_t;
+
+enum { SUMMARY_TABLE_MIN = 1 << 16 };
+
+static void rcl_summary_table_put(rcl_summary_entry_t* slots,
+                                  size_t capacity,
+                                  rcl_summary_entry_t entry) {
+  size_t i = (size_t)entry.key & (capacity - 1);
+  while (slots[i].count != 0)
+    i = (i + 1) & (capacity - 1);
+  slots[i] = entry;
+}
+
+static bool rcl_summary_table_grow(rcl_summary_table_t* table) {
+  size_t capacity =
+      table->capacity == 0 ? SUMMARY_TABLE_MIN : 2 * table->capacity;
+
+  rcl_summary_entry_t* slots = calloc(capacity, sizeof(rcl_summary_entry_t));
+  if (slots == NULL) {
+    rcl_perror("malloc summary table");
+    return false;
+  }
+
+  for (size_t i = 0; i < table->capacity; ++i)
+    if (table->slots[i].count != 0)
+      rcl_summary_table_put(slots, capacity, table->slots[i]);
+
+  free(table->slots);
+  table->slots = slots;
+  table->capacity = capacity;
+  return true;
+}
+
+static bool rcl_summary_table_add(rcl_summary_table_t* table, uint64_t key) {
+  if (2 * (table->size + 1) > table->capacity &&
+      !rcl_summary_table_grow(table))
+    return false;
+
+  size_t i = (size_t)key & (table->capacity - 1);
+  for (; table->slots[i].count != 0; i = (i + 1) & (table->capacity - 1)) {
+    if (table->slots[i].key == key) {
+      ++(table->slots[i].count);
+      return true;
+    }
+  }
+
+  table->slots[i] = (rcl_summary_entry_t){.key = key, .count = 1};
+  ++(table->size);
+  return true;
+}
+
+static int rcl_summary_compare(const void* a, const void* b) {
+  uint64_t ka = ((const rcl_summary_entry_t*)a)->key,
+           kb = ((const rcl_summary_entry_t*)b)->key;
+  return ka < kb ? -1 : (ka > kb ? 1 : 0);
+}
+
+static int rcl_summary_filename(rcl_t* self,
+                                rcl_filepath_t filename,
+                                uint64_t page,
+                                const char* ext) {
+  int count = snprintf(filename, PATH_MAX, "%s/%02" PRIx64 ".s.rcl%s",
+                       self->dir, page, ext);
+  return count < 0 || count >= PATH_MAX ? -1 : 0;
+}
+
+// Maps the summary of the [from, to] blocks of a page, NULL if there's none
+// or it's of other blocks, e.g. of a narrower window
+static rcl_summary_t* rcl_summary_open(rcl_t* self,
+                                       uint64_t page,
+                                       uint64_t from,
+                                       uint64_t to) {
+  rcl_filepath_t filename = {0};
+  struct stat info;
+  if (rcl_summary_filename(self, filename, page, "") != 0 ||
+      stat(filename, &info) != 0 ||
+      (size_t)info.st_size < sizeof(rcl_summary_header_t))
+    return NULL;
+
+  rcl_summary_t* summary = malloc(sizeof(rcl_summary_t));
+  if (summary == NULL) {
+    rcl_perror("malloc rcl_summary_t");
+    return NULL;
+  }
+
+  if (file_open(&(summary->file), filename, (size_t)info.st_size) != 0) {
+    free(summary);
+    return NULL;
+  }
+
+  uint8_t* buffer = summary->file.buffer;
+  memcpy(&(summary->header), buffer, sizeof(rcl_summary_header_t));
+  summary->entries =
+      (const rcl_summary_entry_t*)(buffer + sizeof(rcl_summary_header_t));
+
+  rcl_summary_header_t* header = &(summary->header);
+  if (header->from != from || header->to != to ||
+      sizeof(rcl_summary_header_t) +
+              header->size * sizeof(rcl_summary_entry_t) !=
+          (size_t)info.st_size) {
+    file_close(&(summary->file));
+    free(summary);
+    return NULL;
+  }
+
+  return summary;
+}
+
+// Counts the keys of the [from, to] blocks without the lock, the file is
+// renamed in place once it's written
+static bool rcl_summary_build(rcl_t* self,
+                              uint64_t page,
+                              uint64_t from,
+                              uint64_t to) {
+  rcl_summary_table_t table = {0};
+  rcl_summary_header_t header = {.from = from, .to = to};
+  bool ok = rcl_summary_table_grow(&table);
+
+  for (uint64_t number = from; number <= to && ok; ++number) {
+    if (self->filler_stop)
+      ok = false;
+
+    rcl_block_t* block = rcl_get_block(self, number);
+    header.logs += block->logs_count;
+
+    uint64_t l = block->offset, r = block->offset + block->logs_count;
+    for (; l < r && ok; ++l) {
+      rcl_page_t* logs_page =
+          vector_at(&(self->data_pages), l / LOGS_PAGE_CAPACITY);
+      uint64_t address =
+          file_as_addresses(logs_page->addresses)[l % LOGS_PAGE_CAPACITY];
+      uint64_t* topics =
+          file_as_topics(logs_page->topics)[l % LOGS_PAGE_CAPACITY];
+
+      ok = rcl_summary_table_add(&table, address);
+      for (size_t p = 0; p < TOPICS_LENGTH && ok; ++p)
+        ok = rcl_summary_table_add(&table, rcl_summary_topic(topics[p], p)) &&
+             rcl_summary_table_add(&table,
+                                   rcl_summary_pair(address, topics[p], p));
+    }
+  }
+
+  rcl_filepath_t filename = {0}, staged = {0};
+  ok = ok && rcl_summary_filename(self, filename, page, "") == 0 &&
+       rcl_summary_filename(self, staged, page, ".tmp") == 0;
+
+  if (ok) {
+    size_t size = 0;
+    for (size_t i = 0; i < table.capacity; ++i)
+      if (table.slots[i].count != 0)
+        table.slots[size++] = table.slots[i];
+
+    qsort(table.slots, size, sizeof(rcl_summary_entry_t),
+          rcl_summary_compare);
+    header.size = size;
+
+    int fd = open(staged, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0600);
+    ok = fd >= 0 &&
+         file_write_all(fd, &header, sizeof(header)) == 0 &&
+         file_write_all(fd, table.slots, size * sizeof(rcl_summary_entry_t)) ==
+             0;
+    if (fd >= 0 && close(fd) != 0)
+      ok = false;
+
+    if (!ok || rename(staged, filename) != 0) {
+      rcl_perror("write blocks summary");
+      ok = false;
+    }
+  }
+
+  free(table.slots);
+  return ok;
+}
+
+// The part of a blocks page inside the window, false if it isn't sealed. The
+// last page of a bounded window is never sealed, its last block may be
+// continued. The caller holds the lock.
+static bool rcl_summary_sealed(rcl_t* self,
+                               uint64_t page,
+                               uint64_t* from,
+                               uint64_t* to) {
+  *from = max(page * BLOCKS_FILE_CAPACITY, self->window_from);
+  *to = min(page * BLOCKS_FILE_CAPACITY + BLOCKS_FILE_CAPACITY - 1,
+            self->window_to - 1);
+  if (*from > *to || self->blocks_count <= *to + 1)
+    return false;
+
+  for (size_t i = 0; i < self->ranges.size; ++i) {
+    rcl_range_t* range = vector_at(&(self->ranges), i);
+    if (range->from <= *from && *to <= range->to)
+      return true;
+  }
+
+  return false;
+}
+
+// Summarizes the first sealed page without a summary, the caller holds the
+// lock. False if there's none or it has failed, it's retried later.
+static bool rcl_summary_next(rcl_t* self) {
+  for (size_t page = rcl_window_first_page(self);
+       page < self->blocks_pages.size; ++page) {
+    // zeroed slots are NULL, scans index them meanwhile
+    while (slots_size(&(self->summaries)) <= page) {
+      if (slots_add(&(self->summaries)) == NULL)
+        return false;
+    }
+
+    uint64_t from, to;
+    if (*(_Atomic(rcl_summary_t*)*)slots_at(&(self->summaries), page) !=
+            NULL ||
+        !rcl_summary_sealed(self, page, &from, &to))
+      continue;
+
+    // a summary of the last run is taken as is
+    pthread_mutex_unlock(&(self->lock));
+    rcl_summary_t* summary = rcl_summary_open(self, page, from, to);
+    if (summary == NULL && rcl_summary_build(self, page, from, to))
+      summary = rcl_summary_open(self, page, from, to);
+    pthread_mutex_lock(&(self->lock));
+
+    if (summary == NULL)
+      return false;
+
+    *(_Atomic(rcl_summary_t*)*)slots_at(&(self->summaries), page) = summary;
+    return true;
+  }
+
+  return false;
+}
+
+static rcl_summary_t* rcl_summary_get(rcl_t* self, uint64_t page) {
+  if (page >= slots_size(&(self->summaries)))
+    return NULL;
+  return *(_Atomic(rcl_summary_t*)*)slots_at(&(self->summaries), page);
+}
+
+static void rcl_summary_free(rcl_summary_t* summary) {
+  file_close(&(summary->file));
+  free(summary);
+}
+
+// Queries of addresses, of topics at one position or of both are summarized
+static bool rcl_summary_shape(rcl_filter_t* filter) {
+  size_t positions = 0;
+  for (size_t i = 1; i < FILTER_SETS; ++i)
+    if (filter->len[i] > 0)
+      ++positions;
+  return positions <= 1;
+}
+
+static uint64_t rcl_summary_find(rcl_summary_t* summary, uint64_t key) {
+  size_t l = 0, r = summary->header.size;
+  while (l < r) {
+    size_t m = l + (r - l) / 2;
+    if (summary->entries[m].key < key)
+      l = m + 1;
+    else
+      r = m;
+  }
+
+  return l < summary->header.size && summary->entries[l].key == key
+             ? summary->entries[l].count
+             : 0;
+}
+
+// A key of a set given twice still matches a log once
+static bool rcl_summary_repeated(const uint64_t* hashes, size_t k) {
+  for (size_t j = 0; j < k; ++j)
+    if (hashes[j] == hashes[k])
+      return true;
+  return false;
+}
+
+// Logs of a summarized page matching a filter of rcl_summary_shape, keys of
+// a set are alternatives, so their counts add up
+static uint64_t rcl_summary_count(rcl_summary_t* summary,
+                                  rcl_filter_t* filter) {
+  if (!filter->any)
+    return summary->header.logs;
+
+  // the topic position of the filter, if any
+  size_t set = 1;
+  while (set < FILTER_SETS - 1 && filter->len[set] == 0)
+    ++set;
+
+  const uint64_t *addresses = filter->hashes[0], *topics = filter->hashes[set];
+  size_t position = set - 1;
+  uint64_t count = 0;
+
+  if (filter->len[set] == 0) {
+    for (size_t a = 0; a < filter->len[0]; ++a)
+      if (!rcl_summary_repeated(addresses, a))
+        count += rcl_summary_find(summary, addresses[a]);
+  } else if (filter->len[0] == 0) {
+    for (size_t t = 0; t < filter->len[set]; ++t)
+      if (!rcl_summary_repeated(topics, t))
+        count += rcl_summary_find(summary,
+                                  rcl_summary_topic(topics[t], position));
+  } else {
+    for (size_t a = 0; a < filter->len[0]; ++a) {
+      if (rcl_summary_repeated(addresses, a))
+        continue;
+      for (size_t t = 0; t < filter->len[set]; ++t)
+        if (!rcl_summary_repeated(topics, t))
+          count += rcl_summary_find(
+              summary, rcl_summary_pair(addresses[a], topics[t], position));
+    }
+  }
+
+  return count;
+}
+
+// Applies the config of the upstreams to a new worker, the caller holds the
+// backfill lock
+static rcl_result rcl_backfill_config(rcl_t* self, rcl_backfill_t* worker) {
+  rcl_upstream_set_height(worker->upstream,
+                          min(self->upstream_height, worker->to));
+  rcl_upstream_set_throttle(worker->upstream, self->throttle);
+
+  rcl_result rc = rcl_upstream_set_mode(worker->upstream, self->upstream_mode,
+                                        self->upstream_call_blocks);
+  if (rc == RCLE_OK)
+    rc = rcl_upstream_set_url(worker->upstream, self->upstream_url);
+
+  return rc;
+}
+
+// Gives a free slot the span of the next gap before the head, false if there
+// are no gaps left or the URL isn't set yet, e.g. of a follower
+static bool rcl_backfill_assign(rcl_t* self, rcl_backfill_t* worker) {
+  pthread_mutex_lock(&(self->backfill_lock));
+  bool ready = self->upstream_url != NULL;
+  pthread_mutex_unlock(&(self->backfill_lock));
+
+  if (!ready || self->backfill_next >= self->backfill_end)
+    return false;
+
+  rcl_range_t gap;
+  pthread_mutex_lock(&(self->lock));
+  bool found = rcl_ranges_gap(&(self->ranges), self->backfill_next,
+                              self->backfill_end - 1, &gap);
+  pthread_mutex_unlock(&(self->lock));
+
+  if (!found) {
+    self->backfill_next = self->backfill_end;
+    return false;
+  }
+
+  gap.to = min(gap.to, gap.from + BACKFILL_SPAN_BLOCKS - 1);
+
+  rcl_upstream_t* upstream = NULL;
+  rcl_result rc =
+      rcl_upstream_init(&upstream, rcl_upstream_get_pool(self->upstream),
+                        gap.from, rcl_upstream_callback, self);
+  if (rc == RCLE_OK) {
+    pthread_mutex_lock(&(self->backfill_lock));
+    *worker = (rcl_backfill_t){
+        .upstream = upstream, .from = gap.from, .to = gap.to};
+    if ((rc = rcl_backfill_config(self, worker)) != RCLE_OK)
+      worker->upstream = NULL;
+    pthread_mutex_unlock(&(self->backfill_lock));
+  }
+
+  if (rc != RCLE_OK) {
+    rcl_error("couldn't backfill blocks [%zu, %zu]: %s\n", gap.from, gap.to,
+              rcl_strerror(rc));
+    if (upstream != NULL)
+      rcl_upstream_free(upstream);
+    return false;
+  }
+
+  rcl_info("backfill blocks [%zu, %zu]\n", gap.from, gap.to);
+  self->backfill_next = gap.to + 1;
+
+  return true;
+}
+
+// Frees the workers done with their spans and gives the free slots the next
+// ones. Called by the filler without the lock, commits of a worker take it.
+static void rcl_backfill_step(rcl_t* self) {
+  for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+    rcl_backfill_t* worker = &(self->backfill[i]);
+
+    rcl_upstream_t* done = worker->upstream;
+    if (done != NULL) {
+      if (rcl_upstream_next(done) <= worker->to)
+        continue;
+
+      pthread_mutex_lock(&(self->backfill_lock));
+      worker->upstream = NULL;
+      pthread_mutex_unlock(&(self->backfill_lock));
+
+      rcl_upstream_free(done);
+      rcl_info("backfilled blocks [%zu, %zu]\n", worker->from, worker->to);
+    }
+
+    if (!rcl_backfill_assign(self, worker))
+      break;
+  }
+}
+
+// The filler is joined
+static void rcl_backfill_free(rcl_t* self) {
+  for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+    if (self->backfill[i].upstream != NULL)
+      rcl_upstream_free(self->backfill[i].upstream);
+    self->backfill[i].upstream = NULL;
+  }
+}
+
+// Ingest pacing: every second the filler takes the percentile of the queries
+// since the last check. While the upstream has a backlog, a breach of the
+// target raises the throttle level and a met one lowers it, no queries or no
+// backlog is full speed.
+enum {
+  SCHEDULE_INTERVAL_MS = 1000,
+  SCHEDULE_BACKLOG_MIN = 1024,  // blocks, the head is followed at full speed
+  SCHEDULE_PERCENTILE_DEFAULT = 99,
+};
+
+// The bound of the bucket with the percentile, so targets are compared as
+// powers of two microseconds
+static uint64_t rcl_schedule_latency_ns(const uint64_t* buckets,
+                                        uint64_t count,
+                                        unsigned percentile) {
+  uint64_t rank = (count * percentile + 99) / 100, seen = 0;
+  for (size_t i = 0; i < RCL_HISTOGRAM_BUCKETS - 1; ++i) {
+    if ((seen += buckets[i]) >= rank)
+      return (1ull << i) * 1000;
+  }
+  return UINT64_MAX;
+}
+
+// Called by the filler, it holds the lock
+static void rcl_schedule(rcl_t* self) {
+  uint64_t now = rcl_clock_ns();
+  if (now - self->scheduled_at < SCHEDULE_INTERVAL_MS * 1000000ull)
+    return;
+  self->scheduled_at = now;
+
+  uint64_t buckets[RCL_HISTOGRAM_BUCKETS], count = 0;
+  for (size_t i = 0; i < RCL_HISTOGRAM_BUCKETS; ++i) {
+    uint64_t seen = stats_load(self->counters.query_latency.buckets[i]);
+    buckets[i] = seen - self->scheduled[i];
+    self->scheduled[i] = seen;
+    count += buckets[i];
+  }
+
+  uint64_t target = self->slo_latency_ns;
+  unsigned level = self->throttle;
+
+  uint64_t backlog = rcl_upstream_backlog(self->upstream);
+  pthread_mutex_lock(&(self->backfill_lock));
+  for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+    if (self->backfill[i].upstream != NULL)
+      backlog += rcl_upstream_backlog(self->backfill[i].upstream);
+  }
+  pthread_mutex_unlock(&(self->backfill_lock));
+
+  if (target == 0 || count == 0 || backlog < SCHEDULE_BACKLOG_MIN) {
+    level = 0;
+  } else if (rcl_schedule_latency_ns(buckets, count, self->slo_percentile) >
+             target) {
+    level = min(level + 1, (unsigned)RCL_THROTTLE_MAX);
+  } else if (level > 0) {
+    level--;
+  }
+
+  if (level != self->throttle) {
+    rcl_info("ingest throttle level %u, queries: %" PRIu64 "\n", level, count);
+    self->throttle = level;
+    rcl_upstream_set_throttle(self->upstream, level);
+
+    pthread_mutex_lock(&(self->backfill_lock));
+    for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+      if (self->backfill[i].upstream != NULL)
+        rcl_upstream_set_throttle(self->backfill[i].upstream, level);
+    }
+    pthread_mutex_unlock(&(self->backfill_lock));
+  }
+}
+
+// Starts the writeback of the rows of a commit, so the dirty pages of a
+// throttled ingest reach the disk evenly and not in bursts that stall the
+// queries. The caller holds the lock.
+static void rcl_writeback(rcl_t* self,
+                          uint64_t from,
+                          uint64_t to,
+                          uint64_t position) {
+#ifdef __linux__
+  uint64_t page, offset, count;
+  unsigned flags = SYNC_FILE_RANGE_WRITE;
+
+  for (uint64_t i = from; i <= to; i += count) {
+    get_position(i, BLOCKS_FILE_CAPACITY, &page, &offset);
+    count = min(to - i + 1, BLOCKS_FILE_CAPACITY - offset);
+
+    file_t* file = vector_at(&(self->blocks_pages), page);
+    (void)sync_file_range(file->fd, (off_t)(offset * sizeof(rcl_block_t)),
+                          (off_t)(count * sizeof(rcl_block_t)), flags);
+  }
+
+  for (uint64_t l = position; l < self->logs_count; l += count) {
+    get_position(l, LOGS_PAGE_CAPACITY, &page, &offset);
+    count = min(self->logs_count - l, LOGS_PAGE_CAPACITY - offset);
+
+    rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
+    (void)sync_file_range(logs_page->addresses.fd,
+                          (off_t)(offset * sizeof(rcl_cell_address_t)),
+                          (off_t)(count * sizeof(rcl_cell_address_t)), flags);
+    (void)sync_file_range(logs_page->topics.fd,
+                          (off_t)(offset * sizeof(rcl_cell_topics_t)),
+                          (off_t)(count * sizeof(rcl_cell_topics_t)), flags);
+  }
+#else
+  (void)self, (void)from, (void)to, (void)position;
+#endif
+}
+
+// Counts what inserts leave behind: the standing filters and the summaries of
+// sealed pages. It also paces the ingest, see rcl_schedule, and gives gaps
+// to backfill workers.
+static void* rcl_filler(void* data) {
+  rcl_t* self = data;
+
+  uint64_t* counts = malloc(STANDING_FILL_BLOCKS * sizeof(uint64_t));
+  if (counts == NULL) {
+    rcl_perror("malloc standing counts");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&(self->lock));
+  while (!self->filler_stop) {
+    pthread_mutex_unlock(&(self->lock));
+    rcl_backfill_step(self);
+    pthread_mutex_lock(&(self->lock));
+
+    rcl_schedule(self);
+
+    bool filled = false;
+    for (size_t i = 0; i < self->standing_size && !self->filler_stop; ++i) {
+      rcl_standing_t* st = self->standing[i];
+      if (st != NULL && !st->removed && rcl_standing_fill(self, st, counts))
+        filled = true;
+    }
+
+    if (self->standing_retired_size > 0)
+      rcl_standing_reclaim(self);
+
+    if (filled)
+      rcl_standing_save(self);
+    if (rcl_summary_next(self) || filled)
+      continue;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += STANDING_FILL_INTERVAL_S;
+
+    (void)pthread_cond_timedwait(&(self->filler_wake), &(self->lock),
+                                 &deadline);
+  }
+  pthread_mutex_unlock(&(self->lock));
+
+  free(counts);
+  return NULL;
+}
+
+// A filter with the keys of 'filter' (its hashes are set), they're compared
+// as sorted sets
+static rcl_standing_t* rcl_standing_find(rcl_t* self, rcl_filter_t* filter) {
+  size_t keys = 0, len[FILTER_SETS];
+  for (size_t i = 0; i < FILTER_SETS; ++i)
+    keys += filter->len[i];
+  if (keys > STANDING_KEYS_MAX)
+    return NULL;
+
+  uint64_t hashes[STANDING_KEYS_MAX];
+  rcl_standing_keys(filter, len, hashes, NULL);
+
+  keys = 0;
+  for (size_t i = 0; i < FILTER_SETS; ++i)
+    keys += len[i];
+
+  for (size_t i = 0, size = self->standing_size; i < size; ++i) {
+    rcl_standing_t* st = self->standing[i];
+    if (st != NULL && !st->removed &&
+        memcmp(len, st->filter.len, sizeof(len)) == 0 &&
+        memcmp(hashes, st->hashes, keys * sizeof(uint64_t)) == 0)
+      return st;
+  }
+
+  return NULL;
+}
+
+// Counts the part of 'filter' covered by a standing filter with the same keys
+// and moves 'filter->from' past it, the rest is left to the scan
+static rcl_result rcl_standing_lookup(rcl_t* self,
+                                      rcl_filter_t* filter,
+                                      uint64_t* result) {
+  self->standing_readers++;  // the filter isn't freed while it's read
+
+  rcl_standing_t* st = rcl_standing_find(self, filter);
+  uint64_t next = st != NULL ? st->next : 0;
+  uint64_t from = max(filter->from, self->window_from);
+  if (st == NULL || from >= next || from > filter->to) {
+    self->standing_readers--;
+    return RCLE_OK;
+  }
+
+  uint64_t to = min(filter->to, next - 1);
+  *result += *rcl_standing_at(st, to) -
+             (from > self->window_from ? *rcl_standing_at(st, from - 1) : 0);
+  filter->from = to + 1;
+
+  self->standing_readers--;
+  stats_add(self->counters.standing_hits, 1);
+
+  if (filter->limit > 0 && filter->limit < *result)
+    return RCLE_QUERY_OVERFLOW;
+  return RCLE_OK;
+}
+
+static void rcl_filler_stop(rcl_t* self);
+static void rcl_release(rcl_t* self);
+
+static rcl_result rcl_open_pooled(char* dir,
+                                  uint64_t ram_limit,
+                                  uint64_t from,
+                                  uint64_t to,
+                                  rcl_upstream_pool_t* pool,
+                                  rcl_t** db_ptr) {
+  if (from >= to)
+    return RCLE_INVALID_RANGE;
+
+  *db_ptr = NULL;
+
+  // zeroed, so a failed open releases only what it has built
+  rcl_t* self = (rcl_t*)calloc(1, sizeof(rcl_t));
+  if (self == NULL) {
+    rcl_perror("malloc rcl_t");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  if (pthread_mutex_init(&(self->lock), NULL) != 0) {
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+  if (pthread_cond_init(&(self->filler_wake), NULL) != 0) {
+    pthread_mutex_destroy(&(self->lock));
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+  if (pthread_mutex_init(&(self->backfill_lock), NULL) != 0) {
+    pthread_cond_destroy(&(self->filler_wake));
+    pthread_mutex_destroy(&(self->lock));
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+
+  self->ram_limit = ram_limit;
+  self->window_from = from;
+  self->window_to = to;
+  self->completed = from;
+  self->engine = NULL;
+  self->heat = 0;
+  self->heat_scanned = 0;
+  self->warm_stop = false;
+  self->warmed = false;
+  self->warm_done = 0;
+  self->warm_total = 0;
+  self->standing_size = 0;
+  self->standing_id = 0;
+  self->standing_readers = 0;
+  self->standing_retired_size = 0;
+  self->filler_stop = false;
+  self->slo_latency_ns = 0;
+  self->slo_percentile = SCHEDULE_PERCENTILE_DEFAULT;
+  self->throttle = 0;
+  self->scheduled_at = 0;
+  memset(self->scheduled, 0, sizeof(self->scheduled));
+  memset(&(self->counters), 0, sizeof(self->counters));
+  slots_init(&(self->summaries), sizeof(_Atomic(rcl_summary_t*)));
+
+  rcl_result result = RCLE_OK;
+  bool filler = false;
+
+  if (!vector_init(&(self->ranges), 16, sizeof(rcl_range_t)) ||
+      !vector_init(&(self->imports), 4, sizeof(rcl_range_t)) ||
+      !vector_init(&(self->replicas), 4, sizeof(rcl_replica_t*))) {
+    result = RCLE_OUT_OF_MEMORY;
+    goto error;
+  }
+
+  if (realpath(dir, self->dir) == NULL) {
+    rcl_perror("datadir's realpath");
+    result = RCLE_INVALID_DATADIR;
+    goto error;
+  }
+
+  rcl_filepath_t state_filename = {0};
+  int count = snprintf(state_filename, PATH_MAX, "%s/%s", self->dir,
+                       MANIFEST_FILENAME);
+  if (rcl_unlikely(count < 0 || count >= PATH_MAX)) {
+    result = RCLE_UNKNOWN;
+    goto error;
+  }
+
+  if (access(state_filename, F_OK) == 0) {
+    result = rcl_db_restore(self, state_filename);
+  } else {
+    result = rcl_db_init(self, state_filename);
+  }
+
+  if (result != RCLE_OK)
+    goto error;
+
+  if (!rcl_window_check(self)) {
+    rcl_error("db in \"%s\" has blocks out of [%" PRIu64 ", %" PRIu64 ")\n",
+              self->dir, from, to);
+    result = RCLE_INVALID_RANGE;
+    goto error;
+  }
+
+  if ((result = rcl_standing_load(self)) != RCLE_OK)
+    goto error;
+
+  // the head is followed from the last written block, the gaps before it
+  // are given to backfill workers from the first one
+  uint64_t next = max((uint64_t)self->blocks_count, from);
+  self->backfill_next = from;
+  self->backfill_end = next;
+  self->upstream_mode = RCL_UPSTREAM_LOGS;
+
+  result = rcl_upstream_init(&(self->upstream), pool, next,
+                             rcl_upstream_callback, self);
+  if (result != RCLE_OK)
+    goto error;
+
+  if (pthread_create(&(self->filler), NULL, rcl_filler, self) != 0) {
+    rcl_perror("create filler thread");
+    result = RCLE_UNKNOWN;
+    goto error;
+  }
+  filler = true;
+
+  if (pthread_create(&(self->warmer), NULL, rcl_warmer, self) != 0) {
+    rcl_perror("create warmer thread");
+    result = RCLE_UNKNOWN;
+    goto error;
+  }
+
+  *db_ptr = self;
+  return RCLE_OK;
+
+error:
+  // the manifest isn't rewritten, it keeps what the last close committed
+  if (filler) {
+    rcl_filler_stop(self);
+    rcl_backfill_free(self);
+  }
+  if (self->upstream != NULL)
+    rcl_upstream_free(self->upstream);
+  rcl_release(self);
+
+  return result;
+}
+
+rcl_result rcl_open(char* dir, uint64_t ram_limit, rcl_t** db_ptr) {
+  return rcl_open_pooled(dir, ram_limit, 0, UINT64_MAX, NULL, db_ptr);
+}
+
+rcl_result rcl_open_window(char* dir,
+                           uint64_t ram_limit,
+                           uint64_t from,
+                           uint64_t to,
+                           rcl_t** db_ptr) {
+  return rcl_open_pooled(dir, ram_limit, from, to, NULL, db_ptr);
+}
+
+static void rcl_engine_detach(rcl_engine_t* self, rcl_t* db);
+
+// The filler is joined, the caller doesn't hold the lock
+static void rcl_filler_stop(rcl_t* self) {
+  pthread_mutex_lock(&(self->lock));
+  self->filler_stop = true;
+  pthread_cond_signal(&(self->filler_wake));
+  pthread_mutex_unlock(&(self->lock));
+  pthread_join(self->filler, NULL);
+}
+
+void rcl_free(rcl_t* self) {
+  if (self->engine != NULL)
+    rcl_engine_detach(self->engine, self);
+
+  self->warm_stop = true;
+  pthread_join(self->warmer, NULL);
+
+  rcl_filler_stop(self);
+  rcl_backfill_free(self);
+  rcl_upstream_free(self->upstream);
+
+  for (size_t i = 0; i < self->replicas.size; ++i)
+    rcl_replica_free(*(rcl_replica_t**)vector_at(&(self->replicas), i));
+
+  (void)rcl_state_write(self);
+
+  if (fflush(self->manifest)) {
+    rcl_perror("state fflush");
+  }
+
+  rcl_warm_save(self);
+  rcl_standing_save(self);
+
+  rcl_release(self);
+}
+
+// Frees the memory and the mappings of a db, the threads are stopped. It's
+// the end of rcl_free and of a failed open.
+static void rcl_release(rcl_t* self) {
+  if (self->manifest != NULL && fclose(self->manifest)) {
+    rcl_perror("fclose manifest");
+  }
+
+  vector_destroy(&(self->replicas));
+
+  for (size_t i = 0; i < self->standing_size; ++i)
+    if (self->standing[i] != NULL)
+      rcl_standing_free(self->standing[i]);
+  for (size_t i = 0; i < self->standing_retired_size; ++i)
+    rcl_standing_free(self->standing_retired[i]);
+
+  for (size_t i = 0; i < slots_size(&(self->summaries)); ++i) {
+    rcl_summary_t* summary = rcl_summary_get(self, i);
+    if (summary != NULL)
+      rcl_summary_free(summary);
+  }
+  slots_destroy(&(self->summaries));
+
+  while (self->blocks_pages.size > 0) {
+    file_t* it = (file_t*)(vector_remove_last(&(self->blocks_pages)));
+    file_close(it);
+  }
+
+  while (self->data_pages.size > 0) {
+    rcl_page_t* it = (rcl_page_t*)(vector_remove_last(&(self->data_pages)));
+    rcl_page_destroy(it);
+  }
+
+  vector_destroy(&(self->blocks_pages));
+  vector_destroy(&(self->data_pages));
+  vector_destroy(&(self->ranges));
+  vector_destroy(&(self->imports));
+
+  free(self->upstream_url);
+
+  pthread_mutex_destroy(&(self->backfill_lock));
+  pthread_cond_destroy(&(self->filler_wake));
+  pthread_mutex_destroy(&(self->lock));
+
+  free(self);
+}
+
+// type: rcl_engine_t
+enum {
+  ENGINE_CONNECTIONS_DEFAULT = 64,
+  ENGINE_BALANCE_INTERVAL_S = 10,
+};
+
+struct rcl_engine {
+  uint64_t ram_limit;
+  rcl_upstream_pool_t* pool;
+
+  pthread_mutex_t lock;  // dbs and their heat
+  pthread_cond_t wake;
+  bool closed;
+  pthread_t balancer;
+  vector_t dbs;  // <rcl_t*>
+};
+
+// Shares the budget in pages of blocks in proportion to the heat of the dbs,
+// capped by their pages: what a capped db doesn't take goes to the others,
+// and a page left after rounding goes to the hottest one
+static void rcl_engine_shares(const uint64_t* heat,
+                              const uint64_t* pages,
+                              uint64_t* shares,
+                              size_t count,
+                              uint64_t budget) {
+  memset(shares, 0, count * sizeof(uint64_t));
+
+  while (budget > 0) {
+    double weight = 0;
+    size_t hottest = count;
+    for (size_t i = 0; i < count; ++i) {
+      if (shares[i] >= pages[i])
+        continue;
+
+      weight += (double)heat[i] + 1;  // cold dbs split it evenly
+      if (hottest == count || heat[i] > heat[hottest])
+        hottest = i;
+    }
+    if (hottest == count)
+      break;
+
+    uint64_t round = budget;
+    for (size_t i = 0; i < count; ++i) {
+      if (shares[i] >= pages[i])
+        continue;
+
+      double part = ((double)heat[i] + 1) / weight;
+      uint64_t give = (uint64_t)((double)round * part);
+      give = min(give, pages[i] - shares[i]);
+
+      shares[i] += give;
+      budget -= give;
+    }
+
+    if (budget == round) {
+      shares[hottest]++;
+      budget--;
+    }
+  }
+}
+
+// The heat of a db is the blocks scanned by its queries, the older ones are
+// halved every round. The caller holds the engine's lock.
+static void rcl_engine_balance(rcl_engine_t* self) {
+  size_t count = self->dbs.size;
+  if (count == 0)
+    return;
+
+  uint64_t* heat = malloc(3 * count * sizeof(uint64_t));
+  if (heat == NULL) {
+    rcl_perror("malloc engine shares");
+    return;
+  }
+
+  uint64_t *pages = heat + count, *shares = pages + count;
+
+  for (size_t i = 0; i < count; ++i) {
+    rcl_t* db = *(rcl_t**)vector_at(&(self->dbs), i);
+
+    uint64_t scanned = stats_load(db->counters.blocks_scanned);
+    db->heat = db->heat / 2 + (scanned - db->heat_scanned);
+    db->heat_scanned = scanned;
+    heat[i] = db->heat;
+
+    pthread_mutex_lock(&(db->lock));
+    size_t first = rcl_window_first_page(db);
+    pages[i] = db->blocks_pages.size > first ? db->blocks_pages.size - first : 0;
+    pthread_mutex_unlock(&(db->lock));
+  }
+
+  rcl_engine_shares(heat, pages, shares, count,
+                    self->ram_limit / BLOCKS_PAGE_SIZE);
+
+  for (size_t i = 0; i < count; ++i) {
+    rcl_t* db = *(rcl_t**)vector_at(&(self->dbs), i);
+
+    pthread_mutex_lock(&(db->lock));
+    db->ram_limit = shares[i] * BLOCKS_PAGE_SIZE;
+    rcl_lock_blocks(db);
+    pthread_mutex_unlock(&(db->lock));
+  }
+
+  free(heat);
+}
+
+static void* rcl_engine_balancer(void* data) {
+  rcl_engine_t* self = data;
+
+  pthread_mutex_lock(&(self->lock));
+  while (!self->closed) {
+    rcl_engine_balance(self);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ENGINE_BALANCE_INTERVAL_S;
+
+    (void)pthread_cond_timedwait(&(self->wake), &(self->lock), &deadline);
+  }
+  pthread_mutex_unlock(&(self->lock));
+
+  return NULL;
+}
+
+rcl_result rcl_engine_new(uint64_t ram_limit,
+                          size_t connections,
+                          rcl_engine_t** engine_ptr) {
+  rcl_engine_t* self = calloc(1, sizeof(rcl_engine_t));
+  if (self == NULL) {
+    rcl_perror("malloc rcl_engine_t");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  *engine_ptr = NULL;
+
+  self->ram_limit = ram_limit;
+  self->closed = false;
+
+  if (pthread_mutex_init(&(self->lock), NULL) != 0) {
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+  if (pthread_cond_init(&(self->wake), NULL) != 0) {
+    pthread_mutex_destroy(&(self->lock));
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+
+  rcl_result rc = RCLE_OK;
+  if (!vector_init(&(self->dbs), 16, sizeof(rcl_t*))) {
+    rc = RCLE_OUT_OF_MEMORY;
+    goto error;
+  }
+
+  rc = rcl_upstream_pool_init(
+      &(self->pool),
+      connections == 0 ? ENGINE_CONNECTIONS_DEFAULT : connections);
+  if (rc != RCLE_OK)
+    goto error;
+
+  if (pthread_create(&(self->balancer), NULL, rcl_engine_balancer, self) !=
+      0) {
+    rcl_perror("create balancer thread");
+    rc = RCLE_UNKNOWN;
+    goto error;
+  }
+
+  *engine_ptr = self;
+  return RCLE_OK;
+
+error:
+  if (self->pool != NULL)
+    rcl_upstream_pool_free(self->pool);
+  vector_destroy(&(self->dbs));
+
+  pthread_cond_destroy(&(self->wake));
+  pthread_mutex_destroy(&(self->lock));
+
+  free(self);
+  return rc;
+}
+
+void rcl_engine_free(rcl_engine_t* self) {
+  pthread_mutex_lock(&(self->lock));
+  self->closed = true;
+  pthread_cond_signal(&(self->wake));
+  pthread_mutex_unlock(&(self->lock));
+
+  pthread_join(self->balancer, NULL);
+
+  rcl_upstream_pool_free(self->pool);
+  vector_destroy(&(self->dbs));
+
+  pthread_cond_destroy(&(self->wake));
+  pthread_mutex_destroy(&(self->lock));
+
+  free(self);
+}
+
+rcl_result rcl_engine_open(rcl_engine_t* self, char* dir, rcl_t** db_ptr) {
+  rcl_result rc = rcl_open_pooled(dir, 0, 0, UINT64_MAX, self->pool, db_ptr);
+  if (rc != RCLE_OK)
+    return rc;
+
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_t** item = vector_add(&(self->dbs));
+  if (item != NULL) {
+    *item = *db_ptr;
+    (*db_ptr)->engine = self;
+
+    pthread_cond_signal(&(self->wake));  // its share is taken now
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  if (item == NULL) {
+    rcl_free(*db_ptr);
+    *db_ptr = NULL;
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  return RCLE_OK;
+}
+
+static void rcl_engine_detach(rcl_engine_t* self, rcl_t* db) {
+  pthread_mutex_lock(&(self->lock));
+
+  for (size_t i = 0; i < self->dbs.size; ++i) {
+    rcl_t** it = vector_at(&(self->dbs), i);
+    if (*it == db) {
+      vector_remove(&(self->dbs), it);
+      break;
+    }
+  }
+
+  pthread_cond_signal(&(self->wake));  // its share is free now
+
+  pthread_mutex_unlock(&(self->lock));
+}
+
+rcl_result rcl_update_height(rcl_t* self, uint64_t height) {
+  // the upstream of a shard stops at the end of the window
+  height = min(height, self->window_to - 1);
+
+  pthread_mutex_lock(&(self->backfill_lock));
+  self->upstream_height = height;
+  for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+    rcl_backfill_t* worker = &(self->backfill[i]);
+    if (worker->upstream != NULL)
+      rcl_upstream_set_height(worker->upstream, min(height, worker->to));
+  }
+  pthread_mutex_unlock(&(self->backfill_lock));
+
+  return rcl_upstream_set_height(self->upstream, height);
+}
+
+rcl_result rcl_set_upstream(rcl_t* self, const char* upstream) {
+  rcl_result rc = rcl_upstream_set_url(self->upstream, upstream);
+  if (rc != RCLE_OK)
+    return rc;
+
+  char* url = strdup(upstream);
+  if (url == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  pthread_mutex_lock(&(self->backfill_lock));
+  free(self->upstream_url);
+  self->upstream_url = url;
+  for (size_t i = 0; i < BACKFILL_WORKERS && rc == RCLE_OK; ++i) {
+    if (self->backfill[i].upstream != NULL)
+      rc = rcl_upstream_set_url(self->backfill[i].upstream, url);
+  }
+  pthread_mutex_unlock(&(self->backfill_lock));
+
+  return rc;
+}
+
+// Queues the commit for the followers, the caller holds the lock. Only the
+// descriptor is kept, rows are read from the pages when they're sent.
+static void rcl_replica_publish(rcl_t* self,
+                                uint64_t from,
+                                uint64_t to,
+                                uint64_t position) {
+  rcl_replica_frame_t frame = {.from = from,
+                               .to = to,
+                               .position = position,
+                               .count = self->logs_count - position,
+                               .blocks_count = self->blocks_count,
+                               .logs_count = self->logs_count};
+
+  for (size_t i = 0; i < self->replicas.size; ++i) {
+    rcl_replica_t* replica = *(rcl_replica_t**)vector_at(&(self->replicas), i);
+    if (replica->leader || replica->closed)
+      continue;
+
+    pthread_mutex_lock(&(replica->lock));
+
+    rcl_replica_frame_t* it = NULL;
+    if (replica->frames.size >= REPLICA_FRAMES_LIMIT)
+      rcl_error("follower is dropped, it's too far behind\n");
+    else if ((it = vector_add(&(replica->frames))) == NULL)
+      rcl_error("follower is dropped, no memory for frames\n");
+
+    if (it != NULL) {
+      *it = frame;
+    } else {
+      // the follower sees the end of the stream instead of waiting
+      replica->closed = true;
+      (void)shutdown(replica->fd, SHUT_RDWR);
+    }
+
+    pthread_cond_signal(&(replica->wake));
+    pthread_mutex_unlock(&(replica->lock));
+  }
+}
+
+// Logs must be sorted by block and lie inside the range
+static rcl_result rcl_insert_check(uint64_t from,
+                                   uint64_t to,
+                                   size_t size,
+                                   rcl_log_t* logs) {
+  uint64_t prev = from;
+
+  for (size_t i = 0; i < size; ++i) {
+    uint64_t block_number = logs[i].block_number;
+    if (rcl_unlikely(block_number < prev || block_number > to)) {
+      rcl_debug("log of block %zu is out of range [%zu, %zu]\n", block_number,
+                from, to);
+      return RCLE_INVALID_RANGE;
+    }
+    prev = block_number;
+  }
+
+  return RCLE_OK;
+}
+
+// The caller holds the lock. Logs are appended to the data pages in the
+// arrival order, a block only has to keep its own logs contiguous.
+static rcl_result rcl_insert_locked(rcl_t* self,
+                                    uint64_t from,
+                                    uint64_t to,
+                                    size_t size,
+                                    rcl_log_t* logs) {
+  rcl_result result = RCLE_OK;
+  uint64_t position = self->logs_count, started = rcl_clock_ns();
+  uint64_t blocks_count = self->blocks_count;
+
+  // rcl_insert may continue the last written block
+  rcl_block_t first = {0};
+  if (from < blocks_count)
+    first = *rcl_get_block(self, from);
+
+  if (to >= self->blocks_count && rcl_extend_blocks(self, to) != 0)
+    return RCLE_FILESYSTEM;
+
+  for (rcl_log_t *log = logs, *end = logs + size; log != end;) {
+    uint64_t block_number = log->block_number;
+
+    rcl_block_t* block = rcl_get_block(self, block_number);
+    assert(block != NULL);
+
+    if (block->logs_count == 0) {
+      block->offset = self->logs_count;
+    } else if (rcl_unlikely(block->offset + block->logs_count !=
+                            self->logs_count)) {
+      rcl_debug("add to old block, current: %zu, blocks count: %zu\n",
+                block_number, self->blocks_count);
+      result = RCLE_INVALID_RANGE;
+      goto rollback;
+    }
+
+    size_t count = 0;
+    for (; log != end && log->block_number == block_number; ++log) {
+      uint64_t page, offset;
+      get_position(self->logs_count + count, LOGS_PAGE_CAPACITY, &page,
+                   &offset);
+
+      if (self->data_pages.size <= page) {
+        if (rcl_open_data_page(self) != 0) {
+          result = RCLE_UNKNOWN;
+          goto rollback;
+        }
+      }
+
+      rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
+      assert(logs_page != NULL);
+
+      bloom_add(&(block->logs_bloom), log->address);
+      file_as_addresses(logs_page->addresses)[offset] =
+          murmur64A(log->address, sizeof(rcl_address_t), HASH_SEED);
+
+      for (size_t j = 0; j < TOPICS_LENGTH; ++j) {
+        bloom_add(&(block->logs_bloom), log->topics[j]);
+        file_as_topics(logs_page->topics)[offset][j] =
+            murmur64A(log->topics[j], sizeof(rcl_hash_t), HASH_SEED);
+      }
+
+      count++;
+    }
+
+    block->logs_count += count;
+
+    // mutex is not required for readers as they are atomics
+    self->logs_count += count;
+  }
+
+  if (to >= self->blocks_count)
+    self->blocks_count = to + 1;
+
+  if (rcl_ranges_commit(self, from, to) != 0) {
+    result = RCLE_OUT_OF_MEMORY;
+    goto rollback;
+  }
+
+  rcl_replica_publish(self, from, to, position);
+  rcl_standing_commit(self, from, to);
+
+  if (self->throttle > 0)
+    rcl_writeback(self, from, to, position);
+
+  if ((result = rcl_state_write(self)) == RCLE_OK) {
+    stats_add(self->counters.inserts, 1);
+    stats_add(self->counters.blocks_inserted, to - from + 1);
+    stats_add(self->counters.logs_inserted, size);
+    stats_histogram_add(&(self->counters.insert_latency),
+                        rcl_clock_ns() - started);
+  }
+
+  return result;
+
+rollback:
+  // the range isn't recorded, its blocks are gaps again and a retry writes
+  // them from scratch, as in rcl_import
+  rcl_clear_blocks(self, from, to);
+  if (from < blocks_count)
+    *rcl_get_block(self, from) = first;
+  self->blocks_count = blocks_count;
+  self->logs_count = position;
+
+  return result;
+}
+
+rcl_result rcl_insert_range(rcl_t* self,
+                            uint64_t from,
+                            uint64_t to,
+                            size_t size,
+                            rcl_log_t* logs) {
+  if (from > to || !rcl_window_contains(self, from, to))
+    return RCLE_INVALID_RANGE;
+
+  rcl_result result = rcl_insert_check(from, to, size, logs);
+  if (result != RCLE_OK)
+    return result;
+
+  pthread_mutex_lock(&(self->lock));
+
+  if (rcl_ranges_taken(self, from, to)) {
+    rcl_debug("range [%zu, %zu] is already written\n", from, to);
+    result = RCLE_RANGE_OVERLAP;
+  } else {
+    result = rcl_insert_locked(self, from, to, size, logs);
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return result;
+}
+
+// Writes the gaps of the range, the rest is written by others already: the
+// head may reach an imported range, a backfill worker a replicated one
+static rcl_result rcl_upstream_callback(uint64_t from,
+                                        uint64_t to,
+                                        vector_t* logs,
+                                        void* data) {
+  rcl_t* self = data;
+  rcl_log_t *items = (rcl_log_t*)(logs->buffer), *end = items + logs->size;
+
+  if (from > to || !rcl_window_contains(self, from, to))
+    return RCLE_INVALID_RANGE;
+
+  rcl_result result = rcl_insert_check(from, to, logs->size, items);
+  if (result != RCLE_OK)
+    return result;
+
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_range_t gap;
+  while (result == RCLE_OK && rcl_ranges_free(self, from, to, &gap)) {
+    while (items != end && items->block_number < gap.from)
+      ++items;
+
+    rcl_log_t* last = items;
+    while (last != end && last->block_number <= gap.to)
+      ++last;
+
+    result = rcl_insert_locked(self, gap.from, gap.to, (size_t)(last - items),
+                               items);
+    items = last;
+    from = gap.to + 1;
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return result;
+}
+
+rcl_result rcl_set_query_slo(rcl_t* self,
+                             uint64_t latency_ns,
+                             unsigned percentile) {
+  self->slo_percentile = percentile == 0
+                             ? SCHEDULE_PERCENTILE_DEFAULT
+                             : min(percentile, 100u);
+  self->slo_latency_ns = latency_ns;
+  return RCLE_OK;
+}
+
+rcl_result rcl_set_upstream_mode(rcl_t* self,
+                                 rcl_upstream_mode mode,
+                                 uint64_t call_blocks) {
+  rcl_result rc = rcl_upstream_set_mode(self->upstream, mode, call_blocks);
+  if (rc != RCLE_OK)
+    return rc;
+
+  pthread_mutex_lock(&(self->backfill_lock));
+  self->upstream_mode = mode;
+  self->upstream_call_blocks = call_blocks;
+  for (size_t i = 0; i < BACKFILL_WORKERS; ++i) {
+    if (self->backfill[i].upstream != NULL)
+      rcl_upstream_set_mode(self->backfill[i].upstream, mode, call_blocks);
+  }
+  pthread_mutex_unlock(&(self->backfill_lock));
+
+  return RCLE_OK;
+}
+
+rcl_result rcl_insert(rcl_t* self, size_t size, rcl_log_t* logs) {
+  if (size == 0)
+    return RCLE_OK;
+
+  uint64_t first = logs[0].block_number, last = logs[size - 1].block_number;
+  rcl_result result = RCLE_OK;
+
+  if (!rcl_window_contains(self, first, last))
+    return RCLE_INVALID_RANGE;
+
+  pthread_mutex_lock(&(self->lock));
+
+  // appends to the range before 'first', its last block may be continued and
+  // the blocks after it have no logs. A later range may be written already,
+  // e.g. by an import ahead of the head.
+  uint64_t head = self->window_from;
+  for (size_t i = 0; i < self->ranges.size; ++i) {
+    rcl_range_t* range = vector_at(&(self->ranges), i);
+    if (range->from > first)
+      break;
+    head = range->to + 1;
+  }
+
+  if (rcl_unlikely(head > first + 1)) {
+    rcl_debug("add to old block, current: %zu, head: %zu\n", first, head);
+    result = RCLE_INVALID_RANGE;
+  } else if (head <= last && rcl_ranges_taken(self, head, last)) {
+    rcl_debug("range [%zu, %zu] is already written\n", head, last);
+    result = RCLE_RANGE_OVERLAP;
+  } else {
+    uint64_t from = min(first, head);
+    if ((result = rcl_insert_check(from, last, size, logs)) == RCLE_OK)
+      result = rcl_insert_locked(self, from, last, size, logs);
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return result;
+}
+
+// type: rcl_import_part_t, whole blocks of a batch owned by one thread
+typedef struct {
+  rcl_t* db;
+  rcl_log_t* logs;
+  size_t size;
+  uint64_t position;  // of the first log in the data pages
+} rcl_import_part_t;
+
+static void* rcl_import_worker(void* data) {
+  rcl_import_part_t* part = data;
+  rcl_t* self = part->db;
+
+  uint64_t page = part->position / LOGS_PAGE_CAPACITY,
+           offset = part->position % LOGS_PAGE_CAPACITY;
+  rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
+
+  rcl_block_t* block = NULL;
+  for (size_t i = 0; i < part->size; ++i) {
+    rcl_log_t* log = &(part->logs[i]);
+
+    if (block == NULL || log->block_number != part->logs[i - 1].block_number) {
+      block = rcl_get_block(self, log->block_number);
+      if (block->logs_count == 0)
+        block->offset = part->position + i;
+    }
+
+    bloom_add(&(block->logs_bloom), log->address);
+    file_as_addresses(logs_page->addresses)[offset] =
+        murmur64A(log->address, sizeof(rcl_address_t), HASH_SEED);
+
+    for (size_t j = 0; j < TOPICS_LENGTH; ++j) {
+      bloom_add(&(block->logs_bloom), log->topics[j]);
+      file_as_topics(logs_page->topics)[offset][j] =
+          murmur64A(log->topics[j], sizeof(rcl_hash_t), HASH_SEED);
+    }
+
+    block->logs_count++;
+
+    if (++offset == LOGS_PAGE_CAPACITY) {
+      offset = 0;
+      logs_page = vector_at(&(self->data_pages), ++page);
+    }
+  }
+
+  return NULL;
+}
+
+// Splits the batch by blocks between the threads, data pages must be opened
+static void rcl_import_batch(rcl_t* self,
+                             rcl_log_t* logs,
+                             size_t size,
+                             size_t threads_count) {
+  pthread_t threads[IMPORT_THREADS_MAX];
+  rcl_import_part_t parts[IMPORT_THREADS_MAX];
+  bool started[IMPORT_THREADS_MAX] = {false};
+
+  size_t begin = 0;
+  for (size_t k = 0; k < threads_count && begin < size; ++k) {
+    size_t end = k + 1 == threads_count
+                     ? size
+                     : max(begin + 1, size * (k + 1) / threads_count);
+    while (end < size && logs[end].block_number == logs[end - 1].block_number)
+      ++end;
+
+    parts[k] = (rcl_import_part_t){.db = self,
+                                   .logs = logs + begin,
+                                   .size = end - begin,
+                                   .position = self->logs_count + begin};
+
+    started[k] =
+        pthread_create(&threads[k], NULL, rcl_import_worker, &parts[k]) == 0;
+    if (!started[k])
+      (void)rcl_import_worker(&parts[k]);
+
+    begin = end;
+  }
+
+  for (size_t k = 0; k < threads_count; ++k) {
+    if (started[k])
+      pthread_join(threads[k], NULL);
+  }
+}
+
+// Imports the whole blocks of a batch, the caller holds the lock
+static rcl_result rcl_import_locked(rcl_t* self,
+                                    rcl_log_t* logs,
+                                    size_t size,
+                                    size_t threads_count) {
+  uint64_t last_page = (self->logs_count + size - 1) / LOGS_PAGE_CAPACITY;
+  while (self->data_pages.size <= last_page) {
+    if (rcl_open_data_page(self) != 0)
+      return RCLE_FILESYSTEM;
+  }
+
+  rcl_import_batch(self, logs, size, threads_count);
+  self->logs_count += size;
+
+  return RCLE_OK;
+}
+
+// Drops the reservation of rcl_import, the caller holds the lock
+static void rcl_import_release(rcl_t* self, uint64_t from, uint64_t to) {
+  for (size_t i = 0; i < self->imports.size; ++i) {
+    rcl_range_t* it = vector_at(&(self->imports), i);
+    if (it->from == from && it->to == to) {
+      vector_remove(&(self->imports), it);
+      break;
+    }
+  }
+}
+
+rcl_result rcl_import(rcl_t* self,
+                      uint64_t from,
+                      uint64_t to,
+                      rcl_dump_format format,
+                      const char* path) {
+  if (from > to || !rcl_window_contains(self, from, to))
+    return RCLE_INVALID_RANGE;
+
+  dump_reader_t reader;
+  rcl_result result = dump_open(&reader, path, format);
+  if (result != RCLE_OK)
+    return result;
+
+  vector_t logs;
+  if (!vector_init(&logs, IMPORT_BATCH_SIZE, sizeof(rcl_log_t))) {
+    dump_close(&reader);
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads_count =
+      cpus < 1 ? 1 : (size_t)min(cpus, (long)IMPORT_THREADS_MAX);
+
+  // the range is reserved, so the lock is taken per batch and the upstream
+  // commits go on between them
+  pthread_mutex_lock(&(self->lock));
+
+  if (rcl_ranges_taken(self, from, to)) {
+    rcl_debug("range [%zu, %zu] is already written\n", from, to);
+    result = RCLE_RANGE_OVERLAP;
+  } else if (to >= self->blocks_count && rcl_extend_blocks(self, to) != 0) {
+    result = RCLE_FILESYSTEM;
+  } else {
+    rcl_range_t* reserved = vector_add(&(self->imports));
+    if (reserved != NULL)
+      *reserved = (rcl_range_t){.from = from, .to = to};
+    else
+      result = RCLE_OUT_OF_MEMORY;
+  }
+
+  uint64_t logs_count = self->logs_count, end = logs_count;
+  pthread_mutex_unlock(&(self->lock));
+
+  if (result != RCLE_OK)
+    goto exit;
+
+  uint64_t prev = from, imported = 0;
+  size_t carried = 0;  // logs of the last block, it may go on in the next batch
+  bool interleaved = false;
+
+  while ((result = dump_read(&reader, &logs, IMPORT_BATCH_SIZE)) == RCLE_OK) {
+    rcl_log_t* items = (rcl_log_t*)(logs.buffer);
+    bool last = logs.size == carried;
+
+    result = rcl_insert_check(prev, to, logs.size - carried, items + carried);
+    if (result != RCLE_OK)
+      break;
+    if (logs.size > 0)
+      prev = items[logs.size - 1].block_number;
+
+    // a block keeps its logs contiguous, other commits don't come in between
+    size_t size = logs.size;
+    while (!last && size > 0 && items[size - 1].block_number == prev)
+      --size;
+
+    if (size > 0) {
+      pthread_mutex_lock(&(self->lock));
+      interleaved = interleaved || self->logs_count != end;
+      result = rcl_import_locked(self, items, size, threads_count);
+      end = self->logs_count;
+      pthread_mutex_unlock(&(self->lock));
+
+      if (result != RCLE_OK)
+        break;
+      imported += size;
+    }
+
+    memmove(items, items + size, (logs.size - size) * sizeof(rcl_log_t));
+    logs.size -= size;
+    carried = logs.size;
+
+    if (last)
+      break;
+  }
+
+  pthread_mutex_lock(&(self->lock));
+  rcl_import_release(self, from, to);
+
+  if (result == RCLE_OK) {
+    if (to >= self->blocks_count)
+      self->blocks_count = to + 1;
+    if (rcl_ranges_commit(self, from, to) != 0)
+      result = RCLE_OUT_OF_MEMORY;
+  }
+
+  if (result == RCLE_OK) {
+    // followers get the rows of the other commits in between once more
+    rcl_replica_publish(self, from, to, logs_count);
+    rcl_standing_commit(self, from, to);
+
+    stats_add(self->counters.blocks_inserted, to - from + 1);
+    stats_add(self->counters.logs_inserted, imported);
+
+    result = rcl_state_write(self);
+    rcl_info("imported %zu logs of blocks [%zu, %zu]\n", imported, from, to);
+  } else {
+    // nothing is in the manifest yet, so the blocks are just gaps again. The
+    // data cells stay unreferenced if other commits came after them.
+    rcl_clear_blocks(self, from, to);
+    if (!interleaved && self->logs_count == end)
+      self->logs_count = logs_count;
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+exit:
+  vector_destroy(&logs);
+  dump_close(&reader);
+
+  return result;
+}
+
+// type: rcl_snapshot_t, the state under the watermark
+typedef struct {
+  uint64_t blocks_count, logs_count;
+  vector_t ranges;  // <rcl_range_t>
+
+  size_t blocks_files_count, data_files_count;
+  file_t* blocks_files;
+  rcl_page_t* data_files;
+
+  char* manifest;
+  size_t manifest_size;
+} rcl_snapshot_t;
+
+static void rcl_snapshot_destroy(rcl_snapshot_t* snapshot) {
+  vector_destroy(&(snapshot->ranges));
+  free(snapshot->blocks_files);
+  free(snapshot->data_files);
+  free(snapshot->manifest);
+}
+
+// Pages are never closed before rcl_free, so their copies stay valid. The
+// caller holds the lock.
+static rcl_result rcl_snapshot_take(rcl_t* self, rcl_snapshot_t* snapshot) {
+  rcl_result result = RCLE_OK;
+  *snapshot = (rcl_snapshot_t){0};
+
+  snapshot->blocks_count = self->blocks_count;
+  snapshot->logs_count = self->logs_count;
+
+  uint64_t blocks_files = snapshot->blocks_count + BLOCKS_FILE_CAPACITY - 1,
+           data_files = snapshot->logs_count + LOGS_PAGE_CAPACITY - 1;
+  snapshot->blocks_files_count = blocks_files / BLOCKS_FILE_CAPACITY;
+  snapshot->data_files_count = data_files / LOGS_PAGE_CAPACITY;
+
+  snapshot->blocks_files =
+      calloc(snapshot->blocks_files_count + 1, sizeof(file_t));
+  snapshot->data_files =
+      calloc(snapshot->data_files_count + 1, sizeof(rcl_page_t));
+
+  if (!vector_init(&(snapshot->ranges), self->ranges.size + 1,
+                   sizeof(rcl_range_t)) ||
+      snapshot->blocks_files == NULL || snapshot->data_files == NULL) {
+    result = RCLE_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  for (size_t i = 0; i < self->ranges.size; ++i)
+    *(rcl_range_t*)vector_add(&(snapshot->ranges)) =
+        *(rcl_range_t*)vector_at(&(self->ranges), i);
+
+  for (size_t i = 0; i < snapshot->blocks_files_count; ++i)
+    snapshot->blocks_files[i] = *(file_t*)vector_at(&(self->blocks_pages), i);
+  for (size_t i = 0; i < snapshot->data_files_count; ++i)
+    snapshot->data_files[i] = *(rcl_page_t*)vector_at(&(self->data_pages), i);
+
+  FILE* manifest =
+      open_memstream(&(snapshot->manifest), &(snapshot->manifest_size));
+  if (manifest == NULL) {
+    result = RCLE_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  if (!rcl_state_print(manifest, snapshot->blocks_count, snapshot->logs_count,
+                       &(snapshot->ranges)))
+    result = RCLE_OUT_OF_MEMORY;
+  fclose(manifest);
+
+exit:
+  return result;
+}
+
+// Logs above the watermark aren't in the copy yet
+static void rcl_block_clamp(rcl_block_t* block, uint64_t logs_count) {
+  if (block->offset + block->logs_count > logs_count)
+    block->logs_count =
+        block->offset < logs_count ? logs_count - block->offset : 0;
+}
+
+// Drops what is above the watermark: gaps may be backfilled and the head
+// block may be continued while the page is copied
+static void rcl_snapshot_blocks(rcl_snapshot_t* snapshot,
+                                rcl_block_t* blocks,
+                                uint64_t first,
+                                size_t count) {
+  rcl_range_t* ranges = (rcl_range_t*)(snapshot->ranges.buffer);
+  size_t r = 0;
+
+  for (size_t i = 0; i < count; ++i) {
+    uint64_t number = first + i;
+    while (r < snapshot->ranges.size && ranges[r].to < number)
+      ++r;
+
+    rcl_block_t* block = &(blocks[i]);
+    if (r == snapshot->ranges.size || ranges[r].from > number) {
+      memset(block, 0, sizeof(rcl_block_t));
+      continue;
+    }
+
+    rcl_block_clamp(block, snapshot->logs_count);
+  }
+}
+
+static rcl_result rcl_snapshot_write(rcl_t* self,
+                                     rcl_snapshot_t* snapshot,
+                                     int out) {
+  rcl_result rc = snapshot_write_magic(out);
+  rcl_filepath_t filename;
+
+  size_t page_size = BLOCKS_FILE_CAPACITY * sizeof(rcl_block_t);
+  rcl_block_t* blocks = malloc(page_size);
+  if (blocks == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  for (size_t i = 0; rc == RCLE_OK && i < snapshot->blocks_files_count; ++i) {
+    uint64_t first = i * BLOCKS_FILE_CAPACITY;
+    size_t count = min(BLOCKS_FILE_CAPACITY, snapshot->blocks_count - first);
+
+    memcpy(blocks, snapshot->blocks_files[i].buffer,
+           count * sizeof(rcl_block_t));
+    rcl_snapshot_blocks(snapshot, blocks, first, count);
+
+    rcl_page_filename(filename, ".", i, 'b');
+    rc = snapshot_write_buffer(out, filename + 2, blocks,
+                               count * sizeof(rcl_block_t), page_size);
+  }
+
+  free(blocks);
+
+  // data cells under the watermark are immutable, they're copied as is
+  for (size_t i = 0; rc == RCLE_OK && i < snapshot->data_files_count; ++i) {
+    rcl_page_t* page = &(snapshot->data_files[i]);
+    size_t count =
+        min(LOGS_PAGE_CAPACITY, snapshot->logs_count - i * LOGS_PAGE_CAPACITY);
+
+    rcl_page_filename(filename, ".", i, 'a');
+    rc = snapshot_write_file(out, filename + 2, page->addresses.fd,
+                             page->addresses.buffer,
+                             count * sizeof(rcl_cell_address_t),
+                             page->addresses.bytes);
+    if (rc != RCLE_OK)
+      break;
+
+    rcl_page_filename(filename, ".", i, 't');
+    rc = snapshot_write_file(out, filename + 2, page->topics.fd,
+                             page->topics.buffer,
+                             count * sizeof(rcl_cell_topics_t),
+                             page->topics.bytes);
+  }
+
+  if (rc == RCLE_OK)
+    rc = snapshot_write_buffer(out, MANIFEST_FILENAME, snapshot->manifest,
+                               snapshot->manifest_size, 0);
+  if (rc == RCLE_OK)
+    rc = snapshot_write_end(out);
+
+  rcl_info("snapshot of %s: blocks = %" PRIu64 ", logs = %" PRIu64 ": %s\n",
+           self->dir, snapshot->blocks_count, snapshot->logs_count,
+           rcl_strerror(rc));
+
+  return rc;
+}
+
+rcl_result rcl_snapshot_export(rcl_t* self, const char* path) {
+  bool is_stdout = strcmp(path, "-") == 0;
+  int out = is_stdout ? STDOUT_FILENO
+                      : open(path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0600);
+  if (out < 0) {
+    rcl_perror("open snapshot");
+    return RCLE_FILESYSTEM;
+  }
+
+  pthread_mutex_lock(&(self->lock));
+  rcl_snapshot_t snapshot;
+  rcl_result rc = rcl_snapshot_take(self, &snapshot);
+  pthread_mutex_unlock(&(self->lock));
+
+  if (rc == RCLE_OK)
+    rc = rcl_snapshot_write(self, &snapshot, out);
+
+  rcl_snapshot_destroy(&snapshot);
+
+  if (!is_stdout && close(out) != 0 && rc == RCLE_OK) {
+    rcl_perror("close snapshot");
+    rc = RCLE_FILESYSTEM;
+  }
+
+  return rc;
+}
+
+static rcl_result rcl_snapshot_unpack(int in, const char* dir) {
+  rcl_filepath_t manifest;
+  int count = snprintf(manifest, PATH_MAX, "%s/%s", dir, MANIFEST_FILENAME);
+  if (rcl_unlikely(count < 0 || count >= PATH_MAX))
+    return RCLE_INVALID_DATADIR;
+
+  if (access(manifest, F_OK) == 0) {
+    rcl_error("\"%s\" already has a db\n", dir);
+    return RCLE_INVALID_DATADIR;
+  }
+
+  return snapshot_unpack(in, dir, MANIFEST_FILENAME);
+}
+
+rcl_result rcl_snapshot_import(const char* path, const char* dir) {
+  bool is_stdin = strcmp(path, "-") == 0;
+  int in = is_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+  if (in < 0) {
+    rcl_perror("open snapshot");
+    return RCLE_FILESYSTEM;
+  }
+
+  (void)posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  rcl_result rc = rcl_snapshot_unpack(in, dir);
+
+  if (!is_stdin)
+    close(in);
+
+  return rc;
+}
+
+// Leader: streams rows of a commit, block rows are copied under the lock as
+// the head block may be continued, data cells below the watermark are final
+static rcl_result rcl_replica_send(rcl_t* self,
+                                   int fd,
+                                   rcl_replica_frame_t* frame,
+                                   rcl_block_t* rows) {
+  if (file_write_all(fd, frame, sizeof(rcl_replica_frame_t)) != 0)
+    return RCLE_FILESYSTEM;
+
+  for (uint64_t i = frame->from; i <= frame->to;) {
+    uint64_t page, offset;
+    get_position(i, BLOCKS_FILE_CAPACITY, &page, &offset);
+    uint64_t count = min(BLOCKS_FILE_CAPACITY - offset, frame->to - i + 1);
+
+    pthread_mutex_lock(&(self->lock));
+    file_t* file = vector_at(&(self->blocks_pages), page);
+    memcpy(rows, &(file_as_blocks(file)[offset]), count * sizeof(rcl_block_t));
+    pthread_mutex_unlock(&(self->lock));
+
+    for (uint64_t k = 0; k < count; ++k)
+      rcl_block_clamp(&(rows[k]), frame->logs_count);
+
+    if (file_write_all(fd, rows, count * sizeof(rcl_block_t)) != 0)
+      return RCLE_FILESYSTEM;
+
+    i += count;
+  }
+
+  for (uint64_t i = frame->position, end = i + frame->count; i < end;) {
+    uint64_t page = i / LOGS_PAGE_CAPACITY, offset = i % LOGS_PAGE_CAPACITY;
+    uint64_t count = min(LOGS_PAGE_CAPACITY - offset, end - i);
+
+    pthread_mutex_lock(&(self->lock));
+    rcl_page_t logs_page = *(rcl_page_t*)vector_at(&(self->data_pages), page);
+    pthread_mutex_unlock(&(self->lock));
+
+    if (file_write_all(fd, &(file_as_addresses(logs_page.addresses)[offset]),
+                       count * sizeof(rcl_cell_address_t)) != 0 ||
+        file_write_all(fd, &(file_as_topics(logs_page.topics)[offset]),
+                       count * sizeof(rcl_cell_topics_t)) != 0)
+      return RCLE_FILESYSTEM;
+
+    i += count;
+  }
+
+  return RCLE_OK;
+}
+
+static void* rcl_replica_sender(void* data) {
+  rcl_replica_t* replica = data;
+  rcl_t* self = replica->db;
+
+  // a gone follower fails the write with EPIPE instead of the process
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  vector_t frames;
+  rcl_block_t* rows = malloc(BLOCKS_FILE_CAPACITY * sizeof(rcl_block_t));
+  if (rows == NULL ||
+      !vector_init(&frames, 16, sizeof(rcl_replica_frame_t))) {
+    free(rows);
+    replica->closed = true;
+    return NULL;
+  }
+
+  rcl_result rc = RCLE_OK;
+  while (rc == RCLE_OK && !replica->closed) {
+    pthread_mutex_lock(&(replica->lock));
+    while (replica->frames.size == 0 && !replica->closed)
+      pthread_cond_wait(&(replica->wake), &(replica->lock));
+
+    vector_t pending = replica->frames;
+    replica->frames = frames;
+    frames = pending;
+    pthread_mutex_unlock(&(replica->lock));
+
+    for (size_t i = 0; rc == RCLE_OK && i < frames.size; ++i)
+      rc = rcl_replica_send(self, replica->fd, vector_at(&frames, i), rows);
+
+    vector_reset(&frames);
+  }
+
+  if (rc != RCLE_OK)
+    rcl_info("follower is gone: %s\n", rcl_strerror(rc));
+
+  replica->closed = true;
+
+  free(rows);
+  vector_destroy(&frames);
+
+  return NULL;
+}
+
+static void* rcl_replica_bootstrap(void* data) {
+  rcl_replica_t* replica = data;
+  rcl_snapshot_t* snapshot = (rcl_snapshot_t*)(replica + 1);
+
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  rcl_result rc = rcl_snapshot_write(replica->db, snapshot, replica->fd);
+  rcl_snapshot_destroy(snapshot);
+
+  if (rc != RCLE_OK) {
+    replica->closed = true;
+    return NULL;
+  }
+
+  return rcl_replica_sender(data);
+}
+
+// Follower: the frame is read whole before the lock as the leader may stall,
+// then rows are copied into the pages, the stream must continue the db
+static rcl_result rcl_replica_apply(rcl_t* self,
+                                    int fd,
+                                    rcl_replica_frame_t* frame) {
+  const size_t cell_size =
+      sizeof(rcl_cell_address_t) + sizeof(rcl_cell_topics_t);
+  if (frame->from > frame->to ||
+      frame->to - frame->from >= SIZE_MAX / 2 / sizeof(rcl_block_t) ||
+      frame->count >= SIZE_MAX / 2 / cell_size) {
+    rcl_error("replication frame is broken, blocks: [%zu, %zu]\n",
+              frame->from, frame->to);
+    return RCLE_INVALID_RANGE;
+  }
+
+  size_t rows_size = (frame->to - frame->from + 1) * sizeof(rcl_block_t);
+  char* buffer = malloc(rows_size + frame->count * cell_size);
+  if (buffer == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  if (file_read_all(fd, buffer, rows_size + frame->count * cell_size) != 0) {
+    free(buffer);
+    return RCLE_FILESYSTEM;
+  }
+
+  rcl_result result = RCLE_OK;
+  pthread_mutex_lock(&(self->lock));
+
+  uint64_t position = self->logs_count;
+  if (frame->position != position) {
+    rcl_error("replication stream is out of sync, logs: %zu, frame: %zu\n",
+              position, frame->position);
+    result = RCLE_INVALID_RANGE;
+    goto exit;
+  }
+
+  if (frame->to >= self->blocks_count &&
+      rcl_extend_blocks(self, frame->to) != 0) {
+    result = RCLE_FILESYSTEM;
+    goto exit;
+  }
+
+  // the same chunks as rcl_replica_send wrote
+  char* it = buffer;
+  for (uint64_t i = frame->from; i <= frame->to;) {
+    uint64_t page, offset;
+    get_position(i, BLOCKS_FILE_CAPACITY, &page, &offset);
+    uint64_t count = min(BLOCKS_FILE_CAPACITY - offset, frame->to - i + 1);
+
+    file_t* file = vector_at(&(self->blocks_pages), page);
+    memcpy(&(file_as_blocks(file)[offset]), it, count * sizeof(rcl_block_t));
+    it += count * sizeof(rcl_block_t);
+
+    i += count;
+  }
+
+  for (uint64_t i = frame->position, end = i + frame->count; i < end;) {
+    uint64_t page = i / LOGS_PAGE_CAPACITY, offset = i % LOGS_PAGE_CAPACITY;
+    uint64_t count = min(LOGS_PAGE_CAPACITY - offset, end - i);
+
+    if (self->data_pages.size <= page && rcl_open_data_page(self) != 0) {
+      result = RCLE_FILESYSTEM;
+      goto exit;
+    }
+
+    rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
+    memcpy(&(file_as_addresses(logs_page->addresses)[offset]), it,
+           count * sizeof(rcl_cell_address_t));
+    it += count * sizeof(rcl_cell_address_t);
+    memcpy(&(file_as_topics(logs_page->topics)[offset]), it,
+           count * sizeof(rcl_cell_topics_t));
+    it += count * sizeof(rcl_cell_topics_t);
+
+    i += count;
+  }
+
+  self->logs_count = frame->logs_count;
+  if (frame->blocks_count > self->blocks_count)
+    self->blocks_count = frame->blocks_count;
+
+  if (rcl_ranges_commit(self, frame->from, frame->to) != 0) {
+    result = RCLE_OUT_OF_MEMORY;
+    goto exit;
+  }
+
+  stats_add(self->counters.blocks_inserted, frame->to - frame->from + 1);
+  stats_add(self->counters.logs_inserted, frame->count);
+
+  // followers can be chained
+  rcl_replica_publish(self, frame->from, frame->to, position);
+  rcl_standing_commit(self, frame->from, frame->to);
+  result = rcl_state_write(self);
+
+exit:
+  pthread_mutex_unlock(&(self->lock));
+  free(buffer);
+  return result;
+}
+
+static void* rcl_replica_applier(void* data) {
+  rcl_replica_t* replica = data;
+  rcl_result rc = RCLE_OK;
+
+  while (!replica->closed) {
+    struct pollfd pfd = {.fd = replica->fd, .events = POLLIN};
+    int ready = poll(&pfd, 1, 100);
+    if (ready < 0 && errno != EINTR) {
+      rcl_perror("poll leader");
+      break;
+    }
+    if (ready <= 0)
+      continue;
+
+    rcl_replica_frame_t frame;
+    int status = file_read_all(replica->fd, &frame, sizeof(frame));
+    if (status != 0) {
+      rcl_info("leader is gone\n");
+      break;
+    }
+
+    if ((rc = rcl_replica_apply(replica->db, replica->fd, &frame)) != RCLE_OK) {
+      rcl_error("couldn't apply replication frame: %s\n", rcl_strerror(rc));
+      break;
+    }
+  }
+
+  replica->closed = true;
+  return NULL;
+}
+
+static rcl_replica_t* rcl_replica_new(rcl_t* self, int fd, bool leader) {
+  // a follower's stream keeps the snapshot to send right after the struct
+  rcl_replica_t* replica =
+      calloc(1, sizeof(rcl_replica_t) + (leader ? 0 : sizeof(rcl_snapshot_t)));
+  if (replica == NULL)
+    return NULL;
+
+  replica->db = self;
+  replica->fd = fd;
+  replica->leader = leader;
+  replica->closed = false;
+
+  if (!vector_init(&(replica->frames), 16, sizeof(rcl_replica_frame_t))) {
+    free(replica);
+    return NULL;
+  }
+
+  pthread_mutex_init(&(replica->lock), NULL);
+  pthread_cond_init(&(replica->wake), NULL);
+
+  return replica;
+}
+
+static void rcl_replica_free(rcl_replica_t* replica) {
+  pthread_mutex_lock(&(replica->lock));
+  replica->closed = true;
+  pthread_cond_signal(&(replica->wake));
+  pthread_mutex_unlock(&(replica->lock));
+
+  // unblocks transfers on sockets, pipes wait for the other side
+  (void)shutdown(replica->fd, SHUT_RDWR);
+
+  pthread_join(replica->thread, NULL);
+  close(replica->fd);
+
+  pthread_cond_destroy(&(replica->wake));
+  pthread_mutex_destroy(&(replica->lock));
+  vector_destroy(&(replica->frames));
+  free(replica);
+}
+
+rcl_result rcl_replica_attach(rcl_t* self, int fd) {
+  rcl_replica_t* replica = rcl_replica_new(self, fd, false);
+  if (replica == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  rcl_snapshot_t* snapshot = (rcl_snapshot_t*)(replica + 1);
+
+  // frames start exactly at the watermark of the snapshot
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_result rc = rcl_snapshot_take(self, snapshot);
+  rcl_replica_t** it = vector_add(&(self->replicas));
+  if (rc == RCLE_OK && it == NULL)
+    rc = RCLE_OUT_OF_MEMORY;
+
+  if (rc == RCLE_OK) {
+    *it = replica;
+    if (pthread_create(&(replica->thread), NULL, rcl_replica_bootstrap,
+                       replica) != 0) {
+      vector_remove_last(&(self->replicas));
+      rc = RCLE_UNKNOWN;
+    }
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  if (rc != RCLE_OK) {
+    rcl_snapshot_destroy(snapshot);
+    pthread_cond_destroy(&(replica->wake));
+    pthread_mutex_destroy(&(replica->lock));
+    vector_destroy(&(replica->frames));
+    free(replica);
+  }
+
+  return rc;
+}
+
+rcl_result rcl_replica_follow(char* dir,
+                              uint64_t ram_limit,
+                              int fd,
+                              rcl_t** db_ptr) {
+  rcl_result rc = rcl_snapshot_unpack(fd, dir);
+  if (rc != RCLE_OK)
+    return rc;
+
+  if ((rc = rcl_open(dir, ram_limit, db_ptr)) != RCLE_OK)
+    return rc;
+
+  rcl_t* self = *db_ptr;
+  rcl_replica_t* replica = rcl_replica_new(self, fd, true);
+  if (replica == NULL) {
+    rc = RCLE_OUT_OF_MEMORY;
+    goto error;
+  }
+
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_replica_t** it = vector_add(&(self->replicas));
+  if (it == NULL) {
+    rc = RCLE_OUT_OF_MEMORY;
+  } else {
+    *it = replica;
+    if (pthread_create(&(replica->thread), NULL, rcl_replica_applier,
+                       replica) != 0) {
+      vector_remove_last(&(self->replicas));
+      rc = RCLE_UNKNOWN;
+    }
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  if (rc == RCLE_OK)
+    return rc;
+
+  pthread_mutex_destroy(&(replica->lock));
+  pthread_cond_destroy(&(replica->wake));
+  vector_destroy(&(replica->frames));
+  free(replica);
+
+error:
+  // the caller doesn't get a db that isn't following
+  rcl_free(self);
+  *db_ptr = NULL;
+
+  return rc;
+}
+
+rcl_result rcl_replica_check(rcl_t* self) {
+  rcl_result rc = RCLE_OK;
+
+  pthread_mutex_lock(&(self->lock));
+
+  for (size_t i = 0; i < self->replicas.size; ++i) {
+    rcl_replica_t* replica = *(rcl_replica_t**)vector_at(&(self->replicas), i);
+    if (replica->leader && replica->closed)
+      rc = RCLE_FILESYSTEM;
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return rc;
+}
+
+rcl_result rcl_gaps(rcl_t* self,
+                    uint64_t from,
+                    uint64_t to,
+                    rcl_range_t* gaps,
+                    size_t* count) {
+  size_t capacity = *count, found = 0;
+
+  // blocks out of the window belong to other shards
+  from = max(from, self->window_from);
+  to = min(to, self->window_to - 1);
+
+  uint64_t cursor = from;
+
+  pthread_mutex_lock(&(self->lock));
+
+  for (size_t i = 0; i < self->ranges.size && cursor <= to; ++i) {
+    rcl_range_t* range = vector_at(&(self->ranges), i);
+    if (range->to < cursor)
+      continue;
+    if (range->from > to)
+      break;
+
+    if (range->from > cursor) {
+      if (found < capacity)
+        gaps[found] = (rcl_range_t){.from = cursor, .to = range->from - 1};
+      found++;
+    }
+
+    cursor = range->to + 1;
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  if (cursor <= to) {
+    if (found < capacity)
+      gaps[found] = (rcl_range_t){.from = cursor, .to = to};
+    found++;
+  }
+
+  *count = found;
+
+  return found > capacity ? RCLE_QUERY_OVERFLOW : RCLE_OK;
+}
+
+// Let's select the query as a single block and clear it the same way.
+// It is necessary to avoid memory fragmentation and also to limit the size of
+// the query.
+rcl_result rcl_query_alloc(rcl_query_t** query,
+                           size_t alen,
+                           size_t tlen[TOPICS_LENGTH]) {
+  size_t bytes = sizeof(rcl_query_t) + sizeof(struct rcl_query_address) * alen;
+  for (size_t i = 0; i < TOPICS_LENGTH; ++i)
+    bytes += sizeof(struct rcl_query_topics[TOPICS_LENGTH]) * tlen[i];
+
+  if (bytes > RCL_QUERY_SIZE_LIMIT)
+    return RCLE_TOO_LARGE_QUERY;
+
+  uint8_t* ptr = malloc(bytes);
+  if (ptr == NULL) {
+    rcl_perror("malloc rcl_query_t");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  *query = (void*)ptr;
+  ptr += sizeof(rcl_query_t);
+
+  (*query)->address = (void*)ptr;
+  ptr += sizeof(struct rcl_query_address) * alen;
 
   for (size_t i = 0; i < TOPICS_LENGTH; ++i) {
     if (tlen[i] > 0) {
@@ -508,6 +3702,9 @@ rcl_result rcl_query_alloc(rcl_query_t** query,
   (*query)->alen = alen;
   memcpy((*query)->tlen, tlen, sizeof(size_t) * TOPICS_LENGTH);
 
+  (*query)->timeout_ns = 0;
+  (*query)->cancel = NULL;
+
   return RCLE_OK;
 }
 
@@ -516,27 +3713,20 @@ void rcl_query_free(rcl_query_t* query) {
 }
 
 static bool rcl_query_check_data(rcl_t* self,
-                                 rcl_query_t* q,
+                                 rcl_filter_t* filter,
                                  size_t page,
                                  size_t offset) {
-  size_t k;
-  bool match;
-
   rcl_page_t* logs_page = vector_at(&(self->data_pages), page);
 
   uint64_t address = file_as_addresses(logs_page->addresses)[offset];
   uint64_t* topics = file_as_topics(logs_page->topics)[offset];
 
-  for (match = q->alen == 0, k = 0; !match && k < q->alen; ++k)
-    match = q->address[k]._hash == address;
-
-  if (!match)
-    return false;
-
-  for (size_t i = 0; i < TOPICS_LENGTH; ++i) {
-    for (match = q->tlen[i] == 0, k = 0; !match && k < q->tlen[i]; ++k)
-      match = q->topics[i][k]._hash == topics[i];
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    uint64_t cell = i == 0 ? address : topics[i - 1];
+    bool match = filter->len[i] == 0;
 
+    for (size_t k = 0; !match && k < filter->len[i]; ++k)
+      match = filter->hashes[i][k] == cell;
     if (!match)
       return false;
   }
@@ -544,11 +3734,187 @@ static bool rcl_query_check_data(rcl_t* self,
   return true;
 }
 
+static void rcl_filter_hash(rcl_filter_t* filter) {
+  filter->any = false;
+
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    size_t size = filter_key_size(i);
+    filter->any = filter->any || filter->len[i] > 0;
+
+    for (size_t k = 0; k < filter->len[i]; ++k)
+      filter->hashes[i][k] =
+          murmur64A(filter->keys[i] + k * size, size, HASH_SEED);
+  }
+}
+
+// Adds the logs of a block passed by its bloom which match the hashes
+static void rcl_block_matches(rcl_t* self,
+                              rcl_block_t* block,
+                              rcl_filter_t* filter,
+                              uint64_t* count) {
+  uint64_t l = block->offset, r = block->offset + block->logs_count;
+  for (; l < r; ++l) {
+    uint64_t page, offset;
+    get_position(l, LOGS_PAGE_CAPACITY, &page, &offset);
+
+    if (rcl_query_check_data(self, filter, page, offset))
+      ++(*count);
+  }
+}
+
+// Blocks between checks of the query's deadline and cancel flag
+#define QUERY_CHECK_BLOCKS 4096
+
+static bool rcl_filter_stopped(rcl_filter_t* filter) {
+  if (filter->cancel != NULL &&
+      atomic_load_explicit((const atomic_int*)filter->cancel,
+                           memory_order_relaxed))
+    return true;
+
+  return filter->deadline != 0 && rcl_clock_ns() >= filter->deadline;
+}
+
+// The first gap of [from, to], the blocks before 'completed' have none, so
+// most queries don't take the lock
+static bool rcl_filter_gap(rcl_t* self,
+                           uint64_t from,
+                           uint64_t to,
+                           rcl_range_t* gap) {
+  if (from > to || to < self->completed)
+    return false;
+
+  pthread_mutex_lock(&(self->lock));
+  bool found = rcl_ranges_gap(&(self->ranges), from, to, gap);
+  pthread_mutex_unlock(&(self->lock));
+
+  return found;
+}
+
+static rcl_result rcl_filter_scan(rcl_t* self,
+                                  rcl_filter_t* filter,
+                                  uint64_t blocks_count,
+                                  uint64_t* result) {
+  rcl_result rc = RCLE_OK;
+  uint64_t scanned = 0, checked = 0, passed = 0, examined = 0;
+  bool stoppable = filter->deadline != 0 || filter->cancel != NULL;
+
+  // a shard counts the part of the range inside its window
+  uint64_t start = max(filter->from, self->window_from), end = filter->to;
+  if (end >= blocks_count)
+    end = blocks_count - 1;
+
+  // the scan stops at a gap, written blocks after it aren't counted
+  rcl_range_t gap;
+  bool gapped = rcl_filter_gap(self, start, end, &gap);
+  uint64_t stop = gapped ? gap.from : end + 1;
+
+  // pages inside the range are counted by their summaries
+  bool summarized = filter->visit == NULL && rcl_summary_shape(filter);
+  uint64_t skipped = 0;
+
+  for (size_t number = start; number < stop; ++number, ++scanned) {
+    rcl_block_t* block = rcl_get_block(self, number);
+    assert(block != NULL);
+
+    if (filter->limit > 0 && filter->limit < *result) {
+      rc = RCLE_QUERY_OVERFLOW;
+      break;
+    }
+
+    if (stoppable && scanned > 0 && scanned % QUERY_CHECK_BLOCKS == 0 &&
+        rcl_filter_stopped(filter)) {
+      filter->reached = number - 1;
+      rc = RCLE_QUERY_CANCELED;
+      break;
+    }
+
+    if (summarized &&
+        (number == start || number % BLOCKS_FILE_CAPACITY == 0)) {
+      rcl_summary_t* summary =
+          rcl_summary_get(self, number / BLOCKS_FILE_CAPACITY);
+      if (summary != NULL && summary->header.from == number &&
+          summary->header.to < stop) {
+        *result += rcl_summary_count(summary, filter);
+        skipped += summary->header.to - number + 1;
+        number = summary->header.to;
+        continue;
+      }
+    }
+
+    if (block->logs_count == 0)
+      continue;
+
+    uint64_t before = *result;
+
+    if (!filter->any) {
+      *result += block->logs_count;
+    } else {
+      ++checked;
+      if (!rcl_block_check(block, filter))
+        continue;
+
+      ++passed;
+      examined += block->logs_count;
+      rcl_block_matches(self, block, filter, result);
+    }
+
+    if (filter->visit != NULL && *result != before)
+      filter->visit(filter->visit_data, number, *result - before);
+  }
+
+  if (rc == RCLE_OK && gapped) {
+    filter->reached = gap.from - 1;
+    rc = RCLE_RANGE_GAP;
+  }
+
+  // once per query, the loop stays free of shared writes
+  stats_add(self->counters.blocks_scanned, scanned);
+  stats_add(self->counters.blooms_checked, checked);
+  stats_add(self->counters.blooms_passed, passed);
+  stats_add(self->counters.logs_examined, examined);
+  stats_add(self->counters.blocks_summarized, skipped);
+  if (filter->any)
+    stats_add(self->counters.logs_matched, *result);
+
+  return rc;
+}
+
+static rcl_result rcl_filter_run(rcl_t* self,
+                                 rcl_filter_t* filter,
+                                 uint64_t blocks_count,
+                                 uint64_t* result) {
+  uint64_t started = rcl_clock_ns();
+
+  rcl_filter_hash(filter);
+
+  // a standing filter doesn't know the blocks with logs for 'visit'
+  rcl_result rc = RCLE_OK;
+  if (filter->visit == NULL)
+    rc = rcl_standing_lookup(self, filter, result);
+  if (rc == RCLE_OK)
+    rc = rcl_filter_scan(self, filter, blocks_count, result);
+
+  stats_add(self->counters.queries, 1);
+  if (rc != RCLE_OK)
+    stats_add(self->counters.query_errors, 1);
+  stats_histogram_add(&(self->counters.query_latency),
+                      rcl_clock_ns() - started);
+
+  return rc;
+}
+
+// Keys of small queries are kept on the stack, larger ones on the heap
+#define QUERY_SCRATCH_WORDS 512
+
+static uint64_t* rcl_filter_scratch(uint64_t* stack, size_t words) {
+  if (words <= QUERY_SCRATCH_WORDS)
+    return stack;
+  return malloc(words * sizeof(uint64_t));
+}
+
 rcl_result rcl_query(rcl_t* self, rcl_query_t* query, uint64_t* result) {
   *result = 0;
 
-  int rc;
-
   // pre-check
   size_t blocks_count = self->blocks_count;
   size_t logs_count = self->logs_count;
@@ -556,65 +3922,351 @@ rcl_result rcl_query(rcl_t* self, rcl_query_t* query, uint64_t* result) {
   if (blocks_count == 0 || logs_count == 0)
     return RCLE_OK;
 
-  // fill
-  query->_has_addresses = query->alen > 0;
-  query->_has_topics = false;
+  // decode hex keys into a flat scratch: hashes, then raw keys of every set
+  rcl_filter_t filter = {.from = query->from,
+                         .to = query->to,
+                         .limit = query->limit,
+                         .cancel = query->cancel};
+  if (query->timeout_ns != 0)
+    filter.deadline = rcl_clock_ns() + query->timeout_ns;
+  filter.len[0] = query->alen;
+  memcpy(&(filter.len[1]), query->tlen, sizeof(size_t) * TOPICS_LENGTH);
+
+  size_t keys = 0, words = 0;
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    keys += filter.len[i];
+    words += filter.len[i] * (1 + (filter_key_size(i) + 7) / sizeof(uint64_t));
+  }
 
-  for (size_t i = 0; i < query->alen; ++i) {
-    rc = hex2bin(query->address[i]._data, query->address[i].encoded,
-                 sizeof(rcl_address_t));
-    if (rc != 0)
-      return RCLE_UNKNOWN;
+  uint64_t stack[QUERY_SCRATCH_WORDS];
+  uint64_t* scratch = rcl_filter_scratch(stack, words);
+  if (scratch == NULL)
+    return RCLE_OUT_OF_MEMORY;
 
-    query->address[i]._hash =
-        murmur64A(query->address[i]._data, sizeof(rcl_address_t), HASH_SEED);
-  }
+  uint8_t* data = (uint8_t*)(scratch + keys);
+  for (size_t i = 0, hashes = 0; i < FILTER_SETS; ++i) {
+    int size = (int)filter_key_size(i);
 
-  for (int i = 0; i < TOPICS_LENGTH; ++i) {
-    query->tlen[i] = query->tlen[i];
-    if (query->tlen[i] > 0)
-      query->_has_topics = true;
+    filter.keys[i] = data;
+    filter.hashes[i] = scratch + hashes;
+    hashes += filter.len[i];
 
-    for (size_t j = 0; j < query->tlen[i]; ++j) {
-      rc = hex2bin(query->topics[i][j]._data, query->topics[i][j].encoded,
-                   sizeof(rcl_hash_t));
-      if (rc != 0)
+    for (size_t k = 0; k < filter.len[i]; ++k, data += size) {
+      const char* encoded = i == 0 ? query->address[k].encoded
+                                   : query->topics[i - 1][k].encoded;
+      if (hex2bin(data, encoded, size) != 0) {
+        if (scratch != stack)
+          free(scratch);
         return RCLE_UNKNOWN;
-
-      query->topics[i][j]._hash =
-          murmur64A(query->topics[i][j]._data, sizeof(rcl_hash_t), HASH_SEED);
+      }
     }
   }
 
-  // calc
-  uint64_t start = query->from, end = query->to;
-  if (end >= blocks_count)
-    end = blocks_count - 1;
+  rcl_result rc = rcl_filter_run(self, &filter, blocks_count, result);
+  query->reached = filter.reached;
 
-  for (size_t number = start; number <= end; ++number) {
-    rcl_block_t* block = rcl_get_block(self, number);
-    assert(block != NULL);
+  if (scratch != stack)
+    free(scratch);
 
-    if (query->limit > 0 && query->limit < *result) {
-      return RCLE_QUERY_OVERFLOW;
-    }
+  return rc;
+}
 
-    if (!query->_has_addresses && !query->_has_topics) {
-      *result += block->logs_count;
-      continue;
-    }
+// Runs a filter with the keys and stops of 'query', the rest of the filter
+// (limit, visit) is set by the caller
+static rcl_result rcl_query_keys_run(rcl_t* self,
+                                     rcl_query_keys_t* query,
+                                     rcl_filter_t* filter_ptr,
+                                     uint64_t* result) {
+  *result = 0;
 
-    if (block->logs_count == 0 || !rcl_block_check(block, query))
-      continue;
+  size_t blocks_count = self->blocks_count;
+  size_t logs_count = self->logs_count;
 
-    uint64_t l = block->offset, r = block->offset + block->logs_count;
-    for (; l < r; ++l) {
-      uint64_t page, offset;
-      get_position(l, LOGS_PAGE_CAPACITY, &page, &offset);
+  if (blocks_count == 0 || logs_count == 0)
+    return RCLE_OK;
+
+  rcl_filter_t filter = *filter_ptr;
+  filter.from = query->from;
+  filter.to = query->to;
+  filter.cancel = query->cancel;
+  if (query->timeout_ns != 0)
+    filter.deadline = rcl_clock_ns() + query->timeout_ns;
+  filter.len[0] = query->alen;
+  filter.keys[0] = (const uint8_t*)query->address;
+
+  size_t keys = query->alen;
+  for (size_t i = 0; i < TOPICS_LENGTH; ++i) {
+    filter.len[1 + i] = query->tlen[i];
+    filter.keys[1 + i] = (const uint8_t*)query->topics[i];
+    keys += query->tlen[i];
+  }
+
+  uint64_t stack[QUERY_SCRATCH_WORDS];
+  uint64_t* scratch = rcl_filter_scratch(stack, keys);
+  if (scratch == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  for (size_t i = 0, hashes = 0; i < FILTER_SETS; ++i) {
+    filter.hashes[i] = scratch + hashes;
+    hashes += filter.len[i];
+  }
+
+  rcl_result rc = rcl_filter_run(self, &filter, blocks_count, result);
+  query->reached = filter.reached;
+
+  if (scratch != stack)
+    free(scratch);
+
+  return rc;
+}
+
+rcl_result rcl_query_keys(rcl_t* self,
+                          rcl_query_keys_t* query,
+                          uint64_t* result) {
+  rcl_filter_t filter = {.limit = query->limit};
+  return rcl_query_keys_run(self, query, &filter, result);
+}
+
+// Fills the keys of a filter with the ones of 'query', 'hashes' has room for
+// them. False if there are more than STANDING_KEYS_MAX.
+static bool rcl_standing_query(rcl_query_keys_t* query,
+                               rcl_filter_t* filter,
+                               uint64_t* hashes) {
+  filter->len[0] = query->alen;
+  filter->keys[0] = (const uint8_t*)query->address;
+
+  size_t keys = query->alen;
+  for (size_t i = 0; i < TOPICS_LENGTH; ++i) {
+    filter->len[1 + i] = query->tlen[i];
+    filter->keys[1 + i] = (const uint8_t*)query->topics[i];
+    keys += query->tlen[i];
+  }
+
+  if (keys > STANDING_KEYS_MAX)
+    return false;
+
+  for (size_t i = 0; i < FILTER_SETS; ++i) {
+    filter->hashes[i] = hashes;
+    hashes += filter->len[i];
+  }
+
+  rcl_filter_hash(filter);
+  return true;
+}
+
+rcl_result rcl_standing_filter_add(rcl_t* self,
+                                   rcl_query_keys_t* query,
+                                   uint64_t* id) {
+  rcl_filter_t filter = {0};
+  uint64_t hashes[STANDING_KEYS_MAX];
+  if (!rcl_standing_query(query, &filter, hashes))
+    return RCLE_TOO_LARGE_QUERY;
 
-      if (rcl_query_check_data(self, query, page, offset))
-        ++(*result);
+  rcl_result result = RCLE_OK;
+  pthread_mutex_lock(&(self->lock));
+
+  // the first empty slot, slots of removed filters are emptied right away
+  rcl_standing_reclaim(self);
+  size_t slot = 0;
+  while (slot < self->standing_size && self->standing[slot] != NULL)
+    ++slot;
+
+  rcl_standing_t* st = rcl_standing_find(self, &filter);
+  if (st != NULL) {
+    *id = st->id;
+  } else if (slot == STANDING_FILTERS_MAX) {
+    result = RCLE_TOO_MANY_FILTERS;
+  } else if ((st = rcl_standing_new(self, self->standing_id + 1, &filter)) ==
+             NULL) {
+    result = RCLE_OUT_OF_MEMORY;
+  } else {
+    self->standing[slot] = st;  // readers see the filter set
+    if (slot == self->standing_size)
+      self->standing_size++;
+    self->standing_id = st->id;
+    *id = st->id;
+
+    rcl_standing_save(self);
+    pthread_cond_signal(&(self->filler_wake));
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return result;
+}
+
+// The caller holds the lock
+static rcl_standing_t* rcl_standing_get(rcl_t* self, uint64_t id) {
+  for (size_t i = 0; i < self->standing_size; ++i) {
+    rcl_standing_t* st = self->standing[i];
+    if (st != NULL && st->id == id && !st->removed)
+      return st;
+  }
+
+  return NULL;
+}
+
+rcl_result rcl_standing_filter_remove(rcl_t* self, uint64_t id) {
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_standing_t* st = rcl_standing_get(self, id);
+  if (st != NULL) {
+    st->removed = true;
+
+    // queries may still read the mapped pages, they're closed by the reclaim
+    for (size_t i = 0; i < slots_size(&(st->pages)); ++i) {
+      rcl_filepath_t filename = {0};
+      if (rcl_standing_filename(filename, self->dir, i, id) == 0 &&
+          unlink(filename) != 0)
+        rcl_perror("unlink standing filter page");
     }
+
+    rcl_standing_save(self);
+    rcl_standing_reclaim(self);
+  }
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return st != NULL ? RCLE_OK : RCLE_UNKNOWN_FILTER;
+}
+
+rcl_result rcl_standing_filter_next(rcl_t* self, uint64_t id, uint64_t* next) {
+  pthread_mutex_lock(&(self->lock));
+
+  rcl_standing_t* st = rcl_standing_get(self, id);
+  if (st != NULL)
+    *next = st->next;
+
+  pthread_mutex_unlock(&(self->lock));
+
+  return st != NULL ? RCLE_OK : RCLE_UNKNOWN_FILTER;
+}
+
+// type: rcl_split_t, state of rcl_query_split, the open chunk starts at 'from'
+typedef struct {
+  uint64_t max_logs, from, logs;
+  rcl_range_t* chunks;
+  size_t capacity, count;
+} rcl_split_t;
+
+static void rcl_split_push(rcl_split_t* split, uint64_t to) {
+  if (split->count < split->capacity)
+    split->chunks[split->count] = (rcl_range_t){.from = split->from, .to = to};
+  split->count++;
+}
+
+static void rcl_split_visit(void* data, uint64_t number, uint64_t count) {
+  rcl_split_t* split = data;
+
+  if (split->logs + count > split->max_logs && number > split->from) {
+    rcl_split_push(split, number - 1);
+    split->from = number;
+    split->logs = 0;
+  }
+
+  split->logs += count;
+}
+
+rcl_result rcl_query_split(rcl_t* self,
+                           rcl_query_keys_t* query,
+                           uint64_t max_logs,
+                           rcl_range_t* chunks,
+                           size_t* count) {
+  if (query->from > query->to || max_logs == 0)
+    return RCLE_INVALID_RANGE;
+
+  rcl_split_t split = {.max_logs = max_logs,
+                       .from = query->from,
+                       .chunks = chunks,
+                       .capacity = *count};
+  rcl_filter_t filter = {.visit = rcl_split_visit, .visit_data = &split};
+
+  uint64_t result;
+  rcl_result rc = rcl_query_keys_run(self, query, &filter, &result);
+  if (rc != RCLE_OK) {
+    *count = split.count < split.capacity ? split.count : split.capacity;
+    return rc;
+  }
+
+  rcl_split_push(&split, query->to);
+  *count = split.count;
+
+  return split.count > split.capacity ? RCLE_QUERY_OVERFLOW : RCLE_OK;
+}
+
+// type: rcl_buckets_t, state of rcl_query_histogram
+typedef struct {
+  uint64_t from, bucket_blocks;
+  uint64_t* buckets;
+} rcl_buckets_t;
+
+static void rcl_buckets_visit(void* data, uint64_t number, uint64_t count) {
+  rcl_buckets_t* buckets = data;
+  buckets->buckets[(number - buckets->from) / buckets->bucket_blocks] += count;
+}
+
+rcl_result rcl_query_histogram(rcl_t* self,
+                               rcl_query_keys_t* query,
+                               uint64_t bucket_blocks,
+                               uint64_t* buckets,
+                               size_t* count) {
+  if (query->from > query->to || bucket_blocks == 0)
+    return RCLE_INVALID_RANGE;
+
+  uint64_t needed = (query->to - query->from) / bucket_blocks + 1;
+  if (needed > *count) {
+    *count = needed;
+    return RCLE_QUERY_OVERFLOW;
+  }
+
+  *count = needed;
+  memset(buckets, 0, needed * sizeof(uint64_t));
+
+  rcl_buckets_t state = {.from = query->from,
+                         .bucket_blocks = bucket_blocks,
+                         .buckets = buckets};
+  rcl_filter_t filter = {.visit = rcl_buckets_visit, .visit_data = &state};
+
+  uint64_t result;
+  return rcl_query_keys_run(self, query, &filter, &result);
+}
+
+rcl_result rcl_stats(rcl_t* self, rcl_stats_t* stats) {
+  memset(stats, 0, sizeof(rcl_stats_t));
+
+  stats->blocks_count = self->blocks_count;
+  stats->logs_count = self->logs_count;
+
+  stats->queries = stats_load(self->counters.queries);
+  stats->query_errors = stats_load(self->counters.query_errors);
+  stats->blocks_scanned = stats_load(self->counters.blocks_scanned);
+  stats->blooms_checked = stats_load(self->counters.blooms_checked);
+  stats->blooms_passed = stats_load(self->counters.blooms_passed);
+  stats->logs_examined = stats_load(self->counters.logs_examined);
+  stats->logs_matched = stats_load(self->counters.logs_matched);
+  stats->standing_hits = stats_load(self->counters.standing_hits);
+  stats->blocks_summarized = stats_load(self->counters.blocks_summarized);
+  stats_histogram_read(&(self->counters.query_latency),
+                       &(stats->query_latency));
+
+  stats->inserts = stats_load(self->counters.inserts);
+  stats->blocks_inserted = stats_load(self->counters.blocks_inserted);
+  stats->logs_inserted = stats_load(self->counters.logs_inserted);
+  stats_histogram_read(&(self->counters.insert_latency),
+                       &(stats->insert_latency));
+
+  rcl_upstream_stats(self->upstream, stats);
+
+  stats->ingest_throttle = self->throttle;
+
+  stats->ram_limit = self->ram_limit;
+  stats->warmup_done = stats_load(self->warm_done);
+  stats->warmup_total = stats_load(self->warm_total);
+
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+    stats->minor_faults = (uint64_t)usage.ru_minflt;
+    stats->major_faults = (uint64_t)usage.ru_majflt;
   }
 
   return RCLE_OK;
@@ -1,8 +1,14 @@
 package liboracle
 
 import (
+	"context"
 	"fmt"
+	"os"
 	"runtime"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
 	"unsafe"
 )
 
@@ -10,14 +16,11 @@ import (
 // #cgo pkg-config: libcurl libcjson
 // #include "liboracle.h"
 /*
-void _add_address_to_query(rcl_query_t* query, _GoString_* strs) {
-	for (size_t i = 0; i < query->alen; ++i)
-		query->address[i].encoded = _GoStringPtr(strs[i]);
-}
-void _add_topics_to_query(rcl_query_t* query, size_t j, _GoString_* strs) {
-	for (size_t i = 0; i < query->tlen[j]; ++i)
-		query->topics[j][i].encoded = _GoStringPtr(strs[i]);
-}
+typedef struct {
+	rcl_query_keys_t query;
+	uint64_t result;
+	int cancel;
+} _query_keys_t;
 */
 import "C"
 
@@ -29,6 +32,19 @@ type Query struct { // see rcl_query_t
 	Topics    [][]string
 }
 
+type UpstreamMode int // see rcl_upstream_mode
+
+const (
+	UpstreamLogs     UpstreamMode = C.RCL_UPSTREAM_LOGS
+	UpstreamBatch    UpstreamMode = C.RCL_UPSTREAM_BATCH
+	UpstreamReceipts UpstreamMode = C.RCL_UPSTREAM_RECEIPTS
+)
+
+type Range struct { // see rcl_range_t, inclusive
+	From uint64
+	To   uint64
+}
+
 type Conn struct {
 	db *C.rcl_t
 }
@@ -51,10 +67,51 @@ func NewDB(data_dir string, ram_limit uint64) (*Conn, error) {
 	return &Conn{db: db}, rcl_error(rc)
 }
 
+// NewShard opens a db of the [from, to) blocks of a chain, see rcl_open_window
+func NewShard(data_dir string, ram_limit, from, to uint64) (*Conn, error) {
+	data_dir_cstr := C.CString(data_dir)
+	defer C.free(unsafe.Pointer(data_dir_cstr))
+
+	var db *C.rcl_t
+	rc := C.rcl_open_window(data_dir_cstr, C.uint64_t(ram_limit), C.uint64_t(from), C.uint64_t(to), &db)
+
+	return &Conn{db: db}, rcl_error(rc)
+}
+
 func (conn *Conn) Close() {
 	C.rcl_free(conn.db)
 }
 
+// Engine hosts many dbs in one process, e.g. one per chain, see rcl_engine_t.
+// They share the ingest with connections requests in flight (0 is the
+// default) and ramLimit bytes of blocks in RAM, rebalanced by query heat.
+type Engine struct {
+	engine *C.rcl_engine_t
+}
+
+func NewEngine(ramLimit uint64, connections int) (*Engine, error) {
+	var engine *C.rcl_engine_t
+	rc := C.rcl_engine_new(C.uint64_t(ramLimit), C.size_t(connections), &engine)
+
+	return &Engine{engine: engine}, rcl_error(rc)
+}
+
+// Open opens a db of the engine, it's closed by Conn.Close
+func (e *Engine) Open(dataDir string) (*Conn, error) {
+	data_dir_cstr := C.CString(dataDir)
+	defer C.free(unsafe.Pointer(data_dir_cstr))
+
+	var db *C.rcl_t
+	rc := C.rcl_engine_open(e.engine, data_dir_cstr, &db)
+
+	return &Conn{db: db}, rcl_error(rc)
+}
+
+// Close frees the engine after all its dbs are closed
+func (e *Engine) Close() {
+	C.rcl_engine_free(e.engine)
+}
+
 func (conn *Conn) UpdateHeight(height uint64) error {
 	rc := C.rcl_update_height(conn.db, C.uint64_t(height))
 	return rcl_error(rc)
@@ -68,53 +125,392 @@ func (conn *Conn) SetUpstream(upstream string) error {
 	return rcl_error(rc)
 }
 
+// SetUpstreamMode switches how ranges are requested, callBlocks is the range
+// of one eth_getLogs call in a batch (0 is the default)
+func (conn *Conn) SetUpstreamMode(mode UpstreamMode, callBlocks uint64) error {
+	rc := C.rcl_set_upstream_mode(conn.db, C.rcl_upstream_mode(mode), C.uint64_t(callBlocks))
+	return rcl_error(rc)
+}
+
+// SetQuerySLO throttles the ingest of a backlog while the percentile (0 is
+// 99) of query latency is over the target, 0 is off
+func (conn *Conn) SetQuerySLO(latency time.Duration, percentile uint) error {
+	rc := C.rcl_set_query_slo(conn.db, C.uint64_t(latency.Nanoseconds()), C.uint(percentile))
+	return rcl_error(rc)
+}
+
 func (conn *Conn) Query(query *Query) (uint64, error) {
-	var pinner runtime.Pinner
-	pinner.Pin(query)
-	defer pinner.Unpin()
+	return conn.QueryContext(context.Background(), query)
+}
 
-	if len(query.Topics) > len(query.Topics) {
-		return 0, fmt.Errorf("too many topics")
+// QueryContext stops the scan when ctx is done, see QueryKeysContext
+func (conn *Conn) QueryContext(ctx context.Context, query *Query) (uint64, error) {
+	q := AcquireKeyQuery()
+	defer q.Release()
+
+	q.FromBlock, q.ToBlock = query.FromBlock, query.ToBlock
+	if query.Limit != nil {
+		q.Limit = *(query.Limit)
 	}
 
-	tlen := [C.TOPICS_LENGTH]C.size_t{0}
-	for i := 0; i < len(query.Topics); i++ {
-		tlen[i] = C.size_t(len(query.Topics[i]))
+	if err := q.addKeys(query); err != nil {
+		return 0, err
 	}
 
-	var cquery *C.rcl_query_t = nil
-	rc := C.rcl_query_alloc(
-		&cquery,
-		C.size_t(len(query.Addresses)),
-		&(tlen[0]),
-	)
-	if rc != C.RCLE_OK {
-		return 0, rcl_error(rc)
+	return conn.QueryKeysContext(ctx, q)
+}
+
+// AddStandingFilter registers the keys of the query (its range is ignored),
+// queries with the same keys count the blocks it has counted by two lookups,
+// see rcl_standing_filter_add
+func (conn *Conn) AddStandingFilter(query *Query) (uint64, error) {
+	q := AcquireKeyQuery()
+	defer q.Release()
+
+	if err := q.addKeys(query); err != nil {
+		return 0, err
 	}
-	defer C.rcl_query_free(cquery)
 
-	cquery.from = C.uint64_t(query.FromBlock)
-	cquery.to = C.uint64_t(query.ToBlock)
+	var id C.uint64_t
+	_, err := q.run(context.Background(), func(c *C.rcl_query_keys_t) C.rcl_result {
+		return C.rcl_standing_filter_add(conn.db, c, &id)
+	})
+	return uint64(id), err
+}
 
-	if query.Limit != nil {
-		cquery.limit = C.uint64_t(*(query.Limit))
-	} else {
-		cquery.limit = C.uint64_t(0)
+func (conn *Conn) RemoveStandingFilter(id uint64) error {
+	return rcl_error(C.rcl_standing_filter_remove(conn.db, C.uint64_t(id)))
+}
+
+// StandingFilterNext is the first block not counted by the filter yet
+func (conn *Conn) StandingFilterNext(id uint64) (uint64, error) {
+	var next C.uint64_t
+	rc := C.rcl_standing_filter_next(conn.db, C.uint64_t(id), &next)
+	return uint64(next), rcl_error(rc)
+}
+
+// QueryCanceled is returned with the count of the [FromBlock, Reached] blocks
+// when the query's context is done before the scan
+type QueryCanceled struct {
+	Reached uint64
+	Err     error // of the context
+}
+
+func (e *QueryCanceled) Error() string {
+	return fmt.Sprintf("liboracle: query is stopped at block %d: %v", e.Reached, e.Err)
+}
+
+func (e *QueryCanceled) Unwrap() error {
+	return e.Err
+}
+
+// RangeGap is returned with the count of the [FromBlock, Reached] blocks when
+// a block after them isn't written yet, see Gaps
+type RangeGap struct {
+	Reached uint64
+}
+
+func (e *RangeGap) Error() string {
+	return fmt.Sprintf("liboracle: block %d isn't written yet", e.Reached+1)
+}
+
+// QueryKeys runs a query with decoded keys, it doesn't allocate
+func (conn *Conn) QueryKeys(q *KeyQuery) (uint64, error) {
+	return conn.QueryKeysContext(context.Background(), q)
+}
+
+// QueryKeysContext passes ctx's deadline and cancellation to the scan, they
+// are checked every few thousands blocks
+func (conn *Conn) QueryKeysContext(ctx context.Context, q *KeyQuery) (uint64, error) {
+	q.c.result = 0
+	_, err := q.run(ctx, func(c *C.rcl_query_keys_t) C.rcl_result {
+		return C.rcl_query_keys(conn.db, c, &(q.c.result))
+	})
+	return uint64(q.c.result), err
+}
+
+// QuerySplit splits [FromBlock, ToBlock] into consecutive ranges of at most
+// maxLogs matching logs in one scan, a single block may exceed it
+func (conn *Conn) QuerySplit(ctx context.Context, q *KeyQuery, maxLogs uint64) ([]Range, error) {
+	chunks := make([]C.rcl_range_t, 16)
+
+	for {
+		count := C.size_t(len(chunks))
+		rc, err := q.run(ctx, func(c *C.rcl_query_keys_t) C.rcl_result {
+			return C.rcl_query_split(conn.db, c, C.uint64_t(maxLogs), &chunks[0], &count)
+		})
+		if rc == C.RCLE_QUERY_OVERFLOW {
+			chunks = make([]C.rcl_range_t, count)
+			continue
+		}
+		if err != nil {
+			return nil, err
+		}
+
+		result := make([]Range, count)
+		for i := range result {
+			result[i] = Range{From: uint64(chunks[i].from), To: uint64(chunks[i].to)}
+		}
+		return result, nil
+	}
+}
+
+// QueryHistogramMaxBuckets bounds the buckets of one QueryHistogram
+const QueryHistogramMaxBuckets = 1 << 16
+
+// QueryHistogram counts matching logs of [FromBlock, ToBlock] per bucketBlocks
+// blocks, ToBlock is clamped to the written blocks
+func (conn *Conn) QueryHistogram(ctx context.Context, q *KeyQuery, bucketBlocks uint64) ([]uint64, error) {
+	if bucketBlocks == 0 || q.FromBlock > q.ToBlock {
+		return nil, rcl_error(C.RCLE_INVALID_RANGE)
+	}
+
+	blocks, err := conn.GetBlocksCount()
+	if err != nil {
+		return nil, err
+	}
+	if q.FromBlock >= blocks {
+		return []uint64{}, nil
+	}
+	if q.ToBlock >= blocks {
+		defer func(to uint64) { q.ToBlock = to }(q.ToBlock)
+		q.ToBlock = blocks - 1
+	}
+
+	if (q.ToBlock-q.FromBlock)/bucketBlocks >= QueryHistogramMaxBuckets {
+		return nil, rcl_error(C.RCLE_TOO_LARGE_QUERY)
+	}
+
+	buckets := make([]uint64, (q.ToBlock-q.FromBlock)/bucketBlocks+1)
+	count := C.size_t(len(buckets))
+
+	_, err = q.run(ctx, func(c *C.rcl_query_keys_t) C.rcl_result {
+		data := (*C.uint64_t)(unsafe.Pointer(&buckets[0]))
+		return C.rcl_query_histogram(conn.db, c, C.uint64_t(bucketBlocks), data, &count)
+	})
+	return buckets, err
+}
+
+// run fills the native query and calls fn with ctx's deadline and cancellation
+func (q *KeyQuery) run(ctx context.Context, fn func(*C.rcl_query_keys_t) C.rcl_result) (C.rcl_result, error) {
+	if err := ctx.Err(); err != nil {
+		return C.RCLE_QUERY_CANCELED, err
+	}
+
+	c := &(q.c.query)
+	c.from, c.to = C.uint64_t(q.FromBlock), C.uint64_t(q.ToBlock)
+	c.limit = C.uint64_t(q.Limit)
+
+	c.alen = C.size_t(len(q.addresses))
+	for i := range q.topics {
+		c.tlen[i] = C.size_t(len(q.topics[i]))
+	}
+
+	c.timeout_ns, c.cancel = 0, nil
+	if deadline, ok := ctx.Deadline(); ok {
+		c.timeout_ns = C.uint64_t(max(time.Until(deadline), 1))
+	}
+
+	if ctx.Done() != nil {
+		flag := (*int32)(unsafe.Pointer(&(q.c.cancel)))
+		atomic.StoreInt32(flag, 0)
+		c.cancel = &(q.c.cancel)
+
+		// the flag must not be set after the query is given back
+		done := make(chan struct{})
+		stop := context.AfterFunc(ctx, func() {
+			atomic.StoreInt32(flag, 1)
+			close(done)
+		})
+		defer func() {
+			if !stop() {
+				<-done
+			}
+		}()
+	}
+
+	rc := fn(c)
+	if rc == C.RCLE_QUERY_CANCELED {
+		err := ctx.Err()
+		if err == nil { // the timeout may come a bit earlier than ctx
+			err = context.DeadlineExceeded
+		}
+		return rc, &QueryCanceled{Reached: uint64(c.reached), Err: err}
+	}
+	if rc == C.RCLE_RANGE_GAP {
+		return rc, &RangeGap{Reached: uint64(c.reached)}
+	}
+
+	return rc, rcl_error(rc)
+}
+
+type (
+	Address [20]byte // see rcl_address_t
+	Hash    [32]byte // see rcl_hash_t
+)
+
+// KeyQuery is a reusable query with decoded keys, see rcl_query_keys_t. Keys
+// are kept in C memory, so a pooled query crosses cgo once and allocates
+// nothing after its arrays have grown.
+type KeyQuery struct {
+	FromBlock uint64
+	ToBlock   uint64
+	Limit     uint64 // 0 is no limit
+
+	c         *C._query_keys_t
+	addresses []Address // views of the C arrays
+	topics    [C.TOPICS_LENGTH][]Hash
+}
+
+var keyQueries = sync.Pool{
+	New: func() any {
+		q := &KeyQuery{
+			c: (*C._query_keys_t)(C.calloc(1, C.sizeof__query_keys_t)),
+		}
+		runtime.SetFinalizer(q, (*KeyQuery).free)
+		return q
+	},
+}
+
+func AcquireKeyQuery() *KeyQuery {
+	return keyQueries.Get().(*KeyQuery)
+}
+
+// Release resets the query and puts it back into the pool
+func (q *KeyQuery) Release() {
+	q.Reset()
+	keyQueries.Put(q)
+}
+
+func (q *KeyQuery) Reset() {
+	q.FromBlock, q.ToBlock, q.Limit = 0, 0, 0
+
+	q.addresses = q.addresses[:0]
+	for i := range q.topics {
+		q.topics[i] = q.topics[i][:0]
+	}
+}
+
+func (q *KeyQuery) free() {
+	C.free(unsafe.Pointer(q.c.query.address))
+	for i := range q.topics {
+		C.free(unsafe.Pointer(q.c.query.topics[i]))
+	}
+	C.free(unsafe.Pointer(q.c))
+}
+
+func (q *KeyQuery) AddAddress(address *Address) {
+	*(q.nextAddress()) = *address
+}
+
+// AddAddressHex decodes a "0x"-prefixed address right into the query
+func (q *KeyQuery) AddAddressHex(address string) error {
+	if err := decodeHex(q.nextAddress()[:], address); err != nil {
+		q.addresses = q.addresses[:len(q.addresses)-1]
+		return err
+	}
+	return nil
+}
+
+// AddTopic adds an alternative of the i-th topic, no alternatives match all
+func (q *KeyQuery) AddTopic(i int, topic *Hash) {
+	*(q.nextTopic(i)) = *topic
+}
+
+func (q *KeyQuery) AddTopicHex(i int, topic string) error {
+	if err := decodeHex(q.nextTopic(i)[:], topic); err != nil {
+		q.topics[i] = q.topics[i][:len(q.topics[i])-1]
+		return err
+	}
+	return nil
+}
+
+// addKeys decodes the hex keys of query
+func (q *KeyQuery) addKeys(query *Query) error {
+	if len(query.Topics) > C.TOPICS_LENGTH {
+		return fmt.Errorf("too many topics")
+	}
+
+	for _, address := range query.Addresses {
+		if err := q.AddAddressHex(address); err != nil {
+			return err
+		}
+	}
+
+	for i, topics := range query.Topics {
+		for _, topic := range topics {
+			if err := q.AddTopicHex(i, topic); err != nil {
+				return err
+			}
+		}
+	}
+
+	return nil
+}
+
+func (q *KeyQuery) nextAddress() *Address {
+	ptr, keys := growKeys(unsafe.Pointer(q.c.query.address), q.addresses)
+	q.c.query.address = (*[C.ADDRESS_LENGTH]C.uchar)(ptr)
+
+	q.addresses = keys[:len(keys)+1]
+	return &(q.addresses[len(keys)])
+}
+
+func (q *KeyQuery) nextTopic(i int) *Hash {
+	ptr, keys := growKeys(unsafe.Pointer(q.c.query.topics[i]), q.topics[i])
+	q.c.query.topics[i] = (*[C.HASH_LENGTH]C.uchar)(ptr)
+
+	q.topics[i] = keys[:len(keys)+1]
+	return &(q.topics[i][len(keys)])
+}
+
+// growKeys doubles a full C array of keys
+func growKeys[T any](ptr unsafe.Pointer, keys []T) (unsafe.Pointer, []T) {
+	if len(keys) < cap(keys) {
+		return ptr, keys
 	}
 
-	if len(query.Addresses) > 0 {
-		C._add_address_to_query(cquery, &(query.Addresses[0]))
+	size := max(2*cap(keys), 4)
+
+	var key T
+	ptr = C.realloc(ptr, C.size_t(size)*C.size_t(unsafe.Sizeof(key)))
+	if ptr == nil {
+		panic("liboracle: out of memory")
 	}
 
-	for i := 0; i < len(query.Topics); i++ {
-		if len(query.Topics[i]) > 0 {
-			C._add_topics_to_query(cquery, C.size_t(i), &(query.Topics[0][i]))
+	return ptr, unsafe.Slice((*T)(ptr), size)[:len(keys)]
+}
+
+func decodeHex(dst []byte, str string) error {
+	if len(str) >= 2 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X') {
+		str = str[2:]
+	}
+
+	if len(str) != 2*len(dst) {
+		return fmt.Errorf("invalid key length: %d", len(str))
+	}
+
+	for i := range dst {
+		hi, lo := unhex(str[2*i]), unhex(str[2*i+1])
+		if hi > 0xf || lo > 0xf {
+			return fmt.Errorf("invalid hex key: %s", str)
 		}
+		dst[i] = hi<<4 | lo
 	}
 
-	var count C.uint64_t
-	rc = C.rcl_query(conn.db, (*C.rcl_query_t)(unsafe.Pointer(cquery)), &count)
-	return uint64(count), rcl_error(rc)
+	return nil
+}
+
+func unhex(c byte) byte {
+	switch {
+	case '0' <= c && c <= '9':
+		return c - '0'
+	case 'a' <= c && c <= 'f':
+		return c - 'a' + 10
+	case 'A' <= c && c <= 'F':
+		return c - 'A' + 10
+	}
+	return 0xff
 }
 
 func (conn *Conn) GetLogsCount() (uint64, error) {
@@ -128,3 +524,174 @@ func (conn *Conn) GetBlocksCount() (uint64, error) {
 	rc := C.rcl_blocks_count(conn.db, &result)
 	return uint64(result), rcl_error(rc)
 }
+
+// Gaps lists not yet written blocks of [from, to]
+func (conn *Conn) Gaps(from, to uint64) ([]Range, error) {
+	gaps := make([]C.rcl_range_t, 16)
+
+	for {
+		count := C.size_t(len(gaps))
+		rc := C.rcl_gaps(conn.db, C.uint64_t(from), C.uint64_t(to), &gaps[0], &count)
+		if rc == C.RCLE_QUERY_OVERFLOW {
+			gaps = make([]C.rcl_range_t, count)
+			continue
+		}
+		if rc != C.RCLE_OK {
+			return nil, rcl_error(rc)
+		}
+
+		result := make([]Range, count)
+		for i := range result {
+			result[i] = Range{From: uint64(gaps[i].from), To: uint64(gaps[i].to)}
+		}
+		return result, nil
+	}
+}
+
+const HistogramBuckets = C.RCL_HISTOGRAM_BUCKETS
+
+type Histogram struct { // see rcl_histogram_t
+	Count   uint64
+	SumUs   uint64
+	Buckets [HistogramBuckets]uint64 // the i-th counts calls under 2^i us
+}
+
+type Stats struct { // see rcl_stats_t
+	BlocksCount uint64
+	LogsCount   uint64
+
+	Queries       uint64
+	QueryErrors   uint64
+	BlocksScanned uint64
+	BloomsChecked uint64
+	BloomsPassed  uint64
+	LogsExamined  uint64
+	LogsMatched   uint64
+	StandingHits  uint64 // queries counted by a standing filter
+	Summarized    uint64 // blocks counted by summaries of sealed pages
+	QueryLatency  Histogram
+
+	Inserts        uint64
+	BlocksInserted uint64
+	LogsInserted   uint64
+	InsertLatency  Histogram
+
+	Height           uint64
+	Next             uint64
+	UpstreamRequests uint64
+	UpstreamErrors   uint64
+	UpstreamLatency  Histogram
+	IngestThrottle   uint64 // level of SetQuerySLO, 0 is full speed
+
+	MinorFaults uint64
+	MajorFaults uint64
+
+	RamLimit uint64 // bytes of blocks in RAM, the engine's share of a db
+
+	WarmupDone  uint64 // bytes of pages read in after the start
+	WarmupTotal uint64
+}
+
+func histogram(h *C.rcl_histogram_t) Histogram {
+	result := Histogram{Count: uint64(h.count), SumUs: uint64(h.sum_us)}
+	for i := range result.Buckets {
+		result.Buckets[i] = uint64(h.buckets[i])
+	}
+	return result
+}
+
+// Stats reads the counters since NewDB
+func (conn *Conn) Stats() (Stats, error) {
+	var s C.rcl_stats_t
+	if rc := C.rcl_stats(conn.db, &s); rc != C.RCLE_OK {
+		return Stats{}, rcl_error(rc)
+	}
+
+	return Stats{
+		BlocksCount: uint64(s.blocks_count),
+		LogsCount:   uint64(s.logs_count),
+
+		Queries:       uint64(s.queries),
+		QueryErrors:   uint64(s.query_errors),
+		BlocksScanned: uint64(s.blocks_scanned),
+		BloomsChecked: uint64(s.blooms_checked),
+		BloomsPassed:  uint64(s.blooms_passed),
+		LogsExamined:  uint64(s.logs_examined),
+		LogsMatched:   uint64(s.logs_matched),
+		StandingHits:  uint64(s.standing_hits),
+		Summarized:    uint64(s.blocks_summarized),
+		QueryLatency:  histogram(&s.query_latency),
+
+		Inserts:        uint64(s.inserts),
+		BlocksInserted: uint64(s.blocks_inserted),
+		LogsInserted:   uint64(s.logs_inserted),
+		InsertLatency:  histogram(&s.insert_latency),
+
+		Height:           uint64(s.height),
+		Next:             uint64(s.next),
+		UpstreamRequests: uint64(s.upstream_requests),
+		UpstreamErrors:   uint64(s.upstream_errors),
+		UpstreamLatency:  histogram(&s.upstream_latency),
+		IngestThrottle:   uint64(s.ingest_throttle),
+
+		MinorFaults: uint64(s.minor_faults),
+		MajorFaults: uint64(s.major_faults),
+
+		RamLimit: uint64(s.ram_limit),
+
+		WarmupDone:  uint64(s.warmup_done),
+		WarmupTotal: uint64(s.warmup_total),
+	}, nil
+}
+
+// SnapshotExport streams a consistent snapshot of the db into path, "-" is
+// stdout
+func (conn *Conn) SnapshotExport(path string) error {
+	path_cstr := C.CString(path)
+	defer C.free(unsafe.Pointer(path_cstr))
+
+	return rcl_error(C.rcl_snapshot_export(conn.db, path_cstr))
+}
+
+// SnapshotImport unpacks a snapshot into an empty data dir before NewDB
+func SnapshotImport(path, dir string) error {
+	path_cstr, dir_cstr := C.CString(path), C.CString(dir)
+	defer C.free(unsafe.Pointer(path_cstr))
+	defer C.free(unsafe.Pointer(dir_cstr))
+
+	return rcl_error(C.rcl_snapshot_import(path_cstr, dir_cstr))
+}
+
+// ReplicaAttach streams the db and then every commit to a follower, the db
+// owns a duplicate of the descriptor
+func (conn *Conn) ReplicaAttach(file *os.File) error {
+	fd, err := syscall.Dup(int(file.Fd()))
+	if err != nil {
+		return err
+	}
+
+	return rcl_error(C.rcl_replica_attach(conn.db, C.int(fd)))
+}
+
+// NewFollower bootstraps an empty data dir from the leader behind file and
+// keeps it in sync, the db owns a duplicate of the descriptor
+func NewFollower(data_dir string, ram_limit uint64, file *os.File) (*Conn, error) {
+	fd, err := syscall.Dup(int(file.Fd()))
+	if err != nil {
+		return nil, err
+	}
+
+	data_dir_cstr := C.CString(data_dir)
+	defer C.free(unsafe.Pointer(data_dir_cstr))
+
+	var db *C.rcl_t
+	rc := C.rcl_replica_follow(data_dir_cstr, C.uint64_t(ram_limit), C.int(fd), &db)
+
+	return &Conn{db: db}, rcl_error(rc)
+}
+
+// ReplicaCheck fails once the follower lost its leader, the db keeps its data
+// but isn't synced anymore
+func (conn *Conn) ReplicaCheck() error {
+	return rcl_error(C.rcl_replica_check(conn.db))
+}
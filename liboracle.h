@@ -4,7 +4,9 @@
 #include <stdint.h>
 
 #include "common.h"
+#include "dump.h"
 #include "err.h"
+#include "stats.h"
 #include "upstream.h"
 
 struct rcl_query_address {
@@ -29,26 +31,181 @@ typedef struct {
   size_t alen, tlen[TOPICS_LENGTH];
 
   bool _has_addresses, _has_topics;
+
+  // see rcl_query_keys_t
+  uint64_t timeout_ns;
+  const int* cancel;
+  uint64_t reached;
 } rcl_query_t;
 
+// Query with decoded keys in caller-owned flat arrays, e.g. 'alen' addresses
+// of 20 bytes each, it's the fast path for bindings: nothing is parsed or
+// allocated for small queries
+typedef struct {
+  uint64_t from, to, limit;
+  const rcl_address_t* address;
+  const rcl_hash_t* topics[TOPICS_LENGTH];
+  size_t alen, tlen[TOPICS_LENGTH];
+
+  // Optional stops, checked every few thousands blocks: a timeout since the
+  // call and a flag set by another thread. RCLE_QUERY_CANCELED leaves the
+  // count of the [from, reached] blocks in the result. RCLE_RANGE_GAP leaves
+  // it the same way when a block of the range before the written head isn't
+  // written yet, see rcl_gaps.
+  uint64_t timeout_ns;
+  const int* cancel;
+  uint64_t reached;
+} rcl_query_keys_t;
+
+// inclusive range of blocks
+typedef struct {
+  uint64_t from, to;
+} rcl_range_t;
+
 struct rcl;
 typedef struct rcl rcl_t;
 
+// On an error *self is NULL, a half-open db is already released
 rcl_export rcl_result rcl_open(char* dir, uint64_t ram_limit, rcl_t** self);
+// Opens a shard with the [from, to) blocks of a chain: inserts out of it are
+// RCLE_INVALID_RANGE, queries count the part of their range inside it and
+// the upstream fetches from 'from' up to 'to - 1'. rcl_open is [0, UINT64_MAX).
+rcl_export rcl_result rcl_open_window(char* dir,
+                                      uint64_t ram_limit,
+                                      uint64_t from,
+                                      uint64_t to,
+                                      rcl_t** self);
 rcl_export void rcl_free(rcl_t* self);
 
+// Hosts many dbs in one process, e.g. one per chain. They share the ingest
+// stages with 'connections' requests in flight (0 is 64) and 'ram_limit'
+// bytes of blocks kept in RAM, which are rebalanced by the blocks scanned by
+// queries of every db.
+struct rcl_engine;
+typedef struct rcl_engine rcl_engine_t;
+
+rcl_export rcl_result rcl_engine_new(uint64_t ram_limit,
+                                     size_t connections,
+                                     rcl_engine_t** engine);
+// The dbs of the engine must be freed before
+rcl_export void rcl_engine_free(rcl_engine_t* engine);
+// Opens a db of the engine, it's closed by rcl_free
+rcl_export rcl_result rcl_engine_open(rcl_engine_t* engine,
+                                      char* dir,
+                                      rcl_t** db);
+
 rcl_export rcl_result rcl_update_height(rcl_t* self, uint64_t height);
 rcl_export rcl_result rcl_set_upstream(rcl_t* self, const char* upstream);
+// Paces the upstream ingest by the latency of queries. While the backlog is
+// over 1024 blocks and the 'percentile' (0 is 99) of the queries of the last
+// second is over 'latency_ns', every second halves the requests in flight and
+// the blocks of a commit, down to 1/32, and committed pages are written back
+// at once. Ingest speeds up as queries meet the target and runs at full speed
+// without them. 0 'latency_ns' is off, the default.
+rcl_export rcl_result rcl_set_query_slo(rcl_t* self,
+                                        uint64_t latency_ns,
+                                        unsigned percentile);
+rcl_export rcl_result rcl_set_upstream_mode(rcl_t* self,
+                                            rcl_upstream_mode mode,
+                                            uint64_t call_blocks);
 
 rcl_export rcl_result rcl_query(rcl_t* self,
                                 rcl_query_t* query,
                                 uint64_t* result);
+rcl_export rcl_result rcl_query_keys(rcl_t* self,
+                                     rcl_query_keys_t* query,
+                                     uint64_t* result);
+// Splits [from, to] of a query into consecutive chunks of at most 'max_logs'
+// matching logs, a single block may exceed it. It's one scan instead of
+// bisecting with rcl_query. 'count' is the capacity of 'chunks' and then the
+// number of chunks (RCLE_QUERY_OVERFLOW if they don't fit).
+rcl_export rcl_result rcl_query_split(rcl_t* self,
+                                      rcl_query_keys_t* query,
+                                      uint64_t max_logs,
+                                      rcl_range_t* chunks,
+                                      size_t* count);
+// Counts matching logs of [from, to] per 'bucket_blocks' blocks, 'count' is
+// the capacity of 'buckets' and then the number of buckets
+rcl_export rcl_result rcl_query_histogram(rcl_t* self,
+                                          rcl_query_keys_t* query,
+                                          uint64_t bucket_blocks,
+                                          uint64_t* buckets,
+                                          size_t* count);
 rcl_export rcl_result rcl_query_alloc(rcl_query_t** query,
                                       size_t alen,
                                       size_t tlen[TOPICS_LENGTH]);
 rcl_export void rcl_query_free(rcl_query_t* query);
+// Appends logs to the range before the first one's block: its last block may
+// be continued, the blocks between them have no logs
 rcl_export rcl_result rcl_insert(rcl_t* self, size_t size, rcl_log_t* logs);
 
+// Writes all logs of the [from, to] blocks, ranges may come in any order but
+// must not overlap the written ones
+rcl_export rcl_result rcl_insert_range(rcl_t* self,
+                                       uint64_t from,
+                                       uint64_t to,
+                                       size_t size,
+                                       rcl_log_t* logs);
+// Loads a local dump with all logs of the [from, to] blocks, hashes and
+// blooms are built in parallel and the manifest is written once at the end.
+// The range is reserved, other writes go on between the batches.
+rcl_export rcl_result rcl_import(rcl_t* self,
+                                 uint64_t from,
+                                 uint64_t to,
+                                 rcl_dump_format format,
+                                 const char* path);
+// Streams a checksummed archive of the pages and the manifest at the current
+// watermark into 'path' ("-" is stdout), queries and inserts aren't blocked
+rcl_export rcl_result rcl_snapshot_export(rcl_t* self, const char* path);
+// Unpacks a snapshot into a dir without a db, then it's opened by rcl_open and
+// the upstream catches up the tail
+rcl_export rcl_result rcl_snapshot_import(const char* path, const char* dir);
+
+// Leader: streams a snapshot and then the rows of every commit into the
+// connected 'fd' (a socket), it's owned and closed by the db. A follower that
+// falls 65536 commits behind is disconnected.
+rcl_export rcl_result rcl_replica_attach(rcl_t* self, int fd);
+// Follower: unpacks the leader's snapshot from 'fd' into a dir without a db,
+// opens it and applies the leader's commits until the stream is closed. The
+// follower mustn't have its own upstream.
+rcl_export rcl_result rcl_replica_follow(char* dir,
+                                         uint64_t ram_limit,
+                                         int fd,
+                                         rcl_t** db_ptr);
+// Follower: RCLE_FILESYSTEM once the leader's stream is closed or broken, the
+// db stays readable but is stale and has to be bootstrapped again
+rcl_export rcl_result rcl_replica_check(rcl_t* self);
+
+// Lists not written blocks of [from, to], 'count' is the capacity of 'gaps'
+// and then the number of found gaps (RCLE_QUERY_OVERFLOW if they don't fit).
+// The upstream follows the head from the last written block, the gaps before
+// it are synced by up to 4 backfill workers in parallel.
+rcl_export rcl_result rcl_gaps(rcl_t* self,
+                               uint64_t from,
+                               uint64_t to,
+                               rcl_range_t* gaps,
+                               size_t* count);
+
+// Registers a filter of the keys of 'query' (the range and stops are
+// ignored), its logs are counted per block as they're inserted and the
+// written blocks are backfilled in the background. Queries with the same keys
+// count the counted part by two lookups and scan only the rest. A filter with
+// the same keys is shared. There are up to 64 filters (RCLE_TOO_MANY_FILTERS
+// otherwise) with up to 64 keys (RCLE_TOO_LARGE_QUERY otherwise), a removed
+// filter frees its slot.
+rcl_export rcl_result rcl_standing_filter_add(rcl_t* self,
+                                              rcl_query_keys_t* query,
+                                              uint64_t* id);
+rcl_export rcl_result rcl_standing_filter_remove(rcl_t* self, uint64_t id);
+// The filter has counted blocks before 'next', from the start of the window
+rcl_export rcl_result rcl_standing_filter_next(rcl_t* self,
+                                               uint64_t id,
+                                               uint64_t* next);
+
+// Counters since rcl_open, they're lock-free for writers and read without
+// stopping them
+rcl_export rcl_result rcl_stats(rcl_t* self, rcl_stats_t* stats);
+
 rcl_export rcl_result rcl_logs_count(rcl_t* self, uint64_t* result);
 rcl_export rcl_result rcl_blocks_count(rcl_t* self, uint64_t* result);
 
@@ -0,0 +1,132 @@
+#include "queue.h"
+#include "common.h"
+
+bool queue_init(queue_t* q, size_t capacity) {
+  if (capacity < 2 || (capacity & (capacity - 1)) != 0)
+    return false;
+
+  q->cells = calloc(capacity, sizeof(queue_cell_t));
+  if (rcl_unlikely(q->cells == NULL))
+    return false;
+
+  for (size_t i = 0; i < capacity; ++i)
+    atomic_init(&(q->cells[i].sequence), i);
+
+  q->mask = capacity - 1;
+  atomic_init(&(q->head), 0);
+  atomic_init(&(q->tail), 0);
+  atomic_init(&(q->parked), 0);
+
+  if (pthread_mutex_init(&(q->lock), NULL) != 0) {
+    free(q->cells);
+    q->cells = NULL;
+    return false;
+  }
+  if (pthread_cond_init(&(q->nonempty), NULL) != 0) {
+    pthread_mutex_destroy(&(q->lock));
+    free(q->cells);
+    q->cells = NULL;
+    return false;
+  }
+
+  return true;
+}
+
+void queue_destroy(queue_t* q) {
+  if (q->cells == NULL)
+    return;
+
+  pthread_cond_destroy(&(q->nonempty));
+  pthread_mutex_destroy(&(q->lock));
+  free(q->cells);
+  q->cells = NULL;
+}
+
+bool queue_push(queue_t* q, void* item) {
+  size_t pos = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+
+  for (;;) {
+    queue_cell_t* cell = &(q->cells[pos & q->mask]);
+    size_t seq = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&(q->tail), &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        cell->data = item;
+        atomic_store_explicit(&(cell->sequence), pos + 1,
+                              memory_order_release);
+
+        // pairs with the fence of queue_pop_wait: a consumer either pops
+        // this item or is counted as parked here
+        atomic_thread_fence(memory_order_seq_cst);
+        if (atomic_load_explicit(&(q->parked), memory_order_relaxed) > 0) {
+          pthread_mutex_lock(&(q->lock));
+          pthread_cond_signal(&(q->nonempty));
+          pthread_mutex_unlock(&(q->lock));
+        }
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // full
+    } else {
+      pos = atomic_load_explicit(&(q->tail), memory_order_relaxed);
+    }
+  }
+}
+
+bool queue_pop(queue_t* q, void** item) {
+  size_t pos = atomic_load_explicit(&(q->head), memory_order_relaxed);
+
+  for (;;) {
+    queue_cell_t* cell = &(q->cells[pos & q->mask]);
+    size_t seq = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&(q->head), &pos, pos + 1,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+        *item = cell->data;
+        atomic_store_explicit(&(cell->sequence), pos + q->mask + 1,
+                              memory_order_release);
+        return true;
+      }
+    } else if (diff < 0) {
+      return false;  // empty
+    } else {
+      pos = atomic_load_explicit(&(q->head), memory_order_relaxed);
+    }
+  }
+}
+
+bool queue_pop_wait(queue_t* q, void** item, unsigned timeout_s) {
+  if (queue_pop(q, item))
+    return true;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_s;
+
+  pthread_mutex_lock(&(q->lock));
+  atomic_fetch_add_explicit(&(q->parked), 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+
+  bool popped = queue_pop(q, item);
+  if (!popped) {
+    (void)pthread_cond_timedwait(&(q->nonempty), &(q->lock), &deadline);
+    popped = queue_pop(q, item);
+  }
+
+  atomic_fetch_sub_explicit(&(q->parked), 1, memory_order_relaxed);
+  pthread_mutex_unlock(&(q->lock));
+
+  return popped;
+}
+
+void queue_wake(queue_t* q) {
+  pthread_mutex_lock(&(q->lock));
+  pthread_cond_broadcast(&(q->nonempty));
+  pthread_mutex_unlock(&(q->lock));
+}
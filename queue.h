@@ -0,0 +1,38 @@
+#ifndef _RCL_QUEUE_H
+#define _RCL_QUEUE_H
+
+#include "common.h"
+
+// Bounded lock-free MPMC ring (Dmitry Vyukov's scheme). It's used as the
+// SPSC/MPSC link between ingest stages, so the capacity is always a power of
+// two and never smaller than the number of in-flight items. An idle consumer
+// parks in queue_pop_wait, a push takes the lock only when one is parked.
+typedef struct {
+  atomic_size_t sequence;
+  void* data;
+} queue_cell_t;
+
+typedef struct {
+  queue_cell_t* cells;
+  size_t mask;
+
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+
+  atomic_uint parked;
+  pthread_mutex_t lock;
+  pthread_cond_t nonempty;
+} queue_t;
+
+bool queue_init(queue_t* queue, size_t capacity);
+void queue_destroy(queue_t* queue);
+
+bool queue_push(queue_t* queue, void* item);
+bool queue_pop(queue_t* queue, void** item);
+
+// Waits up to 'timeout_s' for an item, false if there's none or it's woken
+bool queue_pop_wait(queue_t* queue, void** item, unsigned timeout_s);
+// Wakes the parked consumers, e.g. to see a stop flag
+void queue_wake(queue_t* queue);
+
+#endif  // _RCL_QUEUE_H
@@ -0,0 +1,243 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // copy_file_range
+#endif
+
+#include "snapshot.h"
+#include "file.h"
+
+#include <ctype.h>
+#include <sys/sendfile.h>
+
+static const char SNAPSHOT_MAGIC[8] = "RCLSNAP1";
+
+uint64_t snapshot_checksum(uint64_t checksum, const void* data, size_t size) {
+  for (size_t offset = 0; offset < size; offset += SNAPSHOT_CHUNK) {
+    size_t chunk = min(size - offset, (size_t)SNAPSHOT_CHUNK);
+    uint32_t seed = (uint32_t)(checksum ^ (checksum >> 32));
+    checksum = murmur64A((const char*)data + offset, chunk, seed);
+  }
+
+  return checksum;
+}
+
+static rcl_result write_all(int out, const void* data, size_t size) {
+  if (file_write_all(out, data, size) != 0) {
+    rcl_perror("write snapshot");
+    return RCLE_FILESYSTEM;
+  }
+
+  return RCLE_OK;
+}
+
+static rcl_result read_all(int in, void* data, size_t size) {
+  switch (file_read_all(in, data, size)) {
+    case 0:
+      return RCLE_OK;
+    case 1:
+      rcl_error("truncated snapshot\n");
+      return RCLE_INVALID_DUMP;
+    default:
+      rcl_perror("read snapshot");
+      return RCLE_FILESYSTEM;
+  }
+}
+
+static rcl_result write_entry(int out,
+                              const char* name,
+                              size_t size,
+                              size_t file_size,
+                              uint64_t checksum) {
+  snapshot_entry_t entry = {.size = size,
+                            .file_size = file_size,
+                            .checksum = checksum};
+  if (strlen(name) >= SNAPSHOT_NAME_LENGTH)
+    return RCLE_UNKNOWN;
+  strcpy(entry.name, name);
+
+  return write_all(out, &entry, sizeof(entry));
+}
+
+rcl_result snapshot_write_magic(int out) {
+  return write_all(out, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+}
+
+rcl_result snapshot_write_end(int out) {
+  return write_entry(out, "", 0, 0, 0);
+}
+
+rcl_result snapshot_write_buffer(int out,
+                                 const char* name,
+                                 const void* data,
+                                 size_t size,
+                                 size_t file_size) {
+  rcl_result rc = write_entry(out, name, size, file_size,
+                              snapshot_checksum(0, data, size));
+  if (rc != RCLE_OK)
+    return rc;
+
+  return write_all(out, data, size);
+}
+
+rcl_result snapshot_write_file(int out,
+                               const char* name,
+                               int fd,
+                               const void* mapping,
+                               size_t size,
+                               size_t file_size) {
+  rcl_result rc = write_entry(out, name, size, file_size,
+                              snapshot_checksum(0, mapping, size));
+  if (rc != RCLE_OK)
+    return rc;
+
+  // copy_file_range works between regular files only, sendfile does pipes
+  // and sockets
+  bool regular = true;
+  for (off_t offset = 0; (size_t)offset < size;) {
+    size_t count = size - (size_t)offset;
+    ssize_t copied = -1;
+
+    if (regular) {
+      copied = copy_file_range(fd, &offset, out, NULL, count, 0);
+      if (copied < 0 && (errno == EXDEV || errno == EINVAL ||
+                         errno == ENOSYS || errno == EOPNOTSUPP)) {
+        regular = false;
+        continue;
+      }
+    } else {
+      copied = sendfile(out, fd, &offset, count);
+    }
+
+    if (copied < 0 && errno == EINTR)
+      continue;
+    if (copied <= 0) {
+      rcl_perror("copy page into snapshot");
+      return RCLE_FILESYSTEM;
+    }
+  }
+
+  return RCLE_OK;
+}
+
+static bool snapshot_name_valid(const char* name) {
+  if (name[0] == '\0' || name[0] == '.' ||
+      strnlen(name, SNAPSHOT_NAME_LENGTH) == SNAPSHOT_NAME_LENGTH)
+    return false;
+
+  for (const char* it = name; *it; ++it) {
+    if (!isalnum((unsigned char)*it) && *it != '.')
+      return false;
+  }
+
+  return true;
+}
+
+static rcl_result snapshot_unpack_entry(int in,
+                                        int fd,
+                                        const snapshot_entry_t* entry,
+                                        char* buffer) {
+  uint64_t checksum = 0;
+
+  for (uint64_t left = entry->size; left > 0;) {
+    size_t chunk = min(left, (uint64_t)SNAPSHOT_CHUNK);
+
+    rcl_result rc = read_all(in, buffer, chunk);
+    if (rc != RCLE_OK)
+      return rc;
+
+    checksum = snapshot_checksum(checksum, buffer, chunk);
+    if ((rc = write_all(fd, buffer, chunk)) != RCLE_OK)
+      return rc;
+
+    left -= chunk;
+  }
+
+  if (checksum != entry->checksum) {
+    rcl_error("snapshot checksum mismatch in '%s'\n", entry->name);
+    return RCLE_INVALID_DUMP;
+  }
+
+  if (ftruncate(fd, (off_t)max(entry->size, entry->file_size)) != 0) {
+    rcl_perror("ftruncate unpacked file");
+    return RCLE_FILESYSTEM;
+  }
+
+  return RCLE_OK;
+}
+
+rcl_result snapshot_unpack(int in, const char* dir, const char* manifest) {
+  char magic[sizeof(SNAPSHOT_MAGIC)];
+  rcl_result rc = read_all(in, magic, sizeof(magic));
+  if (rc != RCLE_OK)
+    return rc;
+
+  if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0) {
+    rcl_error("not a snapshot\n");
+    return RCLE_INVALID_DUMP;
+  }
+
+  char* buffer = malloc(SNAPSHOT_CHUNK);
+  if (buffer == NULL)
+    return RCLE_OUT_OF_MEMORY;
+
+  char path[PATH_MAX + 1], staged[PATH_MAX + 1] = {0};
+  bool has_manifest = false;
+
+  while (true) {
+    snapshot_entry_t entry;
+    if ((rc = read_all(in, &entry, sizeof(entry))) != RCLE_OK)
+      break;
+
+    if (entry.name[0] == '\0')
+      break;
+
+    if (!snapshot_name_valid(entry.name)) {
+      rcl_error("invalid snapshot entry\n");
+      rc = RCLE_INVALID_DUMP;
+      break;
+    }
+
+    // the manifest makes the dir a db, so it appears only when all is done
+    bool is_manifest = strcmp(entry.name, manifest) == 0;
+    int count = snprintf(path, sizeof(path), "%s/%s%s", dir, entry.name,
+                         is_manifest ? ".tmp" : "");
+    if (count < 0 || count > PATH_MAX) {
+      rc = RCLE_INVALID_DATADIR;
+      break;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, (mode_t)0600);
+    if (fd < 0) {
+      rcl_perror("open unpacked file");
+      rc = RCLE_FILESYSTEM;
+      break;
+    }
+
+    rc = snapshot_unpack_entry(in, fd, &entry, buffer);
+    if (close(fd) != 0 && rc == RCLE_OK)
+      rc = RCLE_FILESYSTEM;
+    if (rc != RCLE_OK)
+      break;
+
+    if (is_manifest) {
+      has_manifest = true;
+      strcpy(staged, path);
+    }
+  }
+
+  free(buffer);
+
+  if (rc == RCLE_OK && !has_manifest) {
+    rcl_error("snapshot has no manifest\n");
+    rc = RCLE_INVALID_DUMP;
+  }
+
+  if (rc == RCLE_OK) {
+    snprintf(path, sizeof(path), "%s/%s", dir, manifest);
+    if (rename(staged, path) != 0) {
+      rcl_perror("rename unpacked manifest");
+      rc = RCLE_FILESYSTEM;
+    }
+  }
+
+  return rc;
+}
@@ -0,0 +1,41 @@
+#ifndef _RCL_SNAPSHOT_H
+#define _RCL_SNAPSHOT_H
+
+#include "common.h"
+#include "err.h"
+
+// Snapshot archive: the magic, then entries of a header and 'size' bytes of
+// a file, then an empty entry. Numbers are in the host (little endian) order.
+// A file is extended with zeros up to 'file_size' when unpacked.
+enum { SNAPSHOT_NAME_LENGTH = 32, SNAPSHOT_CHUNK = 1024 * 1024 };
+
+typedef struct {
+  char name[SNAPSHOT_NAME_LENGTH];
+  uint64_t size, file_size, checksum;
+} snapshot_entry_t;
+
+// murmur64A chained over SNAPSHOT_CHUNK pieces
+uint64_t snapshot_checksum(uint64_t checksum, const void* data, size_t size);
+
+rcl_result snapshot_write_magic(int out);
+rcl_result snapshot_write_end(int out);
+
+// The content is checksummed and written from memory
+rcl_result snapshot_write_buffer(int out,
+                                 const char* name,
+                                 const void* data,
+                                 size_t size,
+                                 size_t file_size);
+// The content is checksummed from the mapping and copied in the kernel from
+// 'fd', so it must not change until the copy is done
+rcl_result snapshot_write_file(int out,
+                               const char* name,
+                               int fd,
+                               const void* mapping,
+                               size_t size,
+                               size_t file_size);
+
+// Unpacks the archive into 'dir', the manifest is renamed in place last
+rcl_result snapshot_unpack(int in, const char* dir, const char* manifest);
+
+#endif  // _RCL_SNAPSHOT_H
@@ -0,0 +1,21 @@
+#include "stats.h"
+
+void stats_histogram_add(stats_histogram_t* histogram, uint64_t elapsed_ns) {
+  uint64_t us = elapsed_ns / 1000;
+
+  size_t bucket = 0;
+  while (bucket < RCL_HISTOGRAM_BUCKETS - 1 && us >= (1ull << bucket))
+    ++bucket;
+
+  stats_add(histogram->count, 1);
+  stats_add(histogram->sum_us, us);
+  stats_add(histogram->buckets[bucket], 1);
+}
+
+void stats_histogram_read(stats_histogram_t* histogram, rcl_histogram_t* out) {
+  out->count = stats_load(histogram->count);
+  out->sum_us = stats_load(histogram->sum_us);
+
+  for (size_t i = 0; i < RCL_HISTOGRAM_BUCKETS; ++i)
+    out->buckets[i] = stats_load(histogram->buckets[i]);
+}
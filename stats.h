@@ -0,0 +1,62 @@
+#ifndef _RCL_STATS_H
+#define _RCL_STATS_H
+
+#include "common.h"
+
+enum { RCL_HISTOGRAM_BUCKETS = 24 };
+
+// Latencies in microseconds, the i-th bucket counts calls under 2^i us and
+// the last one all the slower calls
+typedef struct {
+  uint64_t count, sum_us;
+  uint64_t buckets[RCL_HISTOGRAM_BUCKETS];
+} rcl_histogram_t;
+
+typedef struct {
+  // db
+  uint64_t blocks_count, logs_count;
+
+  // queries
+  uint64_t queries, query_errors;
+  uint64_t blocks_scanned, blooms_checked, blooms_passed;
+  uint64_t logs_examined, logs_matched;
+  uint64_t standing_hits;      // queries counted by a standing filter
+  uint64_t blocks_summarized;  // counted by summaries of sealed pages
+  rcl_histogram_t query_latency;
+
+  // inserts, imports and replication
+  uint64_t inserts, blocks_inserted, logs_inserted;
+  rcl_histogram_t insert_latency;
+
+  // upstream, the lag is 'height - next'
+  uint64_t height, next;
+  uint64_t upstream_requests, upstream_errors;
+  rcl_histogram_t upstream_latency;
+  uint64_t ingest_throttle;  // the level of rcl_set_query_slo, 0 is full speed
+
+  // process
+  uint64_t minor_faults, major_faults;
+
+  // bytes of blocks kept in RAM: the limit of rcl_open or the engine's share
+  uint64_t ram_limit;
+
+  // bytes of pages read in by the warmup after rcl_open, it's done when equal
+  uint64_t warmup_done, warmup_total;
+} rcl_stats_t;
+
+// Writers add with relaxed atomics, a reader sees each counter consistent
+// but not a snapshot of all of them
+typedef struct {
+  atomic_uint_fast64_t count, sum_us;
+  atomic_uint_fast64_t buckets[RCL_HISTOGRAM_BUCKETS];
+} stats_histogram_t;
+
+#define stats_add(counter, value) \
+  atomic_fetch_add_explicit(&(counter), (value), memory_order_relaxed)
+#define stats_load(counter) \
+  atomic_load_explicit(&(counter), memory_order_relaxed)
+
+void stats_histogram_add(stats_histogram_t* histogram, uint64_t elapsed_ns);
+void stats_histogram_read(stats_histogram_t* histogram, rcl_histogram_t* out);
+
+#endif  // _RCL_STATS_H
@@ -1,11 +1,17 @@
+#include <endian.h>
 #include <limits.h>
+#include <sched.h>
 #include <stdlib.h>
+#include <sys/socket.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <criterion/criterion.h>
 #include <criterion/new/assert.h>
 
+#include "../arena.h"
 #include "../liboracle.h"
+#include "../queue.h"
 #include "../vector.h"
 
 static int mkdirp(char* path) {
@@ -295,3 +301,979 @@ Test(liboracle, QueryTopics) {
                /* topics */ v(), v(), v(3), v());
   rcl_free(db);
 }
+
+Test(liboracle, QueryManyAddresses) {
+  enum { COUNT = 500, ENCODED = 2 + 2 * ADDRESS_LENGTH + 1 };
+  rcl_t* db = db_make_filled();
+
+  // 20-byte keys decoded past their 8-byte words overflowed the scratch
+  size_t tlen[TOPICS_LENGTH] = {0};
+  rcl_query_t* q = NULL;
+  cr_assert(rcl_query_alloc(&q, COUNT, tlen) == RCLE_OK);
+
+  char(*encoded)[ENCODED] = calloc(COUNT, ENCODED);
+  cr_assert(encoded != NULL);
+  for (size_t i = 0; i < COUNT; ++i) {
+    snprintf(encoded[i], ENCODED, "0x%040zx", i + 1);
+    q->address[i].encoded = encoded[i];
+  }
+  q->address[COUNT / 2].encoded = addresses[4];
+
+  q->from = 0;
+  q->to = 6;
+
+  uint64_t result = 0;
+  cr_expect(rcl_query(db, q, &result) == RCLE_OK);
+  cr_expect(eq(u64, result, 2));
+
+  rcl_query_free(q);
+  free(encoded);
+  rcl_free(db);
+}
+
+Test(liboracle, QueryKeys) {
+  rcl_t* db = db_make_filled();
+
+  rcl_address_t address[2];
+  rcl_hash_t topic;
+  hex2bin(address[0], addresses[3], sizeof(rcl_address_t));
+  hex2bin(address[1], addresses[4], sizeof(rcl_address_t));
+  hex2bin(topic, topics[2], sizeof(rcl_hash_t));
+
+  rcl_query_keys_t q = {.from = 0, .to = 6, .address = address, .alen = 2};
+
+  uint64_t count;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 3));
+
+  q.topics[0] = &topic;
+  q.tlen[0] = 1;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 1));
+
+  rcl_free(db);
+}
+
+Test(liboracle, QuerySplit) {
+  rcl_t* db = db_make_filled();
+
+  // logs per block: 3, 0, 0, 5, 4, 7, 1
+  rcl_query_keys_t q = {.from = 0, .to = 9};
+
+  rcl_range_t chunks[3];
+  size_t count = 2;
+  cr_expect(rcl_query_split(db, &q, 8, chunks, &count) == RCLE_QUERY_OVERFLOW);
+  cr_expect(eq(sz, count, 3));
+
+  cr_expect(rcl_query_split(db, &q, 8, chunks, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 3));
+  cr_expect(eq(u64, chunks[0].from, 0) && eq(u64, chunks[0].to, 3));
+  cr_expect(eq(u64, chunks[1].from, 4) && eq(u64, chunks[1].to, 4));
+  cr_expect(eq(u64, chunks[2].from, 5) && eq(u64, chunks[2].to, 9));
+
+  rcl_address_t address;
+  hex2bin(address, addresses[1], sizeof(rcl_address_t));
+  q = (rcl_query_keys_t){.from = 0, .to = 6, .address = &address, .alen = 1};
+
+  count = 3;
+  cr_expect(rcl_query_split(db, &q, 2, chunks, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 2));
+  cr_expect(eq(u64, chunks[0].from, 0) && eq(u64, chunks[0].to, 4));
+  cr_expect(eq(u64, chunks[1].from, 5) && eq(u64, chunks[1].to, 6));
+
+  uint64_t buckets[3];
+  q = (rcl_query_keys_t){.from = 0, .to = 6};
+  count = 3;
+  cr_expect(rcl_query_histogram(db, &q, 3, buckets, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 3));
+  cr_expect(eq(u64, buckets[0], 3));
+  cr_expect(eq(u64, buckets[1], 16));
+  cr_expect(eq(u64, buckets[2], 1));
+
+  rcl_free(db);
+}
+
+Test(liboracle, QueryCancel) {
+  rcl_t* db = db_make();
+
+  rcl_log_t logs[] = {ml(0, addresses[1], NULL, NULL, NULL, NULL),
+                      ml(10000, addresses[1], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(db, 0, 19999, 2, logs) == RCLE_OK);
+
+  int cancel = 1;
+  rcl_query_keys_t q = {.from = 0, .to = 19999, .cancel = &cancel};
+
+  uint64_t count;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_QUERY_CANCELED);
+  cr_expect(eq(u64, count, 1));
+  cr_expect(eq(u64, q.reached, 4095));
+
+  q.cancel = NULL;
+  q.timeout_ns = 1;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_QUERY_CANCELED);
+  cr_expect(eq(u64, q.reached, 4095));
+
+  q.timeout_ns = 0;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 2));
+
+  rcl_free(db);
+}
+
+Test(liboracle, Stats) {
+  rcl_t* db = db_make_filled();
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 6,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+
+  rcl_stats_t stats;
+  cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+
+  cr_expect(eq(u64, stats.blocks_count, 7));
+  cr_expect(eq(u64, stats.inserts, 1));
+  cr_expect(eq(u64, stats.logs_inserted, 20));
+  cr_expect(eq(u64, stats.insert_latency.count, 1));
+
+  cr_expect(eq(u64, stats.queries, 1));
+  cr_expect(eq(u64, stats.blocks_scanned, 7));
+  cr_expect(eq(u64, stats.blooms_checked, 5));
+  cr_expect(eq(u64, stats.logs_matched, 2));
+  cr_expect(stats.blooms_passed <= stats.blooms_checked);
+  cr_expect(eq(u64, stats.query_latency.count, 1));
+
+  rcl_free(db);
+}
+
+Test(liboracle, QuerySlo) {
+  rcl_t* db = db_make_filled();
+
+  // the node is far ahead and every query breaches the 1ns target
+  cr_expect(rcl_update_height(db, 1000000) == RCLE_OK);
+  cr_expect(rcl_set_query_slo(db, 1, 0) == RCLE_OK);
+
+  rcl_stats_t stats = {0};
+  for (int i = 0; i < 300 && stats.ingest_throttle == 0; ++i) {
+    expect_query(/* expected */ 2,
+                 /* from, to */ 0, 6,
+                 /* address */ v(4),
+                 /* topics */ v(), v(), v(), v());
+    cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+    usleep(10000);
+  }
+  cr_expect(eq(u64, stats.ingest_throttle, 1));
+
+  // commits of a throttled ingest are written back at once
+  rcl_log_t logs[] = {ml(7, addresses[4], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(db, 7, 7, 1, logs) == RCLE_OK);
+  expect_query(/* expected */ 3,
+               /* from, to */ 0, 7,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+
+  // without queries it's full speed again
+  for (int i = 0; i < 500 && stats.ingest_throttle != 0; ++i) {
+    cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+    usleep(10000);
+  }
+  cr_expect(eq(u64, stats.ingest_throttle, 0));
+
+  rcl_free(db);
+}
+
+Test(liboracle, InsertRangeOutOfOrder) {
+  rcl_t* db = db_make();
+
+  rcl_log_t tail[] = {
+      ml(7, addresses[2], topics[1], NULL, NULL, NULL),
+      ml(9, addresses[3], NULL, NULL, NULL, NULL),
+  };
+  rcl_log_t head[] = {
+      ml(0, addresses[2], topics[1], NULL, NULL, NULL),
+      ml(2, addresses[4], NULL, NULL, NULL, NULL),
+      ml(2, addresses[2], NULL, NULL, NULL, NULL),
+  };
+
+  cr_expect(rcl_insert_range(db, 6, 9, 2, tail) == RCLE_OK);
+  cr_expect(rcl_insert_range(db, 0, 2, 3, head) == RCLE_OK);
+
+  rcl_range_t gaps[4];
+  size_t count = 4;
+  cr_expect(rcl_gaps(db, 0, 12, gaps, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 2));
+  cr_expect(eq(u64, gaps[0].from, 3) && eq(u64, gaps[0].to, 5));
+  cr_expect(eq(u64, gaps[1].from, 10) && eq(u64, gaps[1].to, 12));
+
+  cr_expect(rcl_insert_range(db, 3, 5, 0, NULL) == RCLE_OK);
+  count = 4;
+  cr_expect(rcl_gaps(db, 0, 9, gaps, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 0));
+
+  expect_query(/* expected */ 5,
+               /* from, to */ 0, 9,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 3,
+               /* from, to */ 0, 9,
+               /* address */ v(2),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 9,
+               /* address */ v(),
+               /* topics */ v(1), v(), v(), v());
+
+  // the head appends after the range before the block, not after the last
+  rcl_log_t ahead[] = {ml(21, addresses[2], NULL, NULL, NULL, NULL)};
+  rcl_log_t appended[] = {ml(12, addresses[2], NULL, NULL, NULL, NULL),
+                          ml(30, addresses[2], NULL, NULL, NULL, NULL),
+                          ml(22, addresses[2], NULL, NULL, NULL, NULL),
+                          ml(18, addresses[2], NULL, NULL, NULL, NULL),
+                          ml(21, addresses[2], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(db, 20, 24, 1, ahead) == RCLE_OK);
+  cr_expect(rcl_insert(db, 1, &(appended[0])) == RCLE_OK);
+  cr_expect(rcl_insert(db, 1, &(appended[1])) == RCLE_OK);
+  cr_expect(rcl_insert(db, 1, &(appended[2])) == RCLE_INVALID_RANGE);
+  cr_expect(rcl_insert(db, 2, &(appended[3])) == RCLE_RANGE_OVERLAP);
+  cr_expect(rcl_insert(db, 1, &(appended[3])) == RCLE_OK);
+
+  count = 4;
+  cr_expect(rcl_gaps(db, 0, 30, gaps, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 1));
+  cr_expect(eq(u64, gaps[0].from, 19) && eq(u64, gaps[0].to, 19));
+
+  rcl_query_keys_t q = {.from = 0, .to = 30};
+  uint64_t before = 0;
+  cr_expect(rcl_query_keys(db, &q, &before) == RCLE_RANGE_GAP);
+  cr_expect(eq(u64, before, 7) && eq(u64, q.reached, 18));
+  rcl_free(db);
+}
+
+Test(liboracle, InsertRangeOverlap) {
+  rcl_t* db = db_make();
+
+  rcl_log_t logs[] = {
+      ml(4, addresses[2], NULL, NULL, NULL, NULL),
+      ml(3, addresses[2], NULL, NULL, NULL, NULL),
+  };
+
+  cr_expect(rcl_insert_range(db, 0, 4, 1, logs) == RCLE_OK);
+  cr_expect(rcl_insert_range(db, 4, 8, 1, logs) == RCLE_RANGE_OVERLAP);
+  cr_expect(rcl_insert_range(db, 5, 8, 1, logs) == RCLE_INVALID_RANGE);
+  cr_expect(rcl_insert_range(db, 3, 8, 2, logs) == RCLE_INVALID_RANGE);
+
+  expect_query(/* expected */ 1,
+               /* from, to */ 0, 8,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  rcl_free(db);
+}
+
+Test(liboracle, ImportDump) {
+  rcl_t* db = db_make();
+
+  char jsonl[] = "/tmp/dump.XXXXXX", binary[] = "/tmp/dump.XXXXXX";
+  FILE* fj = fdopen(mkstemp(jsonl), "w");
+  FILE* fb = fdopen(mkstemp(binary), "w");
+  cr_assert(fj != NULL && fb != NULL, "Couldn't create dumps");
+
+  // an eth_getLogs result and a single log per line, blank CRLF lines
+  fprintf(fj,
+          "[{\"blockNumber\":\"0x1\",\"address\":\"%s\",\"topics\":[\"%s\"]},"
+          "{\"blockNumber\":\"0x3\",\"address\":\"%s\",\"topics\":[]}]\r\n"
+          "\r\n \r\n"
+          "{\"blockNumber\":\"0x3\",\"address\":\"%s\",\"topics\":[\"%s\"]}\n",
+          addresses[2], topics[1], addresses[4], addresses[2], topics[5]);
+  fclose(fj);
+
+  rcl_log_t logs[] = {
+      ml(6, addresses[4], topics[1], NULL, NULL, NULL),
+      ml(8, addresses[2], NULL, NULL, NULL, NULL),
+  };
+  for (size_t i = 0; i < 2; ++i) {
+    uint64_t block_number = htole64(logs[i].block_number);
+    fwrite(&block_number, sizeof(block_number), 1, fb);
+    fwrite(logs[i].address, sizeof(rcl_address_t), 1, fb);
+    fwrite(logs[i].topics, sizeof(rcl_hash_t), TOPICS_LENGTH, fb);
+  }
+  fclose(fb);
+
+  cr_expect(rcl_import(db, 5, 9, RCL_DUMP_BINARY, binary) == RCLE_OK);
+  cr_expect(rcl_import(db, 0, 4, RCL_DUMP_JSONL, jsonl) == RCLE_OK);
+  cr_expect(rcl_import(db, 4, 6, RCL_DUMP_JSONL, jsonl) == RCLE_RANGE_OVERLAP);
+
+  int64_t blocks;
+  cr_expect(rcl_blocks_count(db, &blocks) == RCLE_OK && blocks == 10);
+
+  expect_query(/* expected */ 5,
+               /* from, to */ 0, 9,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 3,
+               /* from, to */ 0, 9,
+               /* address */ v(2),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 9,
+               /* address */ v(),
+               /* topics */ v(1), v(), v(), v());
+
+  unlink(jsonl);
+  unlink(binary);
+  rcl_free(db);
+}
+
+Test(liboracle, Snapshot) {
+  rcl_t* db = db_make_filled();
+
+  rcl_log_t logs[] = {ml(12, addresses[4], topics[1], NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(db, 10, 14, 1, logs) == RCLE_OK);
+
+  char snapshot[] = "/tmp/snapshot.XXXXXX", dir[] = "/tmp/tmpdir.XXXXXX";
+  close(mkstemp(snapshot));
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  cr_expect(rcl_snapshot_export(db, snapshot) == RCLE_OK);
+  rcl_free(db);
+
+  cr_expect(rcl_snapshot_import(snapshot, dir) == RCLE_OK);
+  cr_expect(rcl_snapshot_import(snapshot, dir) == RCLE_INVALID_DATADIR);
+  unlink(snapshot);
+
+  db = NULL;
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK, "Couldn't open the replica");
+
+  int64_t blocks, logs_count;
+  cr_expect(rcl_blocks_count(db, &blocks) == RCLE_OK && blocks == 15);
+  cr_expect(rcl_logs_count(db, &logs_count) == RCLE_OK && logs_count == 21);
+
+  rcl_range_t gaps[2];
+  size_t count = 2;
+  cr_expect(rcl_gaps(db, 0, 14, gaps, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 1));
+  cr_expect(eq(u64, gaps[0].from, 7) && eq(u64, gaps[0].to, 9));
+
+  // a query over the gap counts the blocks before it
+  rcl_query_keys_t q = {.from = 0, .to = 14};
+  uint64_t before = 0;
+  cr_expect(rcl_query_keys(db, &q, &before) == RCLE_RANGE_GAP);
+  cr_expect(eq(u64, q.reached, 6));
+
+  cr_expect(eq(u64, before, 20));
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 6,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 1,
+               /* from, to */ 10, 14,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+  rcl_free(db);
+}
+
+Test(liboracle, Replica) {
+  rcl_t* leader = db_make_filled();
+
+  int fds[2];
+  cr_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+  cr_assert(rcl_replica_attach(leader, fds[0]) == RCLE_OK);
+
+  char dir[] = "/tmp/tmpdir.XXXXXX";
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  rcl_t* db = NULL;
+  cr_assert(rcl_replica_follow(dir, 0, fds[1], &db) == RCLE_OK);
+
+  rcl_log_t logs[] = {ml(12, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(14, addresses[4], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(leader, 10, 14, 2, logs) == RCLE_OK);
+  cr_expect(rcl_insert_range(leader, 7, 9, 0, NULL) == RCLE_OK);
+
+  rcl_range_t gaps[1];
+  size_t count = 1;
+  for (int i = 0; i < 200 && count != 0; ++i) {
+    usleep(10000);
+    count = 1;
+    cr_expect(rcl_gaps(db, 0, 14, gaps, &count) == RCLE_OK);
+  }
+  cr_expect(eq(sz, count, 0), "Expected the follower to catch up");
+
+  int64_t blocks, logs_count;
+  cr_expect(rcl_blocks_count(db, &blocks) == RCLE_OK && blocks == 15);
+  cr_expect(rcl_logs_count(db, &logs_count) == RCLE_OK && logs_count == 22);
+
+  expect_query(/* expected */ 4,
+               /* from, to */ 0, 14,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 1,
+               /* from, to */ 13, 14,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  cr_expect(rcl_replica_check(db) == RCLE_OK);
+
+  // the follower notices the closed stream
+  rcl_free(leader);
+  rcl_result rc = RCLE_OK;
+  for (int i = 0; i < 200 && rc == RCLE_OK; ++i) {
+    usleep(10000);
+    rc = rcl_replica_check(db);
+  }
+  cr_expect(rc == RCLE_FILESYSTEM, "Expected the leader to be gone");
+
+  rcl_free(db);
+}
+
+Test(liboracle, Engine) {
+  rcl_engine_t* engine = NULL;
+  cr_assert(rcl_engine_new(64 << 20, 0, &engine) == RCLE_OK);
+
+  char dirs[2][sizeof("/tmp/tmpdir.XXXXXX")] = {"/tmp/tmpdir.XXXXXX",
+                                               "/tmp/tmpdir.XXXXXX"};
+  rcl_t* dbs[2] = {NULL, NULL};
+  for (size_t i = 0; i < 2; ++i) {
+    cr_assert(mkdirp(dirs[i]) == 0, "Couldn't create dir");
+    cr_assert(rcl_engine_open(engine, dirs[i], &dbs[i]) == RCLE_OK);
+  }
+
+  rcl_log_t logs[] = {ml(2, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(3, addresses[4], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(dbs[0], 0, 3, 2, logs) == RCLE_OK);
+  cr_expect(rcl_insert_range(dbs[1], 0, 3, 1, logs) == RCLE_OK);
+
+  rcl_t* db = dbs[0];
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 3,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+  db = dbs[1];
+  expect_query(/* expected */ 1,
+               /* from, to */ 0, 3,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+
+  // the budget is two pages of blocks and more, each db has one
+  rcl_stats_t stats[2];
+  for (int i = 0; i < 200; ++i) {
+    cr_expect(rcl_stats(dbs[0], &stats[0]) == RCLE_OK);
+    cr_expect(rcl_stats(dbs[1], &stats[1]) == RCLE_OK);
+    if (stats[0].ram_limit > 0 && stats[1].ram_limit > 0)
+      break;
+    usleep(10000);
+  }
+  cr_expect(stats[0].ram_limit > 0, "Expected a share of the budget");
+  cr_expect(eq(u64, stats[0].ram_limit, stats[1].ram_limit));
+
+  rcl_free(dbs[0]);
+  rcl_free(dbs[1]);
+  rcl_engine_free(engine);
+}
+
+Test(liboracle, Window) {
+  char dir[] = "/tmp/tmpdir.XXXXXX";
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  rcl_t* db = NULL;
+  cr_expect(rcl_open_window(dir, 0, 200, 100, &db) == RCLE_INVALID_RANGE);
+  cr_assert(rcl_open_window(dir, 0, 100, 200, &db) == RCLE_OK);
+
+  rcl_log_t logs[] = {ml(150, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(152, addresses[4], NULL, NULL, NULL, NULL)};
+  rcl_log_t tail[] = {ml(199, addresses[2], NULL, NULL, NULL, NULL)};
+  rcl_log_t out[] = {ml(200, addresses[2], NULL, NULL, NULL, NULL)};
+
+  cr_expect(rcl_insert_range(db, 0, 5, 0, NULL) == RCLE_INVALID_RANGE);
+  cr_expect(rcl_insert_range(db, 150, 152, 2, logs) == RCLE_OK);
+  cr_expect(rcl_insert(db, 1, tail) == RCLE_OK);
+  cr_expect(rcl_insert(db, 1, out) == RCLE_INVALID_RANGE);
+
+  // the blocks of other shards aren't gaps or counted
+  rcl_range_t gaps[4];
+  size_t count = 4;
+  cr_expect(rcl_gaps(db, 0, 1000, gaps, &count) == RCLE_OK);
+  cr_expect(eq(sz, count, 1));
+  cr_expect(eq(u64, gaps[0].from, 100) && eq(u64, gaps[0].to, 149));
+
+  // the window starts with the gap, nothing before it is counted
+  rcl_query_keys_t q = {.from = 0, .to = 1000};
+  uint64_t before = 1;
+  cr_expect(rcl_query_keys(db, &q, &before) == RCLE_RANGE_GAP);
+  cr_expect(eq(u64, before, 0) && eq(u64, q.reached, 99));
+
+  expect_query(/* expected */ 3,
+               /* from, to */ 150, 1000,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  expect_query(/* expected */ 1,
+               /* from, to */ 151, 1000,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+  rcl_free(db);
+
+  // a narrower window would lose written blocks
+  cr_expect(rcl_open_window(dir, 0, 160, 200, &db) == RCLE_INVALID_RANGE);
+  cr_expect(db == NULL);
+  cr_assert(rcl_open_window(dir, 0, 100, 300, &db) == RCLE_OK);
+  expect_query(/* expected */ 3,
+               /* from, to */ 150, 1000,
+               /* address */ v(),
+               /* topics */ v(), v(), v(), v());
+  rcl_free(db);
+}
+
+Test(liboracle, Warmup) {
+  char dir[] = "/tmp/tmpdir.XXXXXX";
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  rcl_t* db = NULL;
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+
+  rcl_log_t logs[] = {ml(2, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(3, addresses[4], NULL, NULL, NULL, NULL)};
+  cr_expect(rcl_insert(db, 2, logs) == RCLE_OK);
+  rcl_free(db);
+
+  // the pages written before are read in behind the queries
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+  expect_query(/* expected */ 2,
+               /* from, to */ 0, 3,
+               /* address */ v(4),
+               /* topics */ v(), v(), v(), v());
+
+  rcl_stats_t stats;
+  for (int i = 0; i < 200; ++i) {
+    cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+    if (stats.warmup_total > 0 && stats.warmup_done == stats.warmup_total)
+      break;
+    usleep(10000);
+  }
+  cr_expect(stats.warmup_total > 0, "Expected the warm pages of the last run");
+  cr_expect(eq(u64, stats.warmup_done, stats.warmup_total));
+
+  rcl_free(db);
+}
+
+Test(liboracle, StandingFilter) {
+  char dir[] = "/tmp/tmpdir.XXXXXX";
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  rcl_t* db = NULL;
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+
+  rcl_log_t logs[] = {ml(0, addresses[2], topics[1], NULL, NULL, NULL),
+                      ml(2, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(2, addresses[2], NULL, NULL, NULL, NULL),
+                      ml(3, addresses[2], topics[1], NULL, NULL, NULL)};
+  cr_expect(rcl_insert(db, 4, logs) == RCLE_OK);
+
+  rcl_address_t address[2], reversed[2];
+  rcl_hash_t topic;
+  hex2bin(address[0], addresses[4], sizeof(rcl_address_t));
+  hex2bin(address[1], addresses[2], sizeof(rcl_address_t));
+  hex2bin(reversed[0], addresses[2], sizeof(rcl_address_t));
+  hex2bin(reversed[1], addresses[4], sizeof(rcl_address_t));
+  hex2bin(topic, topics[1], sizeof(rcl_hash_t));
+
+  rcl_query_keys_t q = {.address = address, .alen = 2};
+  q.topics[0] = &topic;
+  q.tlen[0] = 1;
+
+  uint64_t id, same, next = 0, count;
+  cr_expect(rcl_standing_filter_add(db, &q, &id) == RCLE_OK);
+
+  // the keys are sets, their order doesn't matter
+  q.address = reversed;
+  cr_expect(rcl_standing_filter_add(db, &q, &same) == RCLE_OK);
+  cr_expect(eq(u64, same, id));
+
+  // the written blocks are backfilled
+  for (int i = 0; i < 200 && next < 4; ++i) {
+    cr_expect(rcl_standing_filter_next(db, id, &next) == RCLE_OK);
+    usleep(10000);
+  }
+  cr_expect(eq(u64, next, 4));
+
+  // new blocks are counted by the insert, the head block is continued
+  rcl_log_t head[] = {ml(3, addresses[4], topics[1], NULL, NULL, NULL),
+                      ml(5, addresses[4], topics[1], NULL, NULL, NULL)};
+  cr_expect(rcl_insert(db, 2, head) == RCLE_OK);
+  cr_expect(rcl_standing_filter_next(db, id, &next) == RCLE_OK);
+  cr_expect(eq(u64, next, 6));
+
+  q.from = 1;
+  q.to = 5;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 4));
+
+  q.limit = 3;
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_QUERY_OVERFLOW);
+  q.limit = 0;
+
+  rcl_stats_t stats;
+  cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+  cr_expect(eq(u64, stats.standing_hits, 2));
+  rcl_free(db);
+
+  // the counts are kept with the db
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+  cr_expect(rcl_standing_filter_next(db, id, &next) == RCLE_OK);
+  cr_expect(eq(u64, next, 6));
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 4));
+
+  cr_expect(rcl_standing_filter_remove(db, id) == RCLE_OK);
+  cr_expect(rcl_standing_filter_remove(db, id) == RCLE_UNKNOWN_FILTER);
+  cr_expect(rcl_query_keys(db, &q, &count) == RCLE_OK);
+  cr_expect(eq(u64, count, 4));
+
+  cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+  cr_expect(eq(u64, stats.standing_hits, 1));
+
+  // slots of removed filters are reused
+  rcl_address_t other;
+  rcl_query_keys_t single = {.address = &other, .alen = 1};
+  for (int i = 0; i < 200; ++i) {
+    memset(other, i, sizeof(rcl_address_t));
+    cr_expect(rcl_standing_filter_add(db, &single, &id) == RCLE_OK);
+    cr_expect(rcl_standing_filter_remove(db, id) == RCLE_OK);
+  }
+
+  uint64_t ids[64];
+  for (int i = 0; i < 64; ++i) {
+    memset(other, i, sizeof(rcl_address_t));
+    cr_expect(rcl_standing_filter_add(db, &single, &ids[i]) == RCLE_OK);
+  }
+  memset(other, 64, sizeof(rcl_address_t));
+  cr_expect(rcl_standing_filter_add(db, &single, &id) == RCLE_TOO_MANY_FILTERS);
+  cr_expect(rcl_standing_filter_remove(db, ids[10]) == RCLE_OK);
+  cr_expect(rcl_standing_filter_add(db, &single, &id) == RCLE_OK);
+
+  rcl_free(db);
+}
+
+Test(liboracle, Summary) {
+  char dir[] = "/tmp/tmpdir.XXXXXX";
+  cr_assert(mkdirp(dir) == 0, "Couldn't create dir");
+
+  rcl_t* db = NULL;
+  cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+
+  // the first page of blocks is sealed once the head is past it
+  rcl_log_t sealed[] = {ml(1, addresses[2], topics[1], NULL, NULL, NULL),
+                        ml(1, addresses[2], topics[3], topics[1], NULL, NULL),
+                        ml(50000, addresses[4], topics[1], NULL, NULL, NULL),
+                        ml(99999, addresses[2], NULL, NULL, NULL, NULL)};
+  rcl_log_t head[] = {ml(100000, addresses[2], topics[1], NULL, NULL, NULL),
+                      ml(100001, addresses[4], topics[3], NULL, NULL, NULL)};
+  cr_expect(rcl_insert_range(db, 0, 99999, 4, sealed) == RCLE_OK);
+  cr_expect(rcl_insert(db, 2, head) == RCLE_OK);
+
+  for (int run = 0; run < 2; ++run) {
+    rcl_stats_t stats = {0};
+    for (int i = 0; i < 200 && stats.blocks_summarized == 0; ++i) {
+      expect_query(/* expected */ 4,
+                   /* from, to */ 0, 100001,
+                   /* address */ v(2),
+                   /* topics */ v(), v(), v(), v());
+      cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+      usleep(10000);
+    }
+    cr_expect(eq(u64, stats.blocks_summarized, 100000));
+
+    expect_query(/* expected */ 3,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(),
+                 /* topics */ v(1), v(), v(), v());
+    expect_query(/* expected */ 2,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(2, 2),
+                 /* topics */ v(1), v(), v(), v());
+    expect_query(/* expected */ 3,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(2, 4),
+                 /* topics */ v(1), v(), v(), v());
+    expect_query(/* expected */ 6,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(),
+                 /* topics */ v(), v(), v(), v());
+
+    // topics of any position are summarized
+    expect_query(/* expected */ 1,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(2),
+                 /* topics */ v(), v(1), v(), v());
+    expect_query(/* expected */ 1,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(),
+                 /* topics */ v(), v(1, 3), v(), v());
+
+    // other shapes and partial pages are scanned
+    expect_query(/* expected */ 1,
+                 /* from, to */ 0, 100001,
+                 /* address */ v(2),
+                 /* topics */ v(3), v(1), v(), v());
+    expect_query(/* expected */ 2,
+                 /* from, to */ 2, 100001,
+                 /* address */ v(2),
+                 /* topics */ v(), v(), v(), v());
+
+    cr_expect(rcl_stats(db, &stats) == RCLE_OK);
+    cr_expect(eq(u64, stats.blocks_summarized, 700000));
+
+    // the summary is kept with the db
+    rcl_free(db);
+    cr_assert(rcl_open(dir, 0, &db) == RCLE_OK);
+  }
+
+  rcl_free(db);
+}
+
+enum { QUEUE_THREADS = 4, QUEUE_ITEMS = 100000 };
+
+static void* queue_producer(void* data) {
+  queue_t* queue = data;
+  for (uintptr_t i = 1; i <= QUEUE_ITEMS; ++i)
+    while (!queue_push(queue, (void*)i))
+      sched_yield();
+  return NULL;
+}
+
+static void* queue_consumer(void* data) {
+  queue_t* queue = data;
+  uintptr_t sum = 0;
+  for (size_t popped = 0; popped < QUEUE_ITEMS;) {
+    void* item;
+    if (queue_pop(queue, &item)) {
+      sum += (uintptr_t)item;
+      popped++;
+    } else {
+      sched_yield();
+    }
+  }
+  return (void*)sum;
+}
+
+static void* queue_waiter(void* data) {
+  void* item = NULL;
+  return queue_pop_wait(data, &item, 10) ? item : NULL;
+}
+
+Test(liboracle, Queue) {
+  queue_t queue;
+  cr_expect(!queue_init(&queue, 3), "capacity isn't a power of two");
+  cr_assert(queue_init(&queue, 4));
+
+  // FIFO up to the capacity
+  void* item = NULL;
+  cr_expect(!queue_pop(&queue, &item));
+  for (uintptr_t i = 1; i <= 4; ++i)
+    cr_expect(queue_push(&queue, (void*)i));
+  cr_expect(!queue_push(&queue, (void*)5));
+
+  for (uintptr_t i = 1; i <= 4; ++i) {
+    cr_expect(queue_pop(&queue, &item));
+    cr_expect(eq(u64, (uintptr_t)item, i));
+  }
+  cr_expect(!queue_pop(&queue, &item));
+  queue_destroy(&queue);
+
+  // every item of concurrent producers is popped once
+  cr_assert(queue_init(&queue, 64));
+
+  pthread_t producers[QUEUE_THREADS], consumers[QUEUE_THREADS];
+  for (size_t i = 0; i < QUEUE_THREADS; ++i) {
+    cr_assert(pthread_create(&producers[i], NULL, queue_producer, &queue) == 0);
+    cr_assert(pthread_create(&consumers[i], NULL, queue_consumer, &queue) == 0);
+  }
+
+  uintptr_t sum = 0;
+  for (size_t i = 0; i < QUEUE_THREADS; ++i) {
+    void* part = NULL;
+    pthread_join(producers[i], NULL);
+    pthread_join(consumers[i], &part);
+    sum += (uintptr_t)part;
+  }
+
+  uintptr_t expected = QUEUE_THREADS * (uintptr_t)QUEUE_ITEMS *
+                       (QUEUE_ITEMS + 1) / 2;
+  cr_expect(eq(u64, sum, expected));
+  cr_expect(!queue_pop(&queue, &item));
+
+  // a parked consumer is woken by a push or queue_wake, not its timeout
+  time_t start = time(NULL);
+  struct timespec delay = {.tv_sec = 0, .tv_nsec = 50 * 1000 * 1000};
+
+  pthread_t waiter;
+  cr_assert(pthread_create(&waiter, NULL, queue_waiter, &queue) == 0);
+  nanosleep(&delay, NULL);
+  cr_expect(queue_push(&queue, (void*)7));
+  pthread_join(waiter, &item);
+  cr_expect(eq(u64, (uintptr_t)item, 7));
+
+  cr_assert(pthread_create(&waiter, NULL, queue_waiter, &queue) == 0);
+  nanosleep(&delay, NULL);
+  queue_wake(&queue);
+  pthread_join(waiter, &item);
+  cr_expect(item == NULL);
+  cr_expect(time(NULL) - start < 5);
+
+  queue_destroy(&queue);
+}
+
+Test(liboracle, Slots) {
+  slots_t slots;
+  slots_init(&slots, sizeof(uint64_t));
+
+  // items keep their address as chunks are added
+  uint64_t* first = slots_add(&slots);
+  cr_assert(first != NULL);
+  *first = 42;
+
+  for (uint64_t i = 1; i < 3 * SLOTS_CHUNK; ++i) {
+    uint64_t* item = slots_add(&slots);
+    cr_assert(item != NULL);
+    *item = i;
+  }
+  cr_expect(eq(u64, slots_size(&slots), 3 * SLOTS_CHUNK));
+  cr_expect(slots_at(&slots, 0) == first && *first == 42);
+  cr_expect(eq(u64, *(uint64_t*)slots_at(&slots, 2 * SLOTS_CHUNK + 5),
+               2 * SLOTS_CHUNK + 5));
+
+  // a removed slot is given back zeroed
+  slots_remove_last(&slots);
+  uint64_t* again = slots_add(&slots);
+  cr_expect(again == slots_at(&slots, 3 * SLOTS_CHUNK - 1) && *again == 0);
+
+  while (slots_size(&slots) < (uint64_t)SLOTS_CHUNKS * SLOTS_CHUNK)
+    cr_assert(slots_add(&slots) != NULL);
+  cr_expect(slots_add(&slots) == NULL, "full");
+
+  slots_destroy(&slots);
+}
+
+Test(liboracle, Arena) {
+  enum { CHUNK = 64 * 1024, HIGH_WATER = 1024 * 1024, PEAK = 8 * 1024 * 1024 };
+
+  arena_t arena;
+  arena_init(&arena, CHUNK, HIGH_WATER);
+
+  // aligned and not overlapping across the growth of chunks
+  uint8_t* prev = NULL;
+  for (size_t i = 0; i < 1000; ++i) {
+    uint8_t* ptr = arena_alloc(&arena, 1000);
+    cr_assert(ptr != NULL);
+    cr_expect(eq(u64, (uintptr_t)ptr % 16, 0));
+    memset(ptr, 0xab, 1000);
+    if (prev != NULL)
+      cr_expect(prev[999] == 0xab);
+    prev = ptr;
+  }
+
+  uint8_t* peak = arena_alloc(&arena, PEAK);
+  cr_assert(peak != NULL);
+  memset(peak, 0xcd, PEAK);
+
+  // the largest chunk is kept for the next round, but its pages above the
+  // high-water mark are given back
+  uint8_t* head = (uint8_t*)arena.head;
+  arena_reset(&arena);
+  cr_expect((uint8_t*)arena.head == head);
+
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t pages = (PEAK - HIGH_WATER) / page;
+  unsigned char* resident = calloc(pages, 1);
+  cr_assert(resident != NULL);
+  cr_assert(mincore(head + HIGH_WATER, pages * page, resident) == 0);
+
+  size_t count = 0;
+  for (size_t i = 0; i < pages; ++i)
+    count += resident[i] & 1;
+  cr_expect(eq(u64, count, 0));
+  free(resident);
+
+  cr_expect(arena_alloc(&arena, PEAK) != NULL);
+  cr_expect((uint8_t*)arena.head == head);
+
+  arena_destroy(&arena);
+}
+
+// A node's JSON log of the samples
+static void json_log(char* buffer, size_t size, int number, int a, int t) {
+  snprintf(buffer, size,
+           "{\"blockNumber\": \"0x%x\", \"address\": \"%s\", "
+           "\"topics\": [\"%s\"]}",
+           number, addresses[a], topics[t]);
+}
+
+static rcl_result parse_response(const char* data,
+                                 rcl_upstream_mode mode,
+                                 size_t calls,
+                                 vector_t* logs) {
+  vector_reset(logs);
+  return rcl_response_parse(data, strlen(data), mode, 100, calls, NULL, logs);
+}
+
+Test(liboracle, ResponseParse) {
+  char l1[256], l2[256], data[1024];
+  json_log(l1, sizeof(l1), 1, 2, 3);
+  json_log(l2, sizeof(l2), 2, 4, 5);
+
+  vector_t logs;
+  cr_assert(vector_init(&logs, 16, sizeof(rcl_log_t)));
+
+  // calls of a batch are matched by id in any order
+  snprintf(data, sizeof(data),
+           "[{\"id\": 101, \"result\": [%s]},"
+           " {\"id\": 100, \"result\": [%s]}]",
+           l2, l1);
+  cr_expect(parse_response(data, RCL_UPSTREAM_BATCH, 2, &logs) == RCLE_OK);
+  cr_assert(eq(u64, logs.size, 2));
+
+  rcl_log_t expected = ml(2, addresses[4], topics[5], NULL, NULL, NULL);
+  cr_expect(memcmp(vector_at(&logs, 0), &expected, sizeof(rcl_log_t)) == 0);
+  expected = ml(1, addresses[2], topics[3], NULL, NULL, NULL);
+  cr_expect(memcmp(vector_at(&logs, 1), &expected, sizeof(rcl_log_t)) == 0);
+
+  // a duplicate, a missing and an unexpected id
+  snprintf(data, sizeof(data),
+           "[{\"id\": 100, \"result\": [%s]},"
+           " {\"id\": 100, \"result\": []}]",
+           l1);
+  cr_expect(parse_response(data, RCL_UPSTREAM_BATCH, 2, &logs) ==
+            RCLE_NODE_REQUEST);
+  cr_expect(parse_response("[{\"id\": 100, \"result\": []}]",
+                           RCL_UPSTREAM_BATCH, 2, &logs) == RCLE_NODE_REQUEST);
+  cr_expect(parse_response("[{\"id\": 102, \"result\": []}]",
+                           RCL_UPSTREAM_BATCH, 2, &logs) == RCLE_NODE_REQUEST);
+
+  // ids out of uint32_t or fractional ones aren't converted
+  const char* ids[] = {"100.5", "-1", "1e20", "4294967396"};
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+    snprintf(data, sizeof(data), "[{\"id\": %s, \"result\": []}]", ids[i]);
+    cr_expect(parse_response(data, RCL_UPSTREAM_BATCH, 1, &logs) ==
+              RCLE_NODE_REQUEST);
+  }
+
+  // an error of one call or of the whole batch fails the request
+  cr_expect(parse_response("[{\"id\": 100, \"result\": []},"
+                           " {\"id\": 101, \"error\": {\"code\": -32005,"
+                           " \"message\": \"limit exceeded\"}}]",
+                           RCL_UPSTREAM_BATCH, 2, &logs) == RCLE_NODE_REQUEST);
+  cr_expect(parse_response("{\"id\": null, \"error\": {\"code\": -32600,"
+                           " \"message\": \"batch too large\"}}",
+                           RCL_UPSTREAM_BATCH, 2, &logs) == RCLE_NODE_REQUEST);
+
+  // receipts are flattened into their logs, a receipt without logs is broken
+  snprintf(data, sizeof(data),
+           "[{\"id\": 100, \"result\": [{\"logs\": [%s, %s]},"
+           " {\"logs\": []}]}]",
+           l1, l2);
+  cr_expect(parse_response(data, RCL_UPSTREAM_RECEIPTS, 1, &logs) == RCLE_OK);
+  cr_expect(eq(u64, logs.size, 2));
+
+  cr_expect(parse_response("[{\"id\": 100, \"result\": "
+                           "[{\"status\": \"0x1\"}]}]",
+                           RCL_UPSTREAM_RECEIPTS, 1, &logs) ==
+            RCLE_NODE_REQUEST);
+
+  vector_destroy(&logs);
+}
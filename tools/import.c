@@ -0,0 +1,62 @@
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../liboracle.h"
+
+static void usage(const char* name) {
+  fprintf(stderr,
+          "usage: %s [-b] <datadir> <from> <to> <dump>\n"
+          "  loads all logs of the [from, to] blocks from a dump sorted by "
+          "block,\n"
+          "  '-' reads stdin\n"
+          "  -b  the dump is a binary rcl_log_t stream, JSONL otherwise\n",
+          name);
+}
+
+int main(int argc, char* argv[]) {
+  rcl_dump_format format = RCL_DUMP_JSONL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "bh")) != -1) {
+    switch (opt) {
+      case 'b':
+        format = RCL_DUMP_BINARY;
+        break;
+      default:
+        usage(argv[0]);
+        return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  }
+
+  if (argc - optind != 4) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  char* dir = argv[optind];
+  uint64_t from = strtoull(argv[optind + 1], NULL, 10);
+  uint64_t to = strtoull(argv[optind + 2], NULL, 10);
+  const char* path = argv[optind + 3];
+
+  rcl_t* db = NULL;
+  rcl_result rc = rcl_open(dir, 0, &db);
+  if (rc != RCLE_OK) {
+    fprintf(stderr, "couldn't open db: %s\n", rcl_strerror(rc));
+    return EXIT_FAILURE;
+  }
+
+  rc = rcl_import(db, from, to, format, path);
+  if (rc != RCLE_OK)
+    fprintf(stderr, "import failed: %s\n", rcl_strerror(rc));
+
+  uint64_t blocks = 0, logs = 0;
+  (void)rcl_blocks_count(db, &blocks);
+  (void)rcl_logs_count(db, &logs);
+  printf("blocks: %" PRIu64 ", logs: %" PRIu64 "\n", blocks, logs);
+
+  rcl_free(db);
+
+  return rc == RCLE_OK ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,62 +1,330 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // pthread_rwlockattr_setkind_np
+#endif
+
 #include "upstream.h"
 #include "common.h"
+#include "arena.h"
 #include "err.h"
+#include "queue.h"
 
 enum {
-  CONNECTIONS_COUNT = 32,
+  CONNECTIONS_COUNT = 32,  // power of two, the requests ring of an upstream
   BLOCKS_REQUEST_BATCH = 128,
+  PARSERS_MAX_COUNT = 8,
+
+  CALLS_MAX = BLOCKS_REQUEST_BATCH + 1,  // calls of a batch request
+  CALL_BUFFER_SIZE = 192,               // bytes of one JSON-RPC call
+  CALL_BLOCKS_DEFAULT = 16,             // blocks of eth_getLogs in a batch
+  RESPONSE_BUFFER_SIZE = (1024 * 1024 * 512),  // 512MB
+  RESPONSE_POOL_HIGH_WATER = (1024 * 1024 * 256),  // 256MB of idle buffers
+
+  PARSE_ARENA_CHUNK_SIZE = (1024 * 1024),  // 1MB
+  PARSE_ARENA_HIGH_WATER = (1024 * 1024 * 32),  // 32MB resident per parser
+  REQUEST_LOGS_HIGH_WATER = (1024 * 64),  // items of rcl_log_t
+
+  RETRY_BUDGET = 8,  // attempts of one range before the whole poll fails
+  RETRY_BACKOFF_MIN_MS = 100,
+  RETRY_BACKOFF_MAX_MS = 10000,
+
+  IDLE_WAIT_MS = 1000,     // before the next check of the height and URL
+  STAGE_WAIT_S = 1,        // of a parked parser or committer, see queue_wake
+  FAILURE_WAIT_MS = 5000,  // before the next poll after a failed one
+};
+
+// Ingest is a pipeline of stages linked by lock-free queues:
+//   fetcher (curl event loop) -> N parsers -> ordered committer (rcl_insert)
+// The stages belong to a pool and serve all its upstreams, the response
+// buffers of the pool bound their requests in flight.
+struct rcl_upstream_pool {
+  atomic_bool closed, started;  // the stages run since the first URL
 
-  REQUEST_BUFFER_SIZE = 256,
-  RESPONSE_BUFFER_SIZE = (1024 * 1024 * 512)  // 512MB
+  pthread_rwlock_t lock;  // upstreams, written by init, free and the start
+  vector_t upstreams;     // <rcl_upstream_t*>
+  size_t turn;            // the first upstream to send, owned by fetcher
+
+  pthread_t fetcher, committer;
+  size_t parsers_count;
+  pthread_t parsers[PARSERS_MAX_COUNT];
+
+  CURLM* multi;
+  struct curl_slist* http_headers;
+
+  buffer_pool_t responses;  // fetcher acquires, parsers release
+
+  queue_t parse_queue;   // req_t*, fetcher -> parsers
+  queue_t commit_queue;  // req_t*, parsers -> committer, only a wakeup
 };
 
+// The requests ring keeps the order: the fetcher assigns ranges at the tail,
+// the committer consumes parsed requests from the head.
 struct rcl_upstream {
-  atomic_bool closed;
-  atomic_size_t height, last;
+  rcl_upstream_pool_t* pool;
+  bool own_pool;
+
+  atomic_bool closed, detached;  // see rcl_upstream_free
+  _Atomic(rcl_result) failure;   // first error of any stage, drops the poll
+  atomic_size_t height, next;
+
+  _Atomic(rcl_upstream_mode) mode;
+  atomic_size_t call_blocks;
+  atomic_uint throttle;  // see rcl_upstream_set_throttle
 
   rcl_upstream_callback_t callback;
   void* callback_data;
 
-  pthread_t* thrd;
-
   _Atomic(CURLU*) url;
-  struct curl_slist* http_headers;
 
-  int requests_head;
-  vector_t requests;  // req_t
+  // the poll, owned by fetcher
+  bool polling, draining;
+  uint64_t start;      // of the next range
+  uint64_t resume_at;  // rcl_clock_ns of the next check
+
+  atomic_size_t requests_head;  // owned by committer
+  size_t requests_tail;         // owned by fetcher
+  vector_t requests;            // req_t
+
+  // see rcl_upstream_stats
+  atomic_uint_fast64_t requests_done, requests_failed;
+  stats_histogram_t latency;
 };
 
-enum req_state { available, sent, received };
+// Every state has a single owner stage:
+//   available -> sent:             fetcher
+//   sent -> received | failed:     fetcher
+//   received -> parsed | failed:   parser
+//   failed -> delayed -> sent:     fetcher, the same range is retried
+//   parsed -> available:           committer
+enum req_state { available, sent, received, parsed, failed, delayed };
 
 typedef struct {
-  uint32_t id;
+  rcl_upstream_t* upstream;
+
+  uint32_t id;  // calls of a batch have 'id + index'
   uint64_t from, to;
-  enum req_state state;
+  _Atomic(enum req_state) state;
+
+  rcl_upstream_mode mode;
+  size_t calls;
+
+  rcl_result error;
+  uint32_t attempts;
+  uint64_t retry_at;  // rcl_clock_ns
 
   CURL* handle;
 
-  size_t response_size;
-  char request[REQUEST_BUFFER_SIZE + 1], *response;
+  buffer_t* response;
+  buffer_t request;
 
   vector_t logs;  // rcl_log_t
 } req_t;
 
-static void* rcl_upstream_thrd(void* data);
+static void* rcl_upstream_fetcher(void* data);
+static void* rcl_upstream_parser(void* data);
+static void* rcl_upstream_committer(void* data);
 static size_t req_onsend(void* contents,
                          size_t size,
                          size_t nmemb,
                          void* userp);
 
-#define rcl_request_at(self, i)          \
-  (req_t*)vector_at(&((self)->requests), \
-                    ((self)->requests_head + (i)) % CONNECTIONS_COUNT)
+// cJSON allocates every node, parsers route them to own arenas
+static pthread_once_t json_hooks_once = PTHREAD_ONCE_INIT;
+static _Thread_local arena_t* json_arena = NULL;
+
+static void* json_malloc(size_t size) {
+  return json_arena ? arena_alloc(json_arena, size) : malloc(size);
+}
+
+static void json_free(void* ptr) {
+  if (json_arena == NULL)
+    free(ptr);
+}
+
+static void json_hooks_init(void) {
+  cJSON_Hooks hooks = {.malloc_fn = json_malloc, .free_fn = json_free};
+  cJSON_InitHooks(&hooks);
+}
+
+#define rcl_request_at(self, i) \
+  (req_t*)vector_at(&((self)->requests), (i) % CONNECTIONS_COUNT)
+
+// Wait of rcl_upstream_free for the detach: spin, then sleep up to 1ms.
+static void rcl_backoff(unsigned* attempt) {
+  if (*attempt < 64) {
+    ++(*attempt);
+    return;
+  }
+
+  unsigned shift = min(*attempt - 64, 5u);
+  struct timespec ts = {.tv_sec = 0, .tv_nsec = (long)(32000u << shift)};
+  nanosleep(&ts, NULL);
+
+  if (shift < 5)
+    ++(*attempt);
+}
+
+static size_t rcl_pow2(size_t n) {
+  size_t result = 1;
+  while (result < n)
+    result <<= 1;
+  return result;
+}
+
+rcl_result rcl_upstream_pool_init(rcl_upstream_pool_t** ptr,
+                                  size_t transfers) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+
+  rcl_upstream_pool_t* self = calloc(1, sizeof(rcl_upstream_pool_t));
+  if (self == NULL) {
+    rcl_perror("alloc memory for upstream pool");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  self->closed = false;
+  self->started = false;
+  self->turn = 0;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  self->parsers_count =
+      cpus < 1 ? 1 : (size_t)min(cpus, (long)PARSERS_MAX_COUNT);
+
+  pthread_once(&json_hooks_once, json_hooks_init);
+
+  // upstreams are rarely added, but the stages mustn't starve rcl_free
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+  int rc = pthread_rwlock_init(&(self->lock), &attr);
+  pthread_rwlockattr_destroy(&attr);
+  if (rc != 0) {
+    free(self);
+    return RCLE_UNKNOWN;
+  }
+
+  // from here a failure is cleared by rcl_upstream_pool_free, nothing runs yet
+
+  // every request in flight holds a response buffer
+  transfers = rcl_pow2(max(transfers, (size_t)1));
+  if (!vector_init(&(self->upstreams), 4, sizeof(rcl_upstream_t*)) ||
+      !queue_init(&(self->parse_queue), transfers) ||
+      !queue_init(&(self->commit_queue), transfers) ||
+      !buffer_pool_init(&(self->responses), transfers,
+                        RESPONSE_POOL_HIGH_WATER)) {
+    rcl_error("couldn't allocate ingest queues\n");
+    rcl_upstream_pool_free(self);
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  self->http_headers = NULL;
+  self->http_headers =
+      curl_slist_append(self->http_headers, "Accept: application/json");
+  self->http_headers =
+      curl_slist_append(self->http_headers, "Content-Type: application/json");
+
+  // lives until rcl_upstream_pool_free, the committer wakes it up
+  if ((self->multi = curl_multi_init()) == NULL) {
+    rcl_error("couldn't init curl multi handle\n");
+    rcl_upstream_pool_free(self);
+    return RCLE_LIBCURL;
+  }
+
+  *ptr = self;
+  return RCLE_OK;
+}
+
+void rcl_upstream_pool_free(rcl_upstream_pool_t* self) {
+  // notify, the parked stages see it at once
+  self->closed = true;
+  queue_wake(&(self->parse_queue));
+  queue_wake(&(self->commit_queue));
+
+  // wait end of the stages, the fetcher is the last as it owns curl multi
+  if (self->started) {
+    pthread_join(self->committer, NULL);
+    for (size_t i = 0; i < self->parsers_count; ++i)
+      pthread_join(self->parsers[i], NULL);
+
+    curl_multi_wakeup(self->multi);
+    pthread_join(self->fetcher, NULL);
+  }
+
+  // clear
+  vector_destroy(&(self->upstreams));
+  queue_destroy(&(self->parse_queue));
+  queue_destroy(&(self->commit_queue));
+  buffer_pool_destroy(&(self->responses));
+
+  if (self->multi)
+    curl_multi_cleanup(self->multi);
+  if (self->http_headers)
+    curl_slist_free_all(self->http_headers);
+
+  pthread_rwlock_destroy(&(self->lock));
+  free(self);
+
+  curl_global_cleanup();
+}
+
+// Runs the stages once an upstream of the pool has a URL
+static rcl_result rcl_upstream_pool_start(rcl_upstream_pool_t* self) {
+  rcl_result rc = RCLE_OK;
+
+  pthread_rwlock_wrlock(&(self->lock));
+
+  if (!self->started) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+
+    if (pthread_create(&(self->fetcher), &attr, rcl_upstream_fetcher, self) !=
+        0) {
+      rcl_perror("create fetcher thread");
+      rc = RCLE_UNKNOWN;
+    } else {
+      pthread_create(&(self->committer), &attr, rcl_upstream_committer, self);
+      for (size_t i = 0; i < self->parsers_count; ++i)
+        pthread_create(&(self->parsers[i]), &attr, rcl_upstream_parser, self);
+
+      self->started = true;
+    }
+
+    pthread_attr_destroy(&attr);
+  }
+
+  pthread_rwlock_unlock(&(self->lock));
+
+  return rc;
+}
+
+// Frees the requests built so far and the own pool, the upstream is detached
+static void rcl_upstream_clear(rcl_upstream_t* self) {
+  for (size_t i = 0; i < self->requests.size; ++i) {
+    req_t* req = vector_at(&(self->requests), i);
+    vector_destroy(&(req->logs));
+    buffer_trim(&(req->request));
+
+    if (req->handle != NULL)
+      curl_easy_cleanup(req->handle);
+  }
+  vector_destroy(&(self->requests));
+
+  if (self->url)
+    curl_url_cleanup(self->url);
+
+  if (self->own_pool)
+    rcl_upstream_pool_free(self->pool);
+
+  free(self);
+}
 
 rcl_result rcl_upstream_init(rcl_upstream_t** ptr,
-                             uint64_t last,
+                             rcl_upstream_pool_t* pool,
+                             uint64_t next,
                              rcl_upstream_callback_t callback,
                              void* callback_data) {
   srand(time(NULL));
-  curl_global_init(CURL_GLOBAL_DEFAULT);
 
   rcl_upstream_t* self = malloc(sizeof(rcl_upstream_t));
   if (self == NULL) {
@@ -64,74 +332,140 @@ rcl_result rcl_upstream_init(rcl_upstream_t** ptr,
     return RCLE_OUT_OF_MEMORY;
   }
 
-  *ptr = self;
+  // a db of its own has the stages of one ring
+  self->own_pool = pool == NULL;
+  if (self->own_pool) {
+    rcl_result rc = rcl_upstream_pool_init(&pool, CONNECTIONS_COUNT);
+    if (rc != RCLE_OK) {
+      free(self);
+      return rc;
+    }
+  }
+  self->pool = pool;
 
   self->url = NULL;
-  self->last = last;
+  self->next = next;
   self->height = 0;
+
+  self->requests_done = 0;
+  self->requests_failed = 0;
+  memset(&(self->latency), 0, sizeof(stats_histogram_t));
+  self->mode = RCL_UPSTREAM_LOGS;
+  self->call_blocks = CALL_BLOCKS_DEFAULT;
+  self->throttle = 0;
   self->closed = false;
+  self->detached = false;
+  self->failure = RCLE_OK;
 
   self->callback = callback;
   self->callback_data = callback_data;
 
-  self->thrd = NULL;
-
-  self->http_headers = NULL;
-  self->http_headers =
-      curl_slist_append(self->http_headers, "Accept: application/json");
-  self->http_headers =
-      curl_slist_append(self->http_headers, "Content-Type: application/json");
+  self->polling = false;
+  self->draining = false;
+  self->start = next;
+  self->resume_at = 0;
 
   self->requests_head = 0;
-  vector_init(&(self->requests), CONNECTIONS_COUNT, sizeof(req_t));
+  self->requests_tail = 0;
+  if (!vector_init(&(self->requests), CONNECTIONS_COUNT, sizeof(req_t))) {
+    self->requests.size = 0;
+    rcl_upstream_clear(self);
+    return RCLE_OUT_OF_MEMORY;
+  }
+
   for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
     req_t* req = vector_add(&(self->requests));
+    req->upstream = self;
     req->id = 0;
     req->from = 0;
     req->to = 0;
+    req->error = RCLE_OK;
+    req->attempts = 0;
+    req->retry_at = 0;
     req->response = NULL;
-    req->response_size = 0;
+    req->request = (buffer_t){0};
     req->state = available;
 
-    vector_init(&(req->logs), 16, sizeof(rcl_log_t));
-
-    if ((req->handle = curl_easy_init()) == NULL)
+    req->handle = curl_easy_init();
+    if (!vector_init(&(req->logs), 16, sizeof(rcl_log_t)) ||
+        req->handle == NULL) {
+      rcl_upstream_clear(self);
       return RCLE_UNKNOWN;
+    }
+
+    curl_easy_setopt(req->handle, CURLOPT_PRIVATE, (void*)req);
+  }
+
+  pthread_rwlock_wrlock(&(pool->lock));
+  rcl_upstream_t** item = vector_add(&(pool->upstreams));
+  if (item != NULL)
+    *item = self;
+  pthread_rwlock_unlock(&(pool->lock));
+
+  if (item == NULL) {
+    rcl_upstream_clear(self);
+    return RCLE_OUT_OF_MEMORY;
   }
 
+  *ptr = self;
   return RCLE_OK;
 }
 
 void rcl_upstream_free(rcl_upstream_t* self) {
-  // notify
+  rcl_upstream_pool_t* pool = self->pool;
+
+  // notify, the fetcher drops the poll and the stages give back the requests
   self->closed = true;
 
-  // wait enf end of upstream
-  if (self->thrd) {
-    pthread_join(*(self->thrd), NULL);
-    free(self->thrd);
+  if (pool->started && !pool->closed) {
+    curl_multi_wakeup(pool->multi);
+    queue_wake(&(pool->commit_queue));  // to sweep the parsed ones
+
+    unsigned idle = 0;
+    while (!self->detached)
+      rcl_backoff(&idle);
   }
 
-  // clear
-  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
-    req_t* req = vector_at(&(self->requests), i);
-    if (req->response)
-      free(req->response);
+  pthread_rwlock_wrlock(&(pool->lock));
+  for (size_t i = 0; i < pool->upstreams.size; ++i) {
+    rcl_upstream_t** it = vector_at(&(pool->upstreams), i);
+    if (*it == self) {
+      vector_remove(&(pool->upstreams), it);
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&(pool->lock));
 
-    vector_destroy(&(req->logs));
+  rcl_upstream_clear(self);
+}
 
-    curl_easy_cleanup(req->handle);
-  }
-  vector_destroy(&(self->requests));
+rcl_upstream_pool_t* rcl_upstream_get_pool(rcl_upstream_t* self) {
+  return self->pool;
+}
 
-  if (self->url)
-    curl_url_cleanup(self->url);
-  if (self->http_headers)
-    curl_slist_free_all(self->http_headers);
+uint64_t rcl_upstream_next(rcl_upstream_t* self) {
+  return self->next;
+}
 
-  free(self);
+void rcl_upstream_stats(rcl_upstream_t* self, rcl_stats_t* stats) {
+  stats->height = self->height;
+  stats->next = self->next;
+  stats->upstream_requests = stats_load(self->requests_done);
+  stats->upstream_errors = stats_load(self->requests_failed);
+  stats_histogram_read(&(self->latency), &(stats->upstream_latency));
+}
 
-  curl_global_cleanup();
+uint64_t rcl_upstream_backlog(rcl_upstream_t* self) {
+  uint64_t height = self->height, next = self->next;
+  return height + 1 > next ? height + 1 - next : 0;
+}
+
+void rcl_upstream_set_throttle(rcl_upstream_t* self, unsigned level) {
+  self->throttle = min(level, (unsigned)RCL_THROTTLE_MAX);
+
+  // a lower level sends more at once, don't wait for the next transfer
+  if (self->pool->started && !self->pool->closed)
+    curl_multi_wakeup(self->pool->multi);
 }
 
 rcl_result rcl_upstream_set_height(rcl_upstream_t* self, uint64_t height) {
@@ -139,176 +473,352 @@ rcl_result rcl_upstream_set_height(rcl_upstream_t* self, uint64_t height) {
   return RCLE_OK;
 }
 
+rcl_result rcl_upstream_set_mode(rcl_upstream_t* self,
+                                rcl_upstream_mode mode,
+                                uint64_t call_blocks) {
+  if (mode != RCL_UPSTREAM_LOGS && mode != RCL_UPSTREAM_BATCH &&
+      mode != RCL_UPSTREAM_RECEIPTS)
+    return RCLE_INVALID_UPSTREAM;
+
+  // applied to the next requests, the sent ones keep their mode
+  self->call_blocks = call_blocks == 0 ? CALL_BLOCKS_DEFAULT : call_blocks;
+  self->mode = mode;
+
+  return RCLE_OK;
+}
+
 rcl_result rcl_upstream_set_url(rcl_upstream_t* self, const char* url) {
   if (self->url == NULL)
     self->url = curl_url();
 
   int rc = curl_url_set(self->url, CURLUPART_URL, url, 0);
   if (rc != CURLUE_OK) {
-    rcl_perror("malloc upstream thread");
+    rcl_error("url error: %s\n", curl_url_strerror(rc));
     return RCLE_INVALID_UPSTREAM;
   }
 
-  if (self->thrd == NULL) {
-    self->thrd = malloc(sizeof(pthread_t));
-    if (self->thrd == NULL) {
-      rcl_error("url error: %s\n", curl_url_strerror(rc));
-      return RCLE_OUT_OF_MEMORY;
-    }
-
-    pthread_attr_t attr;
-    pthread_attr_init(&attr);
-
-    pthread_create(self->thrd, &attr, rcl_upstream_thrd, self);
-  }
+  if (!self->pool->started)
+    return rcl_upstream_pool_start(self->pool);
 
+  curl_multi_wakeup(self->pool->multi);
   return RCLE_OK;
 }
 
-#define BODY                                                      \
-  "{\"id\":%" PRId32                                              \
+#define CALL_LOGS                                                 \
+  "{\"id\":%" PRIu32                                              \
   ",\"jsonrpc\":\"2.0\",\"method\":\"eth_getLogs\",\"params\":[{" \
   "\"fromBlock\":\"0x%" PRIx64 "\",\"toBlock\":\"0x%" PRIx64 "\"}]}"
 
+#define CALL_RECEIPTS                                                    \
+  "{\"id\":%" PRIu32                                                     \
+  ",\"jsonrpc\":\"2.0\",\"method\":\"eth_getBlockReceipts\",\"params\":[" \
+  "\"0x%" PRIx64 "\"]}"
+
+// Fills the HTTP body: a single eth_getLogs call or a batch of calls
+static bool req_build(req_t* req, uint64_t call_blocks) {
+  buffer_t* body = &(req->request);
+  if (!buffer_reserve(body, CALLS_MAX * CALL_BUFFER_SIZE + 2))
+    return false;
+
+  char *it = body->data, *end = body->data + body->capacity;
+
+  if (req->mode == RCL_UPSTREAM_LOGS) {
+    req->calls = 1;
+    it += snprintf(it, (size_t)(end - it), CALL_LOGS, req->id, req->from,
+                   req->to);
+  } else {
+    req->calls = 0;
+    *it++ = '[';
+
+    for (uint64_t from = req->from; from <= req->to; ++(req->calls)) {
+      uint32_t id = req->id + (uint32_t)req->calls;
+      uint64_t to = req->mode == RCL_UPSTREAM_RECEIPTS
+                        ? from
+                        : min(from + call_blocks - 1, req->to);
+
+      if (req->calls > 0)
+        *it++ = ',';
+
+      if (req->mode == RCL_UPSTREAM_RECEIPTS)
+        it += snprintf(it, (size_t)(end - it), CALL_RECEIPTS, id, from);
+      else
+        it += snprintf(it, (size_t)(end - it), CALL_LOGS, id, from, to);
+
+      from = to + 1;
+    }
+
+    *it++ = ']';
+  }
+
+  body->size = (size_t)(it - body->data);
+  return true;
+}
+
 static size_t req_onsend(void* contents,
                          size_t size,
                          size_t nmemb,
                          void* userp) {
   req_t* req = userp;
 
+  buffer_t* response = req->response;
+
   size_t chunksize = size * nmemb;
-  size_t datasize = req->response_size + chunksize + 1;
+  size_t datasize = response->size + chunksize + 1;
   if (datasize > RESPONSE_BUFFER_SIZE) {
-    rcl_error("too big response, size: %zu, chunksize: %zu\n",
-              req->response_size, chunksize);
+    rcl_error("too big response, size: %zu, chunksize: %zu\n", response->size,
+              chunksize);
     return 0;
   }
 
-  // TODO: allocate memory in blocks of multiples of the page size
-  req->response = realloc(req->response, req->response_size + chunksize + 1);
-  if (!req->response) {
-    rcl_perror("realloc buffer for response");
+  if (!buffer_reserve(response, datasize))
     return 0;
-  }
 
-  rcl_memcpy(&(req->response[req->response_size]), contents, chunksize);
-  req->response_size += chunksize;
-  req->response[req->response_size] = 0;
+  rcl_memcpy(&(response->data[response->size]), contents, chunksize);
+  response->size += chunksize;
+  response->data[response->size] = 0;
 
   return chunksize;
 }
 
-static rcl_result req_parse(req_t* req, vector_t* logs) {
+rcl_result rcl_log_parse(const cJSON* item, rcl_log_t* log) {
   rcl_result exit_code = RCLE_OK;
 
-  cJSON* root = cJSON_ParseWithLength(req->response, req->response_size);
-  if (root == NULL) {
-    const char* error_ptr = cJSON_GetErrorPtr();
-    if (error_ptr == NULL)
-      error_ptr = "unrecognized";
+  if (rcl_unlikely(!cJSON_IsObject(item))) {
+    return_err(RCLE_NODE_REQUEST, "logs item is not object\n");
+  }
 
-    return_err(RCLE_NODE_REQUEST,
-               "couldn't parse requset, error: %s, req: %.*s\n", error_ptr,
-               (int)req->response_size, req->response);
+  const cJSON* block_number =
+      cJSON_GetObjectItemCaseSensitive(item, "blockNumber");
+  if (rcl_unlikely(!cJSON_IsString(block_number) ||
+                   block_number->valuestring == NULL)) {
+    return_err(RCLE_NODE_REQUEST, "logs item, block_number is not a string\n");
   }
 
-  if (rcl_unlikely(!cJSON_IsObject(root))) {
-    return_err(RCLE_NODE_REQUEST, "root is not an object\n");
+  const char* start = block_number->valuestring;
+  char* end = NULL;
+
+  errno = 0;
+  log->block_number = (uint64_t)strtoll(start, &end, 16);
+  if (rcl_unlikely(errno == ERANGE)) {
+    return_err(RCLE_NODE_REQUEST, "logs item, block_number range error\n");
   }
 
-  const cJSON* error = cJSON_GetObjectItemCaseSensitive(root, "error");
-  if (error != NULL) {
-    if (cJSON_IsString(error)) {
-      rcl_error("RPC error: %s\n", error->valuestring);
-    } else if (cJSON_IsObject(error)) {
-      const cJSON* msg = cJSON_GetObjectItemCaseSensitive(error, "message");
-      const cJSON* code = cJSON_GetObjectItemCaseSensitive(error, "code");
-
-      rcl_error("RPC error: [message] %s, [code] %i\n",
-                (cJSON_IsString(msg) ? msg->valuestring : "unrecognized"),
-                (cJSON_IsNumber(code) ? code->valueint : -1));
-    } else {
-      rcl_error("RPC error: unrecognized\n");
+  const cJSON* address = cJSON_GetObjectItemCaseSensitive(item, "address");
+  if (rcl_unlikely(!cJSON_IsString(address) || address->valuestring == NULL)) {
+    return_err(RCLE_NODE_REQUEST, "logs item, address is not a string\n");
+  }
+
+  hex2bin(log->address, address->valuestring, sizeof(rcl_address_t));
+
+  const cJSON* topics = cJSON_GetObjectItemCaseSensitive(item, "topics");
+  if (rcl_unlikely(!cJSON_IsArray(topics))) {
+    return_err(RCLE_NODE_REQUEST, "item, topics is not an array\n");
+  }
+
+  size_t topics_size = cJSON_GetArraySize(topics);
+  if (rcl_unlikely(topics_size > TOPICS_LENGTH)) {
+    return_err(RCLE_NODE_REQUEST, "logs item, too many topics\n");
+  }
+
+  memset(log->topics, 0, sizeof(rcl_hash_t) * TOPICS_LENGTH);
+
+  size_t j = 0;
+  const cJSON* topic = NULL;
+  cJSON_ArrayForEach(topic, topics) {
+    if (rcl_unlikely(!cJSON_IsString(topic) || topic->valuestring == NULL)) {
+      return_err(RCLE_NODE_REQUEST, "item, %zu topic is not a string\n", j);
     }
 
-    exit_code = RCLE_NODE_REQUEST;
-    goto exit;
+    hex2bin(log->topics[j++], topic->valuestring, sizeof(rcl_hash_t));
   }
 
-  const cJSON* rid = cJSON_GetObjectItemCaseSensitive(root, "id");
-  if (rcl_unlikely(!cJSON_IsNumber(rid))) {
-    return_err(RCLE_NODE_REQUEST, "'id' is not an integer\n");
+exit:
+  return exit_code;
+}
+
+static void rcl_rpc_error(const cJSON* error) {
+  if (cJSON_IsString(error)) {
+    rcl_error("RPC error: %s\n", error->valuestring);
+  } else if (cJSON_IsObject(error)) {
+    const cJSON* msg = cJSON_GetObjectItemCaseSensitive(error, "message");
+    const cJSON* code = cJSON_GetObjectItemCaseSensitive(error, "code");
+
+    rcl_error("RPC error: [message] %s, [code] %i\n",
+              (cJSON_IsString(msg) ? msg->valuestring : "unrecognized"),
+              (cJSON_IsNumber(code) ? code->valueint : -1));
+  } else {
+    rcl_error("RPC error: unrecognized\n");
+  }
+}
+
+static rcl_result req_add_log(vector_t* logs, const cJSON* item) {
+  rcl_log_t* log = (rcl_log_t*)vector_add(logs);
+  if (rcl_unlikely(log == NULL)) {
+    rcl_error("couldn't add a log\n");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  return rcl_log_parse(item, log);
+}
+
+// The result of one call: logs or block receipts with their logs
+static rcl_result req_parse_call(const cJSON* call,
+                                 rcl_upstream_mode mode,
+                                 vector_t* logs) {
+  rcl_result exit_code = RCLE_OK;
+
+  const cJSON* error = cJSON_GetObjectItemCaseSensitive(call, "error");
+  if (error != NULL) {
+    rcl_rpc_error(error);
+    return RCLE_NODE_REQUEST;
   }
 
-  const cJSON* result = cJSON_GetObjectItemCaseSensitive(root, "result");
+  const cJSON* result = cJSON_GetObjectItemCaseSensitive(call, "result");
   if (rcl_unlikely(!cJSON_IsArray(result))) {
     return_err(RCLE_NODE_REQUEST, "result is not an array\n");
   }
 
   const cJSON* item = NULL;
   cJSON_ArrayForEach(item, result) {
-    if (rcl_unlikely(!cJSON_IsObject(item))) {
-      return_err(RCLE_NODE_REQUEST, "logs item is not object\n");
+    if (mode != RCL_UPSTREAM_RECEIPTS) {
+      if ((exit_code = req_add_log(logs, item)) != RCLE_OK)
+        goto exit;
+      continue;
     }
 
-    rcl_log_t* log = (rcl_log_t*)vector_add(logs);
+    const cJSON* receipt_logs = cJSON_GetObjectItemCaseSensitive(item, "logs");
+    if (rcl_unlikely(!cJSON_IsArray(receipt_logs))) {
+      return_err(RCLE_NODE_REQUEST, "receipt logs is not an array\n");
+    }
 
-    const cJSON* block_number =
-        cJSON_GetObjectItemCaseSensitive(item, "blockNumber");
-    if (rcl_unlikely(!cJSON_IsString(block_number) ||
-                     block_number->valuestring == NULL)) {
-      return_err(RCLE_NODE_REQUEST,
-                 "logs item, block_number is not a string\n");
+    const cJSON* log = NULL;
+    cJSON_ArrayForEach(log, receipt_logs) {
+      if ((exit_code = req_add_log(logs, log)) != RCLE_OK)
+        goto exit;
     }
+  }
+
+exit:
+  return exit_code;
+}
+
+// Ids of calls are uint32_t, other numbers aren't converted
+static bool rcl_rpc_id(const cJSON* rid, uint32_t* id) {
+  if (!cJSON_IsNumber(rid))
+    return false;
+
+  double value = rid->valuedouble;
+  if (!(value >= 0 && value <= (double)UINT32_MAX))  // NaN too
+    return false;
+
+  // truncated, so the id is integral if nothing is cut off
+  *id = (uint32_t)value;
+  return !(value > (double)*id);
+}
+
+static rcl_result response_parse(const char* data,
+                                 size_t size,
+                                 rcl_upstream_mode mode,
+                                 uint32_t id,
+                                 size_t calls,
+                                 vector_t* logs) {
+  rcl_result exit_code = RCLE_OK;
 
-    const char* start = block_number->valuestring;
-    char* end = NULL;
+  cJSON* root = cJSON_ParseWithLength(data, size);
+  if (root == NULL) {
+    const char* error_ptr = cJSON_GetErrorPtr();
+    if (error_ptr == NULL)
+      error_ptr = "unrecognized";
+
+    return_err(RCLE_NODE_REQUEST,
+               "couldn't parse requset, error: %s, req: %.*s\n", error_ptr,
+               (int)size, data);
+  }
 
-    errno = 0;
-    log->block_number = (uint64_t)strtoll(start, &end, 16);
-    if (rcl_unlikely(errno == ERANGE)) {
-      return_err(RCLE_NODE_REQUEST, "logs item, block_number range error\n");
+  if (mode == RCL_UPSTREAM_LOGS) {
+    if (rcl_unlikely(!cJSON_IsObject(root))) {
+      return_err(RCLE_NODE_REQUEST, "root is not an object\n");
     }
 
-    const cJSON* address = cJSON_GetObjectItemCaseSensitive(item, "address");
-    if (rcl_unlikely(!cJSON_IsString(address) ||
-                     address->valuestring == NULL)) {
-      return_err(RCLE_NODE_REQUEST, "logs item, address is not a string\n");
+    const cJSON* rid = cJSON_GetObjectItemCaseSensitive(root, "id");
+    if (rcl_unlikely(!cJSON_IsNumber(rid) &&
+                     !cJSON_GetObjectItemCaseSensitive(root, "error"))) {
+      return_err(RCLE_NODE_REQUEST, "'id' is not an integer\n");
     }
 
-    hex2bin(log->address, address->valuestring, sizeof(rcl_address_t));
+    exit_code = req_parse_call(root, mode, logs);
+    goto exit;
+  }
+
+  // the whole batch may be rejected with a single error
+  if (rcl_unlikely(!cJSON_IsArray(root))) {
+    if (cJSON_IsObject(root))
+      rcl_rpc_error(cJSON_GetObjectItemCaseSensitive(root, "error"));
+    return_err(RCLE_NODE_REQUEST, "batch response is not an array\n");
+  }
+
+  // calls of a batch may be answered in any order, they're matched by id
+  bool answered[CALLS_MAX] = {false};
+  size_t count = 0;
 
-    const cJSON* topics = cJSON_GetObjectItemCaseSensitive(item, "topics");
-    if (rcl_unlikely(!cJSON_IsArray(topics))) {
-      return_err(RCLE_NODE_REQUEST, "item, topics is not an array\n");
+  const cJSON* call = NULL;
+  cJSON_ArrayForEach(call, root) {
+    const cJSON* rid = cJSON_GetObjectItemCaseSensitive(call, "id");
+    uint32_t value;
+    if (rcl_unlikely(!rcl_rpc_id(rid, &value))) {
+      return_err(RCLE_NODE_REQUEST, "'id' is not an integer\n");
     }
 
-    size_t topics_size = cJSON_GetArraySize(topics);
-    if (rcl_unlikely(topics_size > TOPICS_LENGTH)) {
-      return_err(RCLE_NODE_REQUEST, "logs item, too many topics\n");
+    // ids of a batch may wrap around
+    uint32_t index = value - id;
+    if (rcl_unlikely(index >= calls || answered[index])) {
+      return_err(RCLE_NODE_REQUEST,
+                 "unexpected id in batch response: %" PRIu32 "\n", value);
     }
 
-    memset(log->topics, 0, sizeof(rcl_hash_t) * TOPICS_LENGTH);
+    answered[index] = true;
+    count++;
 
-    size_t j = 0;
-    const cJSON* topic = NULL;
-    cJSON_ArrayForEach(topic, topics) {
-      if (rcl_unlikely(!cJSON_IsString(topic) || topic->valuestring == NULL)) {
-        return_err(RCLE_NODE_REQUEST, "item, %zu topic is not a string\n", j);
-      }
+    if ((exit_code = req_parse_call(call, mode, logs)) != RCLE_OK)
+      goto exit;
+  }
 
-      hex2bin(log->topics[j++], topic->valuestring, sizeof(rcl_hash_t));
-    }
+  if (rcl_unlikely(count != calls)) {
+    return_err(RCLE_NODE_REQUEST, "batch response has %zu of %zu calls\n",
+               count, calls);
   }
 
 exit:
-  if (root)
+  // with the parser's arena the tree is dropped all at once
+  if (root && json_arena == NULL)
     cJSON_Delete(root);
 
   return exit_code;
 }
 
-static int logscomp(const void* d1, const void* d2) {
+static rcl_result req_parse(req_t* req, vector_t* logs) {
+  return response_parse(req->response->data, req->response->size, req->mode,
+                        req->id, req->calls, logs);
+}
+
+rcl_result rcl_response_parse(const char* data,
+                              size_t size,
+                              rcl_upstream_mode mode,
+                              uint32_t id,
+                              size_t calls,
+                              arena_t* arena,
+                              vector_t* logs) {
+  pthread_once(&json_hooks_once, json_hooks_init);
+
+  arena_t* outer = json_arena;
+  json_arena = arena;
+  rcl_result rc = response_parse(data, size, mode, id, calls, logs);
+  json_arena = outer;
+
+  return rc;
+}
+
+int logscomp(const void* d1, const void* d2) {
   const rcl_log_t *arg1 = d1, *arg2 = d2;
   if (arg1->block_number < arg2->block_number)
     return -1;
@@ -317,154 +827,283 @@ static int logscomp(const void* d1, const void* d2) {
   return 0;
 }
 
-static rcl_result req_process(rcl_upstream_t* self,
-                              CURLM* multi,
-                              CURLMsg* msg) {
-  if (rcl_unlikely(msg->data.result != CURLE_OK)) {
-    rcl_error("curl_perform failed: %s\n",
-              curl_easy_strerror(msg->data.result));
-    return RCLE_LIBCURL;
-  }
+// Drops the whole poll, it's restarted from 'next'
+static void rcl_upstream_abort(rcl_upstream_t* self, rcl_result rc) {
+  rcl_result expected = RCLE_OK;
+  if (atomic_compare_exchange_strong(&(self->failure), &expected, rc))
+    queue_wake(&(self->pool->commit_queue));  // to sweep the parsed ones
+}
 
-  req_t* req = NULL;
+// Only the range of the request is retried, see rcl_upstream_retry
+static void rcl_upstream_fail(req_t* req, rcl_result rc) {
+  req->error = rc;
+  req->state = failed;
+}
+
+static bool rcl_upstream_busy(rcl_upstream_t* self) {
   for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
-    req_t* it = vector_at(&(self->requests), i);
-    if (it->handle == msg->easy_handle) {
-      req = it;
-      break;
-    }
+    req_t* req = vector_at(&(self->requests), i);
+    if (req->state != available)
+      return true;
   }
+  return false;
+}
 
-  if (rcl_unlikely(req == NULL)) {
+// Fetcher stage: checks the transfer and hands the response to parsers
+static rcl_result req_process(rcl_upstream_pool_t* pool, CURLMsg* msg) {
+  req_t* req = NULL;
+  if (curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**)&req) !=
+          CURLE_OK ||
+      rcl_unlikely(req == NULL)) {
     rcl_error("easy_handle not found\n");
     return RCLE_UNKNOWN;
   }
 
-  curl_multi_remove_handle(multi, req->handle);
+  rcl_upstream_t* self = req->upstream;
+  curl_multi_remove_handle(pool->multi, req->handle);
+
+  curl_off_t elapsed_us = 0;
+  if (curl_easy_getinfo(req->handle, CURLINFO_TOTAL_TIME_T, &elapsed_us) ==
+      CURLE_OK)
+    stats_histogram_add(&(self->latency), (uint64_t)elapsed_us * 1000);
+  stats_add(self->requests_done, 1);
+
+  if (rcl_unlikely(msg->data.result != CURLE_OK)) {
+    rcl_error("curl_perform failed: %s\n",
+              curl_easy_strerror(msg->data.result));
+    rcl_upstream_fail(req, RCLE_LIBCURL);
+    return RCLE_OK;
+  }
 
   long code = 0;
   if (curl_easy_getinfo(req->handle, CURLINFO_RESPONSE_CODE, &code) !=
       CURLE_OK) {
     rcl_error("couldn't get response code\n");
-    return RCLE_LIBCURL;
+    rcl_upstream_fail(req, RCLE_LIBCURL);
+    return RCLE_OK;
   }
 
   if (code != 200) {
     rcl_error("server responded with code %ld\n", code);
-    return RCLE_NODE_REQUEST;
+    rcl_upstream_fail(req, RCLE_NODE_REQUEST);
+    return RCLE_OK;
+  }
+
+  req->state = received;
+  if (rcl_unlikely(!queue_push(&(pool->parse_queue), req))) {
+    rcl_error("parse queue overflow\n");
+    rcl_upstream_fail(req, RCLE_UNKNOWN);
+    rcl_upstream_abort(self, RCLE_UNKNOWN);
   }
 
-  vector_reset(&(req->logs));
+  return RCLE_OK;
+}
 
-  rcl_result rc = req_parse(req, &(req->logs));
-  if (rc != RCLE_OK)
-    return rc;
+// The request holds a response buffer of the pool
+static rcl_result req_send(rcl_upstream_t* self, req_t* req) {
+  int rc;
 
-  // TODO: create a sorted array in place
-  vector_sort(&(req->logs), logscomp);
+  req->id = (uint32_t)rand();
+  req->response->size = 0;
 
-  req->state = received;
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_CURLU, self->url))) {
+    rcl_error("set url: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_ACCEPT_ENCODING, ""))) {
+    rcl_error("set encoding: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_HTTPHEADER,
+                             self->pool->http_headers))) {
+    rcl_error("set headers: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if (!req_build(req, self->call_blocks)) {
+    rcl_error("couldn't build request body\n");
+    return RCLE_OUT_OF_MEMORY;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_POSTFIELDS,
+                             req->request.data))) {
+    rcl_error("set body: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_POSTFIELDSIZE,
+                             (long)req->request.size))) {
+    rcl_error("set body size: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_WRITEDATA, (void*)req))) {
+    rcl_error("set write data: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_easy_setopt(req->handle, CURLOPT_WRITEFUNCTION,
+                             req_onsend))) {
+    rcl_error("set write callback: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  if ((rc = curl_multi_add_handle(self->pool->multi, req->handle))) {
+    rcl_error("add in multi_handle: %s\n", curl_url_strerror(rc));
+    return RCLE_LIBCURL;
+  }
+
+  req->state = sent;
 
   return RCLE_OK;
 }
 
-static rcl_result rcl_upstream_send(rcl_upstream_t* self,
-                                    CURLM* multi,
-                                    uint64_t* start,
-                                    int* inprogress) {
-  if (self->closed || *start > self->height)
-    return RCLE_OK;
+// Requests of the ring in any stage
+static size_t rcl_upstream_inflight(rcl_upstream_t* self) {
+  size_t count = 0;
+  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
+    req_t* req = vector_at(&(self->requests), i);
+    if (req->state != available)
+      count++;
+  }
+  return count;
+}
 
-  int rc;
+// Sends the next ranges while the ring and the buffers of the pool allow, a
+// throttled upstream sends fewer and smaller ones
+static rcl_result rcl_upstream_send(rcl_upstream_t* self) {
+  rcl_upstream_pool_t* pool = self->pool;
+  rcl_result rc;
+
+  unsigned throttle = self->throttle;
+  size_t limit = CONNECTIONS_COUNT >> throttle;
+  size_t inflight = rcl_upstream_inflight(self);
 
-  size_t i = 0;
-  for (; i < CONNECTIONS_COUNT; ++i) {
-    if ((rcl_request_at(self, i))->state == available)
+  for (; inflight < limit; ++inflight) {
+    if (self->closed || self->failure != RCLE_OK ||
+        self->start > self->height)
       break;
-  }
 
-  for (; i < CONNECTIONS_COUNT && !self->closed; ++i) {
-    req_t* req = rcl_request_at(self, i);
+    // the ring is full, wait until the committer releases the head
+    req_t* req = rcl_request_at(self, self->requests_tail);
+    if (req->state != available)
+      break;
 
-    if (req->state != available) {
-      rcl_error("trying to send a request that has already been sent\n");
-      return RCLE_UNKNOWN;
-    }
+    // other upstreams have all the buffers, a parser gives one back soon
+    if ((req->response = buffer_pool_acquire(&(pool->responses))) == NULL)
+      break;
 
-    size_t count = min(BLOCKS_REQUEST_BATCH, self->height - *start);
+    size_t count = min(BLOCKS_REQUEST_BATCH >> throttle,
+                       self->height - self->start);
 
-    req->id = rand();
-    req->from = *start;
-    req->to = *start + count;
-    req->response_size = 0;
-    req->state = sent;
+    req->from = self->start;
+    req->to = self->start + count;
+    req->mode = self->mode;
+    req->attempts = 0;
 
-    *start += count + 1;
+    self->start += count + 1;
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_CURLU, self->url))) {
-      rcl_error("set url: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
+    if ((rc = req_send(self, req))) {
+      buffer_pool_release(&(pool->responses), req->response);
+      req->response = NULL;
+      return rc;
     }
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_ACCEPT_ENCODING, ""))) {
-      rcl_error("set encoding: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+    self->requests_tail = (self->requests_tail + 1) % CONNECTIONS_COUNT;
+  }
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_HTTPHEADER,
-                               self->http_headers))) {
-      rcl_error("set headers: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+  return RCLE_OK;
+}
 
-    snprintf(req->request, REQUEST_BUFFER_SIZE, BODY, req->id, req->from,
-             req->to);
-    if ((rc =
-             curl_easy_setopt(req->handle, CURLOPT_POSTFIELDS, req->request))) {
-      rcl_error("set body: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+// Equal jitter: uniform in [backoff / 2, backoff], backoff doubles per
+// attempt. Half of it stays, so a failing node is never retried at once.
+static uint64_t rcl_retry_delay_ns(uint32_t attempts) {
+  uint64_t backoff = RETRY_BACKOFF_MIN_MS;
+  for (uint32_t i = 1; i < attempts && backoff < RETRY_BACKOFF_MAX_MS; ++i)
+    backoff *= 2;
+  backoff = min(backoff, (uint64_t)RETRY_BACKOFF_MAX_MS);
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_POSTFIELDSIZE,
-                               strlen(req->request)))) {
-      rcl_error("set body size: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+  uint64_t jitter = (uint64_t)rand() % (backoff / 2 + 1);
+  return (backoff / 2 + jitter) * 1000000ull;
+}
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_WRITEDATA, (void*)req))) {
-      rcl_error("set write data: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+static void rcl_timeout_min(int* timeout_ms, uint64_t wait_ns) {
+  uint64_t wait_ms = wait_ns / 1000000 + 1;
+  *timeout_ms = (int)min((uint64_t)*timeout_ms, wait_ms);
+}
 
-    if ((rc = curl_easy_setopt(req->handle, CURLOPT_WRITEFUNCTION,
-                               req_onsend))) {
-      rcl_error("set write callback: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+// Re-sends failed ranges in place, so the ordered commit of the other ranges
+// isn't blocked. Lowers *timeout_ms to the nearest pending retry.
+static rcl_result rcl_upstream_retry(rcl_upstream_t* self, int* timeout_ms) {
+  uint64_t now = rcl_clock_ns();
+  rcl_result rc;
 
-    if ((rc = curl_multi_add_handle(multi, req->handle))) {
-      rcl_error("add in multi_handle: %s\n", curl_url_strerror(rc));
-      return RCLE_LIBCURL;
-    }
+  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
+    if (self->closed || self->failure != RCLE_OK)
+      break;
+
+    req_t* req = vector_at(&(self->requests), i);
+
+    switch (req->state) {
+      case failed:
+        stats_add(self->requests_failed, 1);
+
+        if (++(req->attempts) >= RETRY_BUDGET) {
+          rcl_error("range from %" PRIu64 " to %" PRIu64
+                    " failed %u times, last error: %s\n",
+                    req->from, req->to, req->attempts,
+                    rcl_strerror(req->error));
+          rcl_upstream_abort(self, req->error);
+          return req->error;
+        }
+
+        req->retry_at = now + rcl_retry_delay_ns(req->attempts);
+        req->state = delayed;
+
+        rcl_info("retry range from %" PRIu64 " to %" PRIu64
+                 " in %" PRIu64 "ms, attempt %u: %s\n",
+                 req->from, req->to, (req->retry_at - now) / 1000000,
+                 req->attempts, rcl_strerror(req->error));
+        /* Fall through. */
+
+      case delayed:
+        if (req->retry_at > now) {
+          rcl_timeout_min(timeout_ms, req->retry_at - now);
+          break;
+        }
+
+        // a parser has given back the buffer of a broken response
+        if (req->response == NULL &&
+            (req->response = buffer_pool_acquire(&(self->pool->responses))) ==
+                NULL)
+          break;
 
-    ++(*inprogress);
+        if ((rc = req_send(self, req)))
+          return rc;
+        break;
+
+      default:
+        break;
+    }
   }
 
   return RCLE_OK;
 }
 
-static rcl_result rcl_upstream_receive(rcl_upstream_t* self, CURLM* multi) {
+static rcl_result rcl_upstream_receive(rcl_upstream_pool_t* pool) {
   int numfds;
   CURLMsg* msg;
 
-  while ((msg = curl_multi_info_read(multi, &numfds))) {
-    if (self->closed)
+  while ((msg = curl_multi_info_read(pool->multi, &numfds))) {
+    if (pool->closed)
       break;
 
     rcl_result rc;
     switch (msg->msg) {
       case CURLMSG_DONE:
-        if ((rc = req_process(self, multi, msg)))
+        if ((rc = req_process(pool, msg)))
           return rc;
         break;
 
@@ -477,135 +1116,272 @@ static rcl_result rcl_upstream_receive(rcl_upstream_t* self, CURLM* multi) {
   return RCLE_OK;
 }
 
-static rcl_result rcl_upstream_process(rcl_upstream_t* self,
-                                       int* inprogress,
-                                       bool exact) {
-  rcl_result rc;
+// Parser stage: JSON -> sorted rcl_log_t, any number of workers. The request
+// isn't touched after its state is given to the committer or the fetcher.
+static void* rcl_upstream_parser(void* data) {
+  rcl_upstream_pool_t* pool = data;
 
-  for (size_t i = 0; i < CONNECTIONS_COUNT && !self->closed; ++i) {
-    req_t* req = vector_at(&(self->requests), self->requests_head);
+  arena_t arena;
+  arena_init(&arena, PARSE_ARENA_CHUNK_SIZE, PARSE_ARENA_HIGH_WATER);
+  json_arena = &arena;
 
-    switch (req->state) {
-      case available:
-        return RCLE_OK;
+  while (!pool->closed) {
+    req_t* req = NULL;
+    if (!queue_pop_wait(&(pool->parse_queue), (void**)&req, STAGE_WAIT_S))
+      continue;
 
-      case sent:
-        if (exact) {
-          rcl_error("completed request not parsed\n");
-          return RCLE_UNKNOWN;
-        }
-        return RCLE_OK;
+    vector_reset(&(req->logs));
 
-      case received:
-        if ((rc = self->callback(&(req->logs), self->callback_data)))
-          return rc;
+    // don't waste time on the results which will be dropped
+    rcl_upstream_t* self = req->upstream;
+    rcl_result rc = self->closed ? RCLE_UNKNOWN : self->failure;
+    if (rc == RCLE_OK)
+      rc = req_parse(req, &(req->logs));
 
-        req->state = available;
-        self->requests_head = (self->requests_head + 1) % CONNECTIONS_COUNT;
+    arena_reset(&arena);
+    buffer_pool_release(&(pool->responses), req->response);
+    req->response = NULL;
 
-        if (req->to > self->last)
-          self->last = min(req->to, self->height);
+    if (rc == RCLE_OK) {
+      // TODO: create a sorted array in place
+      vector_sort(&(req->logs), logscomp);
+      req->state = parsed;
 
-        --(*inprogress);
+      // only a wakeup: a full queue has wakeups pending for this one too
+      if (!queue_push(&(pool->commit_queue), req))
+        queue_wake(&(pool->commit_queue));
+    } else {
+      rcl_upstream_fail(req, rc);
+      curl_multi_wakeup(pool->multi);  // to schedule the retry
+    }
+  }
 
-        // rcl_debug("added %zu logs from: %zu to %zu, last: %zu, height:
-        // %zu\n",
-        //           req->logs.size, req->from, req->to, self->last,
-        //           self->height);
+  json_arena = NULL;
+  arena_destroy(&arena);
 
-        break;
+  pthread_exit(0);
+}
 
-      default:
-        rcl_error("invalid request state\n");
-        return RCLE_UNKNOWN;
+// Committer stage: inserts parsed requests strictly in order of ranges
+static void rcl_upstream_commit(rcl_upstream_t* self) {
+  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
+    if (self->closed || self->failure != RCLE_OK)
+      break;
+
+    req_t* req = rcl_request_at(self, self->requests_head);
+    if (req->state != parsed)
+      break;
+
+    rcl_result rc =
+        self->callback(req->from, req->to, &(req->logs), self->callback_data);
+    if (rc != RCLE_OK) {
+      rcl_error("couldn't commit logs from %" PRIu64 " to %" PRIu64 ": %s\n",
+                req->from, req->to, rcl_strerror(rc));
+      rcl_upstream_abort(self, rc);
+      break;
     }
+
+    if (req->to >= self->next)
+      self->next = req->to + 1;
+
+    // don't keep the memory of the largest range ever seen
+    if (req->logs.capacity > REQUEST_LOGS_HIGH_WATER &&
+        req->logs.capacity > req->logs.size * 2)
+      (void)vector_shrink(&(req->logs), max(req->logs.size,
+                                            (uint64_t)REQUEST_LOGS_HIGH_WATER));
+    vector_reset(&(req->logs));
+
+    req->state = available;
+    self->requests_head = (self->requests_head + 1) % CONNECTIONS_COUNT;
   }
+}
 
-  return RCLE_OK;
+// After an abort the results are dropped, the poll starts again from 'next'
+static void rcl_upstream_sweep(rcl_upstream_t* self) {
+  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
+    req_t* req = vector_at(&(self->requests), i);
+    if (req->state == parsed)
+      req->state = available;
+  }
 }
 
-static rcl_result rcl_upstream_poll(rcl_upstream_t* self) {
-  rcl_result rc = 0;
+// The queue only wakes it up: a popped request may be already committed with
+// the previous ones, so every upstream is checked from its head
+static void* rcl_upstream_committer(void* data) {
+  rcl_upstream_pool_t* pool = data;
+
+  while (!pool->closed) {
+    req_t* req = NULL;
+    bool popped =
+        queue_pop_wait(&(pool->commit_queue), (void**)&req, STAGE_WAIT_S);
+
+    pthread_rwlock_rdlock(&(pool->lock));
+    for (size_t i = 0; i < pool->upstreams.size; ++i) {
+      rcl_upstream_t* self =
+          *(rcl_upstream_t**)vector_at(&(pool->upstreams), i);
+
+      if (self->closed || self->failure != RCLE_OK) {
+        rcl_upstream_sweep(self);
+      } else if (popped) {
+        rcl_upstream_commit(self);
+      }
+    }
+    pthread_rwlock_unlock(&(pool->lock));
 
-  int inprogress = 0;
-  uint64_t start = self->last == 0 ? 0 : self->last + 1;
+    // there are free connections now
+    if (popped)
+      curl_multi_wakeup(pool->multi);
+  }
 
-  CURLM* multi_handle = curl_multi_init();
-  if (multi_handle == NULL)
-    return RCLE_LIBCURL;
+  pthread_exit(0);
+}
 
-  rcl_info("start new poll from %zu\n", start);
+// Cancels own transfers, false until other stages drop the rest
+static bool rcl_upstream_drain(rcl_upstream_t* self) {
+  rcl_upstream_pool_t* pool = self->pool;
 
-  if ((rc = rcl_upstream_send(self, multi_handle, &start, &inprogress)))
-    goto exit;
+  for (size_t i = 0; i < CONNECTIONS_COUNT; ++i) {
+    req_t* req = vector_at(&(self->requests), i);
 
-  do {
-    if (self->closed)
-      break;
+    enum req_state state = req->state;
+    if (state == sent)
+      curl_multi_remove_handle(pool->multi, req->handle);
 
-    int still_running, numfds;
-    CURLMcode mc = curl_multi_perform(multi_handle, &still_running);
-    if (mc != CURLM_OK) {
-      rcl_error("curl_multi_perform failed: '%s'\n", curl_multi_strerror(mc));
-      rc = RCLE_LIBCURL;
-      goto exit;
+    if (state == sent || state == failed || state == delayed) {
+      if (req->response != NULL) {
+        buffer_pool_release(&(pool->responses), req->response);
+        req->response = NULL;
+      }
+      req->state = available;
     }
+  }
 
-    mc = curl_multi_poll(multi_handle, NULL, 0, 1000, &numfds);
-    if (mc != CURLM_OK) {
-      rcl_error("curl_multi_pool failed: '%s'\n", curl_multi_strerror(mc));
-      rc = RCLE_LIBCURL;
-      goto exit;
+  if (rcl_upstream_busy(self))
+    return false;
+
+  self->requests_head = 0;
+  self->requests_tail = 0;
+  self->failure = RCLE_OK;
+
+  return true;
+}
+
+// Fetcher stage of one upstream: starts a poll when there are new blocks,
+// then sends and retries its ranges until they're committed
+static void rcl_upstream_step(rcl_upstream_t* self, int* timeout_ms) {
+  uint64_t now = rcl_clock_ns();
+
+  if (!self->polling) {
+    if (self->closed) {
+      self->detached = true;
+      return;
     }
 
-    if ((rc = rcl_upstream_receive(self, multi_handle)))
-      goto exit;
+    if (now < self->resume_at) {
+      rcl_timeout_min(timeout_ms, self->resume_at - now);
+      return;
+    }
 
-    if ((rc = rcl_upstream_process(self, &inprogress, false)))
-      goto exit;
+    if (self->height == 0 || self->url == NULL) {
+      rcl_info("wait height and URL...\n");
+      self->resume_at = now + IDLE_WAIT_MS * 1000000ull;
+      return;
+    }
 
-    if ((rc = rcl_upstream_send(self, multi_handle, &start, &inprogress)))
-      goto exit;
-  } while (inprogress > 0);
+    if (self->next > self->height) {
+      rcl_info("nothing to download, height: %zu, next: %zu\n", self->height,
+               self->next);
+      self->resume_at = now + IDLE_WAIT_MS * 1000000ull;
+      return;
+    }
 
-  if (self->closed)
-    goto exit;
+    self->polling = true;
+    self->start = self->next;
 
-  if ((rc = rcl_upstream_receive(self, multi_handle)))
-    goto exit;
+    rcl_info("start new poll from %zu\n", self->start);
+  }
 
-  if ((rc = rcl_upstream_process(self, &inprogress, true)))
-    goto exit;
+  if (!self->draining) {
+    rcl_result rc = self->failure;
+    if (rc == RCLE_OK && !self->closed) {
+      if ((rc = rcl_upstream_retry(self, timeout_ms)) == RCLE_OK)
+        rc = rcl_upstream_send(self);
+
+      // the end of the poll, or the buffers are waited for
+      if (rc == RCLE_OK &&
+          (rcl_upstream_busy(self) || self->start <= self->height))
+        return;
+    }
+
+    if (rc == RCLE_OK && !self->closed) {
+      self->polling = false;
+      rcl_info("end poll\n");
+      return;
+    }
+
+    // results of the other stages are dropped too
+    if (rc != RCLE_OK) {
+      rcl_error("failed perform upstream pool: %s\n", rcl_strerror(rc));
+      self->resume_at = now + FAILURE_WAIT_MS * 1000000ull;
+      rcl_upstream_abort(self, rc);
+    }
+
+    self->draining = true;
+  }
+
+  // parsers and the committer give back the rest soon
+  if (!rcl_upstream_drain(self)) {
+    *timeout_ms = min(*timeout_ms, 1);
+    return;
+  }
+
+  self->draining = false;
+  self->polling = false;
 
-exit:
   rcl_info("end poll\n");
-  curl_multi_cleanup(multi_handle);
-  return rc;
 }
 
-static void* rcl_upstream_thrd(void* data) {
-  rcl_upstream_t* self = data;
+static void* rcl_upstream_fetcher(void* data) {
+  rcl_upstream_pool_t* pool = data;
 
   rcl_info("start fetcher thread\n");
 
-  while (!self->closed) {
-    if (self->height == 0 || self->url == NULL) {
-      rcl_info("wait height and URL...\n");
-      sleep(1);
-      continue;
+  while (!pool->closed) {
+    int timeout_ms = IDLE_WAIT_MS;
+
+    pthread_rwlock_rdlock(&(pool->lock));
+    size_t count = pool->upstreams.size;
+    for (size_t i = 0; i < count; ++i) {
+      // a busy upstream doesn't take all the buffers first every time
+      size_t k = (pool->turn + i) % count;
+      rcl_upstream_step(*(rcl_upstream_t**)vector_at(&(pool->upstreams), k),
+                        &timeout_ms);
     }
+    pool->turn++;
+    pthread_rwlock_unlock(&(pool->lock));
 
-    if (self->last >= self->height) {
-      rcl_info("nothing to download, height: %zu, last: %zu\n", self->height,
-               self->last);
-      sleep(1);
-      continue;
+    int still_running, numfds;
+    CURLMcode mc = curl_multi_perform(pool->multi, &still_running);
+    if (mc == CURLM_OK)
+      mc = curl_multi_poll(pool->multi, NULL, 0, timeout_ms, &numfds);
+
+    rcl_result rc = RCLE_LIBCURL;
+    if (mc != CURLM_OK) {
+      rcl_error("curl multi failed: '%s'\n", curl_multi_strerror(mc));
+    } else {
+      rc = rcl_upstream_receive(pool);
     }
 
-    rcl_result rc = rcl_upstream_poll(self);
+    // the transfers of all polls are in doubt
     if (rc != RCLE_OK) {
-      rcl_error("failed perform upstream pool: %s\n", rcl_strerror(rc));
-      sleep(5);
+      pthread_rwlock_rdlock(&(pool->lock));
+      for (size_t i = 0; i < pool->upstreams.size; ++i) {
+        rcl_upstream_t* self =
+            *(rcl_upstream_t**)vector_at(&(pool->upstreams), i);
+        if (self->polling)
+          rcl_upstream_abort(self, rc);
+      }
+      pthread_rwlock_unlock(&(pool->lock));
     }
   }
 
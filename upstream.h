@@ -1,8 +1,10 @@
 #ifndef _RCL_LOADER_H
 #define _RCL_LOADER_H
 
+#include "arena.h"
 #include "common.h"
 #include "err.h"
+#include "stats.h"
 #include "vector.h"
 
 enum { HASH_LENGTH = 32, ADDRESS_LENGTH = 20, TOPICS_LENGTH = 4 };
@@ -16,18 +18,82 @@ typedef struct {
   rcl_hash_t topics[TOPICS_LENGTH];
 } rcl_log_t;
 
-typedef rcl_result (*rcl_upstream_callback_t)(vector_t* logs, void* data);
+// How ranges are requested from the node
+typedef enum {
+  RCL_UPSTREAM_LOGS,      // an eth_getLogs call per request
+  RCL_UPSTREAM_BATCH,     // a JSON-RPC batch of smaller eth_getLogs calls
+  RCL_UPSTREAM_RECEIPTS,  // a JSON-RPC batch of eth_getBlockReceipts
+} rcl_upstream_mode;
+
+// Commits the logs of the [from, to] blocks range
+typedef rcl_result (*rcl_upstream_callback_t)(uint64_t from,
+                                              uint64_t to,
+                                              vector_t* logs,
+                                              void* data);
+
+// Parses an item of the eth_getLogs result
+rcl_result rcl_log_parse(const cJSON* item, rcl_log_t* log);
+
+// Parses a response body the way the ingest does, e.g. for benchmarks: the
+// calls of a batch have ids from 'id', the JSON tree is allocated in 'arena'
+// if it isn't NULL (the caller resets it)
+rcl_result rcl_response_parse(const char* data,
+                              size_t size,
+                              rcl_upstream_mode mode,
+                              uint32_t id,
+                              size_t calls,
+                              arena_t* arena,
+                              vector_t* logs);
+
+// Orders logs by block, parsed logs are sorted with it before the commit
+int logscomp(const void* d1, const void* d2);
+
+struct rcl_upstream_pool;
+typedef struct rcl_upstream_pool rcl_upstream_pool_t;
+
+// The ingest stages shared by upstreams, e.g. of many dbs in one process: one
+// curl event loop, the parsers and the committer. Requests in flight of all
+// the upstreams are bounded by 'transfers' response buffers.
+rcl_result rcl_upstream_pool_init(rcl_upstream_pool_t** self,
+                                  size_t transfers);
+// Upstreams of the pool must be freed before
+void rcl_upstream_pool_free(rcl_upstream_pool_t* self);
 
 struct rcl_upstream;
 typedef struct rcl_upstream rcl_upstream_t;
 
+// A NULL pool is an own one with the requests of a single upstream
 rcl_result rcl_upstream_init(rcl_upstream_t** self,
-                             uint64_t last,
+                             rcl_upstream_pool_t* pool,
+                             uint64_t next,
                              rcl_upstream_callback_t callback,
                              void* callback_data);
+// Drops the poll and waits until the stages give back its requests
 void rcl_upstream_free(rcl_upstream_t* self);
 
+// The pool of the upstream, e.g. for more upstreams of the same db
+rcl_upstream_pool_t* rcl_upstream_get_pool(rcl_upstream_t* self);
+
+// The first block not committed yet
+uint64_t rcl_upstream_next(rcl_upstream_t* self);
+
+// Fills the upstream part of the stats
+void rcl_upstream_stats(rcl_upstream_t* self, rcl_stats_t* stats);
+
+// Blocks of the node not committed yet, 'height + 1 - next'
+uint64_t rcl_upstream_backlog(rcl_upstream_t* self);
+
+enum { RCL_THROTTLE_MAX = 5 };
+
+// Paces the ingest: each level halves the requests in flight and the blocks
+// of a request (a commit), 0 is full speed
+void rcl_upstream_set_throttle(rcl_upstream_t* self, unsigned level);
+
 rcl_result rcl_upstream_set_url(rcl_upstream_t* self, const char* url);
 rcl_result rcl_upstream_set_height(rcl_upstream_t* self, uint64_t height);
+// 'call_blocks' is the range of one eth_getLogs call in the batch mode
+rcl_result rcl_upstream_set_mode(rcl_upstream_t* self,
+                                 rcl_upstream_mode mode,
+                                 uint64_t call_blocks);
 
 #endif  // _RCL_LOADER_H
@@ -23,6 +23,21 @@ void vector_destroy(vector_t* v) {
     free(v->buffer);
 }
 
+bool vector_shrink(vector_t* v, uint64_t capacity) {
+  if (capacity >= v->capacity || capacity < v->size)
+    return true;
+
+  void* buffer = realloc(v->buffer, max(capacity, (uint64_t)1) * v->item_size);
+  if (rcl_unlikely(buffer == NULL)) {
+    return false;
+  }
+
+  v->buffer = buffer;
+  v->capacity = capacity;
+
+  return true;
+}
+
 void* vector_add(vector_t* v) {
   uint64_t old_capacity = v->capacity, new_capacity;
 
@@ -55,3 +70,37 @@ void vector_remove(vector_t* v, void* item) {
 
   v->size--;
 }
+
+void slots_init(slots_t* s, uint64_t item_size) {
+  for (size_t i = 0; i < SLOTS_CHUNKS; ++i)
+    atomic_init(&(s->chunks[i]), NULL);
+
+  atomic_init(&(s->size), 0);
+  s->item_size = item_size;
+}
+
+void slots_destroy(slots_t* s) {
+  for (size_t i = 0; i < SLOTS_CHUNKS; ++i)
+    free(atomic_load_explicit(&(s->chunks[i]), memory_order_relaxed));
+}
+
+void* slots_add(slots_t* s) {
+  uint64_t size = atomic_load_explicit(&(s->size), memory_order_relaxed);
+  if (rcl_unlikely(size == (uint64_t)SLOTS_CHUNKS * SLOTS_CHUNK))
+    return NULL;
+
+  _Atomic(void*)* chunk = &(s->chunks[size / SLOTS_CHUNK]);
+  if (atomic_load_explicit(chunk, memory_order_relaxed) == NULL) {
+    void* items = calloc(SLOTS_CHUNK, s->item_size);
+    if (rcl_unlikely(items == NULL))
+      return NULL;
+
+    atomic_store_explicit(chunk, items, memory_order_release);
+  }
+
+  void* item = slots_at(s, size);
+  memset(item, 0, s->item_size);
+
+  atomic_store_explicit(&(s->size), size + 1, memory_order_release);
+  return item;
+}
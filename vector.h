@@ -13,6 +13,8 @@ typedef struct {
 bool vector_init(vector_t* vector, uint64_t capacity, uint64_t item_size);
 void vector_destroy(vector_t* vector);
 
+bool vector_shrink(vector_t* vector, uint64_t capacity);
+
 void* vector_add(vector_t* vector);
 void vector_remove(vector_t* vector, void* item);
 
@@ -33,4 +35,39 @@ rcl_inline void* vector_remove_last(vector_t* vector) {
   return rcl_pointer_to(vector->buffer, vector->item_size * vector->size);
 }
 
+// Items that never move, so readers index them without the writer's lock. A
+// chunk is allocated once and published before the size that covers it, the
+// contents of an item are published by its user.
+enum {
+  SLOTS_CHUNK = 256,
+  SLOTS_CHUNKS = 256,  // up to 65536 items
+};
+
+typedef struct {
+  _Atomic(void*) chunks[SLOTS_CHUNKS];
+  atomic_uint_fast64_t size;
+  uint64_t item_size;
+} slots_t;
+
+void slots_init(slots_t* slots, uint64_t item_size);
+void slots_destroy(slots_t* slots);
+
+// Zeroed, NULL if it's full or out of memory. Only one writer at a time.
+void* slots_add(slots_t* slots);
+
+rcl_inline uint64_t slots_size(slots_t* slots) {
+  return atomic_load_explicit(&(slots->size), memory_order_acquire);
+}
+
+rcl_inline void* slots_at(slots_t* slots, uint64_t i) {
+  void* chunk = atomic_load_explicit(&(slots->chunks[i / SLOTS_CHUNK]),
+                                     memory_order_acquire);
+  return rcl_pointer_to(chunk, slots->item_size * (i % SLOTS_CHUNK));
+}
+
+// The slot stays allocated, the next slots_add returns it zeroed again
+rcl_inline void slots_remove_last(slots_t* slots) {
+  atomic_fetch_sub_explicit(&(slots->size), 1, memory_order_release);
+}
+
 #endif  // _RCL_VECTOR_H